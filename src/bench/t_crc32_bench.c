@@ -0,0 +1,140 @@
+/*
+ * bench/t_crc32_bench.c
+ *
+ * compare t_crc32_ogg() against libogg's ogg_page_checksum_set() on pages of
+ * various size.
+ *
+ * usage: t_crc32_bench [total MiB per page size]
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ogg/ogg.h"
+
+#include "t_crc32.h"
+
+
+/* the body length of the benchmarked pages, 65025 is the largest possible */
+static const long	bench_sizes[] = { 255, 4096, 16384, 65025 };
+
+
+static double	now(void);
+static void	page_init(ogg_page *og, unsigned char *buf, long bodylen);
+static void	crc_set(ogg_page *og);
+
+
+int
+main(int argc, char *argv[])
+{
+	unsigned char *buf;
+	ogg_page og;
+	size_t i, n;
+	long mib = 256, iter, j, total;
+	double t0, tlibogg, tours;
+	uint32_t expected;
+
+	if (argc > 1 && (mib = strtol(argv[1], NULL, 10)) <= 0) {
+		(void)fprintf(stderr, "usage: %s [MiB]\n", argv[0]);
+		return (EXIT_FAILURE);
+	}
+	if ((buf = malloc(27 + 255 + 65025)) == NULL) {
+		perror("malloc");
+		return (EXIT_FAILURE);
+	}
+
+	(void)printf("t_crc32_ogg() implementation: %s\n", t_crc32_ogg_impl());
+	(void)printf("%8s %14s %14s %8s\n", "body", "libogg MiB/s",
+	    "t_crc32 MiB/s", "speedup");
+	n = sizeof(bench_sizes) / sizeof(bench_sizes[0]);
+	for (i = 0; i < n; i++) {
+		page_init(&og, buf, bench_sizes[i]);
+		total = og.header_len + og.body_len;
+		iter  = mib * 1024 * 1024 / total;
+
+		ogg_page_checksum_set(&og);
+		(void)memcpy(&expected, og.header + 22, sizeof(expected));
+		crc_set(&og);
+		if (memcmp(&expected, og.header + 22, sizeof(expected)) != 0) {
+			(void)fprintf(stderr, "CRC mismatch for %ld bytes\n",
+			    bench_sizes[i]);
+			return (EXIT_FAILURE);
+		}
+
+		t0 = now();
+		for (j = 0; j < iter; j++)
+			ogg_page_checksum_set(&og);
+		tlibogg = now() - t0;
+		t0 = now();
+		for (j = 0; j < iter; j++)
+			crc_set(&og);
+		tours = now() - t0;
+
+		(void)printf("%8ld %14.1f %14.1f %7.1fx\n", bench_sizes[i],
+		    (double)(iter * total) / tlibogg / (1024 * 1024),
+		    (double)(iter * total) / tours / (1024 * 1024),
+		    tlibogg / tours);
+	}
+
+	free(buf);
+	return (EXIT_SUCCESS);
+}
+
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	(void)clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((double)ts.tv_sec + (double)ts.tv_nsec / 1e9);
+}
+
+
+/* build a page with a bodylen bytes pseudo-random body in buf */
+static void
+page_init(ogg_page *og, unsigned char *buf, long bodylen)
+{
+	long i, nseg;
+	uint32_t x = 0x2545f491;
+
+	/* a page has at most 255 segments: a 65025 bytes body is a packet
+	   continued on the next page, without the terminating lacing value */
+	nseg = bodylen / 255 + 1;
+	if (nseg > 255)
+		nseg = 255;
+	(void)memset(buf, 0, 27);
+	(void)memcpy(buf, "OggS", 4);
+	buf[26] = (unsigned char)nseg;
+	for (i = 0; i < nseg; i++) {
+		buf[27 + i] = (bodylen - 255 * i >= 255 ? 255 :
+		    (unsigned char)(bodylen - 255 * i));
+	}
+	for (i = 0; i < bodylen; i++) {
+		x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+		buf[27 + nseg + i] = (unsigned char)x;
+	}
+
+	og->header     = buf;
+	og->header_len = 27 + nseg;
+	og->body       = buf + 27 + nseg;
+	og->body_len   = bodylen;
+}
+
+
+/* same as ogg_page_checksum_set() using t_crc32_ogg() */
+static void
+crc_set(ogg_page *og)
+{
+	uint32_t crc;
+
+	(void)memset(og->header + 22, 0, 4);
+	crc = t_crc32_ogg(0, og->header, (size_t)og->header_len);
+	crc = t_crc32_ogg(crc, og->body, (size_t)og->body_len);
+	og->header[22] = (unsigned char)(crc & 0xff);
+	og->header[23] = (unsigned char)((crc >> 8) & 0xff);
+	og->header[24] = (unsigned char)((crc >> 16) & 0xff);
+	og->header[25] = (unsigned char)((crc >> 24) & 0xff);
+}
@@ -0,0 +1,142 @@
+/*
+ * bench/t_taglist_bench.c
+ *
+ * count the malloc(3) calls and time of a typical per-file tag pipeline, with
+ * heap allocated taglists and with a per-file arena (see t_arena.h).
+ *
+ * The pipeline mimic what t_tune and the actions do for each file: the
+ * backend read the tags, then each action borrow the tags, unshare them
+ * (copy-on-write), modify them and set them back, then a rename pattern look
+ * up a tag.
+ *
+ * usage: t_taglist_bench [files [tags per file]]
+ *
+ * must be linked with -Wl,--wrap=malloc so that malloc(3) calls are counted.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "t_config.h"
+#include "t_toolkit.h"
+#include "t_arena.h"
+#include "t_taglist.h"
+
+
+/* number of actions applied to each file */
+#define	BENCH_ACTIONS	5
+
+static unsigned long	nmalloc;
+
+void	*__real_malloc(size_t size);
+void	*__wrap_malloc(size_t size);
+
+static double	now(void);
+static void	pipeline(struct t_arena *arena, long ntag);
+static void	run(const char *name, int use_arena, long nfile, long ntag);
+
+
+void *
+__wrap_malloc(size_t size)
+{
+
+	nmalloc++;
+	return (__real_malloc(size));
+}
+
+
+int
+main(int argc, char *argv[])
+{
+	long nfile = 100000, ntag = 16;
+
+	if (argc > 1 && (nfile = strtol(argv[1], NULL, 10)) <= 0)
+		goto usage;
+	if (argc > 2 && (ntag = strtol(argv[2], NULL, 10)) <= 0)
+		goto usage;
+
+	(void)printf("%ld files, %ld tags per file, %d actions per file\n",
+	    nfile, ntag, BENCH_ACTIONS);
+	(void)printf("%8s %14s %14s %10s\n", "taglist", "malloc calls",
+	    "malloc/file", "seconds");
+	run("heap", 0, nfile, ntag);
+	run("arena", 1, nfile, ntag);
+	return (EXIT_SUCCESS);
+usage:
+	(void)fprintf(stderr, "usage: %s [files [tags per file]]\n", argv[0]);
+	return (EXIT_FAILURE);
+}
+
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	(void)clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+
+/* the tags of one file going through BENCH_ACTIONS actions */
+static void
+pipeline(struct t_arena *arena, long ntag)
+{
+	struct t_taglist *backend, *current, *copy, *shared;
+	char key[32], val[64], *s;
+	long i;
+
+	/* what a backend read */
+	if ((backend = t_taglist_new()) == NULL)
+		err(EXIT_FAILURE, "t_taglist_new");
+	for (i = 0; i < ntag; i++) {
+		(void)snprintf(key, sizeof(key), "key%ld", i % 8);
+		(void)snprintf(val, sizeof(val), "a value for the tag #%ld", i);
+		if (t_taglist_insert(backend, key, val) == -1)
+			err(EXIT_FAILURE, "t_taglist_insert");
+	}
+
+	/* t_tune_tags() / t_tune_set_tags() */
+	if ((current = t_taglist_clone_arena(backend, arena)) == NULL)
+		err(EXIT_FAILURE, "t_taglist_clone_arena");
+	t_taglist_delete(backend);
+	for (i = 0; i < BENCH_ACTIONS; i++) {
+		shared = t_taglist_ref(current);
+		if ((copy = t_taglist_unshare(shared)) == NULL ||
+		    t_taglist_replace(copy, "title", "Echoes") == -1)
+			err(EXIT_FAILURE, "t_taglist_replace");
+		t_taglist_delete(current);
+		current = copy;
+	}
+
+	/* a rename pattern lookup */
+	if ((copy = t_taglist_find_all(current, "key1")) == NULL ||
+	    (s = t_taglist_join(copy, " + ")) == NULL)
+		err(EXIT_FAILURE, "t_taglist_join");
+	free(s);
+	t_taglist_delete(copy);
+
+	t_taglist_delete(current);
+}
+
+
+static void
+run(const char *name, int use_arena, long nfile, long ntag)
+{
+	struct t_arena *arena;
+	unsigned long before;
+	double t0;
+	long i;
+
+	before = nmalloc;
+	t0 = now();
+	for (i = 0; i < nfile; i++) {
+		/* like t_tune_new() and t_tune_delete() */
+		arena = (use_arena ? t_arena_get() : NULL);
+		pipeline(arena, ntag);
+		t_arena_put(arena);
+	}
+	(void)printf("%8s %14lu %14.1f %10.3f\n", name, nmalloc - before,
+	    (double)(nmalloc - before) / nfile, now() - t0);
+}
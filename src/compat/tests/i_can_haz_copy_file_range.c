@@ -0,0 +1,14 @@
+/*
+ * tests/i_can_haz_copy_file_range.c
+ */
+#define	_GNU_SOURCE
+#include <unistd.h>
+
+int
+main(void)
+{
+	off_t off = 0;
+
+	(void)copy_file_range(0, &off, 1, NULL, 0, 0);
+	return (0);
+}
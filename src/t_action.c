@@ -19,6 +19,10 @@
 #include "t_editor.h"
 #include "t_loader.h"
 #include "t_renamer.h"
+#include "t_filter.h"
+#include "t_subst.h"
+#include "t_stats.h"
+#include "t_sink.h"
 
 
 struct t_action_token {
@@ -37,7 +41,11 @@ static struct t_action_token t_action_keywords[] = {
 	{ .word = "load",	.kind = T_ACTION_LOAD,		.argc = 1 },
 	{ .word = "print",	.kind = T_ACTION_PRINT,		.argc = 0 },
 	{ .word = "rename",	.kind = T_ACTION_RENAME,	.argc = 1 },
+	{ .word = "repad",	.kind = T_ACTION_REPAD,		.argc = 1 },
 	{ .word = "set",	.kind = T_ACTION_SET,		.argc = 1 },
+	{ .word = "stats",	.kind = T_ACTION_STATS,		.argc = 1 },
+	{ .word = "sub",	.kind = T_ACTION_SUB,		.argc = 1 },
+	{ .word = "where",	.kind = T_ACTION_WHERE,		.argc = 1 },
 };
 
 
@@ -49,15 +57,34 @@ static struct t_action	*t_action_new(enum t_actionkind kind, const char *arg);
 /* free an action and all internal ressources */
 static void		 t_action_delete(struct t_action *victim);
 
+/*
+ * fold each run of consecutive tag-mutating actions of aQ into a
+ * T_ACTION_FUSED action.
+ *
+ * @return
+ *   0 on success, -1 and set errno to ENOMEM on error.
+ */
+static int	t_actionQ_fuse(struct t_actionQ *aQ);
+
+/* 1 if the action can be part of a T_ACTION_FUSED, 0 otherwise */
+static int	t_action_fusable(const struct t_action *a);
+
+/*
+ * 1 if the action replace all the tags (i.e. the tags before it don't
+ * matter), 0 otherwise.
+ */
+static int	t_action_resets(const struct t_action *a);
+
 /* action methods */
-static int	t_action_add(struct t_action *self, struct t_tune *tune);
 static int	t_action_backend(struct t_action *self, struct t_tune *tune);
-static int	t_action_clear(struct t_action *self, struct t_tune *tune);
 static int	t_action_edit(struct t_action *self, struct t_tune *tune);
-static int	t_action_load(struct t_action *self, struct t_tune *tune);
+static int	t_action_fused(struct t_action *self, struct t_tune *tune);
 static int	t_action_print(struct t_action *self, struct t_tune *tune);
 static int	t_action_rename(struct t_action *self, struct t_tune *tune);
-static int	t_action_set(struct t_action *self, struct t_tune *tune);
+static int	t_action_repad(struct t_action *self, struct t_tune *tune);
+static int	t_action_stats(struct t_action *self, struct t_tune *tune);
+static int	t_action_stats_finish(struct t_action *self);
+static int	t_action_where(struct t_action *self, struct t_tune *tune);
 
 /* used to search in the t_action_keywords array */
 static int	t_action_token_cmp(const void *vstr, const void *vtoken);
@@ -130,6 +157,9 @@ t_actionQ_new(int *argc_p, char ***argv_p)
 		TAILQ_INSERT_TAIL(aQ, a, entries);
 	}
 
+	if (t_actionQ_fuse(aQ) == -1)
+		goto cleanup;
+
 	/* All went well. */
 	success = 1;
 
@@ -147,6 +177,23 @@ cleanup:
 }
 
 
+int
+t_actionQ_finish(struct t_actionQ *aQ)
+{
+	struct t_action *a;
+	int success = 1;
+
+	assert(aQ != NULL);
+
+	TAILQ_FOREACH(a, aQ, entries) {
+		if (a->finish != NULL && a->finish(a) != 0)
+			success = 0;
+	}
+
+	return (success ? 0 : -1);
+}
+
+
 void
 t_actionQ_delete(struct t_actionQ *aQ)
 {
@@ -164,6 +211,66 @@ t_actionQ_delete(struct t_actionQ *aQ)
 }
 
 
+static int
+t_actionQ_fuse(struct t_actionQ *aQ)
+{
+	struct t_action *a, *next, *fused, *step;
+	struct t_actionQ *steps;
+
+	assert(aQ != NULL);
+
+	a = TAILQ_FIRST(aQ);
+	while (a != NULL) {
+		if (!t_action_fusable(a)) {
+			a = TAILQ_NEXT(a, entries);
+			continue;
+		}
+
+		fused = calloc(1, sizeof(struct t_action));
+		steps = malloc(sizeof(struct t_actionQ));
+		if (fused == NULL || steps == NULL) {
+			free(steps);
+			free(fused);
+			return (-1);
+		}
+		TAILQ_INIT(steps);
+		fused->kind   = T_ACTION_FUSED;
+		fused->opaque = steps;
+		fused->write  = 1;
+		fused->apply  = t_action_fused;
+		TAILQ_INSERT_BEFORE(a, fused, entries);
+
+		/* move the run from aQ to steps */
+		for (; a != NULL && t_action_fusable(a); a = next) {
+			next = TAILQ_NEXT(a, entries);
+			TAILQ_REMOVE(aQ, a, entries);
+			if (t_action_resets(a)) {
+				/*
+				 * the add, clear, set and sub steps before a
+				 * are useless. Previous load are kept because
+				 * they may fail (e.g. unreadable file).
+				 */
+				step = TAILQ_FIRST(steps);
+				while (step != NULL) {
+					struct t_action *snext;
+					snext = TAILQ_NEXT(step, entries);
+					if (step->kind != T_ACTION_LOAD) {
+						TAILQ_REMOVE(steps, step,
+						    entries);
+						t_action_delete(step);
+					}
+					step = snext;
+				}
+			}
+			TAILQ_INSERT_TAIL(steps, a, entries);
+			fused->interactive |= a->interactive;
+		}
+	}
+
+	return (0);
+}
+
+
 /*
  * create a new action of the given type.
  *
@@ -184,6 +291,7 @@ t_action_new(enum t_actionkind kind, const char *arg)
 	int success = 0;
 	char *key = NULL, *val, *eq;
 	struct t_action *a;
+	extern int Yflag, Nflag;
 
 	a = calloc(1, sizeof(struct t_action));
 	if (a == NULL)
@@ -208,7 +316,7 @@ t_action_new(enum t_actionkind kind, const char *arg)
 		free(key);
 		key = NULL;
 		a->write = 1;
-		a->apply = t_action_add;
+		/* applied by t_action_fused() */
 		break;
 	case T_ACTION_BACKEND:
 		a->apply = t_action_backend;
@@ -221,10 +329,11 @@ t_action_new(enum t_actionkind kind, const char *arg)
 				goto cleanup;
 		}
 		a->write = 1;
-		a->apply = t_action_clear;
+		/* applied by t_action_fused() */
 		break;
 	case T_ACTION_EDIT:
 		a->write = 1;
+		a->interactive = 1;
 		a->apply = t_action_edit;
 		break;
 	case T_ACTION_LOAD:
@@ -233,7 +342,9 @@ t_action_new(enum t_actionkind kind, const char *arg)
 		if (a->opaque == NULL)
 			goto cleanup;
 		a->write = 1;
-		a->apply = t_action_load;
+		/* see t_load(), empty or `-' means stdin */
+		a->interactive = (strlen(arg) == 0 || strcmp(arg, "-") == 0);
+		/* applied by t_action_fused() */
 		break;
 	case T_ACTION_PRINT:
 		a->apply = t_action_print;
@@ -253,8 +364,21 @@ t_action_new(enum t_actionkind kind, const char *arg)
 			goto cleanup;
 		}
 		a->write = 1;
+		/* t_rename() prompt for confirmation unless -Y or -N */
+		a->interactive = (!Yflag && !Nflag);
 		a->apply = t_action_rename;
 		break;
+	case T_ACTION_REPAD:
+		assert(arg != NULL);
+		if ((a->opaque = malloc(sizeof(struct t_padding))) == NULL)
+			goto cleanup;
+		if (t_backend_padding_parse(a->opaque, arg) == -1) {
+			warn("repad: %s", arg);
+			goto cleanup;
+		}
+		a->write = 1;
+		a->apply = t_action_repad;
+		break;
 	case T_ACTION_SET: /* very similar to T_ACTION_ADD */
 		assert(arg != NULL);
 		if ((key = strdup(arg)) == NULL)
@@ -272,7 +396,32 @@ t_action_new(enum t_actionkind kind, const char *arg)
 		free(key);
 		key = NULL;
 		a->write = 1;
-		a->apply = t_action_set;
+		/* applied by t_action_fused() */
+		break;
+	case T_ACTION_STATS:
+		assert(arg != NULL);
+		if (strlen(arg) == 0) {
+			warnx("stats: missing tag key");
+			errno = EINVAL;
+			goto cleanup;
+		}
+		if ((a->opaque = t_stats_new(arg)) == NULL)
+			goto cleanup;
+		a->apply  = t_action_stats;
+		a->finish = t_action_stats_finish;
+		break;
+	case T_ACTION_SUB:
+		assert(arg != NULL);
+		if ((a->opaque = t_subst_parse(arg)) == NULL)
+			goto cleanup;
+		a->write = 1;
+		/* applied by t_action_fused() */
+		break;
+	case T_ACTION_WHERE:
+		assert(arg != NULL);
+		if ((a->opaque = t_filter_parse(arg)) == NULL)
+			goto cleanup;
+		a->apply = t_action_where;
 		break;
 	default: /* unexpected, unhandled t_actionkind */
 		errno = EINVAL;
@@ -304,12 +453,25 @@ t_action_delete(struct t_action *victim)
 			t_tag_delete(victim->opaque);
 			break;
 		case T_ACTION_CLEAR: /* FALLTHROUGH */
-		case T_ACTION_LOAD:
+		case T_ACTION_LOAD:  /* FALLTHROUGH */
+		case T_ACTION_REPAD:
 			free(victim->opaque);
 			break;
 		case T_ACTION_RENAME:
 			t_rename_pattern_delete(victim->opaque);
 			break;
+		case T_ACTION_FUSED:
+			t_actionQ_delete(victim->opaque);
+			break;
+		case T_ACTION_STATS:
+			t_stats_delete(victim->opaque);
+			break;
+		case T_ACTION_SUB:
+			t_subst_delete(victim->opaque);
+			break;
+		case T_ACTION_WHERE:
+			t_filter_delete(victim->opaque);
+			break;
 		default:
 			/* do nada */
 			break;
@@ -320,34 +482,32 @@ t_action_delete(struct t_action *victim)
 
 
 static int
-t_action_add(struct t_action *self, struct t_tune *tune)
+t_action_fusable(const struct t_action *a)
 {
-	int success = 0;
-	const struct t_tag *t;
-	struct t_taglist *tlist = NULL;
 
-	assert(self != NULL);
-	assert(self->kind == T_ACTION_ADD);
-	assert(tune != NULL);
+	assert(a != NULL);
 
-	t = self->opaque;
+	switch (a->kind) {
+	case T_ACTION_ADD:   /* FALLTHROUGH */
+	case T_ACTION_CLEAR: /* FALLTHROUGH */
+	case T_ACTION_LOAD:  /* FALLTHROUGH */
+	case T_ACTION_SET:   /* FALLTHROUGH */
+	case T_ACTION_SUB:
+		return (1);
+	default:
+		return (0);
+	}
+}
 
-	tlist = t_tune_tags(tune);
-	if (tlist == NULL)
-		goto cleanup;
 
-	if (t_taglist_insert(tlist, t->key, t->val) != 0)
-		goto cleanup;
-	if (t_tune_set_tags(tune, tlist) != 0)
-		goto cleanup;
+static int
+t_action_resets(const struct t_action *a)
+{
 
-	/* All went well. */
-	success = 1;
+	assert(a != NULL);
 
-	/* FALLTHROUGH */
-cleanup:
-	t_taglist_delete(tlist);
-	return (success ? 0 : -1);
+	return (a->kind == T_ACTION_LOAD ||
+	    (a->kind == T_ACTION_CLEAR && a->opaque == NULL));
 }
 
 
@@ -359,40 +519,97 @@ t_action_backend(t__unused struct t_action *self, struct t_tune *tune)
 	assert(tune != NULL);
 	assert(self->kind == T_ACTION_BACKEND);
 
-	(void)printf("%s %s\n", t_tune_backend(tune)->libid, t_tune_path(tune));
-	return (0);
+	return (t_sink_printf(t_sink_get(), "%s %s\n",
+	    t_tune_backend(tune)->libid, t_tune_path(tune)) == 0 ? 0 : -1);
 }
 
 
 static int
-t_action_clear(struct t_action *self, struct t_tune *tune)
+t_action_edit(t__unused struct t_action *self, struct t_tune *tune)
 {
-	int success = 0;
+
+	assert(self != NULL);
+	assert(self->kind == T_ACTION_EDIT);
+	assert(tune != NULL);
+
+	int success = (t_edit(tune) == 0);
+	return (success ? 0 : -1);
+}
+
+
+static int
+t_action_fused(struct t_action *self, struct t_tune *tune)
+{
+	int dirty = 0, success = 0;
+	struct t_action *step;
+	struct t_actionQ *steps;
+	struct t_taglist *tlist = NULL, *neo;
 	const struct t_tag *t;
-	struct t_taglist *tlist = NULL;
-	struct t_taglist *cleared;
-	const char *clear_key;
 
 	assert(self != NULL);
-	assert(self->kind == T_ACTION_CLEAR);
+	assert(self->kind == T_ACTION_FUSED);
 	assert(tune != NULL);
 
-	clear_key = self->opaque;
-	cleared = t_taglist_new();
-	if (cleared == NULL)
-		goto cleanup;
+	steps = self->opaque;
+
+	TAILQ_FOREACH(step, steps, entries) {
+		if (t_action_resets(step)) {
+			t_taglist_delete(tlist);
+			if (step->kind == T_ACTION_LOAD)
+				tlist = t_load_tags(step->opaque);
+			else
+				tlist = t_taglist_new_arena(t_tune_arena(tune));
+			if (tlist == NULL)
+				goto cleanup;
+			dirty = 1;
+			continue;
+		}
 
-	if (clear_key != NULL) {
-		if ((tlist = t_tune_tags(tune)) == NULL)
+		/* fetch the tags lazily, a run may not need them at all */
+		if (tlist == NULL && (tlist = t_tune_tags(tune)) == NULL)
 			goto cleanup;
-		TAILQ_FOREACH(t, tlist->tags, entries) {
-			if (t_tag_keycmp(t->key, clear_key) != 0) {
-				if (t_taglist_insert(cleared, t->key, t->val) != 0)
-					goto cleanup;
+
+		if (step->kind == T_ACTION_SUB) {
+			/* t_subst() only copy the list when a value change */
+			switch (t_subst(step->opaque, &tlist,
+			    t_tune_arena(tune))) {
+			case -1:
+				goto cleanup;
+			case 1:
+				dirty = 1;
+				break;
 			}
+			continue;
+		}
+
+		/* only the list is copied, not the tags */
+		if ((neo = t_taglist_unshare(tlist)) == NULL)
+			goto cleanup;
+		tlist = neo;
+		dirty = 1;
+
+		switch (step->kind) {
+		case T_ACTION_ADD:
+			t = step->opaque;
+			if (t_taglist_insert(tlist, t->key, t->val) != 0)
+				goto cleanup;
+			break;
+		case T_ACTION_CLEAR:
+			t_taglist_clear(tlist, step->opaque);
+			break;
+		case T_ACTION_SET:
+			/* "replace" existing tag(s) with a matching key. */
+			t = step->opaque;
+			if (t_taglist_replace(tlist, t->key, t->val) != 0)
+				goto cleanup;
+			break;
+		default:
+			/* t_actionQ_fuse() bug */
+			ABANDON_SHIP();
 		}
 	}
-	if (t_tune_set_tags(tune, cleared) != 0)
+
+	if (dirty && t_tune_set_tags(tune, tlist) != 0)
 		goto cleanup;
 
 	/* All went well. */
@@ -400,128 +617,132 @@ t_action_clear(struct t_action *self, struct t_tune *tune)
 
 	/* FALLTHROUGH */
 cleanup:
-	t_taglist_delete(cleared);
 	t_taglist_delete(tlist);
 	return (success ? 0 : -1);
 }
 
 
 static int
-t_action_edit(t__unused struct t_action *self, struct t_tune *tune)
+t_action_print(t__unused struct t_action *self, struct t_tune *tune)
 {
+	int success = 0;
+	struct t_sink *sink;
+	struct t_taglist *tlist = NULL;
+	extern const struct t_format *Fflag;
 
 	assert(self != NULL);
-	assert(self->kind == T_ACTION_EDIT);
+	assert(self->kind == T_ACTION_PRINT);
 	assert(tune != NULL);
 
-	int success = (t_edit(tune) == 0);
+	tlist = t_tune_tags(tune);
+	if (tlist == NULL)
+		goto cleanup;
+
+	sink = t_sink_get();
+	if (Fflag->tags2sink(sink, tlist, t_tune_path(tune)) == -1)
+		goto cleanup;
+	success = (t_sink_write(sink, "\n", 1) == 0);
+
+	/* FALLTHROUGH */
+cleanup:
+	t_taglist_delete(tlist);
 	return (success ? 0 : -1);
 }
 
 
 static int
-t_action_load(struct t_action *self, struct t_tune *tune)
+t_action_rename(struct t_action *self, struct t_tune *tune)
 {
 
 	assert(self != NULL);
-	assert(self->kind == T_ACTION_LOAD);
+	assert(self->kind == T_ACTION_RENAME);
 	assert(tune != NULL);
 
-	int success = (t_load(tune, self->opaque) == 0);
+	int success = (t_rename(tune, self->opaque) == 0);
 	return (success ? 0 : -1);
 }
 
 
 static int
-t_action_print(t__unused struct t_action *self, struct t_tune *tune)
+t_action_repad(struct t_action *self, struct t_tune *tune)
 {
-	int nprinted, success = 0;
-	char *fmtdata = NULL;
-	struct t_taglist *tlist = NULL;
-	extern const struct t_format *Fflag;
 
 	assert(self != NULL);
-	assert(self->kind == T_ACTION_PRINT);
+	assert(self->kind == T_ACTION_REPAD);
 	assert(tune != NULL);
 
-	tlist = t_tune_tags(tune);
-	if (tlist == NULL)
-		goto cleanup;
+	int success = (t_tune_repad(tune, self->opaque) == 0);
+	return (success ? 0 : -1);
+}
 
-	fmtdata = Fflag->tags2fmt(tlist, t_tune_path(tune));
-	if (fmtdata == NULL)
-		goto cleanup;
 
-	nprinted = printf("%s\n", fmtdata);
-	if (nprinted > 0) {
-		// +1 for the trailing \n
-		success = ((unsigned)nprinted == (strlen(fmtdata) + 1));
-	}
+static int
+t_action_stats(struct t_action *self, struct t_tune *tune)
+{
+	int status;
+	struct t_taglist *tlist;
 
-	/* FALLTHROUGH */
-cleanup:
+	assert(self != NULL);
+	assert(self->kind == T_ACTION_STATS);
+	assert(tune != NULL);
+
+	if ((tlist = t_tune_tags(tune)) == NULL)
+		return (-1);
+	status = t_stats_add(self->opaque, tlist);
 	t_taglist_delete(tlist);
-	free(fmtdata);
-	return (success ? 0 : -1);
+	return (status == 0 ? 0 : -1);
 }
 
 
 static int
-t_action_rename(struct t_action *self, struct t_tune *tune)
+t_action_stats_finish(struct t_action *self)
 {
+	int success = 0;
+	char *title = NULL;
+	struct t_sink *sink;
+	struct t_taglist *report;
+	extern const struct t_format *Fflag;
 
 	assert(self != NULL);
-	assert(self->kind == T_ACTION_RENAME);
-	assert(tune != NULL);
+	assert(self->kind == T_ACTION_STATS);
 
-	int success = (t_rename(tune, self->opaque) == 0);
+	if ((report = t_stats_report(self->opaque)) == NULL)
+		goto cleanup;
+	if (asprintf(&title, "stats:%s", t_stats_key(self->opaque)) == -1) {
+		title = NULL;
+		goto cleanup;
+	}
+
+	sink = t_sink_get();
+	if (Fflag->tags2sink(sink, report, title) == -1)
+		goto cleanup;
+	success = (t_sink_write(sink, "\n", 1) == 0);
+
+	/* FALLTHROUGH */
+cleanup:
+	if (!success)
+		warn("stats");
+	t_taglist_delete(report);
+	free(title);
 	return (success ? 0 : -1);
 }
 
 
 static int
-t_action_set(struct t_action *self, struct t_tune *tune)
+t_action_where(struct t_action *self, struct t_tune *tune)
 {
-	struct t_tag *t, *t_tmp, *neo;
+	int match;
 	struct t_taglist *tlist;
-	int n, status;
 
 	assert(self != NULL);
-	assert(self->kind == T_ACTION_SET);
+	assert(self->kind == T_ACTION_WHERE);
 	assert(tune != NULL);
 
-	t_tmp = self->opaque;
-	neo = t_tag_new(t_tmp->key, t_tmp->val);
-	if (neo == NULL)
-		return (-1);
-	t_tmp = NULL;
-
-	tlist = t_tune_tags(tune);
-	if (tlist == NULL) {
-		t_tag_delete(neo);
+	if ((tlist = t_tune_tags(tune)) == NULL)
 		return (-1);
-	}
-
-	/* We want to "replace" existing tag(s) with a matching key. If there is
-	   any, neo replace the first occurence found */
-	n = 0;
-	TAILQ_FOREACH_SAFE(t, tlist->tags, entries, t_tmp) {
-		if (t_tag_keycmp(neo->key, t->key) == 0) {
-			if (++n == 1)
-				TAILQ_INSERT_BEFORE(t, neo, entries);
-			TAILQ_REMOVE(tlist->tags, t, entries);
-			t_tag_delete(t);
-		}
-	}
-	if (n == 0) {
-		/* there wasn't any tag matching the key, so we just add neo at
-		   the end. */
-		TAILQ_INSERT_TAIL(tlist->tags, neo, entries);
-	}
-
-	status = t_tune_set_tags(tune, tlist);
+	match = t_filter_match(self->opaque, tlist);
 	t_taglist_delete(tlist);
-	return (status == 0 ? 0 : -1);
+	return (match ? 0 : T_ACTION_SKIP);
 }
 
 
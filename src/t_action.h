@@ -20,7 +20,13 @@ enum t_actionkind {
 	T_ACTION_LOAD,		/* load:PATH		load file */
 	T_ACTION_PRINT,		/* print		display tags */
 	T_ACTION_RENAME,	/* rename:PATTERN	rename files */
+	T_ACTION_REPAD,		/* repad:SIZE		change padding */
 	T_ACTION_SET,		/* set:TAG=VALUE	set tags */
+	T_ACTION_STATS,		/* stats:TAG		count values */
+	T_ACTION_SUB,		/* sub:TAG/RE/REPL/FLAGS substitute tags */
+	T_ACTION_WHERE,		/* where:EXPR		filter files */
+	/* internal */
+	T_ACTION_FUSED,		/* consecutive add, clear, load, set and sub */
 };
 
 /* action with (or without) argument to proceed */
@@ -28,15 +34,34 @@ struct t_action {
 	enum t_actionkind kind;
 	void	*opaque; /* argument of the action */
 	int	write; /* 1 if the action need write access, 0 otherwise */
+	int	interactive; /* 1 if the action may use the terminal (stdin) */
+	/*
+	 * return 0 on success, -1 on error or T_ACTION_SKIP when the remaining
+	 * actions should not be applied to the tune (which is then not
+	 * saved).
+	 */
 	int (*apply)(struct t_action *self, struct t_tune *tune);
+	/*
+	 * called once all the files have been processed, NULL if the action
+	 * doesn't need it. return 0 on success, -1 on error.
+	 */
+	int (*finish)(struct t_action *self);
 	TAILQ_ENTRY(t_action)	entries;
 };
+/* t_action apply() return value to skip a tune */
+#define	T_ACTION_SKIP	1
+
 /* action queue head */
 TAILQ_HEAD(t_actionQ, t_action);
 
 /*
  * Create a queue of action based on argc/argv.
  *
+ * Each run of consecutive tag-mutating actions (add, clear, load, set and sub)
+ * is compiled into a single T_ACTION_FUSED action, so that the tags of a file
+ * are fetched and set once per run instead of once per action. The other
+ * actions are barriers: they see the tags as set by the preceding run.
+ *
  * @param argc_p
  *   A pointer to argc. Cannot be NULL.
  *
@@ -51,6 +76,17 @@ TAILQ_HEAD(t_actionQ, t_action);
  */
 struct t_actionQ	*t_actionQ_new(int *argc_p, char ***argv_p);
 
+/*
+ * call the finish routine of each action of the queue, in order.
+ *
+ * This routine should be called once, after all the files have been
+ * processed.
+ *
+ * @return
+ *   0 on success, -1 if any finish routine failed.
+ */
+int	t_actionQ_finish(struct t_actionQ *aQ);
+
 /*
  * destroy (free memory) of an action queue.
  */
@@ -0,0 +1,212 @@
+/*
+ * t_arena.c
+ *
+ * bump allocator for short lived allocations.
+ */
+#include <limits.h>
+#include <pthread.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stddef.h>
+
+#include "t_config.h"
+#include "t_toolkit.h"
+#include "t_arena.h"
+
+
+/* size of a regular chunk, bigger allocations get a chunk of their own */
+#define	T_ARENA_CHUNK	(16 * 1024)
+#define	T_ARENA_ALIGN	alignof(max_align_t)
+#define	T_ARENA_ROUNDUP(x) \
+	(((x) + T_ARENA_ALIGN - 1) & ~(size_t)(T_ARENA_ALIGN - 1))
+
+struct t_arena_chunk {
+	struct t_arena_chunk	*next;
+	size_t			 size; /* usable bytes in data */
+	size_t			 used;
+	alignas(max_align_t) unsigned char	data[];
+};
+
+struct t_arena {
+	/* the current chunk (the one we bump into) is always the first */
+	struct t_arena_chunk	*chunks;
+};
+
+
+static atomic_ulong	t_arena_nalloc;
+static atomic_ulong	t_arena_nchunk;
+static atomic_ulong	t_arena_nreset;
+
+/* per-thread cache used by t_arena_get() and t_arena_put() */
+static pthread_once_t	t_arena_once = PTHREAD_ONCE_INIT;
+static pthread_key_t	t_arena_key;
+
+
+/* pthread_once(3) routine creating t_arena_key */
+static void	t_arena_key_init(void);
+/* t_arena_key destructor, free the arena cached by an exiting thread */
+static void	t_arena_key_delete(void *arena);
+
+
+struct t_arena *
+t_arena_new(void)
+{
+
+	return (calloc(1, sizeof(struct t_arena)));
+}
+
+
+void *
+t_arena_alloc(struct t_arena *arena, size_t size)
+{
+	struct t_arena_chunk *c;
+	size_t csize;
+	int big;
+	void *ret;
+
+	assert(arena != NULL);
+
+	size = T_ARENA_ROUNDUP(size > 0 ? size : 1);
+	c = arena->chunks;
+	if (c == NULL || c->size - c->used < size) {
+		big   = (size > T_ARENA_CHUNK / 4);
+		csize = (big ? size : T_ARENA_CHUNK);
+		c = malloc(sizeof(struct t_arena_chunk) + csize);
+		if (c == NULL)
+			return (NULL);
+		atomic_fetch_add(&t_arena_nchunk, 1);
+		c->size = csize;
+		c->used = 0;
+		if (big && arena->chunks != NULL) {
+			/* don't waste what is left in the current chunk */
+			c->next = arena->chunks->next;
+			arena->chunks->next = c;
+		} else {
+			c->next = arena->chunks;
+			arena->chunks = c;
+		}
+	}
+
+	ret = c->data + c->used;
+	c->used += size;
+	atomic_fetch_add(&t_arena_nalloc, 1);
+	return (ret);
+}
+
+
+struct sbuf *
+t_arena_sbuf(struct t_arena *arena, struct sbuf *s, size_t len)
+{
+	char *buf = NULL;
+
+	assert(s != NULL);
+	assert(len <= INT_MAX);
+
+	if (arena != NULL && (buf = t_arena_alloc(arena, len)) == NULL)
+		return (NULL);
+
+	return (sbuf_new(s, buf, (buf == NULL ? 0 : (int)len),
+	    SBUF_AUTOEXTEND));
+}
+
+
+void
+t_arena_reset(struct t_arena *arena)
+{
+	struct t_arena_chunk *c, *next, *keep = NULL;
+
+	assert(arena != NULL);
+
+	/* keep one regular chunk around, free the others */
+	for (c = arena->chunks; c != NULL; c = next) {
+		next = c->next;
+		if (keep == NULL && c->size == T_ARENA_CHUNK)
+			keep = c;
+		else
+			free(c);
+	}
+	if (keep != NULL) {
+		keep->next = NULL;
+		keep->used = 0;
+	}
+	arena->chunks = keep;
+	atomic_fetch_add(&t_arena_nreset, 1);
+}
+
+
+struct t_arena *
+t_arena_get(void)
+{
+	struct t_arena *arena;
+
+	if ((errno = pthread_once(&t_arena_once, t_arena_key_init)) != 0)
+		return (NULL);
+
+	arena = pthread_getspecific(t_arena_key);
+	if (arena != NULL) {
+		(void)pthread_setspecific(t_arena_key, NULL);
+		return (arena);
+	}
+
+	return (t_arena_new());
+}
+
+
+void
+t_arena_put(struct t_arena *arena)
+{
+
+	if (arena == NULL)
+		return;
+
+	t_arena_reset(arena);
+	if (pthread_once(&t_arena_once, t_arena_key_init) != 0 ||
+	    pthread_getspecific(t_arena_key) != NULL ||
+	    pthread_setspecific(t_arena_key, arena) != 0)
+		t_arena_delete(arena);
+}
+
+
+void
+t_arena_counters(struct t_arena_counters *c)
+{
+
+	assert(c != NULL);
+
+	c->nalloc = atomic_load(&t_arena_nalloc);
+	c->nchunk = atomic_load(&t_arena_nchunk);
+	c->nreset = atomic_load(&t_arena_nreset);
+}
+
+
+void
+t_arena_delete(struct t_arena *arena)
+{
+	struct t_arena_chunk *c, *next;
+
+	if (arena == NULL)
+		return;
+
+	for (c = arena->chunks; c != NULL; c = next) {
+		next = c->next;
+		free(c);
+	}
+	free(arena);
+}
+
+
+static void
+t_arena_key_init(void)
+{
+
+	if ((errno = pthread_key_create(&t_arena_key, t_arena_key_delete)) != 0)
+		err(EXIT_FAILURE, "pthread_key_create");
+}
+
+
+static void
+t_arena_key_delete(void *arena)
+{
+
+	t_arena_delete(arena);
+}
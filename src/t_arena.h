@@ -0,0 +1,101 @@
+#ifndef T_ARENA_H
+#define T_ARENA_H
+/*
+ * t_arena.h
+ *
+ * bump allocator for short lived allocations.
+ *
+ * All the memory allocated from an arena is released at once by
+ * t_arena_reset() or t_arena_delete(), there is no way to free a single
+ * allocation. A tune own an arena for its tags (see t_tune_arena()) which is
+ * reset when the tune is deleted.
+ */
+#include "t_config.h"
+
+
+/* an arena, made of chunks allocated by malloc(3) */
+struct t_arena;
+
+/* arena counters, see t_arena_counters() */
+struct t_arena_counters {
+	unsigned long	nalloc;  /* allocations served by an arena */
+	unsigned long	nchunk;  /* chunks allocated, i.e. malloc(3) calls */
+	unsigned long	nreset;  /* t_arena_reset() calls */
+};
+
+
+/*
+ * create a new arena.
+ *
+ * @return
+ *   an empty t_arena that should be passed to t_arena_delete() after use, or
+ *   NULL and set errno on error (malloc(3) failed).
+ */
+struct t_arena	*t_arena_new(void);
+
+/*
+ * allocate size bytes from an arena.
+ *
+ * The returned memory is suitably aligned for any kind of variable, is not
+ * initialized and is valid until the next t_arena_reset() or t_arena_delete().
+ *
+ * @return
+ *   a pointer to the allocated memory, or NULL and set errno on error
+ *   (malloc(3) failed).
+ */
+void	*t_arena_alloc(struct t_arena *arena, size_t size);
+
+/*
+ * setup an auto-extended sbuf, using a buffer of len bytes allocated from
+ * arena as its initial storage.
+ *
+ * The sbuf only use malloc(3) when it outgrow len. It should be passed to
+ * sbuf_delete() after use, as usual.
+ *
+ * @param arena
+ *   The arena to allocate from. If NULL, the sbuf is a plain sbuf_new(3) auto
+ *   extended sbuf.
+ *
+ * @param s
+ *   The sbuf structure to initialize, cannot be NULL.
+ *
+ * @return
+ *   s on success, NULL on error.
+ */
+struct sbuf	*t_arena_sbuf(struct t_arena *arena, struct sbuf *s, size_t len);
+
+/*
+ * release all the memory allocated from an arena.
+ *
+ * The arena can be used again after a reset, some of its memory is kept to
+ * serve the next allocations without calling malloc(3).
+ */
+void	t_arena_reset(struct t_arena *arena);
+
+/*
+ * get an arena from the calling thread's cache, or a new one if the cache is
+ * empty. It should be given back with t_arena_put() after use.
+ *
+ * @return
+ *   an empty t_arena, or NULL and set errno on error (malloc(3) failed).
+ */
+struct t_arena	*t_arena_get(void);
+
+/*
+ * reset an arena and keep it in the calling thread's cache, so that the next
+ * t_arena_get() (typically for the next tune processed by this worker) reuse
+ * its memory.
+ */
+void	t_arena_put(struct t_arena *arena);
+
+/*
+ * get the global arena counters (summed over all threads).
+ */
+void	t_arena_counters(struct t_arena_counters *c);
+
+/*
+ * free an arena and all the memory allocated from it.
+ */
+void	t_arena_delete(struct t_arena *arena);
+
+#endif /* ndef T_ARENA_H */
@@ -3,6 +3,14 @@
  *
  * backends functions for tagutil
  */
+#include <sys/param.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+
 #include "t_config.h"
 #include "t_toolkit.h"
 
@@ -11,6 +19,7 @@
 
 struct t_backend	*t_ftflac_backend(void) t__weak;
 struct t_backend	*t_ftoggvorbis_backend(void) t__weak;
+struct t_backend	*t_ftid3v2_backend(void) t__weak;
 struct t_backend	*t_fttaglib_backend(void) t__weak;
 struct t_backend	*t_ftid3v1_backend(void) t__weak;
 
@@ -32,6 +41,10 @@ t_all_backends(void)
 		if (t_ftoggvorbis_backend != NULL)
 			TAILQ_INSERT_TAIL(&bQ, t_ftoggvorbis_backend(), entries);
 
+		/* mp3 ID3v2.3 and ID3v2.4 tags support (built-in) */
+		if (t_ftid3v2_backend != NULL)
+			TAILQ_INSERT_TAIL(&bQ, t_ftid3v2_backend(), entries);
+
 		/* Multiple files types support using TagLib */
 		if (t_fttaglib_backend != NULL)
 			TAILQ_INSERT_TAIL(&bQ, t_fttaglib_backend(), entries);
@@ -45,3 +58,187 @@ t_all_backends(void)
 
 	return (&bQ);
 }
+
+
+int
+t_backend_probe_read(struct t_backend_probe *probe, const char *path)
+{
+	int fd;
+	ssize_t n;
+	struct stat st;
+
+	assert(probe != NULL);
+	assert(path != NULL);
+
+	bzero(probe, sizeof(struct t_backend_probe));
+	probe->fd = -1;
+	if ((fd = open(path, O_RDONLY)) == -1)
+		return (-1);
+	if (fstat(fd, &st) == -1)
+		goto error_label;
+	probe->size = st.st_size;
+
+	if ((n = pread(fd, probe->head, sizeof(probe->head), 0)) == -1)
+		goto error_label;
+	probe->headlen = (size_t)n;
+
+	if (probe->size <= (off_t)probe->headlen) {
+		/* the whole file is in head, no need for another read */
+		probe->taillen = MIN(probe->headlen, sizeof(probe->tail));
+		(void)memcpy(probe->tail,
+		    probe->head + probe->headlen - probe->taillen,
+		    probe->taillen);
+	} else {
+		size_t len = (size_t)MIN(probe->size, (off_t)sizeof(probe->tail));
+		n = pread(fd, probe->tail, len, probe->size - (off_t)len);
+		if (n == -1)
+			goto error_label;
+		probe->taillen = (size_t)n;
+	}
+
+	/* keep fd for the backend, see t_backend_probe_fd() */
+	probe->fd = fd;
+	return (0);
+error_label:
+	(void)close(fd);
+	return (-1);
+}
+
+
+int
+t_backend_probe_fd(struct t_backend_probe *probe, const char *path)
+{
+	int fd;
+
+	assert(path != NULL);
+
+	if (probe == NULL || probe->fd == -1) {
+		if (probe != NULL)
+			probe->nopen++;
+		return (open(path, O_RDONLY));
+	}
+
+	fd = probe->fd;
+	probe->fd = -1;
+	return (fd);
+}
+
+
+void
+t_backend_probe_close(struct t_backend_probe *probe)
+{
+
+	assert(probe != NULL);
+
+	if (probe->fd != -1) {
+		(void)close(probe->fd);
+		probe->fd = -1;
+	}
+}
+
+
+int
+t_backend_match(const struct t_backend *b, const struct t_backend_probe *probe)
+{
+	const struct t_backend_magic *m;
+	const unsigned char *p;
+	size_t i;
+
+	assert(b != NULL);
+	assert(probe != NULL);
+
+	if (b->magics == NULL)
+		return (0);
+
+	for (m = b->magics; m->len > 0; m++) {
+		if (m->offset >= 0) {
+			if ((size_t)m->offset + m->len > probe->headlen)
+				continue;
+			p = probe->head + m->offset;
+		} else {
+			if ((size_t)-m->offset > probe->taillen ||
+			    (size_t)-m->offset < m->len)
+				continue;
+			p = probe->tail + probe->taillen - (size_t)-m->offset;
+		}
+		for (i = 0; i < m->len; i++) {
+			unsigned char c = p[i];
+			if (m->mask != NULL)
+				c &= (unsigned char)m->mask[i];
+			if (c != (unsigned char)m->bytes[i])
+				break;
+		}
+		if (i == m->len)
+			return (1);
+	}
+
+	return (0);
+}
+
+
+int
+t_backend_padding_parse(struct t_padding *pad, const char *str)
+{
+	long long l;
+	char *endptr;
+
+	assert(pad != NULL);
+	assert(str != NULL);
+
+	bzero(pad, sizeof(struct t_padding));
+	errno = 0;
+	l = strtoll(str, &endptr, 10);
+	if (errno != 0 || endptr == str || l < 0)
+		goto invalid;
+
+	switch (*endptr) {
+	case '\0':
+		break;
+	case 'k': /* FALLTHROUGH */
+	case 'K':
+		if (l > LLONG_MAX / 1024)
+			goto invalid;
+		l *= 1024;
+		endptr++;
+		break;
+	case 'm': /* FALLTHROUGH */
+	case 'M':
+		if (l > LLONG_MAX / (1024 * 1024))
+			goto invalid;
+		l *= 1024 * 1024;
+		endptr++;
+		break;
+	case '%':
+		if (l > 100)
+			goto invalid;
+		pad->percent = 1;
+		endptr++;
+		break;
+	default:
+		goto invalid;
+	}
+	if (*endptr != '\0')
+		goto invalid;
+
+	pad->value = (off_t)l;
+	return (0);
+invalid:
+	errno = EINVAL;
+	return (-1);
+}
+
+
+size_t
+t_backend_padding_size(const struct t_padding *pad, off_t size, size_t max)
+{
+	off_t len;
+
+	assert(pad != NULL);
+	assert(size >= 0);
+
+	len = pad->value;
+	if (pad->percent)
+		len = size / 100 * pad->value + size % 100 * pad->value / 100;
+
+	return ((uintmax_t)len > max ? max : (size_t)len);
+}
@@ -5,30 +5,100 @@
  *
  * backends functions for tagutil
  */
+#include <sys/types.h>
+
 #include "t_config.h"
 #include "t_tune.h"
 
 
+/* how many bytes are read at the start and the end of a file to find out its
+   backend */
+#define	T_BACKEND_HEADLEN	512
+#define	T_BACKEND_TAILLEN	128
+
+/*
+ * a file signature. The backend is expected to handle a file if its content
+ * at the given offset match the bytes (after masking if mask is not NULL).
+ */
+struct t_backend_magic {
+	off_t		 offset; /* from the start, or the end if negative */
+	size_t		 len; /* 0 terminate an array of t_backend_magic */
+	const char	*bytes;
+	const char	*mask;
+};
+
+/*
+ * the head and tail of a file, used to match t_backend_magic signatures. The
+ * file descriptor used to read them is kept open so that the backend can take
+ * it over instead of opening the file again, see t_backend_probe_fd().
+ */
+struct t_backend_probe {
+	off_t		size; /* the file size */
+	size_t		headlen;
+	size_t		taillen;
+	unsigned char	head[T_BACKEND_HEADLEN];
+	unsigned char	tail[T_BACKEND_TAILLEN];
+	int		fd; /* opened read-only, -1 once closed or taken */
+	unsigned int	nopen; /* open(2) calls made by backends on this file */
+};
+
+/*
+ * room reserved in a file for its tags to grow without a full rewrite, see -P
+ * and the repad action.
+ */
+struct t_padding {
+	off_t	value;   /* in bytes, or in percent if percent is set */
+	int	percent; /* 1 if value is relative to the file size */
+};
+
+
 struct t_backend {
 	const char	*libid;
 	const char	*desc;
 
+	/*
+	 * signatures of the files handled by this backend, terminated by an
+	 * element with a zero len. Used to probe files when the probe member
+	 * is NULL.
+	 */
+	const struct t_backend_magic	*magics;
+
+	/*
+	 * cheap check to find out if a file should be handled by this backend.
+	 *
+	 * This routine must not parse the file, it is called with the file
+	 * head and tail already read. If both probe and magics are NULL, the
+	 * backend is only tried (using open) when no other backend claimed
+	 * the file.
+	 *
+	 * @return
+	 *   1 if the backend should handle the file, 0 otherwise.
+	 */
+	int	(*probe)(const struct t_backend_probe *probe);
+
 	/*
 	 * tune internal data (opaque) initialization.
 	 *
-	 * This routine can be used to detect if a backend can handle a
-	 * particular file.
+	 * This routine is called lazily, when the tags are first needed. It
+	 * is also used to detect if a backend can handle a particular file
+	 * that was not claimed by any probe.
+	 *
+	 * @param probe
+	 *   The file head and tail, NULL if they could not be read. The
+	 *   backend should use t_backend_probe_fd() to get a descriptor rather
+	 *   than opening path, and increment probe->nopen when it has to open
+	 *   the file by other means (like a library taking a path).
 	 *
 	 * @return
 	 *   A pointer to the opaque data on success, NULL otherwise.
 	 */
-	void *	(*init)(const char *path);
+	void *	(*open)(const char *path, struct t_backend_probe *probe);
 
 	/*
 	 * Read all the tags from the storage.
 	 *
 	 * @param opaque
-	 *   an opaque pointer that has been provided by the init member
+	 *   an opaque pointer that has been provided by the open member
 	 *   function.
 	 *
 	 * @return
@@ -40,7 +110,7 @@ struct t_backend {
 	 * write the given taglist to the file.
 	 *
 	 * @param opaque
-	 *   an opaque pointer that has been provided by the init member
+	 *   an opaque pointer that has been provided by the open member
 	 *   function.
 	 *
 	 * @param tlist
@@ -58,11 +128,31 @@ struct t_backend {
 	 * anymore.
 	 *
 	 * @param opaque
-	 *   an opaque pointer that has been provided by the init member
+	 *   an opaque pointer that has been provided by the open member
 	 *   function.
 	 */
 	void	(*clear)(void *opaque);
 
+	/*
+	 * print the backend statistics (see -v) to fp, can be NULL.
+	 *
+	 * This routine is called once all the files have been processed.
+	 */
+	void	(*stats)(FILE *fp);
+
+	/*
+	 * change the padding of the file to the given reserve, rewriting the
+	 * file if needed. Can be NULL if the file format has no padding.
+	 *
+	 * @param opaque
+	 *   an opaque pointer that has been provided by the open member
+	 *   function.
+	 *
+	 * @return
+	 *   return -1 on error, 0 on success.
+	 */
+	int	(*repad)(void *opaque, const struct t_padding *pad);
+
 	/* used for the backend queue */
 	TAILQ_ENTRY(t_backend)	entries;
 };
@@ -73,4 +163,69 @@ TAILQ_HEAD(t_backendQ, t_backend);
  */
 const struct t_backendQ	*t_all_backends(void);
 
+/*
+ * read the head and tail of the file at path.
+ *
+ * On success the file is left open (see probe->fd), the caller should pass
+ * probe to t_backend_probe_close() once the backend open routine is done.
+ *
+ * @return
+ *   0 on success, -1 on error and set errno.
+ */
+int	t_backend_probe_read(struct t_backend_probe *probe, const char *path);
+
+/*
+ * get a read-only file descriptor for the file at path, taking the one left
+ * open by t_backend_probe_read() if it is still available.
+ *
+ * @param probe
+ *   The probe of path, can be NULL. probe->nopen is incremented when the file
+ *   has to be opened.
+ *
+ * @return
+ *   a file descriptor that should be passed to close(2) after use, or -1 and
+ *   set errno on error.
+ */
+int	t_backend_probe_fd(struct t_backend_probe *probe, const char *path);
+
+/*
+ * close the file descriptor of a probe, if it was not taken by a backend.
+ */
+void	t_backend_probe_close(struct t_backend_probe *probe);
+
+/*
+ * check if a backend magics match a probed file.
+ *
+ * This is the default probe routine for backends defining magics.
+ *
+ * @return
+ *   1 if one of b's signature match, 0 otherwise.
+ */
+int	t_backend_match(const struct t_backend *b,
+	    const struct t_backend_probe *probe);
+
+/*
+ * parse a padding reserve: a count of bytes with an optional k or M suffix
+ * (like "8192", "8k" or "1M") or a percentage of the file size (like "5%").
+ *
+ * @return
+ *   0 on success, -1 and set errno to EINVAL if str is not a valid padding.
+ */
+int	t_backend_padding_parse(struct t_padding *pad, const char *str);
+
+/*
+ * compute the padding length in bytes for a file.
+ *
+ * @param size
+ *   The file size, not counting its current padding.
+ *
+ * @param max
+ *   The biggest padding supported by the file format.
+ *
+ * @return
+ *   the padding length in bytes, at most max.
+ */
+size_t	t_backend_padding_size(const struct t_padding *pad, off_t size,
+	    size_t max);
+
 #endif /* ndef T_BACKEND_H */
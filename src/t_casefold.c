@@ -0,0 +1,454 @@
+/*
+ * t_casefold.c
+ *
+ * case folding, comparison and hashing of (mostly ASCII) strings.
+ *
+ * Each implementation provide two kernels: fold() which convert a string to
+ * lower or upper case, and mismatch() which find the first position where two
+ * strings differ ignoring case. The comparison routines are built on top of
+ * them. Strings shorter than a SSE2 vector (most tag keys) go straight to the
+ * SWAR kernels, and so does the hash which consume a word at a time anyway.
+ *
+ * The portable implementation is SWAR: eight bytes are loaded in a 64 bits
+ * word and the ASCII letters are found with two additions, see
+ * t_casefold_swar8(). On x86 the same is done 16 (SSE2) or 32 (AVX2) bytes at
+ * a time. A block having a non-ASCII byte is handled byte by byte with
+ * tolower(3) or toupper(3), so that the result doesn't depend on the
+ * implementation. Tag keys being almost always ASCII, this is rare.
+ */
+#include <pthread.h>
+
+#include "t_config.h"
+#include "t_toolkit.h"
+#include "t_casefold.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) && \
+    !defined(lint)
+#	define	T_CASEFOLD_X86	1
+#	include <immintrin.h>
+#endif
+
+
+#define	T_CASEFOLD_ONES		UINT64_C(0x0101010101010101)
+#define	T_CASEFOLD_HIGH		UINT64_C(0x8080808080808080)
+/* shorter strings are handled by the SWAR kernels */
+#define	T_CASEFOLD_SHORT	16
+
+struct t_casefold_impl {
+	const char	*name;
+	void	(*fold)(unsigned char *dst, const unsigned char *src,
+		    size_t len, int upper);
+	size_t	(*mismatch)(const unsigned char *a, const unsigned char *b,
+		    size_t len);
+};
+
+/* set by t_casefold_init() */
+static struct t_casefold_impl	t_casefold;
+
+static pthread_once_t	t_casefold_once = PTHREAD_ONCE_INIT;
+
+
+/* pick the implementation, called once */
+static void	t_casefold_init(void);
+
+/* dispatch to the mismatch() kernel */
+static size_t	t_casefold_mismatch(const char *a, const char *b, size_t len);
+
+/* fold one byte */
+static inline unsigned char	t_casefold_byte(unsigned char c, int upper);
+/* fold eight ASCII bytes */
+static inline uint64_t	t_casefold_swar8(uint64_t w, int upper);
+
+static void	t_casefold_swar_fold(unsigned char *dst,
+		    const unsigned char *src, size_t len, int upper);
+static size_t	t_casefold_swar_mismatch(const unsigned char *a,
+		    const unsigned char *b, size_t len);
+#if defined(T_CASEFOLD_X86)
+static void	t_casefold_sse2_fold(unsigned char *dst,
+		    const unsigned char *src, size_t len, int upper);
+static size_t	t_casefold_sse2_mismatch(const unsigned char *a,
+		    const unsigned char *b, size_t len);
+static void	t_casefold_avx2_fold(unsigned char *dst,
+		    const unsigned char *src, size_t len, int upper);
+static size_t	t_casefold_avx2_mismatch(const unsigned char *a,
+		    const unsigned char *b, size_t len);
+#endif
+
+
+void
+t_casefold_lower(char *dst, const char *src, size_t len)
+{
+
+	assert(dst != NULL || len == 0);
+	assert(src != NULL || len == 0);
+
+	if (len < T_CASEFOLD_SHORT) {
+		t_casefold_swar_fold((unsigned char *)dst,
+		    (const unsigned char *)src, len, 0);
+		return;
+	}
+	(void)pthread_once(&t_casefold_once, t_casefold_init);
+	t_casefold.fold((unsigned char *)dst, (const unsigned char *)src, len,
+	    0);
+}
+
+
+void
+t_casefold_upper(char *dst, const char *src, size_t len)
+{
+
+	assert(dst != NULL || len == 0);
+	assert(src != NULL || len == 0);
+
+	if (len < T_CASEFOLD_SHORT) {
+		t_casefold_swar_fold((unsigned char *)dst,
+		    (const unsigned char *)src, len, 1);
+		return;
+	}
+	(void)pthread_once(&t_casefold_once, t_casefold_init);
+	t_casefold.fold((unsigned char *)dst, (const unsigned char *)src, len,
+	    1);
+}
+
+
+int
+t_casefold_eq(const char *a, const char *b, size_t len)
+{
+
+	assert(a != NULL || len == 0);
+	assert(b != NULL || len == 0);
+
+	if (a == b)
+		return (1);
+
+	return (t_casefold_mismatch(a, b, len) == len);
+}
+
+
+int
+t_casefold_cmp(const char *a, size_t alen, const char *b, size_t blen)
+{
+	size_t i, len;
+
+	assert(a != NULL || alen == 0);
+	assert(b != NULL || blen == 0);
+
+	len = (alen < blen ? alen : blen);
+	i = t_casefold_mismatch(a, b, len);
+	if (i < len) {
+		return (t_casefold_byte((unsigned char)a[i], 0) -
+		    t_casefold_byte((unsigned char)b[i], 0));
+	}
+
+	return (alen < blen ? -1 : (alen > blen ? 1 : 0));
+}
+
+
+uint32_t
+t_casefold_hash(const char *s, size_t len)
+{
+	const unsigned char *p = (const unsigned char *)s;
+	uint64_t h, w;
+	size_t n, i;
+	unsigned char c;
+
+	assert(s != NULL || len == 0);
+
+	h = UINT64_C(0xcbf29ce484222325) ^ len;
+	for (; len > 0; p += n, len -= n) {
+		if (len >= sizeof(w)) {
+			n = sizeof(w);
+			(void)memcpy(&w, p, sizeof(w));
+		} else {
+			/* the last word is padded with zeros (never folded) */
+			n = len;
+			for (w = 0, i = 0; i < n; i++)
+				w |= (uint64_t)p[i] << (8 * i);
+		}
+		if (w & T_CASEFOLD_HIGH) {
+			for (i = 0; i < sizeof(w); i++) {
+				c = (unsigned char)(w >> (8 * i));
+				w ^= (uint64_t)(c ^ t_casefold_byte(c, 0)) <<
+				    (8 * i);
+			}
+		} else
+			w = t_casefold_swar8(w, 0);
+		h = (h ^ w) * UINT64_C(0x9e3779b97f4a7c15);
+		h ^= h >> 32;
+	}
+	h *= UINT64_C(0xff51afd7ed558ccd);
+	h ^= h >> 33;
+
+	return ((uint32_t)h);
+}
+
+
+const char *
+t_casefold_impl(void)
+{
+
+	(void)pthread_once(&t_casefold_once, t_casefold_init);
+	return (t_casefold.name);
+}
+
+
+static void
+t_casefold_init(void)
+{
+
+	t_casefold.name     = "swar";
+	t_casefold.fold     = t_casefold_swar_fold;
+	t_casefold.mismatch = t_casefold_swar_mismatch;
+#if defined(T_CASEFOLD_X86)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		t_casefold.name     = "avx2";
+		t_casefold.fold     = t_casefold_avx2_fold;
+		t_casefold.mismatch = t_casefold_avx2_mismatch;
+	} else if (__builtin_cpu_supports("sse2")) {
+		t_casefold.name     = "sse2";
+		t_casefold.fold     = t_casefold_sse2_fold;
+		t_casefold.mismatch = t_casefold_sse2_mismatch;
+	}
+#endif
+}
+
+
+static size_t
+t_casefold_mismatch(const char *a, const char *b, size_t len)
+{
+
+	if (len < T_CASEFOLD_SHORT) {
+		return (t_casefold_swar_mismatch((const unsigned char *)a,
+		    (const unsigned char *)b, len));
+	}
+	(void)pthread_once(&t_casefold_once, t_casefold_init);
+	return (t_casefold.mismatch((const unsigned char *)a,
+	    (const unsigned char *)b, len));
+}
+
+
+static inline unsigned char
+t_casefold_byte(unsigned char c, int upper)
+{
+
+	if (c < 0x80) {
+		if (upper && c >= 'a' && c <= 'z')
+			return ((unsigned char)(c - ('a' - 'A')));
+		if (!upper && c >= 'A' && c <= 'Z')
+			return ((unsigned char)(c + ('a' - 'A')));
+		return (c);
+	}
+	return ((unsigned char)(upper ? toupper(c) : tolower(c)));
+}
+
+
+/*
+ * For an ASCII byte c, c + (0x80 - lo) has its high bit set if and only if
+ * c >= lo, and cannot carry into the next byte. The letters are the bytes
+ * with c >= lo but not c > hi, their case bit (0x20) is flipped.
+ */
+static inline uint64_t
+t_casefold_swar8(uint64_t w, int upper)
+{
+	const uint64_t lo = (upper ? 'a' : 'A');
+	const uint64_t hi = (upper ? 'z' : 'Z');
+	uint64_t ge, gt;
+
+	assert((w & T_CASEFOLD_HIGH) == 0);
+
+	ge = w + (0x80 - lo) * T_CASEFOLD_ONES;
+	gt = w + (0x80 - hi - 1) * T_CASEFOLD_ONES;
+	return (w ^ ((ge & ~gt & T_CASEFOLD_HIGH) >> 2));
+}
+
+
+static void
+t_casefold_swar_fold(unsigned char *dst, const unsigned char *src, size_t len,
+    int upper)
+{
+	uint64_t w;
+	size_t i;
+
+	for (; len >= 8; src += 8, dst += 8, len -= 8) {
+		(void)memcpy(&w, src, sizeof(w));
+		if (w & T_CASEFOLD_HIGH) {
+			for (i = 0; i < 8; i++)
+				dst[i] = t_casefold_byte(src[i], upper);
+		} else {
+			w = t_casefold_swar8(w, upper);
+			(void)memcpy(dst, &w, sizeof(w));
+		}
+	}
+	for (i = 0; i < len; i++)
+		dst[i] = t_casefold_byte(src[i], upper);
+}
+
+
+static size_t
+t_casefold_swar_mismatch(const unsigned char *a, const unsigned char *b,
+    size_t len)
+{
+	uint64_t wa, wb;
+	size_t i = 0, j;
+
+	for (; len - i >= 8; i += 8) {
+		(void)memcpy(&wa, a + i, sizeof(wa));
+		(void)memcpy(&wb, b + i, sizeof(wb));
+		if (wa == wb)
+			continue;
+		if (((wa | wb) & T_CASEFOLD_HIGH) == 0 &&
+		    t_casefold_swar8(wa, 0) == t_casefold_swar8(wb, 0))
+			continue;
+		/* there is a non-ASCII byte or a difference in this word */
+		for (j = i; j < i + 8; j++) {
+			if (t_casefold_byte(a[j], 0) != t_casefold_byte(b[j], 0))
+				return (j);
+		}
+	}
+	for (; i < len; i++) {
+		if (t_casefold_byte(a[i], 0) != t_casefold_byte(b[i], 0))
+			return (i);
+	}
+
+	return (len);
+}
+
+
+#if defined(T_CASEFOLD_X86)
+/*
+ * the SSE2 and AVX2 kernels.
+ *
+ * Bytes are signed for the comparison instructions, so a non-ASCII byte is
+ * never in the range of the letters. The tail (less than a vector) is handed
+ * to the SWAR kernels.
+ */
+__attribute__((__target__("sse2")))
+static inline __m128i
+t_casefold_sse2_fold16(__m128i x, int upper)
+{
+	const __m128i lo = _mm_set1_epi8((char)(upper ? 'a' - 1 : 'A' - 1));
+	const __m128i hi = _mm_set1_epi8((char)(upper ? 'z' + 1 : 'Z' + 1));
+	__m128i m;
+
+	m = _mm_and_si128(_mm_cmpgt_epi8(x, lo), _mm_cmplt_epi8(x, hi));
+	return (_mm_xor_si128(x, _mm_and_si128(m, _mm_set1_epi8(0x20))));
+}
+
+
+__attribute__((__target__("sse2")))
+static void
+t_casefold_sse2_fold(unsigned char *dst, const unsigned char *src, size_t len,
+    int upper)
+{
+	__m128i x;
+	size_t i;
+
+	for (; len >= 16; src += 16, dst += 16, len -= 16) {
+		x = _mm_loadu_si128((const __m128i *)(const void *)src);
+		if (_mm_movemask_epi8(x) != 0) {
+			for (i = 0; i < 16; i++)
+				dst[i] = t_casefold_byte(src[i], upper);
+		} else {
+			_mm_storeu_si128((__m128i *)(void *)dst,
+			    t_casefold_sse2_fold16(x, upper));
+		}
+	}
+	t_casefold_swar_fold(dst, src, len, upper);
+}
+
+
+__attribute__((__target__("sse2")))
+static size_t
+t_casefold_sse2_mismatch(const unsigned char *a, const unsigned char *b,
+    size_t len)
+{
+	__m128i xa, xb;
+	unsigned int neq;
+	size_t i = 0, j;
+
+	for (; len - i >= 16; i += 16) {
+		xa = _mm_loadu_si128((const __m128i *)(const void *)(a + i));
+		xb = _mm_loadu_si128((const __m128i *)(const void *)(b + i));
+		if (_mm_movemask_epi8(_mm_or_si128(xa, xb)) != 0) {
+			/* non-ASCII, let the SWAR kernel sort it out */
+			j = t_casefold_swar_mismatch(a + i, b + i, 16);
+			if (j < 16)
+				return (i + j);
+			continue;
+		}
+		neq = 0xffffU ^ (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(
+		    t_casefold_sse2_fold16(xa, 0),
+		    t_casefold_sse2_fold16(xb, 0)));
+		if (neq != 0)
+			return (i + (size_t)__builtin_ctz(neq));
+	}
+
+	return (i + t_casefold_swar_mismatch(a + i, b + i, len - i));
+}
+
+
+__attribute__((__target__("avx2")))
+static inline __m256i
+t_casefold_avx2_fold32(__m256i x, int upper)
+{
+	const __m256i lo = _mm256_set1_epi8((char)(upper ? 'a' - 1 : 'A' - 1));
+	const __m256i hi = _mm256_set1_epi8((char)(upper ? 'z' + 1 : 'Z' + 1));
+	__m256i m;
+
+	m = _mm256_and_si256(_mm256_cmpgt_epi8(x, lo), _mm256_cmpgt_epi8(hi, x));
+	return (_mm256_xor_si256(x, _mm256_and_si256(m,
+	    _mm256_set1_epi8(0x20))));
+}
+
+
+__attribute__((__target__("avx2")))
+static void
+t_casefold_avx2_fold(unsigned char *dst, const unsigned char *src, size_t len,
+    int upper)
+{
+	__m256i x;
+	size_t i;
+
+	for (; len >= 32; src += 32, dst += 32, len -= 32) {
+		x = _mm256_loadu_si256((const __m256i *)(const void *)src);
+		if (_mm256_movemask_epi8(x) != 0) {
+			for (i = 0; i < 32; i++)
+				dst[i] = t_casefold_byte(src[i], upper);
+		} else {
+			_mm256_storeu_si256((__m256i *)(void *)dst,
+			    t_casefold_avx2_fold32(x, upper));
+		}
+	}
+	t_casefold_sse2_fold(dst, src, len, upper);
+}
+
+
+__attribute__((__target__("avx2")))
+static size_t
+t_casefold_avx2_mismatch(const unsigned char *a, const unsigned char *b,
+    size_t len)
+{
+	__m256i xa, xb;
+	unsigned int neq;
+	size_t i = 0, j;
+
+	for (; len - i >= 32; i += 32) {
+		xa = _mm256_loadu_si256((const __m256i *)(const void *)(a + i));
+		xb = _mm256_loadu_si256((const __m256i *)(const void *)(b + i));
+		if (_mm256_movemask_epi8(_mm256_or_si256(xa, xb)) != 0) {
+			j = t_casefold_swar_mismatch(a + i, b + i, 32);
+			if (j < 32)
+				return (i + j);
+			continue;
+		}
+		neq = ~(unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(
+		    t_casefold_avx2_fold32(xa, 0),
+		    t_casefold_avx2_fold32(xb, 0)));
+		if (neq != 0)
+			return (i + (size_t)__builtin_ctz(neq));
+	}
+
+	return (i + t_casefold_sse2_mismatch(a + i, b + i, len - i));
+}
+#endif /* T_CASEFOLD_X86 */
@@ -0,0 +1,59 @@
+#ifndef T_CASEFOLD_H
+#define T_CASEFOLD_H
+/*
+ * t_casefold.h
+ *
+ * case folding, comparison and hashing of (mostly ASCII) strings.
+ *
+ * ASCII bytes are folded with the C locale rules, other bytes by tolower(3)
+ * or toupper(3). All the routines are thread-safe.
+ */
+#include <stddef.h>
+#include <stdint.h>
+
+#include "t_config.h"
+
+
+/*
+ * copy len bytes from src to dst, in lower case.
+ *
+ * dst and src may be equal (in place conversion) but should not overlap
+ * otherwise.
+ */
+void	t_casefold_lower(char *dst, const char *src, size_t len);
+
+/*
+ * copy len bytes from src to dst, in upper case, see t_casefold_lower().
+ */
+void	t_casefold_upper(char *dst, const char *src, size_t len);
+
+/*
+ * @return
+ *   1 if the len first bytes of a and b are equal ignoring case, 0 otherwise.
+ */
+int	t_casefold_eq(const char *a, const char *b, size_t len);
+
+/*
+ * compare a and b ignoring case, like strcasecmp(3).
+ *
+ * @return
+ *   an integer greater than, equal to, or less than 0, according as a is
+ *   greater than, equal to, or less than b.
+ */
+int	t_casefold_cmp(const char *a, size_t alen, const char *b, size_t blen);
+
+/*
+ * case insensitive hash.
+ *
+ * @return
+ *   the same hash for all the strings equal according to t_casefold_eq().
+ */
+uint32_t	t_casefold_hash(const char *s, size_t len);
+
+/*
+ * @return
+ *   the name of the implementation in use ("avx2", "sse2" or "swar").
+ */
+const char	*t_casefold_impl(void);
+
+#endif /* ndef T_CASEFOLD_H */
@@ -15,6 +15,7 @@
 #	define	t__unused
 #	define	t__dead2
 #	define	t__deprecated
+#	define	t__thread
 #	define	t__printflike(fmtarg, firstvarg)
 #else
 #	define	t__weak		__attribute__((__weak__))
@@ -22,6 +23,7 @@
 #	define	t__unused	__attribute__((__unused__))
 #	define	t__dead2	__attribute__((__noreturn__))
 #	define	t__deprecated	__attribute__((__deprecated__))
+#	define	t__thread	_Thread_local
 #	define	t__printflike(fmtarg, firstvararg) \
 	    __attribute__((__format__(__printf__, fmtarg, firstvararg)))
 #endif /* lint */
@@ -0,0 +1,215 @@
+/*
+ * t_crc32.c
+ *
+ * CRC-32 as used by the Ogg container.
+ *
+ * The portable implementation is slicing-by-8: eight 256 entries tables
+ * allowing to process eight bytes per iteration with independent lookups.
+ *
+ * On x86 with PCLMULQDQ we fold the data 64 bytes at a time using carry-less
+ * multiplications. Because the Ogg CRC is not reflected, the message is
+ * loaded big-endian so that the first bit is the most significant one and
+ * a 128 bits accumulator A followed by the block B is replaced by
+ *
+ *   (A.hi * (x^(n+64) mod P)) xor (A.lo * (x^n mod P)) xor B
+ *
+ * which has the same remainder modulo P. The remaining 16 bytes accumulator
+ * is then handed to the slicing-by-8 implementation, so we don't need any
+ * Barrett reduction.
+ */
+#include <pthread.h>
+
+#include "t_config.h"
+#include "t_toolkit.h"
+#include "t_crc32.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) && \
+    !defined(lint)
+#	define	T_CRC32_PCLMUL	1
+#	include <immintrin.h>
+#endif
+
+
+#define	T_CRC32_POLY	0x04c11db7U
+
+
+/* the slicing-by-8 tables, t_crc32_table[0] is the classic bytewise table */
+static uint32_t	t_crc32_table[8][256];
+
+#if defined(T_CRC32_PCLMUL)
+/* folding constants, see t_crc32_xpow() */
+static uint64_t	t_crc32_k512[2];
+static uint64_t	t_crc32_k128[2];
+#endif
+
+/* set by t_crc32_init() */
+static uint32_t	(*t_crc32_func)(uint32_t crc, const unsigned char *p, size_t len);
+static const char	*t_crc32_name;
+
+static pthread_once_t	t_crc32_once = PTHREAD_ONCE_INIT;
+
+
+/* setup the tables and pick the implementation, called once */
+static void	t_crc32_init(void);
+static uint32_t	t_crc32_slice8(uint32_t crc, const unsigned char *p,
+		    size_t len);
+#if defined(T_CRC32_PCLMUL)
+static uint32_t	t_crc32_xpow(unsigned int n);
+static uint32_t	t_crc32_pclmul(uint32_t crc, const unsigned char *p,
+		    size_t len);
+#endif
+
+
+uint32_t
+t_crc32_ogg(uint32_t crc, const void *buf, size_t len)
+{
+
+	assert(buf != NULL || len == 0);
+
+	(void)pthread_once(&t_crc32_once, t_crc32_init);
+	return (t_crc32_func(crc, buf, len));
+}
+
+
+const char *
+t_crc32_ogg_impl(void)
+{
+
+	(void)pthread_once(&t_crc32_once, t_crc32_init);
+	return (t_crc32_name);
+}
+
+
+static void
+t_crc32_init(void)
+{
+	uint32_t r;
+	int i, j;
+
+	for (i = 0; i < 256; i++) {
+		r = (uint32_t)i << 24;
+		for (j = 0; j < 8; j++)
+			r = (r & 0x80000000U) ? (r << 1) ^ T_CRC32_POLY : (r << 1);
+		t_crc32_table[0][i] = r;
+	}
+	for (i = 0; i < 256; i++) {
+		r = t_crc32_table[0][i];
+		for (j = 1; j < 8; j++) {
+			r = (r << 8) ^ t_crc32_table[0][r >> 24];
+			t_crc32_table[j][i] = r;
+		}
+	}
+
+	t_crc32_func = t_crc32_slice8;
+	t_crc32_name = "slicing-by-8";
+#if defined(T_CRC32_PCLMUL)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("pclmul") && __builtin_cpu_supports("ssse3")) {
+		t_crc32_k512[0] = t_crc32_xpow(512);
+		t_crc32_k512[1] = t_crc32_xpow(512 + 64);
+		t_crc32_k128[0] = t_crc32_xpow(128);
+		t_crc32_k128[1] = t_crc32_xpow(128 + 64);
+		t_crc32_func = t_crc32_pclmul;
+		t_crc32_name = "pclmul";
+	}
+#endif
+}
+
+
+static uint32_t
+t_crc32_slice8(uint32_t crc, const unsigned char *p, size_t len)
+{
+
+	for (; len >= 8; p += 8, len -= 8) {
+		crc ^= (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 |
+		    (uint32_t)p[2] << 8 | (uint32_t)p[3];
+		crc = t_crc32_table[7][crc >> 24] ^
+		    t_crc32_table[6][(crc >> 16) & 0xff] ^
+		    t_crc32_table[5][(crc >> 8) & 0xff] ^
+		    t_crc32_table[4][crc & 0xff] ^
+		    t_crc32_table[3][p[4]] ^
+		    t_crc32_table[2][p[5]] ^
+		    t_crc32_table[1][p[6]] ^
+		    t_crc32_table[0][p[7]];
+	}
+	for (; len > 0; p++, len--)
+		crc = (crc << 8) ^ t_crc32_table[0][(crc >> 24) ^ *p];
+
+	return (crc);
+}
+
+
+#if defined(T_CRC32_PCLMUL)
+/*
+ * @return
+ *   x^n mod P
+ */
+static uint32_t
+t_crc32_xpow(unsigned int n)
+{
+	uint32_t r = 1;
+
+	while (n-- > 0)
+		r = (r & 0x80000000U) ? (r << 1) ^ T_CRC32_POLY : (r << 1);
+	return (r);
+}
+
+
+__attribute__((__target__("pclmul,ssse3")))
+static inline __m128i
+t_crc32_fold(__m128i a, __m128i k, __m128i b)
+{
+
+	return (_mm_xor_si128(b, _mm_xor_si128(
+	    _mm_clmulepi64_si128(a, k, 0x11),
+	    _mm_clmulepi64_si128(a, k, 0x00))));
+}
+
+
+__attribute__((__target__("pclmul,ssse3")))
+static uint32_t
+t_crc32_pclmul(uint32_t crc, const unsigned char *p, size_t len)
+{
+	unsigned char acc[16];
+	__m128i bswap, k, x0, x1, x2, x3;
+
+	if (len < 64)
+		return (t_crc32_slice8(crc, p, len));
+
+	/* reverse the bytes order so that the first byte is the MSB */
+	bswap = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7,
+	    8, 9, 10, 11, 12, 13, 14, 15);
+#define	LOAD(off) _mm_shuffle_epi8( \
+	    _mm_loadu_si128((const __m128i *)(const void *)(p + (off))), bswap)
+
+	x0 = LOAD(0);
+	x1 = LOAD(16);
+	x2 = LOAD(32);
+	x3 = LOAD(48);
+	/* the initial CRC is xor'ed into the first 32 bits of the message */
+	x0 = _mm_xor_si128(x0, _mm_set_epi32((int)crc, 0, 0, 0));
+	p += 64;
+	len -= 64;
+
+	k = _mm_loadu_si128((const __m128i *)(const void *)t_crc32_k512);
+	for (; len >= 64; p += 64, len -= 64) {
+		x0 = t_crc32_fold(x0, k, LOAD(0));
+		x1 = t_crc32_fold(x1, k, LOAD(16));
+		x2 = t_crc32_fold(x2, k, LOAD(32));
+		x3 = t_crc32_fold(x3, k, LOAD(48));
+	}
+
+	k = _mm_loadu_si128((const __m128i *)(const void *)t_crc32_k128);
+	x0 = t_crc32_fold(x0, k, x1);
+	x0 = t_crc32_fold(x0, k, x2);
+	x0 = t_crc32_fold(x0, k, x3);
+	for (; len >= 16; p += 16, len -= 16)
+		x0 = t_crc32_fold(x0, k, LOAD(0));
+#undef	LOAD
+
+	/* store the accumulator back in message order */
+	_mm_storeu_si128((__m128i *)(void *)acc, _mm_shuffle_epi8(x0, bswap));
+	crc = t_crc32_slice8(0, acc, sizeof(acc));
+	return (t_crc32_slice8(crc, p, len));
+}
+#endif /* T_CRC32_PCLMUL */
@@ -0,0 +1,41 @@
+#ifndef T_CRC32_H
+#define T_CRC32_H
+/*
+ * t_crc32.h
+ *
+ * CRC-32 as used by the Ogg container.
+ */
+#include <stddef.h>
+#include <stdint.h>
+
+#include "t_config.h"
+
+
+/*
+ * Compute the Ogg CRC-32 (polynomial 0x04c11db7, MSB first, initial value 0
+ * and no final xor) of buf.
+ *
+ * A PCLMULQDQ implementation is used when the CPU support it, slicing-by-8
+ * otherwise. This routine is thread-safe.
+ *
+ * @param crc
+ *   The CRC of the previous data, 0 to start a new computation.
+ *
+ * @param buf
+ *   The data, can be NULL if len is zero.
+ *
+ * @param len
+ *   The length of buf.
+ *
+ * @return
+ *   The updated CRC.
+ */
+uint32_t	t_crc32_ogg(uint32_t crc, const void *buf, size_t len);
+
+/*
+ * @return
+ *   the name of the implementation used by t_crc32_ogg().
+ */
+const char	*t_crc32_ogg_impl(void);
+
+#endif /* ndef T_CRC32_H */
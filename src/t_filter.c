@@ -0,0 +1,558 @@
+/*
+ * t_filter.c
+ *
+ * tag predicates for tagutil.
+ *
+ * An expression is compiled once by a recursive descent parser into a small
+ * bytecode program, which is then evaluated for every file. The program has a
+ * single boolean register: tests set it, T_FILTER_NOT flip it and the `and' /
+ * `or' operators are compiled into conditional jumps, so that they short
+ * circuit without any stack.
+ */
+#include <regex.h>
+#include <stdint.h>
+
+#include "t_config.h"
+#include "t_toolkit.h"
+#include "t_key.h"
+#include "t_filter.h"
+
+
+enum t_filter_op {
+	T_FILTER_EXISTS,	/* reg = any tag has key */
+	T_FILTER_EQ,		/* reg = any tag key is equal to val */
+	T_FILTER_MATCH,		/* reg = any tag key match re */
+	T_FILTER_LT,		/* reg = any tag key is less than val */
+	T_FILTER_NOT,		/* reg = !reg */
+	T_FILTER_JZ,		/* if (!reg) goto jump */
+	T_FILTER_JNZ,		/* if (reg) goto jump */
+};
+
+struct t_filter_insn {
+	enum t_filter_op op;
+	const char	*key; /* interned, see t_key_intern() */
+	char		*val;
+	size_t		 vlen;
+	int		 isnum; /* 1 if val is a number (num is then set) */
+	double		 num;
+	regex_t		*re;
+	size_t		 jump; /* index of the target instruction */
+};
+
+struct t_filter {
+	size_t			 count;
+	size_t			 size;
+	struct t_filter_insn	*code;
+};
+
+
+/* the tokens of the expression language */
+enum t_filter_tokkind {
+	T_FILTER_TEOF,
+	T_FILTER_TLPAREN,	/* ( */
+	T_FILTER_TRPAREN,	/* ) */
+	T_FILTER_TEQ,		/* == */
+	T_FILTER_TNE,		/* != */
+	T_FILTER_TMATCH,	/* =~ */
+	T_FILTER_TLT,		/* < */
+	T_FILTER_TWORD,		/* bare word, may be a keyword */
+	T_FILTER_TSTRING,	/* double-quoted string, never a keyword */
+};
+
+struct t_filter_parser {
+	const char	*expr; /* the whole expression, for error messages */
+	const char	*p; /* the next character to read */
+	const char	*tok; /* the current token, for error messages */
+	enum t_filter_tokkind kind; /* the current token */
+	char		*word; /* T_FILTER_TWORD and T_FILTER_TSTRING value */
+	size_t		 wlen;
+	struct t_filter	*filter;
+};
+
+
+/*
+ * read the next token.
+ *
+ * @return
+ *   0 on success, -1 and set errno on error.
+ */
+static int	t_filter_next(struct t_filter_parser *P);
+
+/* 1 if the current token is the bare word kw, 0 otherwise. */
+static int	t_filter_keyword(const struct t_filter_parser *P,
+		    const char *kw);
+
+/*
+ * the recursive descent parser, one routine by grammar rule (see
+ * t_filter_parse()).
+ *
+ * @return
+ *   0 on success, -1 and set errno on error.
+ */
+static int	t_filter_or(struct t_filter_parser *P);
+static int	t_filter_and(struct t_filter_parser *P);
+static int	t_filter_not(struct t_filter_parser *P);
+static int	t_filter_primary(struct t_filter_parser *P);
+
+/*
+ * append an instruction to the program.
+ *
+ * @return
+ *   the new instruction on success, NULL and set errno on error.
+ */
+static struct t_filter_insn	*t_filter_emit(struct t_filter *filter,
+		    enum t_filter_op op);
+
+/* report a syntax error, always return -1 and set errno to EINVAL. */
+static int	t_filter_error(const struct t_filter_parser *P,
+		    const char *msg);
+
+/*
+ * parse s as a number.
+ *
+ * @return
+ *   1 and set *num if the whole s is a number, 0 otherwise.
+ */
+static int	t_filter_number(const char *s, double *num);
+
+/* evaluate a test instruction against tlist. */
+static int	t_filter_test(const struct t_filter_insn *insn,
+		    const struct t_taglist *tlist);
+
+
+struct t_filter *
+t_filter_parse(const char *expr)
+{
+	int success = 0;
+	struct t_filter_parser P;
+
+	assert(expr != NULL);
+
+	P.expr   = expr;
+	P.p      = P.tok = expr;
+	P.word   = NULL;
+	P.filter = calloc(1, sizeof(struct t_filter));
+	if (P.filter == NULL)
+		goto cleanup;
+
+	if (t_filter_next(&P) == -1 || t_filter_or(&P) == -1)
+		goto cleanup;
+	if (P.kind != T_FILTER_TEOF) {
+		(void)t_filter_error(&P, "unexpected token");
+		goto cleanup;
+	}
+
+	/* All went well. */
+	success = 1;
+
+	/* FALLTHROUGH */
+cleanup:
+	free(P.word);
+	if (!success) {
+		assert(errno == EINVAL || errno == ENOMEM);
+		t_filter_delete(P.filter);
+		P.filter = NULL;
+	}
+	return (P.filter);
+}
+
+
+int
+t_filter_match(const struct t_filter *filter, const struct t_taglist *tlist)
+{
+	const struct t_filter_insn *insn;
+	size_t pc;
+	int reg = 0;
+
+	assert(filter != NULL);
+	assert(tlist != NULL);
+
+	pc = 0;
+	while (pc < filter->count) {
+		insn = &filter->code[pc++];
+		switch (insn->op) {
+		case T_FILTER_NOT:
+			reg = !reg;
+			break;
+		case T_FILTER_JZ:
+			if (!reg)
+				pc = insn->jump;
+			break;
+		case T_FILTER_JNZ:
+			if (reg)
+				pc = insn->jump;
+			break;
+		default:
+			reg = t_filter_test(insn, tlist);
+			break;
+		}
+	}
+
+	return (reg);
+}
+
+
+void
+t_filter_delete(struct t_filter *filter)
+{
+	size_t i;
+
+	if (filter == NULL)
+		return;
+
+	for (i = 0; i < filter->count; i++) {
+		free(filter->code[i].val);
+		if (filter->code[i].re != NULL) {
+			regfree(filter->code[i].re);
+			free(filter->code[i].re);
+		}
+	}
+	free(filter->code);
+	free(filter);
+}
+
+
+static int
+t_filter_next(struct t_filter_parser *P)
+{
+	const char *start;
+	char *w;
+
+	assert(P != NULL);
+
+	free(P->word);
+	P->word = NULL;
+
+	while (isspace((unsigned char)*P->p))
+		P->p++;
+
+	start = P->tok = P->p;
+	switch (*P->p) {
+	case '\0':
+		P->kind = T_FILTER_TEOF;
+		return (0);
+	case '(':
+		P->kind = T_FILTER_TLPAREN;
+		P->p++;
+		return (0);
+	case ')':
+		P->kind = T_FILTER_TRPAREN;
+		P->p++;
+		return (0);
+	case '<':
+		P->kind = T_FILTER_TLT;
+		P->p++;
+		return (0);
+	case '=':
+		if (P->p[1] == '=')
+			P->kind = T_FILTER_TEQ;
+		else if (P->p[1] == '~')
+			P->kind = T_FILTER_TMATCH;
+		else
+			return (t_filter_error(P, "expected == or =~"));
+		P->p += 2;
+		return (0);
+	case '!':
+		if (P->p[1] != '=')
+			return (t_filter_error(P, "expected !="));
+		P->kind = T_FILTER_TNE;
+		P->p += 2;
+		return (0);
+	case '"':
+		/* the unescaped string is never longer than the quoted one */
+		P->kind = T_FILTER_TSTRING;
+		P->word = w = malloc(strlen(P->p));
+		if (w == NULL)
+			return (-1);
+		for (P->p++; *P->p != '"'; P->p++) {
+			if (P->p[0] == '\\' &&
+			    (P->p[1] == '"' || P->p[1] == '\\'))
+				P->p++;
+			if (*P->p == '\0') {
+				return (t_filter_error(P,
+				    "unterminated string"));
+			}
+			*w++ = *P->p;
+		}
+		P->p++; /* skip the closing `"' */
+		*w = '\0';
+		P->wlen = w - P->word;
+		return (0);
+	default:
+		P->kind = T_FILTER_TWORD;
+		while (*P->p != '\0' && !isspace((unsigned char)*P->p) &&
+		    strchr("()<=!\"", *P->p) == NULL)
+			P->p++;
+		P->wlen = P->p - start;
+		if ((P->word = malloc(P->wlen + 1)) == NULL)
+			return (-1);
+		(void)memcpy(P->word, start, P->wlen);
+		P->word[P->wlen] = '\0';
+		return (0);
+	}
+	/* NOTREACHED */
+}
+
+
+static int
+t_filter_keyword(const struct t_filter_parser *P, const char *kw)
+{
+
+	assert(P != NULL);
+	assert(kw != NULL);
+
+	return (P->kind == T_FILTER_TWORD && strcmp(P->word, kw) == 0);
+}
+
+
+static int
+t_filter_or(struct t_filter_parser *P)
+{
+	struct t_filter_insn *jnz;
+	size_t at;
+
+	assert(P != NULL);
+
+	if (t_filter_and(P) == -1)
+		return (-1);
+	while (t_filter_keyword(P, "or")) {
+		if (t_filter_next(P) == -1)
+			return (-1);
+		/* the code may be moved by t_filter_emit(), keep an index */
+		if ((jnz = t_filter_emit(P->filter, T_FILTER_JNZ)) == NULL)
+			return (-1);
+		at = jnz - P->filter->code;
+		if (t_filter_and(P) == -1)
+			return (-1);
+		P->filter->code[at].jump = P->filter->count;
+	}
+
+	return (0);
+}
+
+
+static int
+t_filter_and(struct t_filter_parser *P)
+{
+	struct t_filter_insn *jz;
+	size_t at;
+
+	assert(P != NULL);
+
+	if (t_filter_not(P) == -1)
+		return (-1);
+	while (t_filter_keyword(P, "and")) {
+		if (t_filter_next(P) == -1)
+			return (-1);
+		if ((jz = t_filter_emit(P->filter, T_FILTER_JZ)) == NULL)
+			return (-1);
+		at = jz - P->filter->code;
+		if (t_filter_not(P) == -1)
+			return (-1);
+		P->filter->code[at].jump = P->filter->count;
+	}
+
+	return (0);
+}
+
+
+static int
+t_filter_not(struct t_filter_parser *P)
+{
+
+	assert(P != NULL);
+
+	if (!t_filter_keyword(P, "not"))
+		return (t_filter_primary(P));
+
+	if (t_filter_next(P) == -1 || t_filter_not(P) == -1)
+		return (-1);
+	return (t_filter_emit(P->filter, T_FILTER_NOT) == NULL ? -1 : 0);
+}
+
+
+static int
+t_filter_primary(struct t_filter_parser *P)
+{
+	struct t_filter_insn *insn;
+	enum t_filter_tokkind op;
+	const char *key;
+	int exists, error;
+	char errbuf[BUFSIZ];
+
+	assert(P != NULL);
+
+	if (P->kind == T_FILTER_TLPAREN) {
+		if (t_filter_next(P) == -1 || t_filter_or(P) == -1)
+			return (-1);
+		if (P->kind != T_FILTER_TRPAREN)
+			return (t_filter_error(P, "expected )"));
+		return (t_filter_next(P));
+	}
+
+	exists = t_filter_keyword(P, "exists");
+	if (exists && t_filter_next(P) == -1)
+		return (-1);
+	if (P->kind != T_FILTER_TWORD && P->kind != T_FILTER_TSTRING)
+		return (t_filter_error(P, "expected a tag key"));
+	if ((key = t_key_intern(P->word, P->wlen)) == NULL)
+		return (-1);
+	if (t_filter_next(P) == -1)
+		return (-1);
+
+	if (exists) {
+		if ((insn = t_filter_emit(P->filter, T_FILTER_EXISTS)) == NULL)
+			return (-1);
+		insn->key = key;
+		return (0);
+	}
+
+	op = P->kind;
+	switch (op) {
+	case T_FILTER_TEQ: /* FALLTHROUGH */
+	case T_FILTER_TNE:
+		insn = t_filter_emit(P->filter, T_FILTER_EQ);
+		break;
+	case T_FILTER_TMATCH:
+		insn = t_filter_emit(P->filter, T_FILTER_MATCH);
+		break;
+	case T_FILTER_TLT:
+		insn = t_filter_emit(P->filter, T_FILTER_LT);
+		break;
+	default:
+		return (t_filter_error(P, "expected ==, !=, =~ or <"));
+	}
+	if (insn == NULL)
+		return (-1);
+	insn->key = key;
+
+	if (t_filter_next(P) == -1)
+		return (-1);
+	if (P->kind != T_FILTER_TWORD && P->kind != T_FILTER_TSTRING)
+		return (t_filter_error(P, "expected a value"));
+	/* steal the token's value */
+	insn->val  = P->word;
+	insn->vlen = P->wlen;
+	P->word    = NULL;
+	insn->isnum = t_filter_number(insn->val, &insn->num);
+
+	if (op == T_FILTER_TMATCH) {
+		if ((insn->re = malloc(sizeof(regex_t))) == NULL)
+			return (-1);
+		error = regcomp(insn->re, insn->val, REG_EXTENDED | REG_NOSUB);
+		if (error != 0) {
+			(void)regerror(error, insn->re, errbuf, sizeof(errbuf));
+			free(insn->re);
+			insn->re = NULL;
+			warnx("where: %s: %s", insn->val, errbuf);
+			errno = EINVAL;
+			return (-1);
+		}
+	}
+
+	if (t_filter_next(P) == -1)
+		return (-1);
+	if (op == T_FILTER_TNE &&
+	    t_filter_emit(P->filter, T_FILTER_NOT) == NULL)
+		return (-1);
+	return (0);
+}
+
+
+static struct t_filter_insn *
+t_filter_emit(struct t_filter *filter, enum t_filter_op op)
+{
+	struct t_filter_insn *insn;
+	size_t size;
+
+	assert(filter != NULL);
+
+	if (filter->count == filter->size) {
+		size = (filter->size == 0 ? 8 : 2 * filter->size);
+		if (size > SIZE_MAX / sizeof(*insn)) {
+			errno = ENOMEM;
+			return (NULL);
+		}
+		insn = realloc(filter->code, size * sizeof(*insn));
+		if (insn == NULL)
+			return (NULL);
+		filter->code = insn;
+		filter->size = size;
+	}
+
+	insn = &filter->code[filter->count++];
+	(void)memset(insn, 0, sizeof(*insn));
+	insn->op = op;
+	return (insn);
+}
+
+
+static int
+t_filter_error(const struct t_filter_parser *P, const char *msg)
+{
+
+	assert(P != NULL);
+	assert(msg != NULL);
+
+	warnx("where: %s at column %zu: %s", msg,
+	    (size_t)(P->tok - P->expr) + 1, P->expr);
+	errno = EINVAL;
+	return (-1);
+}
+
+
+static int
+t_filter_number(const char *s, double *num)
+{
+	char *end;
+
+	assert(s != NULL);
+	assert(num != NULL);
+
+	if (*s == '\0' || isspace((unsigned char)*s))
+		return (0);
+	errno = 0;
+	*num = strtod(s, &end);
+	return (*end == '\0' && errno == 0);
+}
+
+
+static int
+t_filter_test(const struct t_filter_insn *insn, const struct t_taglist *tlist)
+{
+	const struct t_tag *t;
+	double num;
+
+	assert(insn != NULL);
+	assert(tlist != NULL);
+
+	T_TAGLIST_FOREACH(t, tlist) {
+		if (t->key != insn->key)
+			continue;
+		switch (insn->op) {
+		case T_FILTER_EXISTS:
+			return (1);
+		case T_FILTER_EQ:
+			if (t->vlen == insn->vlen &&
+			    memcmp(t->val, insn->val, t->vlen) == 0)
+				return (1);
+			break;
+		case T_FILTER_MATCH:
+			if (regexec(insn->re, t->val, 0, NULL, 0) == 0)
+				return (1);
+			break;
+		case T_FILTER_LT:
+			if (insn->isnum && t_filter_number(t->val, &num)) {
+				if (num < insn->num)
+					return (1);
+			} else if (strcmp(t->val, insn->val) < 0)
+				return (1);
+			break;
+		default:
+			/* not a test instruction */
+			ABANDON_SHIP();
+		}
+	}
+
+	return (0);
+}
@@ -0,0 +1,58 @@
+#ifndef T_FILTER_H
+#define T_FILTER_H
+/*
+ * t_filter.h
+ *
+ * tag predicates for tagutil.
+ */
+#include "t_config.h"
+#include "t_taglist.h"
+
+
+/* declaration of a compiled filter type */
+struct t_filter;
+
+
+/*
+ * compile a filter expression.
+ *
+ * The expression grammar is:
+ *
+ *   expr    := and ( "or" and )*
+ *   and     := not ( "and" not )*
+ *   not     := "not" not | primary
+ *   primary := "(" expr ")" | "exists" KEY | KEY op VALUE
+ *   op      := "==" | "!=" | "=~" | "<"
+ *
+ * KEY and VALUE are either bare words or double-quoted strings (where \" and
+ * \\ are escapes). A comparison is true when any tag with the key KEY matches
+ * (!= being the negation of ==). =~ use a POSIX extended regex, < compare
+ * numerically when both side are numbers and byte-wise otherwise.
+ *
+ * On error a warning is emitted.
+ *
+ * @return
+ *   the compiled filter on success, NULL and set errno to either EINVAL
+ *   (malformed expression) or ENOMEM on error. The returned value should be
+ *   passed to t_filter_delete() after use.
+ */
+struct t_filter	*t_filter_parse(const char *expr);
+
+/*
+ * evaluate a filter against a tag list.
+ *
+ * A compiled filter is never modified by this routine, so it can be evaluated
+ * by several threads concurrently.
+ *
+ * @return
+ *   1 if tlist match the filter, 0 otherwise.
+ */
+int	t_filter_match(const struct t_filter *filter,
+	    const struct t_taglist *tlist);
+
+/*
+ * free all memory associated with a filter.
+ */
+void	t_filter_delete(struct t_filter *filter);
+
+#endif /* ndef T_FILTER_H */
@@ -9,6 +9,7 @@
 
 #include "t_config.h"
 #include "t_taglist.h"
+#include "t_sink.h"
 
 
 struct t_format {
@@ -32,6 +33,20 @@ struct t_format {
 	 */
 	char	*(*tags2fmt)(const struct t_taglist *tlist, const char *path);
 
+	/*
+	 * like tags2fmt, but write the formated tags into a sink instead of
+	 * returning a string.
+	 *
+	 * @param sink
+	 *   The t_sink receiving the output, cannot be NULL.
+	 *
+	 * @return
+	 *   0 on success, -1 and set errno on error. On error, sink may contain
+	 *   partial output.
+	 */
+	int	(*tags2sink)(struct t_sink *sink, const struct t_taglist *tlist,
+		    const char *path);
+
 	/*
 	 * Parse a format file and create a t_taglist based on its content.
 	 *
@@ -1,11 +1,31 @@
 /*
  * t_ftflac.c
  *
- * FLAC format handler using libFLAC.
+ * FLAC format handler.
+ *
+ * The metadata blocks are read natively from a mmap(2)'d file: we only walk the
+ * blocks headers and parse the VORBIS_COMMENT block in place, so reading tags
+ * only touch the pages holding them (a PICTURE block of several megabytes is
+ * never read) and allocate one t_tag per comment.
+ *
+ * Writing serialize the new VORBIS_COMMENT block once and patch it in place
+ * when it fits in the old one and the PADDING block following it. Otherwise
+ * the file is rewritten using libFLAC, reserving the padding requested by -P
+ * (if any) right after the VORBIS_COMMENT block so that the next writes can be
+ * done in place. The repad action use the same rewrite to normalize the
+ * padding of files whose tags don't change.
  *
  * XXX: error handling could be better since libFLAC has a very good API. For
  * now it's mostly silent.
  */
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <unistd.h>
 
 /* libFLAC headers */
 #include "FLAC/metadata.h"
@@ -17,20 +37,75 @@
 
 static const char libid[] = "libFLAC";
 
+static const struct t_backend_magic magics[] = {
+	{ .offset = 0, .len = 4, .bytes = "fLaC" },
+	{ .len = 0 },
+};
+
+/* METADATA_BLOCK_HEADER, see https://xiph.org/flac/format.html */
+#define	T_FTFLAC_BLOCK_HEADLEN	4
+#define	T_FTFLAC_BLOCK_LAST	0x80
+#define	T_FTFLAC_BLOCK_TYPE	0x7f
+#define	T_FTFLAC_BLOCK_MAXLEN	0xffffff
+
+
+/*
+ * the metadata blocks we care about. Offsets are the ones of the block header,
+ * 0 means that there is no such block.
+ */
+struct t_ftflac_layout {
+	size_t	vcoff;  /* the (first) VORBIS_COMMENT block */
+	size_t	vclen;
+	size_t	padoff; /* the PADDING block right after the VORBIS_COMMENT one
+			   or the first PADDING block if there is no
+			   VORBIS_COMMENT block */
+	size_t	padlen;
+	int	last;   /* 1 if the last of those is the last metadata block */
+};
 
 struct t_ftflac_data {
 	const char		*libid; /* pointer to libid */
-	FLAC__Metadata_Chain	*chain;
-	FLAC__StreamMetadata	*vocomments; /* Vorbis Comments */
+	const char		*path;  /* this is needed for t_ftflac_write() */
+	const unsigned char	*map;   /* the mmap(2)'d file */
+	size_t			 maplen;
+	struct t_ftflac_layout	 layout;
 };
 
 
+/* write outcome counters, see t_ftflac_stats() */
+static atomic_ulong	t_ftflac_ninplace;	/* comments patched in place */
+static atomic_ulong	t_ftflac_nrewrite;	/* files rewritten by libFLAC */
+static atomic_ulong	t_ftflac_nrepad;	/* files rewritten by repad */
+
+
 struct t_backend	*t_ftflac_backend(void);
 
-static void 		*t_ftflac_init(const char *path);
+static void 		*t_ftflac_open(const char *path,
+			     struct t_backend_probe *probe);
 static struct t_taglist	*t_ftflac_read(void *opaque);
 static int		 t_ftflac_write(void *opaque, const struct t_taglist *tlist);
 static void		 t_ftflac_clear(void *opaque);
+static void		 t_ftflac_stats(FILE *fp);
+static int		 t_ftflac_repad(void *opaque, const struct t_padding *pad);
+
+/* helpers for t_ftflac_open() and t_ftflac_read() */
+static int		 t_ftflac_map(struct t_ftflac_data *data, int fd);
+static int		 t_ftflac_walk(const unsigned char *p, size_t len,
+			     struct t_ftflac_layout *layout);
+static size_t		 t_ftflac_skip_id3v2(const unsigned char *p, size_t len);
+/* helpers for t_ftflac_write() */
+static unsigned char	*t_ftflac_vc_encode(const struct t_ftflac_data *data,
+			     const struct t_taglist *tlist, size_t *lenp);
+static int		 t_ftflac_write_inplace(struct t_ftflac_data *data,
+			     const unsigned char *vc, size_t vclen,
+			     const char **whyp);
+static int		 t_ftflac_write_chain(struct t_ftflac_data *data,
+			     const struct t_taglist *tlist,
+			     const struct t_padding *pad);
+static size_t		 t_ftflac_padding(const struct t_ftflac_data *data,
+			     const struct t_padding *pad);
+static uint32_t		 le32dec(const unsigned char *p);
+static void		 le32enc(unsigned char *p, uint32_t u);
 
 struct t_backend *
 t_ftflac_backend(void)
@@ -39,10 +114,13 @@ t_ftflac_backend(void)
 		.libid		= libid,
 		.desc		=
 		    "Free Lossless Audio Codec (FLAC) files format",
-		.init		= t_ftflac_init,
+		.magics		= magics,
+		.open		= t_ftflac_open,
 		.read		= t_ftflac_read,
 		.write		= t_ftflac_write,
 		.clear		= t_ftflac_clear,
+		.stats		= t_ftflac_stats,
+		.repad		= t_ftflac_repad,
 	};
 
 	return (&b);
@@ -50,95 +128,146 @@ t_ftflac_backend(void)
 
 
 static void *
-t_ftflac_init(const char *path)
+t_ftflac_open(const char *path, struct t_backend_probe *probe)
 {
-	FLAC__Metadata_Iterator *it;
 	struct t_ftflac_data *data;
+	size_t plen;
+	char *s;
+	int fd;
 
 	assert(path != NULL);
 
-	data = calloc(1, sizeof(struct t_ftflac_data));
+	plen = strlen(path);
+	data = calloc(1, sizeof(struct t_ftflac_data) + plen + 1);
 	if (data == NULL)
-		goto error0;
+		return (NULL);
 	data->libid = libid;
+	data->path = s = (char *)(data + 1);
+	(void)memcpy(s, path, plen + 1);
 
-	data->chain = FLAC__metadata_chain_new();
-	if (data->chain == NULL)
-		goto error0;
-	if (!FLAC__metadata_chain_read(data->chain, path))
-		goto error1;
+	if ((fd = t_backend_probe_fd(probe, path)) == -1 ||
+	    t_ftflac_map(data, fd) == -1) {
+		free(data);
+		return (NULL);
+	}
 
-	it = FLAC__metadata_iterator_new();
-	if (it == NULL)
-		goto error1;
-	FLAC__metadata_iterator_init(it, data->chain);
+	return (data);
+}
 
-	data->vocomments = NULL;
-	do {
-		if (FLAC__metadata_iterator_get_block_type(it) == FLAC__METADATA_TYPE_VORBIS_COMMENT)
-			data->vocomments = FLAC__metadata_iterator_get_block(it);
-	} while (data->vocomments == NULL && FLAC__metadata_iterator_next(it));
-	if (data->vocomments == NULL) {
-		/* create a new block FLAC__METADATA_TYPE_VORBIS_COMMENT */
-		data->vocomments = FLAC__metadata_object_new(FLAC__METADATA_TYPE_VORBIS_COMMENT);
-		if (data->vocomments == NULL)
-			goto error2;
-		if (!FLAC__metadata_iterator_insert_block_after(it, data->vocomments))
-			goto error3;
+
+/*
+ * mmap(2) the file at data->path and walk its metadata blocks. The previous
+ * mapping (if any) is released first, this is needed once libFLAC has
+ * rewritten the file.
+ *
+ * @param fd
+ *   A read-only descriptor of data->path closed by this routine, or -1 to
+ *   open data->path.
+ *
+ * @return
+ *   0 on success, -1 on error (data->map is then NULL).
+ */
+static int
+t_ftflac_map(struct t_ftflac_data *data, int fd)
+{
+	struct stat st;
+	void *map;
+
+	assert(data != NULL);
+
+	if (data->map != NULL) {
+		(void)munmap((void *)(uintptr_t)data->map, data->maplen);
+		data->map = NULL;
 	}
-	FLAC__metadata_iterator_delete(it);
 
-	return (data);
-	/* NOTREACHED */
-
-error3:
-	FLAC__metadata_object_delete(data->vocomments);
-error2:
-	FLAC__metadata_iterator_delete(it);
-error1:
-	FLAC__metadata_chain_delete(data->chain);
-error0:
-	free(data);
-	return (NULL);
+	if (fd == -1 && (fd = open(data->path, O_RDONLY)) == -1)
+		return (-1);
+	if (fstat(fd, &st) == -1 || st.st_size < 4 ||
+	    (uintmax_t)st.st_size > SIZE_MAX) {
+		(void)close(fd);
+		return (-1);
+	}
+	map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	(void)close(fd);
+	if (map == MAP_FAILED)
+		return (-1);
+	/* we only jump from a block header to the next one */
+	(void)posix_madvise(map, (size_t)st.st_size, POSIX_MADV_RANDOM);
+
+	if (t_ftflac_walk(map, (size_t)st.st_size, &data->layout) == -1) {
+		(void)munmap(map, (size_t)st.st_size);
+		return (-1);
+	}
+	data->map    = map;
+	data->maplen = (size_t)st.st_size;
+	return (0);
 }
 
 
 static struct t_taglist *
 t_ftflac_read(void *opaque)
 {
-	char *field_name  = NULL;
-	char *field_value = NULL;
-	struct t_taglist   *tlist = NULL;
+	struct t_taglist *tlist = NULL;
 	struct t_ftflac_data *data;
-	FLAC__StreamMetadata_VorbisComment_Entry e;
-	uint32_t i;
+	const unsigned char *p, *eq;
+	size_t len, clen;
+	uint32_t i, count;
 
 	assert(opaque != NULL);
 	data = opaque;
 	assert(data->libid == libid);
 
+	if (data->map == NULL)
+		return (NULL);
 	if ((tlist = t_taglist_new()) == NULL)
 		return (NULL);
-
-	for (i = 0; i < data->vocomments->data.vorbis_comment.num_comments; i++) {
-		e = data->vocomments->data.vorbis_comment.comments[i];
-		if (!FLAC__metadata_object_vorbiscomment_entry_to_name_value_pair(e,
-		    &field_name, &field_value))
+	/* no VORBIS_COMMENT block, no tags */
+	if (data->layout.vcoff == 0)
+		return (tlist);
+
+	/*
+	 * The Vorbis Comment (without the framing bit) is the vendor string and
+	 * the comment count, then each comment. Lengths are 32 bits little
+	 * endian and the strings are not NUL-terminated.
+	 */
+	p   = data->map + data->layout.vcoff + T_FTFLAC_BLOCK_HEADLEN;
+	len = data->layout.vclen;
+	if (len < 4 || len - 4 < le32dec(p))
+		goto invalid;
+	len -= 4 + le32dec(p);
+	p   += 4 + le32dec(p);
+	if (len < 4)
+		goto invalid;
+	count = le32dec(p);
+	p   += 4;
+	len -= 4;
+
+	for (i = 0; i < count; i++) {
+		if (len < 4 || len - 4 < le32dec(p))
+			goto invalid;
+		clen = le32dec(p);
+		p   += 4;
+		len -= 4;
+
+		eq = memchr(p, '=', clen);
+		if (eq == NULL) {
+			warnx("%s: invalid vorbis comment: %.*s", data->path,
+			    (int)clen, (const char *)p);
+		} else if (t_taglist_insert_len(tlist, (const char *)p,
+		    (size_t)(eq - p), (const char *)(eq + 1),
+		    clen - (size_t)(eq - p) - 1) == -1) {
 			goto error;
-		if ((t_taglist_insert(tlist, field_name, field_value)) == -1)
-			goto error;
-		free(field_name);
-		free(field_value);
-		field_name  = NULL;
-		field_value = NULL;
+		}
+		p   += clen;
+		len -= clen;
 	}
 
 	return (tlist);
-	/* NOTREACHED */
+invalid:
+	warnx("%s: invalid VORBIS_COMMENT block", data->path);
+	/* FALLTHROUGH */
 error:
 	t_taglist_delete(tlist);
-	free(field_name);
-	free(field_value);
 	return (NULL);
 }
 
@@ -147,38 +276,372 @@ static int
 t_ftflac_write(void *opaque, const struct t_taglist *tlist)
 {
 	struct t_ftflac_data *data;
-	struct t_tag *t;
-	FLAC__StreamMetadata_VorbisComment_Entry e;
+	unsigned char *vc;
+	const char *why;
+	size_t vclen;
+	int ret;
+	extern int vflag;
+	extern const struct t_padding *Pflag;
 
 	assert(opaque != NULL);
 	data = opaque;
 	assert(data->libid == libid);
 
-	/* clear all the tags */
-	while (data->vocomments->data.vorbis_comment.num_comments > 0) {
-		if (!FLAC__metadata_object_vorbiscomment_delete_comment(data->vocomments, 0))
-			return (-1);
+	if (data->map == NULL)
+		return (-1);
+	if ((vc = t_ftflac_vc_encode(data, tlist, &vclen)) == NULL)
+		return (-1);
+	ret = t_ftflac_write_inplace(data, vc, vclen, &why);
+	free(vc);
+
+	if (ret == 0) {
+		atomic_fetch_add(&t_ftflac_ninplace, 1);
+		if (vflag) {
+			(void)fprintf(stderr, "%s: %s: comments written in place\n",
+			    getprogname(), data->path);
+		}
+	} else if (why != NULL) {
+		/* it didn't fit, rewrite the whole file */
+		ret = t_ftflac_write_chain(data, tlist, Pflag);
+		if (ret == 0)
+			atomic_fetch_add(&t_ftflac_nrewrite, 1);
+		if (vflag) {
+			(void)fprintf(stderr, "%s: %s: %s, %s\n", getprogname(),
+			    data->path, why,
+			    ret == 0 ? "file rewritten" : "rewrite failed");
+		}
 	}
 
-	/* load the tlist */
-	TAILQ_FOREACH(t, tlist->tags, entries) {
-		if (!FLAC__metadata_object_vorbiscomment_entry_from_name_value_pair(&e, t->key, t->val))
-			return (-1);
-		if(!FLAC__metadata_object_vorbiscomment_append_comment(data->vocomments, e, /* copy */false)) {
-			free(e.entry);
-			return (-1);
-		}
+	return (ret);
+}
+
+
+/*
+ * Serialize the VORBIS_COMMENT block data (without the block header) for tlist.
+ * The vendor string of the current block (if any) is kept.
+ *
+ * @param lenp
+ *   Set to the length of the returned buffer.
+ *
+ * @return
+ *   A buffer that should be passed to free(3) after use, or NULL on error.
+ */
+static unsigned char *
+t_ftflac_vc_encode(const struct t_ftflac_data *data,
+    const struct t_taglist *tlist, size_t *lenp)
+{
+	const struct t_tag *t;
+	const unsigned char *vendor = NULL;
+	unsigned char *buf, *p;
+	size_t len, vendorlen = 0;
+
+	assert(data != NULL);
+	assert(tlist != NULL);
+	assert(lenp != NULL);
+
+	if (data->layout.vcoff != 0 && data->layout.vclen >= 4) {
+		vendor = data->map + data->layout.vcoff + T_FTFLAC_BLOCK_HEADLEN;
+		vendorlen = le32dec(vendor);
+		if (vendorlen > data->layout.vclen - 4)
+			vendorlen = 0;
+		vendor += 4;
 	}
 
-	/* do the write */
-	FLAC__metadata_chain_sort_padding(data->chain);
-	if (!FLAC__metadata_chain_write(data->chain, /* padding */true, /* preserve_file_stats */false))
+	len = 4 + vendorlen + 4;
+	T_TAGLIST_FOREACH(t, tlist)
+		len += 4 + t->klen + 1 + t->vlen;
+	if (len > T_FTFLAC_BLOCK_MAXLEN || tlist->count > UINT32_MAX) {
+		warnx("%s: too many comments", data->path);
+		return (NULL);
+	}
+
+	if ((buf = malloc(len)) == NULL)
+		return (NULL);
+	p = buf;
+	le32enc(p, (uint32_t)vendorlen);
+	if (vendorlen > 0)
+		(void)memcpy(p + 4, vendor, vendorlen);
+	p += 4 + vendorlen;
+	le32enc(p, (uint32_t)tlist->count);
+	p += 4;
+	T_TAGLIST_FOREACH(t, tlist) {
+		le32enc(p, (uint32_t)(t->klen + 1 + t->vlen));
+		p += 4;
+		(void)memcpy(p, t->key, t->klen);
+		p += t->klen;
+		*p++ = '=';
+		(void)memcpy(p, t->val, t->vlen);
+		p += t->vlen;
+	}
+	assert((size_t)(p - buf) == len);
+
+	*lenp = len;
+	return (buf);
+}
+
+
+/*
+ * Write the VORBIS_COMMENT block data vc into the space used by the current
+ * VORBIS_COMMENT block and the PADDING block following it, with a single
+ * pwrite(2). What is left (if any) become the new PADDING block.
+ *
+ * @param whyp
+ *   On failure, set to the reason why the block could not be written in place
+ *   or NULL on I/O error.
+ *
+ * @return
+ *   0 on success, -1 on failure.
+ */
+static int
+t_ftflac_write_inplace(struct t_ftflac_data *data, const unsigned char *vc,
+    size_t vclen, const char **whyp)
+{
+	const struct t_ftflac_layout *l;
+	unsigned char *buf;
+	size_t start, end, need, rest, wlen;
+	ssize_t n;
+	int fd;
+
+	assert(data != NULL);
+	assert(vc != NULL);
+	assert(whyp != NULL);
+	l = &data->layout;
+
+	*whyp = NULL;
+	if (l->vcoff == 0 && l->padoff == 0) {
+		*whyp = "no VORBIS_COMMENT nor PADDING block";
+		return (-1);
+	}
+	start = (l->vcoff != 0 ? l->vcoff : l->padoff);
+	end   = (l->padoff != 0 ? l->padoff + T_FTFLAC_BLOCK_HEADLEN + l->padlen :
+	    l->vcoff + T_FTFLAC_BLOCK_HEADLEN + l->vclen);
+	need  = T_FTFLAC_BLOCK_HEADLEN + vclen;
+	/* what is left must be either nothing or a whole PADDING block */
+	if (end - start < need ||
+	    (end - start > need && end - start - need < T_FTFLAC_BLOCK_HEADLEN) ||
+	    (end - start > need &&
+	    end - start - need - T_FTFLAC_BLOCK_HEADLEN > T_FTFLAC_BLOCK_MAXLEN)) {
+		*whyp = "not enough padding";
+		return (-1);
+	}
+	rest = end - start - need;
+
+	/*
+	 * write the new blocks headers and data, and zero what was the old
+	 * VORBIS_COMMENT data and PADDING header so that the padding is clean.
+	 */
+	wlen = need + (rest > 0 ? T_FTFLAC_BLOCK_HEADLEN : 0);
+	if (l->padoff != 0 && wlen < l->padoff + T_FTFLAC_BLOCK_HEADLEN - start)
+		wlen = l->padoff + T_FTFLAC_BLOCK_HEADLEN - start;
+	else if (l->vcoff != 0 && wlen < T_FTFLAC_BLOCK_HEADLEN + l->vclen)
+		wlen = T_FTFLAC_BLOCK_HEADLEN + l->vclen;
+	if ((buf = calloc(1, wlen)) == NULL)
 		return (-1);
+	buf[0] = FLAC__METADATA_TYPE_VORBIS_COMMENT |
+	    (l->last && rest == 0 ? T_FTFLAC_BLOCK_LAST : 0);
+	buf[1] = (unsigned char)((vclen >> 16) & 0xff);
+	buf[2] = (unsigned char)((vclen >> 8) & 0xff);
+	buf[3] = (unsigned char)(vclen & 0xff);
+	(void)memcpy(buf + T_FTFLAC_BLOCK_HEADLEN, vc, vclen);
+	if (rest > 0) {
+		rest -= T_FTFLAC_BLOCK_HEADLEN;
+		buf[need + 0] = FLAC__METADATA_TYPE_PADDING |
+		    (l->last ? T_FTFLAC_BLOCK_LAST : 0);
+		buf[need + 1] = (unsigned char)((rest >> 16) & 0xff);
+		buf[need + 2] = (unsigned char)((rest >> 8) & 0xff);
+		buf[need + 3] = (unsigned char)(rest & 0xff);
+	}
 
+	n = -1;
+	if ((fd = open(data->path, O_WRONLY)) != -1) {
+		n = pwrite(fd, buf, wlen, (off_t)start);
+		if (close(fd) == -1)
+			n = -1;
+	}
+	free(buf);
+	if (n != (ssize_t)wlen)
+		return (-1);
+
+	/* the mapping is shared, so it reflect the new layout */
+	(void)t_ftflac_walk(data->map, data->maplen, &data->layout);
 	return (0);
 }
 
 
+/*
+ * Write tlist using libFLAC, which will rewrite the whole file.
+ *
+ * @param tlist
+ *   The tags to write, or NULL to keep the current ones.
+ *
+ * @param pad
+ *   The padding to reserve right after the VORBIS_COMMENT block, or NULL to
+ *   let libFLAC use (or add) whatever padding it see fit.
+ *
+ * @return
+ *   0 on success, -1 on error.
+ */
+static int
+t_ftflac_write_chain(struct t_ftflac_data *data, const struct t_taglist *tlist,
+    const struct t_padding *pad)
+{
+	FLAC__Metadata_Chain *chain = NULL;
+	FLAC__Metadata_Iterator *it = NULL;
+	FLAC__StreamMetadata *vocomments = NULL, *padding;
+	struct t_tag *t;
+	FLAC__StreamMetadata_VorbisComment_Entry e;
+	size_t padlen = 0;
+	int success = 0;
+
+	assert(data != NULL);
+
+	/* computed now, as it depend on the current layout */
+	if (pad != NULL)
+		padlen = t_ftflac_padding(data, pad);
+
+	if ((chain = FLAC__metadata_chain_new()) == NULL)
+		goto cleanup_label;
+	if (!FLAC__metadata_chain_read(chain, data->path))
+		goto cleanup_label;
+	if ((it = FLAC__metadata_iterator_new()) == NULL)
+		goto cleanup_label;
+	FLAC__metadata_iterator_init(it, chain);
+
+	do {
+		if (FLAC__metadata_iterator_get_block_type(it) == FLAC__METADATA_TYPE_VORBIS_COMMENT)
+			vocomments = FLAC__metadata_iterator_get_block(it);
+	} while (vocomments == NULL && FLAC__metadata_iterator_next(it));
+	if (vocomments == NULL) {
+		/* create a new block FLAC__METADATA_TYPE_VORBIS_COMMENT */
+		vocomments = FLAC__metadata_object_new(FLAC__METADATA_TYPE_VORBIS_COMMENT);
+		if (vocomments == NULL)
+			goto cleanup_label;
+		if (!FLAC__metadata_iterator_insert_block_after(it, vocomments)) {
+			FLAC__metadata_object_delete(vocomments);
+			goto cleanup_label;
+		}
+	}
+
+	if (tlist != NULL) {
+		/* clear all the tags at once */
+		if (!FLAC__metadata_object_vorbiscomment_resize_comments(vocomments, 0))
+			goto cleanup_label;
+
+		/* load the tlist */
+		T_TAGLIST_FOREACH(t, tlist) {
+			if (!FLAC__metadata_object_vorbiscomment_entry_from_name_value_pair(&e, t->key, t->val))
+				goto cleanup_label;
+			if(!FLAC__metadata_object_vorbiscomment_append_comment(vocomments, e, /* copy */false)) {
+				free(e.entry);
+				goto cleanup_label;
+			}
+		}
+	}
+
+	if (pad == NULL) {
+		/* do the write */
+		FLAC__metadata_chain_sort_padding(chain);
+		if (!FLAC__metadata_chain_write(chain, /* padding */true, /* preserve_file_stats */false))
+			goto cleanup_label;
+	} else {
+		/* drop every PADDING block */
+		FLAC__metadata_iterator_init(it, chain);
+		do {
+			if (FLAC__metadata_iterator_get_block_type(it) == FLAC__METADATA_TYPE_PADDING &&
+			    !FLAC__metadata_iterator_delete_block(it, /* replace_with_padding */false))
+				goto cleanup_label;
+		} while (FLAC__metadata_iterator_next(it));
+		/* and add one of the requested size after the comments */
+		if (padlen > 0) {
+			FLAC__metadata_iterator_init(it, chain);
+			while (FLAC__metadata_iterator_get_block(it) != vocomments)
+				(void)FLAC__metadata_iterator_next(it);
+			padding = FLAC__metadata_object_new(FLAC__METADATA_TYPE_PADDING);
+			if (padding == NULL)
+				goto cleanup_label;
+			padding->length = (unsigned)padlen;
+			if (!FLAC__metadata_iterator_insert_block_after(it, padding)) {
+				FLAC__metadata_object_delete(padding);
+				goto cleanup_label;
+			}
+		}
+		if (!FLAC__metadata_chain_write(chain, /* padding */false, /* preserve_file_stats */false))
+			goto cleanup_label;
+	}
+
+	success = 1;
+	/* FALLTHROUGH */
+cleanup_label:
+	if (it != NULL)
+		FLAC__metadata_iterator_delete(it);
+	if (chain != NULL)
+		FLAC__metadata_chain_delete(chain);
+	/* libFLAC may have replaced the file, our mapping would be stale */
+	if (success && t_ftflac_map(data, -1) == -1) {
+		warnx("%s: could not read the file back", data->path);
+		success = 0;
+	}
+	return (success ? 0 : -1);
+}
+
+
+/*
+ * @return
+ *   the PADDING block length to reserve for pad. A percentage is relative to the
+ *   file size without its current padding.
+ */
+static size_t
+t_ftflac_padding(const struct t_ftflac_data *data, const struct t_padding *pad)
+{
+	size_t size;
+
+	assert(data != NULL);
+	assert(pad  != NULL);
+
+	size = data->maplen;
+	if (data->layout.padoff != 0)
+		size -= T_FTFLAC_BLOCK_HEADLEN + data->layout.padlen;
+
+	return (t_backend_padding_size(pad, (off_t)size, T_FTFLAC_BLOCK_MAXLEN));
+}
+
+
+static int
+t_ftflac_repad(void *opaque, const struct t_padding *pad)
+{
+	struct t_ftflac_data *data;
+	const struct t_ftflac_layout *l;
+	size_t padlen;
+	int ret;
+	extern int vflag;
+
+	assert(opaque != NULL);
+	assert(pad != NULL);
+	data = opaque;
+	assert(data->libid == libid);
+
+	if (data->map == NULL)
+		return (-1);
+	l = &data->layout;
+	padlen = t_ftflac_padding(data, pad);
+
+	/* already padded as requested, don't rewrite the file */
+	if (l->vcoff != 0 && (padlen == 0 ? l->padoff == 0 :
+	    (l->padoff != 0 && l->padlen == padlen)))
+		return (0);
+
+	if ((ret = t_ftflac_write_chain(data, NULL, pad)) == 0)
+		atomic_fetch_add(&t_ftflac_nrepad, 1);
+	if (vflag) {
+		(void)fprintf(stderr, "%s: %s: padding set to %zu bytes, %s\n",
+		    getprogname(), data->path, padlen,
+		    ret == 0 ? "file rewritten" : "rewrite failed");
+	}
+
+	return (ret);
+}
+
+
 static void
 t_ftflac_clear(void *opaque)
 {
@@ -188,6 +651,125 @@ t_ftflac_clear(void *opaque)
 	data = opaque;
 	assert(data->libid == libid);
 
-	FLAC__metadata_chain_delete(data->chain);
+	if (data->map != NULL)
+		(void)munmap((void *)(uintptr_t)data->map, data->maplen);
 	free(data);
 }
+
+
+static void
+t_ftflac_stats(FILE *fp)
+{
+
+	assert(fp != NULL);
+
+	(void)fprintf(fp, "%s: FLAC writes: %lu in place, %lu rewritten, "
+	    "%lu repadded\n", getprogname(), atomic_load(&t_ftflac_ninplace),
+	    atomic_load(&t_ftflac_nrewrite), atomic_load(&t_ftflac_nrepad));
+}
+
+
+/*
+ * walk the metadata blocks headers of the FLAC file p to fill layout.
+ *
+ * @return
+ *   0 on success, -1 if p is not a valid FLAC file.
+ */
+static int
+t_ftflac_walk(const unsigned char *p, size_t len, struct t_ftflac_layout *layout)
+{
+	size_t off, blen, firstpad = 0, firstpadlen = 0;
+	int type, last, prev = -1, vclast = 0, padlast = 0;
+
+	assert(p != NULL);
+	assert(layout != NULL);
+
+	bzero(layout, sizeof(struct t_ftflac_layout));
+	off = t_ftflac_skip_id3v2(p, len);
+	if (len - off < 4 || memcmp(p + off, "fLaC", 4) != 0)
+		return (-1);
+	off += 4;
+
+	do {
+		if (len - off < T_FTFLAC_BLOCK_HEADLEN)
+			return (-1);
+		last = p[off] & T_FTFLAC_BLOCK_LAST;
+		type = p[off] & T_FTFLAC_BLOCK_TYPE;
+		blen = (size_t)p[off + 1] << 16 | (size_t)p[off + 2] << 8 |
+		    (size_t)p[off + 3];
+		if (len - off - T_FTFLAC_BLOCK_HEADLEN < blen ||
+		    type == T_FTFLAC_BLOCK_TYPE)
+			return (-1);
+		if (type == FLAC__METADATA_TYPE_VORBIS_COMMENT &&
+		    layout->vcoff == 0) {
+			layout->vcoff = off;
+			layout->vclen = blen;
+			vclast = (last != 0);
+		} else if (type == FLAC__METADATA_TYPE_PADDING) {
+			if (prev == FLAC__METADATA_TYPE_VORBIS_COMMENT &&
+			    layout->vcoff != 0 && layout->padoff == 0) {
+				layout->padoff = off;
+				layout->padlen = blen;
+				padlast = (last != 0);
+			}
+			if (firstpad == 0) {
+				firstpad    = off;
+				firstpadlen = blen;
+				if (layout->vcoff == 0)
+					padlast = (last != 0);
+			}
+		}
+		/* don't mistake a later PADDING block as adjacent */
+		prev = (off == layout->vcoff ? type : -1);
+		off += T_FTFLAC_BLOCK_HEADLEN + blen;
+	} while (!last);
+
+	if (layout->vcoff == 0) {
+		layout->padoff = firstpad;
+		layout->padlen = firstpadlen;
+	}
+	layout->last = (layout->padoff != 0 ? padlast : vclast);
+	return (0);
+}
+
+
+/*
+ * @return
+ *   the length of the ID3v2 tag at the beginning of p (if any), 0 otherwise.
+ */
+static size_t
+t_ftflac_skip_id3v2(const unsigned char *p, size_t len)
+{
+	size_t tlen;
+
+	assert(p != NULL);
+
+	if (len < 10 || memcmp(p, "ID3", 3) != 0 ||
+	    ((p[6] | p[7] | p[8] | p[9]) & 0x80))
+		return (0);
+	/* syncsafe integer, add the header and the footer if any */
+	tlen = (size_t)p[6] << 21 | (size_t)p[7] << 14 | (size_t)p[8] << 7 |
+	    (size_t)p[9];
+	tlen += 10 + ((p[5] & 0x10) ? 10 : 0);
+	return (tlen > len ? 0 : tlen);
+}
+
+
+static uint32_t
+le32dec(const unsigned char *p)
+{
+
+	return ((uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 |
+	    (uint32_t)p[3] << 24);
+}
+
+
+static void
+le32enc(unsigned char *p, uint32_t u)
+{
+
+	p[0] = (unsigned char)(u & 0xff);
+	p[1] = (unsigned char)((u >> 8) & 0xff);
+	p[2] = (unsigned char)((u >> 16) & 0xff);
+	p[3] = (unsigned char)((u >> 24) & 0xff);
+}
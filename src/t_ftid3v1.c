@@ -2,165 +2,30 @@
  * t_ftid3v1.c
  *
  * ID3v1 backend.
+ *
+ * The head and the 128 bytes tail of the file are already in the probe given
+ * to t_ftid3v1_open(), so reading the tag does not need any I/O. The file is
+ * only opened (read-write) by t_ftid3v1_write() and the tag is written with a
+ * single pwrite(2), either over the old tag or at the end of the file, so that
+ * reading tags has no side effect (like an inotify IN_CLOSE_WRITE event).
  */
-#include <stdio.h>
+#include <sys/types.h>
+
+#include <fcntl.h>
 #include <limits.h>
+#include <unistd.h>
 
 #include "t_config.h"
 #include "t_backend.h"
+#include "t_id3genre.h"
 
 
 static const char libid[] = "ID3v1";
 
-static const char * const id3v1_genre_str[] = {
-      [0] = "Blues",
-      [1] = "Classic Rock",
-      [2] = "Country",
-      [3] = "Dance",
-      [4] = "Disco",
-      [5] = "Funk",
-      [6] = "Grunge",
-      [7] = "Hip-Hop",
-      [8] = "Jazz",
-      [9] = "Metal",
-     [10] = "New Age",
-     [11] = "Oldies",
-     [12] = "Other",
-     [13] = "Pop",
-     [14] = "R&B",
-     [15] = "Rap",
-     [16] = "Reggae",
-     [17] = "Rock",
-     [18] = "Techno",
-     [19] = "Industrial",
-     [20] = "Alternative",
-     [21] = "Ska",
-     [22] = "Death Metal",
-     [23] = "Pranks",
-     [24] = "Soundtrack",
-     [25] = "Euro-Techno",
-     [26] = "Ambient",
-     [27] = "Trip-Hop",
-     [28] = "Vocal",
-     [29] = "Jazz+Funk",
-     [30] = "Fusion",
-     [31] = "Trance",
-     [32] = "Classical",
-     [33] = "Instrumental",
-     [34] = "Acid",
-     [35] = "House",
-     [36] = "Game",
-     [37] = "Sound Clip",
-     [38] = "Gospel",
-     [39] = "Noise",
-     [40] = "AlternRock",
-     [41] = "Bass",
-     [42] = "Soul",
-     [43] = "Punk",
-     [44] = "Space",
-     [45] = "Meditative",
-     [46] = "Instrumental Pop",
-     [47] = "Instrumental Rock",
-     [48] = "Ethnic",
-     [49] = "Gothic",
-     [50] = "Darkwave",
-     [51] = "Techno-Industrial",
-     [52] = "Electronic",
-     [53] = "Pop-Folk",
-     [54] = "Eurodance",
-     [55] = "Dream",
-     [56] = "Southern Rock",
-     [57] = "Comedy",
-     [58] = "Cult",
-     [59] = "Gangsta",
-     [60] = "Top 40",
-     [61] = "Christian Rap",
-     [62] = "Pop/Funk",
-     [63] = "Jungle",
-     [64] = "Native American",
-     [65] = "Cabaret",
-     [66] = "New Wave",
-     [67] = "Psychadelic", /* gloup */
-     [68] = "Rave",
-     [69] = "Showtunes",
-     [70] = "Trailer",
-     [71] = "Lo-Fi",
-     [72] = "Tribal",
-     [73] = "Acid Punk",
-     [74] = "Acid Jazz",
-     [75] = "Polka",
-     [76] = "Retro",
-     [77] = "Musical",
-     [78] = "Rock & Roll",
-     [79] = "Hard Rock",
-     [80] = "Folk",
-     [81] = "Folk-Rock",
-     [82] = "National Folk",
-     [83] = "Swing",
-     [84] = "Fast Fusion",
-     [85] = "Bebob",
-     [86] = "Latin",
-     [87] = "Revival",
-     [88] = "Celtic",
-     [89] = "Bluegrass",
-     [90] = "Avantgarde",
-     [91] = "Gothic Rock",
-     [92] = "Progressive Rock",
-     [93] = "Psychedelic Rock",
-     [94] = "Symphonic Rock",
-     [95] = "Slow Rock",
-     [96] = "Big Band",
-     [97] = "Chorus",
-     [98] = "Easy Listening",
-     [99] = "Acoustic",
-    [100] = "Humour",
-    [101] = "Speech",
-    [102] = "Chanson",
-    [103] = "Opera",
-    [104] = "Chamber Music",
-    [105] = "Sonata",
-    [106] = "Symphony",
-    [107] = "Booty Bass",
-    [108] = "Primus",
-    [109] = "Porn Groove",
-    [110] = "Satire",
-    [111] = "Slow Jam",
-    [112] = "Club",
-    [113] = "Tango",
-    [114] = "Samba",
-    [115] = "Folklore",
-    [116] = "Ballad",
-    [117] = "Power Ballad",
-    [118] = "Rhythmic Soul",
-    [119] = "Freestyle",
-    [120] = "Duet",
-    [121] = "Punk Rock",
-    [122] = "Drum Solo",
-    [123] = "A capella",
-    [124] = "Euro-House",
-    [125] = "Dance Hall",
-    [126] = "Goa",
-    [127] = "Drum & Bass",
-    [128] = "Club-House",
-    [129] = "Hardcore",
-    [130] = "Terror",
-    [131] = "Indie",
-    [132] = "BritPop",
-    [133] = "Negerpunk",
-    [134] = "Polsk Punk",
-    [135] = "Beat",
-    [136] = "Christian Gangsta",
-    [137] = "Heavy Metal",
-    [138] = "Black Metal",
-    [139] = "Crossover",
-    [140] = "Contemporary Christian",
-    [141] = "Christian Rock",
-    [142] = "Merengue",
-    [143] = "Salsa",
-    [144] = "Thrash Metal",
-    [145] = "Anime",
-    [146] = "JPop",
-    [147] = "SynthPop",
+static const struct t_backend_magic magics[] = {
+	/* see t_ftid3v1_open() */
+	{ .offset = 0, .len = 2, .bytes = "\xFF\xFB" },
+	{ .len = 0 },
 };
 
 
@@ -185,15 +50,18 @@ struct id3v1_tag {
 
 struct t_ftid3v1_data {
 	const char	*libid; /* pointer to libid */
-	const char	*path;  /* this is needed for t_ftid3v1_write() */
+	const char	*path;
+	int		 fd;    /* -1 until t_ftid3v1_write() */
+	off_t		 size;  /* the file size */
 	int		 id3;   /* 1 if id3 tag is already present in the file, 0 otherwise */
-	FILE		*fp;    /* read-only file pointer */
+	struct id3v1_tag tag;   /* the file's tag, valid if id3 is set */
 };
 
 
 struct t_backend	*t_ftid3v1_backend(void);
 
-static void 		*t_ftid3v1_init(const char *path);
+static void 		*t_ftid3v1_open(const char *path,
+			     struct t_backend_probe *probe);
 static struct t_taglist	*t_ftid3v1_read(void *opaque);
 static int		 t_ftid3v1_write(void *opaque, const struct t_taglist *tlist);
 static void		 t_ftid3v1_clear(void *opaque);
@@ -210,7 +78,8 @@ t_ftid3v1_backend(void)
 	static struct t_backend b = {
 		.libid		= libid,
 		.desc		= "ID3v1.1 tag (only used by \"old\" mp3 files)",
-		.init		= t_ftid3v1_init,
+		.magics		= magics,
+		.open		= t_ftid3v1_open,
 		.read		= t_ftid3v1_read,
 		.write		= t_ftid3v1_write,
 		.clear		= t_ftid3v1_clear,
@@ -221,77 +90,72 @@ t_ftid3v1_backend(void)
 
 
 static void *
-t_ftid3v1_init(const char *path)
+t_ftid3v1_open(const char *path, struct t_backend_probe *probe)
 {
-	unsigned char magic[3];
-	char *p;
+	struct t_backend_probe p;
+	const unsigned char *head;
+	char *s;
 	struct t_ftid3v1_data *data = NULL;
-	FILE *fp = NULL;
 	size_t plen;
 
 	assert(path != NULL);
 
+	if (probe == NULL) {
+		/* the tune could not probe the file, try again here */
+		if (t_backend_probe_read(&p, path) == -1)
+			return (NULL);
+		t_backend_probe_close(&p);
+		probe = &p;
+	}
+	if (probe->size < (off_t)sizeof(struct id3v1_tag) ||
+	    probe->taillen != sizeof(struct id3v1_tag))
+		return (NULL);
+
+	head = probe->head;
+	/* check that we don't handle a file with ID3v2 tags. */
+	if (head[0] == 'I' &&
+	    head[1] == 'D' &&
+	    head[2] == '3') {
+		return (NULL);
+	/* check that the file looks like mp3 */
+	} else if (!(head[0] == 0xFF && head[1] == 0xFB)) {
+		return (NULL);
+	}
+
 	plen = strlen(path);
 	data = malloc(sizeof(struct t_ftid3v1_data) + plen + 1);
 	if (data == NULL)
-		goto error_label;
+		return (NULL);
 	data->libid = libid;
-	data->path = p = (char *)(data + 1);
-	(void)memcpy(p, path, plen + 1);
-
-	if ((data->fp = fp = fopen(data->path, "r")) == NULL)
-		goto error_label;
-	/* go to the end of the file minus the ID3v1 metadata (128 bytes) */
-	if (fseek(fp, -(sizeof(struct id3v1_tag)), SEEK_END) != 0)
-		goto error_label;
-	/* read the start of the ID3v1 metadata, where the magic is supposed to
-	   be */
-	if (fread(&magic, sizeof(char), NELEM(magic), fp) != NELEM(magic))
-		goto error_label;
+	data->path = s = (char *)(data + 1);
+	(void)memcpy(s, path, plen + 1);
+	data->fd   = -1;
+	data->size = probe->size;
+
+	/* the ID3v1 metadata (last 128 bytes) */
+	assert(T_BACKEND_TAILLEN >= sizeof(struct id3v1_tag));
+	(void)memcpy(&data->tag, probe->tail, sizeof(struct id3v1_tag));
 	/* check if the magic bytes match a ID3v1 header */
 	data->id3 = (
-	    magic[0] == 'T' &&
-	    magic[1] == 'A' &&
-	    magic[2] == 'G' ?
+	    data->tag.magic[0] == 'T' &&
+	    data->tag.magic[1] == 'A' &&
+	    data->tag.magic[2] == 'G' ?
 	    1 : 0
 	);
 
-	/* go the the very beginning of the file */
-	if (fseek(fp, 0L, SEEK_SET) != 0)
-		goto error_label;
-	if (fread(&magic, sizeof(char), NELEM(magic), fp) != NELEM(magic))
-		goto error_label;
-	/* check that we don't handle a file with ID3v2 tags. */
-	if (magic[0] == 'I' &&
-	    magic[1] == 'D' &&
-	    magic[2] == '3') {
-		goto error_label;
-	/* check that the file looks like mp3 */
-	} else if (!(magic[0] == 0xFF && magic[1] == 0xFB)) {
-			goto error_label;
-	}
-
 	return (data);
-	/* NOTREACHED */
-error_label:
-	free(data);
-	if (fp != NULL)
-		(void)fclose(fp);
-	return (NULL);
 }
 
 
 static struct t_taglist *
 t_ftid3v1_read(void *opaque)
 {
-	struct id3v1_tag id3tag;
 	struct t_taglist *tlist = NULL;
 	struct t_ftid3v1_data *data;
 
 	assert(opaque != NULL);
 	data = opaque;
 	assert(data->libid == libid);
-	assert(data->fp != NULL);
 
 	tlist = t_taglist_new();
 	if (tlist == NULL)
@@ -300,12 +164,8 @@ t_ftid3v1_read(void *opaque)
 	if (!data->id3)
 		return (tlist);
 
-	if (fseek(data->fp, -(sizeof(struct id3v1_tag)), SEEK_END) != 0)
-		goto error_label;
-	if (fread(&id3tag, sizeof(struct id3v1_tag), 1, data->fp) != 1)
-		goto error_label;
-
-	if (id3tag_to_taglist(&id3tag, tlist) != 0)
+	/* the tag was copied from the probe by t_ftid3v1_open() */
+	if (id3tag_to_taglist(&data->tag, tlist) != 0)
 		goto error_label;
 
 	return (tlist);
@@ -320,42 +180,38 @@ t_ftid3v1_write(void *opaque, const struct t_taglist *tlist)
 {
 	struct id3v1_tag id3tag;
 	struct t_ftid3v1_data *data;
-	FILE *fp = NULL;
+	off_t offset;
 
 	assert(opaque != NULL);
 	assert(tlist != NULL);
 	data = opaque;
 	assert(data->libid == libid);
-	assert(data->fp != NULL);
 
 	if (taglist_to_id3tag(tlist, &id3tag) != 0)
 		return (-1);
 
-	(void)fclose(data->fp);
-	data->fp = NULL;
+	if (data->fd == -1) {
+		/* t_ftid3v1_open() does not open the file */
+		if ((data->fd = open(data->path, O_RDWR)) == -1) {
+			warn("%s", data->path);
+			return (-1);
+		}
+	}
 
-	if (data->id3) {
-		if ((fp = fopen(data->path, "r+")) == NULL)
-			goto error_label;
-		if (fseek(fp, -(sizeof(struct id3v1_tag)), SEEK_END) != 0)
-			goto error_label;
-	} else {
-		if ((fp = fopen(data->path, "a")) == NULL)
-			goto error_label;
+	/* overwrite the old tag, or append the new one */
+	offset = data->size - (data->id3 ? (off_t)sizeof(struct id3v1_tag) : 0);
+	if (pwrite(data->fd, &id3tag, sizeof(struct id3v1_tag), offset) !=
+	    (ssize_t)sizeof(struct id3v1_tag)) {
+		warn("%s", data->path);
+		return (-1);
 	}
-	if (fwrite(&id3tag, sizeof(struct id3v1_tag), 1, fp) != 1)
-		goto error_label;
-	if (fclose(fp) != 0)
-		goto error_label;
-	fp = NULL;
 
-	data->fp = fopen(data->path, "r");
+	if (!data->id3) {
+		data->size += (off_t)sizeof(struct id3v1_tag);
+		data->id3 = 1;
+	}
+	(void)memcpy(&data->tag, &id3tag, sizeof(struct id3v1_tag));
 	return (0);
-error_label:
-	if (fp != NULL);
-		(void)fclose(fp);
-	data->fp = fopen(data->path, "r");
-	return (-1);
 }
 
 
@@ -368,8 +224,8 @@ t_ftid3v1_clear(void *opaque)
 	data = opaque;
 	assert(data->libid == libid);
 
-	if (data->fp != NULL)
-		(void)fclose(data->fp);
+	if (data->fd != -1)
+		(void)close(data->fd);
 	free(data);
 }
 
@@ -378,6 +234,7 @@ static int
 id3tag_to_taglist(const struct id3v1_tag *tag, struct t_taglist *tlist)
 {
 	char buf[31];
+	const char *genre;
 
 	assert(tag != NULL);
 	assert(tlist != NULL);
@@ -439,8 +296,8 @@ id3tag_to_taglist(const struct id3v1_tag *tag, struct t_taglist *tlist)
 		}
 	}
 	/* genre */
-	if (tag->genre < NELEM(id3v1_genre_str)) {
-		if (t_taglist_insert(tlist, "genre", id3v1_genre_str[tag->genre]) != 0)
+	if ((genre = t_id3genre_name(tag->genre)) != NULL) {
+		if (t_taglist_insert(tlist, "genre", genre) != 0)
 			return (-1);
 	}
 
@@ -461,7 +318,7 @@ taglist_to_id3tag(const struct t_taglist *tlist, struct id3v1_tag *tag)
 	(void)memcpy(tag->magic, "TAG", strlen("TAG"));
 	tag->genre = 0xFF;
 
-	TAILQ_FOREACH(t, tlist->tags, entries) {
+	T_TAGLIST_FOREACH(t, tlist) {
 		size_t siz = 30;
 		size_t len = strlen(t->val);
 		char *p    = NULL;
@@ -473,7 +330,7 @@ taglist_to_id3tag(const struct t_taglist *tlist, struct id3v1_tag *tag)
 		 * is likely to fail when the value is checked but `+' will be
 		 * accepted.
 		 */
-		if (strcasecmp(t->key, "tracknumber") == 0) {
+		if (t->key == t_key_tracknumber) {
 			char *endptr;
 			unsigned long lu = strtoul(t->val, &endptr, 10);
 			if (*endptr != '\0' || endptr == t->val || lu > UCHAR_MAX || lu == 0)
@@ -481,24 +338,20 @@ taglist_to_id3tag(const struct t_taglist *tlist, struct id3v1_tag *tag)
 			else /* casting is safe now */
 				tag->comment.v1_1.tracknumber = (unsigned char)lu;
 			continue;
-		} else if (strcasecmp(t->key, "genre") == 0) {
-			int i;
-			for (i = 0; i < NELEM(id3v1_genre_str); i++) {
-				if (strcasecmp(t->val, id3v1_genre_str[i]) == 0) {
-					tag->genre = i;
-					break;
-				}
-			}
-			if (i == NELEM(id3v1_genre_str))
+		} else if (t->key == t_key_genre) {
+			int i = t_id3genre_index(t->val);
+			if (i == -1)
 				warnx("ID3v1: %s: invalid value for %s", t->val, t->key);
+			else /* casting is safe now */
+				tag->genre = (unsigned char)i;
 			continue;
-		} else if (strcasecmp(t->key, "title") == 0) {
+		} else if (t->key == t_key_title) {
 			p = tag->title;
-		} else if (strcasecmp(t->key, "artist") == 0) {
+		} else if (t->key == t_key_artist) {
 			p = tag->artist;
-		} else if (strcasecmp(t->key, "album") == 0) {
+		} else if (t->key == t_key_album) {
 			p = tag->album;
-		} else if (strcasecmp(t->key, "year") == 0) {
+		} else if (t->key == t_key_year) {
 			char *endptr;
 			unsigned long lu = strtoul(t->val, &endptr, 10);
 			if (*endptr != '\0' || endptr == t->val ||
@@ -508,7 +361,7 @@ taglist_to_id3tag(const struct t_taglist *tlist, struct id3v1_tag *tag)
 				p = tag->year;
 				siz = 4;
 			}
-		} else if (strcasecmp(t->key, "comment") == 0) {
+		} else if (t->key == t_key_comment) {
 			p = tag->comment.v1_1.comment;
 			siz = 28;
 		}
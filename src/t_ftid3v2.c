@@ -0,0 +1,1704 @@
+/*
+ * t_ftid3v2.c
+ *
+ * ID3v2.3 and ID3v2.4 backend.
+ *
+ * The tag is parsed straight from the mmap(2)'d file: frames are walked in
+ * place and UTF-8 (or ASCII) text is inserted in the t_taglist without any
+ * intermediate copy. Only unsynchronised data (the whole v2.3 tag or v2.4
+ * frames) and text in other encodings need a buffer.
+ *
+ * Every text frame is exposed as a tag, using a friendly key for the common
+ * ones (see t_ftid3v2_keys), the frame ID for the others and the description
+ * for TXXX frames. The comment tag is the COMM frame without description. All
+ * the other frames (pictures, URLs, private data, compressed or encrypted
+ * frames etc.) are kept as-is when writing.
+ *
+ * When the new frames fit in the space used by the old tag (i.e. its padding
+ * is big enough) the tag is rewritten in place with a single pwrite(2),
+ * otherwise the whole file is rewritten (see -P for the padding reserve). An
+ * ID3v1 tag at the end of the file is updated too, with what fit in it.
+ */
+#include <sys/param.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <strings.h>
+#include <unistd.h>
+
+#include "t_config.h"
+#include "t_toolkit.h"
+#include "t_backend.h"
+#include "t_id3genre.h"
+
+
+static const char libid[] = "ID3v2";
+
+/* length of the tag header, footer and frame header */
+#define	T_FTID3V2_HEADLEN	10
+/* biggest syncsafe integer, the limit for the tag and the frames sizes */
+#define	T_FTID3V2_MAXSIZE	0x0fffffff
+/* padding of tags created (or rewritten) without -P */
+#define	T_FTID3V2_PADDING	1024
+/* length of the ID3v1 tag that may follow the audio */
+#define	T_FTID3V2_V1LEN		128
+
+/* tag header flags */
+#define	T_FTID3V2_UNSYNC	0x80
+#define	T_FTID3V2_EXTENDED	0x40
+#define	T_FTID3V2_FOOTER	0x10
+/* frame format flags (second flags byte) */
+#define	T_FTID3V2_24_GROUP	0x40
+#define	T_FTID3V2_24_COMPRESS	0x08
+#define	T_FTID3V2_24_ENCRYPT	0x04
+#define	T_FTID3V2_24_UNSYNC	0x02
+#define	T_FTID3V2_24_DATALEN	0x01
+#define	T_FTID3V2_23_COMPRESS	0x80
+#define	T_FTID3V2_23_ENCRYPT	0x40
+#define	T_FTID3V2_23_GROUP	0x20
+
+/* text encodings */
+#define	T_FTID3V2_LATIN1	0
+#define	T_FTID3V2_UTF16		1 /* with BOM */
+#define	T_FTID3V2_UTF16BE	2 /* v2.4 only */
+#define	T_FTID3V2_UTF8		3 /* v2.4 only */
+/* true if the string s is empty, UTF-16 strings may only have a BOM */
+#define	T_FTID3V2_EMPTY(enc, s, len)	((len) == 0 ||			\
+	    ((enc) == T_FTID3V2_UTF16 && (len) == 2 &&				\
+	    (((s)[0] == 0xff && (s)[1] == 0xfe) || ((s)[0] == 0xfe && (s)[1] == 0xff))))
+
+
+/* the text frames having a friendly key, sorted by id for bsearch(3) */
+static const struct t_ftid3v2_key {
+	const char	 id[5];
+	const char	*key;
+	int		 version; /* write this frame only for this version (or 0) */
+} t_ftid3v2_keys[] = {
+	{ "TALB", "album",		0 },
+	{ "TBPM", "bpm",		0 },
+	{ "TCMP", "compilation",	0 },
+	{ "TCOM", "composer",		0 },
+	{ "TCON", "genre",		0 },
+	{ "TCOP", "copyright",		0 },
+	{ "TDOR", "originaldate",	0 },
+	{ "TDRC", "year",		4 },
+	{ "TENC", "encodedby",		0 },
+	{ "TEXT", "lyricist",		0 },
+	{ "TIT1", "grouping",		0 },
+	{ "TIT2", "title",		0 },
+	{ "TIT3", "subtitle",		0 },
+	{ "TKEY", "initialkey",		0 },
+	{ "TLAN", "language",		0 },
+	{ "TMED", "media",		0 },
+	{ "TMOO", "mood",		0 },
+	{ "TOPE", "originalartist",	0 },
+	{ "TPE1", "artist",		0 },
+	{ "TPE2", "albumartist",	0 },
+	{ "TPE3", "conductor",		0 },
+	{ "TPE4", "remixer",		0 },
+	{ "TPOS", "discnumber",		0 },
+	{ "TPUB", "label",		0 },
+	{ "TRCK", "track",		0 },
+	{ "TSO2", "albumartistsort",	0 },
+	{ "TSOA", "albumsort",		0 },
+	{ "TSOP", "artistsort",		0 },
+	{ "TSOT", "titlesort",		0 },
+	{ "TSRC", "isrc",		0 },
+	{ "TSSE", "encoding",		0 },
+	{ "TYER", "year",		3 },
+};
+
+
+/* a frame of the tag */
+struct t_ftid3v2_frame {
+	const unsigned char	*p;     /* the frame header */
+	size_t			 len;   /* the frame data length */
+	char			 id[5];
+	int			 flags; /* format flags */
+};
+
+struct t_ftid3v2_data {
+	const char		*libid; /* pointer to libid */
+	const char		*path;
+	const unsigned char	*map;   /* the mmap(2)'d file */
+	size_t			 maplen;
+	int			 version; /* 3 or 4, 0 if the file has no tag */
+	int			 unsync;  /* all the frames are unsynchronised */
+	const unsigned char	*frames;  /* the frames, followed by the padding */
+	size_t			 frameslen;
+	size_t			 used;    /* length of the frames without padding */
+	unsigned char		*buf;     /* the resynchronised v2.3 tag (or NULL),
+					     frames may point into it */
+	size_t			 tagsize; /* the whole tag, where the audio start */
+};
+
+
+/* write outcome counters, see t_ftid3v2_stats() */
+static atomic_ulong	t_ftid3v2_ninplace;	/* tags written in place */
+static atomic_ulong	t_ftid3v2_nrewrite;	/* files rewritten */
+static atomic_ulong	t_ftid3v2_nrepad;	/* files rewritten by repad */
+
+
+struct t_backend	*t_ftid3v2_backend(void);
+
+static int		 t_ftid3v2_probe(const struct t_backend_probe *probe);
+static void		*t_ftid3v2_open(const char *path,
+			     struct t_backend_probe *probe);
+static struct t_taglist	*t_ftid3v2_read(void *opaque);
+static int		 t_ftid3v2_write(void *opaque, const struct t_taglist *tlist);
+static void		 t_ftid3v2_clear(void *opaque);
+static void		 t_ftid3v2_stats(FILE *fp);
+static int		 t_ftid3v2_repad(void *opaque, const struct t_padding *pad);
+
+/* helpers for t_ftid3v2_open() and t_ftid3v2_read() */
+static int		 t_ftid3v2_mpeg(const unsigned char *p, size_t len);
+static int		 t_ftid3v2_map(struct t_ftid3v2_data *data, int fd);
+static int		 t_ftid3v2_frame_next(const struct t_ftid3v2_data *data,
+			     size_t *offp, struct t_ftid3v2_frame *f);
+static int		 t_ftid3v2_frame_content(const struct t_ftid3v2_data *data,
+			     const struct t_ftid3v2_frame *f,
+			     const unsigned char **pp, size_t *lenp,
+			     unsigned char **bufp);
+static int		 t_ftid3v2_frame_tags(const struct t_ftid3v2_data *data,
+			     const struct t_ftid3v2_frame *f,
+			     struct t_taglist *tlist);
+static int		 t_ftid3v2_text_next(int enc, const unsigned char **pp,
+			     size_t *lenp, const unsigned char **sp, size_t *slenp);
+static int		 t_ftid3v2_text_insert(struct t_taglist *tlist,
+			     const char *key, size_t klen, int enc,
+			     const unsigned char *s, size_t slen, int genre);
+static char		*t_ftid3v2_utf8(int enc, const unsigned char *s,
+			     size_t len, size_t *lenp);
+static int		 t_ftid3v2_keycmp(const void *vid, const void *vkey);
+static size_t		 t_ftid3v2_unsync(unsigned char *dst,
+			     const unsigned char *src, size_t len);
+/* helpers for t_ftid3v2_write() and t_ftid3v2_repad() */
+static int		 t_ftid3v2_render(const struct t_ftid3v2_data *data,
+			     const struct t_taglist *tlist, int version,
+			     struct sbuf *sb);
+static int		 t_ftid3v2_render_same(const struct t_taglist *tlist,
+			     char (*ids)[5], size_t i, size_t j);
+static int		 t_ftid3v2_render_frame(struct sbuf *sb, int version,
+			     const char *id, struct sbuf *body);
+static int		 t_ftid3v2_frame_copy(const struct t_ftid3v2_data *data,
+			     const struct t_ftid3v2_frame *f, struct sbuf *sb);
+static int		 t_ftid3v2_render_text(struct sbuf *body, int enc,
+			     const char *s, size_t len);
+static const char	*t_ftid3v2_frame_id(int version, const char *key,
+			     char *buf);
+static void		 t_ftid3v2_comm_lang(const struct t_ftid3v2_data *data,
+			     size_t n, char *lang);
+static char		*t_ftid3v2_txxx_desc(const struct t_ftid3v2_data *data,
+			     const char *key, size_t klen);
+static int		 t_ftid3v2_inplace(struct t_ftid3v2_data *data,
+			     int version, const char *frames, size_t len);
+static int		 t_ftid3v2_rewrite(struct t_ftid3v2_data *data,
+			     int version, const char *frames, size_t len,
+			     size_t padlen);
+static int		 t_ftid3v2_id3v1(const struct t_ftid3v2_data *data,
+			     int version, const struct t_taglist *tlist);
+static void		 t_ftid3v2_header(unsigned char *p, int version,
+			     size_t size);
+static uint32_t		 syncsafe_dec(const unsigned char *p);
+static void		 syncsafe_enc(unsigned char *p, uint32_t u);
+static uint32_t		 be32dec(const unsigned char *p);
+static void		 be32enc(unsigned char *p, uint32_t u);
+
+
+struct t_backend *
+t_ftid3v2_backend(void)
+{
+
+	static struct t_backend b = {
+		.libid		= libid,
+		.desc		= "ID3v2.3 and ID3v2.4 tags (mp3 files)",
+		.probe		= t_ftid3v2_probe,
+		.open		= t_ftid3v2_open,
+		.read		= t_ftid3v2_read,
+		.write		= t_ftid3v2_write,
+		.clear		= t_ftid3v2_clear,
+		.stats		= t_ftid3v2_stats,
+		.repad		= t_ftid3v2_repad,
+	};
+
+	return (&b);
+}
+
+
+/*
+ * We claim files starting with an ID3v2.3 or ID3v2.4 tag, and untagged MPEG
+ * audio files so that a tag can be added. MPEG audio files having an ID3v1 or
+ * APE tag (and no ID3v2 tag) are left to the other backends.
+ */
+static int
+t_ftid3v2_probe(const struct t_backend_probe *probe)
+{
+	const unsigned char *h, *t;
+
+	assert(probe != NULL);
+	h = probe->head;
+	t = probe->tail;
+
+	if (probe->headlen >= T_FTID3V2_HEADLEN && memcmp(h, "ID3", 3) == 0)
+		return (h[3] == 3 || h[3] == 4);
+
+	if (!t_ftid3v2_mpeg(h, probe->headlen))
+		return (0);
+	if (probe->taillen >= 128 &&
+	    memcmp(t + probe->taillen - 128, "TAG", 3) == 0)
+		return (0);
+	if (probe->taillen >= 32 &&
+	    memcmp(t + probe->taillen - 32, "APETAGEX", 8) == 0)
+		return (0);
+	return (1);
+}
+
+
+/*
+ * @return
+ *   1 if p starts with an MPEG audio frame header, 0 otherwise.
+ */
+static int
+t_ftid3v2_mpeg(const unsigned char *p, size_t len)
+{
+
+	assert(p != NULL);
+
+	/* frame sync, a valid MPEG version and a layer (ADTS has none) */
+	return (len >= 2 && p[0] == 0xff && (p[1] & 0xe0) == 0xe0 &&
+	    (p[1] & 0x18) != 0x08 && (p[1] & 0x06) != 0);
+}
+
+
+static void *
+t_ftid3v2_open(const char *path, struct t_backend_probe *probe)
+{
+	struct t_ftid3v2_data *data;
+	size_t plen;
+	char *s;
+	int fd;
+
+	assert(path != NULL);
+
+	plen = strlen(path);
+	data = calloc(1, sizeof(struct t_ftid3v2_data) + plen + 1);
+	if (data == NULL)
+		return (NULL);
+	data->libid = libid;
+	data->path = s = (char *)(data + 1);
+	(void)memcpy(s, path, plen + 1);
+
+	if ((fd = t_backend_probe_fd(probe, path)) == -1 ||
+	    t_ftid3v2_map(data, fd) == -1) {
+		free(data);
+		return (NULL);
+	}
+
+	return (data);
+}
+
+
+/*
+ * mmap(2) the file at data->path and find its tag frames. The previous mapping
+ * (if any) is released first, this is needed once the file has been rewritten.
+ *
+ * @param fd
+ *   A read-only descriptor of data->path closed by this routine, or -1 to
+ *   open data->path.
+ *
+ * @return
+ *   0 on success, -1 on error or if the file is not handled by this backend
+ *   (data->map is then NULL).
+ */
+static int
+t_ftid3v2_map(struct t_ftid3v2_data *data, int fd)
+{
+	struct t_ftid3v2_frame f;
+	struct stat st;
+	const unsigned char *p;
+	unsigned char *map = NULL;
+	size_t len, off, skip;
+	int flags, ret;
+
+	assert(data != NULL);
+
+	if (data->map != NULL)
+		(void)munmap((void *)(uintptr_t)data->map, data->maplen);
+	free(data->buf);
+	data->map = data->frames = NULL;
+	data->buf = NULL;
+	data->maplen = data->frameslen = data->used = data->tagsize = 0;
+	data->version = data->unsync = 0;
+
+	if (fd == -1 && (fd = open(data->path, O_RDONLY)) == -1)
+		return (-1);
+	if (fstat(fd, &st) == -1 || st.st_size < T_FTID3V2_HEADLEN ||
+	    (uintmax_t)st.st_size > SIZE_MAX) {
+		(void)close(fd);
+		return (-1);
+	}
+	len = (size_t)st.st_size;
+	map = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+	(void)close(fd);
+	if (map == MAP_FAILED)
+		return (-1);
+	data->map    = p = map;
+	data->maplen = len;
+
+	if (memcmp(p, "ID3", 3) != 0) {
+		/* no tag, we can add one to MPEG audio files */
+		if (!t_ftid3v2_mpeg(p, len))
+			goto error_label;
+		return (0);
+	}
+	if ((p[3] != 3 && p[3] != 4) || p[4] == 0xff ||
+	    ((p[6] | p[7] | p[8] | p[9]) & 0x80))
+		goto error_label;
+	data->version = p[3];
+	flags = p[5];
+	data->tagsize = T_FTID3V2_HEADLEN + syncsafe_dec(p + 6);
+	if (data->version == 4 && (flags & T_FTID3V2_FOOTER))
+		data->tagsize += T_FTID3V2_HEADLEN;
+	if (data->tagsize > len)
+		goto error_label;
+	/* a FLAC file with an ID3v2 tag is not for us */
+	if (len - data->tagsize >= 4 && memcmp(p + data->tagsize, "fLaC", 4) == 0)
+		goto error_label;
+
+	data->frames    = p + T_FTID3V2_HEADLEN;
+	data->frameslen = syncsafe_dec(p + 6);
+	if (flags & T_FTID3V2_UNSYNC) {
+		if (data->version == 3) {
+			/* the whole tag is unsynchronised */
+			if ((data->buf = malloc(data->frameslen + 1)) == NULL)
+				goto error_label;
+			data->frameslen = t_ftid3v2_unsync(data->buf,
+			    data->frames, data->frameslen);
+			data->frames = data->buf;
+		} else
+			data->unsync = 1;
+	}
+	if (flags & T_FTID3V2_EXTENDED) {
+		if (data->frameslen < 4)
+			goto error_label;
+		if (data->version == 3)
+			skip = 4 + be32dec(data->frames);
+		else
+			skip = syncsafe_dec(data->frames);
+		if (skip > data->frameslen)
+			goto error_label;
+		data->frames    += skip;
+		data->frameslen -= skip;
+	}
+
+	/* check every frame now, so that read and write can't fail on them */
+	off = 0;
+	while ((ret = t_ftid3v2_frame_next(data, &off, &f)) == 1)
+		continue;
+	if (ret == -1) {
+		warnx("%s: invalid ID3v2 frame at offset %zu", data->path, off);
+		goto error_label;
+	}
+	data->used = off;
+
+	return (0);
+error_label:
+	(void)munmap(map, len);
+	free(data->buf);
+	data->map = data->frames = NULL;
+	data->buf = NULL;
+	return (-1);
+}
+
+
+static struct t_taglist *
+t_ftid3v2_read(void *opaque)
+{
+	struct t_ftid3v2_frame f;
+	struct t_ftid3v2_data *data;
+	struct t_taglist *tlist;
+	size_t off = 0;
+
+	assert(opaque != NULL);
+	data = opaque;
+	assert(data->libid == libid);
+
+	if (data->map == NULL)
+		return (NULL);
+	if ((tlist = t_taglist_new()) == NULL)
+		return (NULL);
+
+	while (t_ftid3v2_frame_next(data, &off, &f) == 1) {
+		if (t_ftid3v2_frame_tags(data, &f, tlist) == -1) {
+			t_taglist_delete(tlist);
+			return (NULL);
+		}
+	}
+
+	return (tlist);
+}
+
+
+static int
+t_ftid3v2_write(void *opaque, const struct t_taglist *tlist)
+{
+	struct t_ftid3v2_data *data;
+	struct sbuf *sb;
+	size_t len, padlen;
+	int version, ret = -1;
+	extern int vflag;
+	extern const struct t_padding *Pflag;
+
+	assert(opaque != NULL);
+	assert(tlist != NULL);
+	data = opaque;
+	assert(data->libid == libid);
+
+	if (data->map == NULL)
+		return (-1);
+	version = (data->version != 0 ? data->version : 4);
+
+	if ((sb = sbuf_new_auto()) == NULL)
+		return (-1);
+	if (t_ftid3v2_render(data, tlist, version, sb) == -1)
+		goto cleanup_label;
+	len = (size_t)sbuf_len(sb);
+	if (len > T_FTID3V2_MAXSIZE - T_FTID3V2_HEADLEN) {
+		warnx("%s: ID3v2 tag too big", data->path);
+		goto cleanup_label;
+	}
+
+	if (data->version != 0 &&
+	    T_FTID3V2_HEADLEN + len <= data->tagsize) {
+		ret = t_ftid3v2_inplace(data, version, sbuf_data(sb), len);
+		if (ret == 0)
+			atomic_fetch_add(&t_ftid3v2_ninplace, 1);
+		if (vflag) {
+			(void)fprintf(stderr, "%s: %s: tag written in place%s\n",
+			    getprogname(), data->path,
+			    ret == 0 ? "" : " failed");
+		}
+	} else {
+		padlen = T_FTID3V2_PADDING;
+		if (Pflag != NULL) {
+			padlen = t_backend_padding_size(Pflag,
+			    (off_t)(data->maplen - data->tagsize),
+			    T_FTID3V2_MAXSIZE - T_FTID3V2_HEADLEN - len);
+		}
+		ret = t_ftid3v2_rewrite(data, version, sbuf_data(sb), len,
+		    padlen);
+		if (ret == 0)
+			atomic_fetch_add(&t_ftid3v2_nrewrite, 1);
+		if (vflag) {
+			(void)fprintf(stderr, "%s: %s: %s, %s\n", getprogname(),
+			    data->path, data->version == 0 ? "no ID3v2 tag" :
+			    "not enough padding",
+			    ret == 0 ? "file rewritten" : "rewrite failed");
+		}
+	}
+	if (ret == 0 && (ret = t_ftid3v2_id3v1(data, version, tlist)) == -1)
+		warn("%s: ID3v1 tag", data->path);
+
+	/* FALLTHROUGH */
+cleanup_label:
+	sbuf_delete(sb);
+	return (ret);
+}
+
+
+static void
+t_ftid3v2_clear(void *opaque)
+{
+	struct t_ftid3v2_data *data;
+
+	assert(opaque != NULL);
+	data = opaque;
+	assert(data->libid == libid);
+
+	if (data->map != NULL)
+		(void)munmap((void *)(uintptr_t)data->map, data->maplen);
+	free(data->buf);
+	free(data);
+}
+
+
+static void
+t_ftid3v2_stats(FILE *fp)
+{
+
+	assert(fp != NULL);
+
+	(void)fprintf(fp, "%s: ID3v2 writes: %lu in place, %lu rewritten, "
+	    "%lu repadded\n", getprogname(), atomic_load(&t_ftid3v2_ninplace),
+	    atomic_load(&t_ftid3v2_nrewrite), atomic_load(&t_ftid3v2_nrepad));
+}
+
+
+static int
+t_ftid3v2_repad(void *opaque, const struct t_padding *pad)
+{
+	struct t_ftid3v2_frame f;
+	struct t_ftid3v2_data *data;
+	struct sbuf *sb = NULL;
+	const char *frames;
+	size_t padlen, off = 0;
+	int ret;
+	extern int vflag;
+
+	assert(opaque != NULL);
+	assert(pad != NULL);
+	data = opaque;
+	assert(data->libid == libid);
+
+	if (data->map == NULL)
+		return (-1);
+	if (data->used > T_FTID3V2_MAXSIZE - T_FTID3V2_HEADLEN)
+		return (-1);
+	padlen = t_backend_padding_size(pad,
+	    (off_t)(data->maplen - data->tagsize),
+	    T_FTID3V2_MAXSIZE - T_FTID3V2_HEADLEN - data->used);
+
+	/* already padded as requested, don't rewrite the file */
+	if (data->version != 0 &&
+	    data->tagsize == T_FTID3V2_HEADLEN + data->used + padlen)
+		return (0);
+
+	/* the frames are kept as-is, only the padding change */
+	frames = (const char *)data->frames;
+	if (data->unsync) {
+		/* the frames flags have to be updated, see
+		   t_ftid3v2_frame_copy() */
+		if ((sb = sbuf_new_auto()) == NULL)
+			return (-1);
+		ret = 0;
+		while (ret == 0 && t_ftid3v2_frame_next(data, &off, &f) == 1)
+			ret = t_ftid3v2_frame_copy(data, &f, sb);
+		if (ret == -1 || sbuf_finish(sb) == -1) {
+			sbuf_delete(sb);
+			return (-1);
+		}
+		assert((size_t)sbuf_len(sb) == data->used);
+		frames = sbuf_data(sb);
+	}
+	ret = t_ftid3v2_rewrite(data, (data->version != 0 ? data->version : 4),
+	    frames, data->used, padlen);
+	if (sb != NULL)
+		sbuf_delete(sb);
+	if (ret == 0)
+		atomic_fetch_add(&t_ftid3v2_nrepad, 1);
+	if (vflag) {
+		(void)fprintf(stderr, "%s: %s: padding set to %zu bytes, %s\n",
+		    getprogname(), data->path, padlen,
+		    ret == 0 ? "file rewritten" : "rewrite failed");
+	}
+
+	return (ret);
+}
+
+
+/*
+ * get the frame at *offp and move *offp to the next one.
+ *
+ * @return
+ *   1 on success, 0 when there is no more frame (we reached the padding) and
+ *   -1 if the frame is invalid.
+ */
+static int
+t_ftid3v2_frame_next(const struct t_ftid3v2_data *data, size_t *offp,
+    struct t_ftid3v2_frame *f)
+{
+	const unsigned char *p;
+	size_t rest, len;
+	int i;
+
+	assert(data != NULL);
+	assert(offp != NULL);
+	assert(f != NULL);
+
+	if (data->frames == NULL || *offp >= data->frameslen)
+		return (0);
+	p    = data->frames + *offp;
+	rest = data->frameslen - *offp;
+	if (rest < T_FTID3V2_HEADLEN || p[0] == '\0')
+		return (0);
+
+	for (i = 0; i < 4; i++) {
+		if (!(p[i] >= 'A' && p[i] <= 'Z') && !(p[i] >= '0' && p[i] <= '9'))
+			return (-1);
+	}
+	if (data->version == 4) {
+		if ((p[4] | p[5] | p[6] | p[7]) & 0x80)
+			return (-1);
+		len = syncsafe_dec(p + 4);
+	} else
+		len = be32dec(p + 4);
+	if (len > rest - T_FTID3V2_HEADLEN)
+		return (-1);
+
+	f->p   = p;
+	f->len = len;
+	(void)memcpy(f->id, p, 4);
+	f->id[4] = '\0';
+	f->flags = p[9];
+	*offp += T_FTID3V2_HEADLEN + len;
+	return (1);
+}
+
+
+/*
+ * get the content of a frame, without its unsynchronisation and the extra
+ * bytes following its header.
+ *
+ * @param bufp
+ *   Set to a buffer that should be passed to free(3) after use when the content
+ *   had to be copied, NULL otherwise.
+ *
+ * @return
+ *   0 on success, 1 if the frame is compressed or encrypted (its content is
+ *   not available) and -1 on error (malloc(3) failed).
+ */
+static int
+t_ftid3v2_frame_content(const struct t_ftid3v2_data *data,
+    const struct t_ftid3v2_frame *f, const unsigned char **pp, size_t *lenp,
+    unsigned char **bufp)
+{
+	const unsigned char *p;
+	size_t len, skip = 0;
+
+	assert(data != NULL);
+	assert(f != NULL);
+	assert(pp != NULL);
+	assert(lenp != NULL);
+	assert(bufp != NULL);
+
+	*bufp = NULL;
+	p   = f->p + T_FTID3V2_HEADLEN;
+	len = f->len;
+
+	if (data->version == 4) {
+		if (f->flags & (T_FTID3V2_24_COMPRESS | T_FTID3V2_24_ENCRYPT))
+			return (1);
+		if (data->unsync || (f->flags & T_FTID3V2_24_UNSYNC)) {
+			if ((*bufp = malloc(len + 1)) == NULL)
+				return (-1);
+			len = t_ftid3v2_unsync(*bufp, p, len);
+			p = *bufp;
+		}
+		if (f->flags & T_FTID3V2_24_GROUP)
+			skip += 1;
+		if (f->flags & T_FTID3V2_24_DATALEN)
+			skip += 4;
+	} else {
+		if (f->flags & (T_FTID3V2_23_COMPRESS | T_FTID3V2_23_ENCRYPT))
+			return (1);
+		if (f->flags & T_FTID3V2_23_GROUP)
+			skip += 1;
+	}
+	if (skip > len)
+		skip = len;
+
+	*pp   = p + skip;
+	*lenp = len - skip;
+	return (0);
+}
+
+
+/*
+ * insert the tags of the frame f into tlist.
+ *
+ * @param tlist
+ *   The t_taglist to fill, or NULL to only find out if f is exposed as tags.
+ *
+ * @return
+ *   1 if the frame is exposed as tags (text frames and the COMM frame without
+ *   description), 0 if it is not and -1 on error.
+ */
+static int
+t_ftid3v2_frame_tags(const struct t_ftid3v2_data *data,
+    const struct t_ftid3v2_frame *f, struct t_taglist *tlist)
+{
+	const struct t_ftid3v2_key *k;
+	const unsigned char *p, *s, *desc;
+	unsigned char *buf = NULL;
+	size_t len, slen, desclen;
+	char *key = NULL;
+	int enc, ret;
+
+	assert(data != NULL);
+	assert(f != NULL);
+
+	if (f->id[0] != 'T' && strcmp(f->id, "COMM") != 0)
+		return (0);
+	if ((ret = t_ftid3v2_frame_content(data, f, &p, &len, &buf)) != 0)
+		return (ret == 1 ? 0 : -1);
+	ret = 0;
+	if (len < 1 || p[0] > T_FTID3V2_UTF8)
+		goto cleanup_label;
+	enc = p[0];
+	p++;
+	len--;
+
+	if (strcmp(f->id, "COMM") == 0) {
+		/* language and description, we only want the "main" one */
+		if (len < 3)
+			goto cleanup_label;
+		p   += 3;
+		len -= 3;
+		if (t_ftid3v2_text_next(enc, &p, &len, &desc, &desclen) != 1 ||
+		    !T_FTID3V2_EMPTY(enc, desc, desclen))
+			goto cleanup_label;
+		ret = 1;
+		if (tlist != NULL &&
+		    t_ftid3v2_text_next(enc, &p, &len, &s, &slen) == 1 &&
+		    t_ftid3v2_text_insert(tlist, "comment", strlen("comment"),
+		    enc, s, slen, 0) == -1)
+			ret = -1;
+		goto cleanup_label;
+	}
+
+	if (strcmp(f->id, "TXXX") == 0) {
+		/* the description is the key */
+		if (t_ftid3v2_text_next(enc, &p, &len, &desc, &desclen) != 1 ||
+		    T_FTID3V2_EMPTY(enc, desc, desclen))
+			goto cleanup_label;
+		ret = 1;
+		if (tlist == NULL)
+			goto cleanup_label;
+		if ((key = t_ftid3v2_utf8(enc, desc, desclen, &desclen)) == NULL) {
+			ret = -1;
+			goto cleanup_label;
+		}
+		while (ret == 1 && t_ftid3v2_text_next(enc, &p, &len, &s, &slen) == 1) {
+			if (t_ftid3v2_text_insert(tlist, key, desclen, enc, s,
+			    slen, 0) == -1)
+				ret = -1;
+		}
+		goto cleanup_label;
+	}
+
+	ret = 1;
+	if (tlist == NULL)
+		goto cleanup_label;
+	k = bsearch(f->id, t_ftid3v2_keys, NELEM(t_ftid3v2_keys),
+	    sizeof(*t_ftid3v2_keys), t_ftid3v2_keycmp);
+	while (ret == 1 && t_ftid3v2_text_next(enc, &p, &len, &s, &slen) == 1) {
+		if (t_ftid3v2_text_insert(tlist, (k != NULL ? k->key : f->id),
+		    strlen(k != NULL ? k->key : f->id), enc, s, slen,
+		    strcmp(f->id, "TCON") == 0) == -1)
+			ret = -1;
+	}
+
+	/* FALLTHROUGH */
+cleanup_label:
+	if (key != NULL && key != (const char *)desc)
+		free(key);
+	free(buf);
+	return (ret);
+}
+
+
+/*
+ * get the next NUL-terminated string from the text at *pp. The last string may
+ * not be terminated.
+ *
+ * @return
+ *   1 and set sp and slenp to the string on success, 0 at the end of the text.
+ */
+static int
+t_ftid3v2_text_next(int enc, const unsigned char **pp, size_t *lenp,
+    const unsigned char **sp, size_t *slenp)
+{
+	const unsigned char *p;
+	size_t len, i;
+
+	assert(pp != NULL);
+	assert(lenp != NULL);
+	assert(sp != NULL);
+	assert(slenp != NULL);
+
+	p   = *pp;
+	len = *lenp;
+	if (len == 0)
+		return (0);
+
+	if (enc == T_FTID3V2_UTF16 || enc == T_FTID3V2_UTF16BE) {
+		for (i = 0; i + 1 < len && (p[i] != 0 || p[i + 1] != 0); i += 2)
+			continue;
+		*sp    = p;
+		*slenp = MIN(i, len);
+		i = (i + 1 < len ? i + 2 : len);
+	} else {
+		for (i = 0; i < len && p[i] != 0; i++)
+			continue;
+		*sp    = p;
+		*slenp = i;
+		i = (i < len ? i + 1 : len);
+	}
+
+	*pp   = p + i;
+	*lenp = len - i;
+	return (1);
+}
+
+
+/*
+ * insert the text s as a tag value, converting it to UTF-8 if needed.
+ *
+ * @param genre
+ *   1 if s is a TCON string that may reference an ID3v1 genre by number.
+ *
+ * @return
+ *   0 on success, -1 on error.
+ */
+static int
+t_ftid3v2_text_insert(struct t_taglist *tlist, const char *key, size_t klen,
+    int enc, const unsigned char *s, size_t slen, int genre)
+{
+	const char *val, *name;
+	char *utf8;
+	size_t vlen, i;
+	unsigned int n;
+	int ret;
+
+	assert(tlist != NULL);
+	assert(key != NULL);
+	assert(s != NULL);
+
+	if ((utf8 = t_ftid3v2_utf8(enc, s, slen, &vlen)) == NULL)
+		return (-1);
+	val = utf8;
+
+	/* "17", "(17)" and "(17)Rock" (val may not be NUL-terminated) */
+	if (genre && vlen > 0) {
+		n = 0;
+		for (i = (val[0] == '('); i < vlen && i < 4 &&
+		    val[i] >= '0' && val[i] <= '9'; i++)
+			n = n * 10 + (unsigned int)(val[i] - '0');
+		if (i > (size_t)(val[0] == '(') &&
+		    (name = t_id3genre_name(n)) != NULL) {
+			if (val[0] != '(' && i == vlen) {
+				val  = name;
+				vlen = strlen(name);
+			} else if (val[0] == '(' && i < vlen && val[i] == ')') {
+				if (i + 1 == vlen) {
+					val  = name;
+					vlen = strlen(name);
+				} else {
+					/* the refinement */
+					val  += i + 1;
+					vlen -= i + 1;
+				}
+			}
+		}
+	}
+
+	ret = t_taglist_insert_len(tlist, key, klen, val, vlen);
+	if (utf8 != (const char *)s)
+		free(utf8);
+	return (ret);
+}
+
+
+/*
+ * convert a string to UTF-8.
+ *
+ * @param lenp
+ *   Set to the length of the returned string.
+ *
+ * @return
+ *   s itself when it is already valid UTF-8 (the returned string is then not
+ *   NUL-terminated), or a NUL-terminated string that should be passed to
+ *   free(3) after use. NULL on error (malloc(3) failed).
+ */
+static char *
+t_ftid3v2_utf8(int enc, const unsigned char *s, size_t len, size_t *lenp)
+{
+	unsigned char *ret, *q;
+	uint32_t c, c2;
+	size_t i;
+	int le;
+
+	assert(s != NULL);
+	assert(lenp != NULL);
+
+	if (enc == T_FTID3V2_UTF8) {
+		*lenp = len;
+		return ((char *)(uintptr_t)s);
+	}
+	if (enc == T_FTID3V2_LATIN1) {
+		for (i = 0; i < len && s[i] < 0x80; i++)
+			continue;
+		if (i == len) {
+			/* ASCII */
+			*lenp = len;
+			return ((char *)(uintptr_t)s);
+		}
+	}
+
+	/* at most two UTF-8 bytes per Latin-1 byte or UTF-16 byte */
+	if ((ret = q = malloc(2 * len + 1)) == NULL)
+		return (NULL);
+
+	if (enc == T_FTID3V2_LATIN1) {
+		for (i = 0; i < len; i++) {
+			if (s[i] < 0x80) {
+				*q++ = s[i];
+			} else {
+				*q++ = (unsigned char)(0xc0 | (s[i] >> 6));
+				*q++ = (unsigned char)(0x80 | (s[i] & 0x3f));
+			}
+		}
+	} else {
+		/* UTF-16, with a BOM unless UTF-16BE */
+		le = 0;
+		i  = 0;
+		if (enc == T_FTID3V2_UTF16 && len >= 2) {
+			if (s[0] == 0xff && s[1] == 0xfe) {
+				le = 1;
+				i = 2;
+			} else if (s[0] == 0xfe && s[1] == 0xff)
+				i = 2;
+		}
+		for (; i + 1 < len; i += 2) {
+			c = (le ? (uint32_t)s[i + 1] << 8 | s[i] :
+			    (uint32_t)s[i] << 8 | s[i + 1]);
+			if (c >= 0xd800 && c < 0xdc00 && i + 3 < len) {
+				c2 = (le ? (uint32_t)s[i + 3] << 8 | s[i + 2] :
+				    (uint32_t)s[i + 2] << 8 | s[i + 3]);
+				if (c2 >= 0xdc00 && c2 < 0xe000) {
+					c = 0x10000 + ((c - 0xd800) << 10) +
+					    (c2 - 0xdc00);
+					i += 2;
+				}
+			}
+			if (c >= 0xd800 && c < 0xe000)
+				c = 0xfffd; /* lone surrogate */
+			if (c < 0x80) {
+				*q++ = (unsigned char)c;
+			} else if (c < 0x800) {
+				*q++ = (unsigned char)(0xc0 | (c >> 6));
+				*q++ = (unsigned char)(0x80 | (c & 0x3f));
+			} else if (c < 0x10000) {
+				*q++ = (unsigned char)(0xe0 | (c >> 12));
+				*q++ = (unsigned char)(0x80 | ((c >> 6) & 0x3f));
+				*q++ = (unsigned char)(0x80 | (c & 0x3f));
+			} else {
+				*q++ = (unsigned char)(0xf0 | (c >> 18));
+				*q++ = (unsigned char)(0x80 | ((c >> 12) & 0x3f));
+				*q++ = (unsigned char)(0x80 | ((c >> 6) & 0x3f));
+				*q++ = (unsigned char)(0x80 | (c & 0x3f));
+			}
+		}
+	}
+
+	*q = '\0';
+	*lenp = (size_t)(q - ret);
+	return ((char *)ret);
+}
+
+
+/* used to search in the t_ftid3v2_keys array */
+static int
+t_ftid3v2_keycmp(const void *vid, const void *vkey)
+{
+	const struct t_ftid3v2_key *k = vkey;
+
+	assert(vid != NULL);
+	assert(vkey != NULL);
+
+	return (strcmp(vid, k->id));
+}
+
+
+/*
+ * undo the unsynchronisation of src (i.e. replace each $FF $00 by $FF).
+ *
+ * @return
+ *   the length of dst, at most len.
+ */
+static size_t
+t_ftid3v2_unsync(unsigned char *dst, const unsigned char *src, size_t len)
+{
+	size_t i, n = 0;
+
+	assert(dst != NULL);
+	assert(src != NULL);
+
+	for (i = 0; i < len; i++) {
+		dst[n++] = src[i];
+		if (src[i] == 0xff && i + 1 < len && src[i + 1] == 0x00)
+			i++;
+	}
+
+	return (n);
+}
+
+
+/*
+ * serialize the frames for tlist: a frame by frame ID in tlist order (a COMM
+ * frame by comment, a TXXX frame by key) followed by the current frames that
+ * are not exposed as tags. The values of keys stored in the same frame (like
+ * conductor and tpe3) are all written into it, a text frame can't be repeated.
+ *
+ * @return
+ *   0 on success, -1 on error.
+ */
+static int
+t_ftid3v2_render(const struct t_ftid3v2_data *data,
+    const struct t_taglist *tlist, int version, struct sbuf *sb)
+{
+	struct t_ftid3v2_frame f;
+	const struct t_tag *t, *u;
+	struct sbuf *body;
+	const char *id;
+	char idbuf[5], lang[3], *desc, (*ids)[5] = NULL;
+	size_t off = 0, ncomm = 0, i, j;
+	int enc, ret, success = 0;
+
+	assert(data != NULL);
+	assert(tlist != NULL);
+	assert(sb != NULL);
+
+	if ((body = sbuf_new_auto()) == NULL)
+		return (-1);
+
+	/* the frame ID of each tag */
+	if (tlist->count > 0 &&
+	    (ids = calloc(tlist->count, sizeof(*ids))) == NULL)
+		goto cleanup_label;
+	for (i = 0; i < tlist->count; i++) {
+		id = t_ftid3v2_frame_id(version, tlist->tags[i]->key, idbuf);
+		(void)memcpy(ids[i], id, sizeof(ids[i]));
+	}
+
+	for (i = 0; i < tlist->count; i++) {
+		t = tlist->tags[i];
+		/* skip the frames we already did */
+		for (j = 0; j < i && !t_ftid3v2_render_same(tlist, ids, i, j); j++)
+			continue;
+		if (j < i)
+			continue;
+
+		/* v2.3 has neither UTF-8 nor multiple values, but nobody care
+		   about the latter */
+		enc = T_FTID3V2_UTF8;
+		if (version == 3) {
+			enc = T_FTID3V2_LATIN1;
+			for (j = i; j < tlist->count; j++) {
+				size_t k;
+				u = tlist->tags[j];
+				if (!t_ftid3v2_render_same(tlist, ids, i, j))
+					continue;
+				for (k = 0; k < u->vlen && !(u->val[k] & 0x80); k++)
+					continue;
+				if (k < u->vlen)
+					enc = T_FTID3V2_UTF16;
+			}
+		}
+
+		sbuf_clear(body);
+		if (sbuf_putc(body, enc) == -1)
+			goto cleanup_label;
+		id = ids[i];
+		if (strcmp(id, "COMM") == 0) {
+			/* the current language, no description */
+			t_ftid3v2_comm_lang(data, ncomm++, lang);
+			if (sbuf_bcat(body, lang, sizeof(lang)) == -1 ||
+			    t_ftid3v2_render_text(body, enc, "", 0) == -1 ||
+			    t_ftid3v2_render_text(body, enc, t->val, t->vlen) == -1)
+				goto cleanup_label;
+		} else {
+			if (strcmp(id, "TXXX") == 0) {
+				/* keys are lower case, keep the current case */
+				desc = t_ftid3v2_txxx_desc(data, t->key, t->klen);
+				ret = t_ftid3v2_render_text(body, enc,
+				    (desc != NULL ? desc : t->key), t->klen);
+				free(desc);
+				if (ret == -1)
+					goto cleanup_label;
+			}
+			for (j = i; j < tlist->count; j++) {
+				u = tlist->tags[j];
+				if (t_ftid3v2_render_same(tlist, ids, i, j) &&
+				    t_ftid3v2_render_text(body, enc, u->val, u->vlen) == -1)
+					goto cleanup_label;
+			}
+		}
+		/* the last string don't need its terminator */
+		if (sbuf_setpos(body, sbuf_len(body) -
+		    (enc == T_FTID3V2_UTF16 ? 2 : 1)) == -1)
+			goto cleanup_label;
+		if (sbuf_finish(body) == -1 ||
+		    t_ftid3v2_render_frame(sb, version, id, body) == -1)
+			goto cleanup_label;
+	}
+
+	/* keep all the other frames */
+	while (t_ftid3v2_frame_next(data, &off, &f) == 1) {
+		if ((ret = t_ftid3v2_frame_tags(data, &f, NULL)) == -1)
+			goto cleanup_label;
+		if (ret == 0 && t_ftid3v2_frame_copy(data, &f, sb) == -1)
+			goto cleanup_label;
+	}
+
+	if (sbuf_finish(sb) == -1)
+		goto cleanup_label;
+
+	success = 1;
+	/* FALLTHROUGH */
+cleanup_label:
+	free(ids);
+	sbuf_delete(body);
+	return (success ? 0 : -1);
+}
+
+
+/*
+ * @param ids
+ *   The frame ID of each tag of tlist.
+ *
+ * @return
+ *   1 if the tags i and j of tlist are rendered in the same frame, 0
+ *   otherwise.
+ */
+static int
+t_ftid3v2_render_same(const struct t_taglist *tlist, char (*ids)[5],
+    size_t i, size_t j)
+{
+
+	assert(tlist != NULL);
+	assert(ids != NULL);
+	assert(i < tlist->count && j < tlist->count);
+
+	if (i == j)
+		return (1);
+	if (strcmp(ids[i], ids[j]) != 0 || strcmp(ids[i], "COMM") == 0)
+		return (0);
+	/* the TXXX description is the key */
+	if (strcmp(ids[i], "TXXX") == 0)
+		return (tlist->tags[i]->key == tlist->tags[j]->key);
+	return (1);
+}
+
+
+/*
+ * append the frame id with the finished body to sb.
+ *
+ * @return
+ *   0 on success, -1 on error.
+ */
+static int
+t_ftid3v2_render_frame(struct sbuf *sb, int version, const char *id,
+    struct sbuf *body)
+{
+	unsigned char hdr[T_FTID3V2_HEADLEN];
+	size_t len;
+
+	assert(sb != NULL);
+	assert(id != NULL && strlen(id) == 4);
+	assert(body != NULL);
+
+	len = (size_t)sbuf_len(body);
+	if (len > T_FTID3V2_MAXSIZE)
+		return (-1);
+	(void)memcpy(hdr, id, 4);
+	if (version == 4)
+		syncsafe_enc(hdr + 4, (uint32_t)len);
+	else
+		be32enc(hdr + 4, (uint32_t)len);
+	hdr[8] = hdr[9] = 0;
+
+	if (sbuf_bcat(sb, hdr, sizeof(hdr)) == -1 ||
+	    sbuf_bcat(sb, sbuf_data(body), len) == -1)
+		return (-1);
+	return (0);
+}
+
+
+/*
+ * append the frame f as-is to sb.
+ *
+ * The frames of a v2.4 tag with the unsynchronisation flag are
+ * unsynchronised, but their own flags don't have to say so. The written tag
+ * never has this flag, so it is set on the frame instead.
+ *
+ * @return
+ *   0 on success, -1 on error.
+ */
+static int
+t_ftid3v2_frame_copy(const struct t_ftid3v2_data *data,
+    const struct t_ftid3v2_frame *f, struct sbuf *sb)
+{
+	unsigned char hdr[T_FTID3V2_HEADLEN];
+
+	assert(data != NULL);
+	assert(f != NULL);
+	assert(sb != NULL);
+
+	(void)memcpy(hdr, f->p, sizeof(hdr));
+	if (data->unsync)
+		hdr[9] |= T_FTID3V2_24_UNSYNC;
+
+	if (sbuf_bcat(sb, hdr, sizeof(hdr)) == -1 ||
+	    sbuf_bcat(sb, f->p + T_FTID3V2_HEADLEN, f->len) == -1)
+		return (-1);
+	return (0);
+}
+
+
+/*
+ * append the UTF-8 string s (and its terminator) to body using the encoding
+ * enc, which is either T_FTID3V2_UTF8, T_FTID3V2_LATIN1 (s must be ASCII) or
+ * T_FTID3V2_UTF16.
+ *
+ * @return
+ *   0 on success, -1 on error.
+ */
+static int
+t_ftid3v2_render_text(struct sbuf *body, int enc, const char *s, size_t len)
+{
+	const unsigned char *p, *end;
+	unsigned char u[4];
+	uint32_t c;
+	int n;
+
+	assert(body != NULL);
+	assert(s != NULL);
+
+	if (enc != T_FTID3V2_UTF16) {
+		if (sbuf_bcat(body, s, len) == -1 || sbuf_putc(body, '\0') == -1)
+			return (-1);
+		return (0);
+	}
+
+	/* UTF-16LE with a BOM */
+	if (sbuf_bcat(body, "\xff\xfe", 2) == -1)
+		return (-1);
+	p   = (const unsigned char *)s;
+	end = p + len;
+	while (p < end) {
+		if (p[0] < 0x80) {
+			c = p[0];
+			n = 1;
+		} else if ((p[0] & 0xe0) == 0xc0 && end - p >= 2) {
+			c = (uint32_t)(p[0] & 0x1f) << 6 | (p[1] & 0x3f);
+			n = 2;
+		} else if ((p[0] & 0xf0) == 0xe0 && end - p >= 3) {
+			c = (uint32_t)(p[0] & 0x0f) << 12 |
+			    (uint32_t)(p[1] & 0x3f) << 6 | (p[2] & 0x3f);
+			n = 3;
+		} else if ((p[0] & 0xf8) == 0xf0 && end - p >= 4) {
+			c = (uint32_t)(p[0] & 0x07) << 18 |
+			    (uint32_t)(p[1] & 0x3f) << 12 |
+			    (uint32_t)(p[2] & 0x3f) << 6 | (p[3] & 0x3f);
+			n = 4;
+		} else {
+			c = 0xfffd; /* invalid UTF-8 */
+			n = 1;
+		}
+		p += n;
+		if (c >= 0x10000 && c < 0x110000) {
+			c -= 0x10000;
+			u[0] = (unsigned char)((0xd800 | (c >> 10)) & 0xff);
+			u[1] = (unsigned char)((0xd800 | (c >> 10)) >> 8);
+			u[2] = (unsigned char)((0xdc00 | (c & 0x3ff)) & 0xff);
+			u[3] = (unsigned char)((0xdc00 | (c & 0x3ff)) >> 8);
+			n = 4;
+		} else {
+			if (c > 0xffff)
+				c = 0xfffd;
+			u[0] = (unsigned char)(c & 0xff);
+			u[1] = (unsigned char)(c >> 8);
+			n = 2;
+		}
+		if (sbuf_bcat(body, u, (size_t)n) == -1)
+			return (-1);
+	}
+
+	if (sbuf_bcat(body, "\0\0", 2) == -1)
+		return (-1);
+	return (0);
+}
+
+
+/*
+ * @param key
+ *   A tag key, interned (see t_key_intern()).
+ *
+ * @param buf
+ *   A buffer of at least 5 bytes, used when the key is a frame ID.
+ *
+ * @return
+ *   the frame ID used to store the tag key: the frame having this friendly
+ *   key, the key itself (in upper case) if it looks like a text frame ID, COMM
+ *   for the comments and TXXX for everything else.
+ */
+static const char *
+t_ftid3v2_frame_id(int version, const char *key, char *buf)
+{
+	size_t i;
+
+	assert(key != NULL);
+	assert(buf != NULL);
+
+	for (i = 0; i < NELEM(t_ftid3v2_keys); i++) {
+		if ((t_ftid3v2_keys[i].version == 0 ||
+		    t_ftid3v2_keys[i].version == version) &&
+		    t_tag_keycmp(key, t_ftid3v2_keys[i].key) == 0)
+			return (t_ftid3v2_keys[i].id);
+	}
+	if (key == t_key_comment)
+		return ("COMM");
+
+	/* keys are lower case, see t_tag_new() */
+	if (strlen(key) == 4 && toupper((unsigned char)key[0]) == 'T' &&
+	    t_tag_keycmp(key, "TXXX") != 0) {
+		for (i = 0; i < 4; i++) {
+			buf[i] = (char)toupper((unsigned char)key[i]);
+			if (!(buf[i] >= 'A' && buf[i] <= 'Z') &&
+			    !(buf[i] >= '0' && buf[i] <= '9'))
+				break;
+		}
+		buf[4] = '\0';
+		if (i == 4)
+			return (buf);
+	}
+
+	return ("TXXX");
+}
+
+
+/*
+ * get the language of the nth current COMM frame exposed as a comment tag (or
+ * of the last one if there are less) into the 3 bytes lang, "XXX" (unknown)
+ * if there is no such frame.
+ */
+static void
+t_ftid3v2_comm_lang(const struct t_ftid3v2_data *data, size_t n, char *lang)
+{
+	struct t_ftid3v2_frame f;
+	const unsigned char *p;
+	unsigned char *buf;
+	size_t off = 0, len;
+
+	assert(data != NULL);
+	assert(lang != NULL);
+
+	(void)memcpy(lang, "XXX", 3);
+	while (t_ftid3v2_frame_next(data, &off, &f) == 1) {
+		if (strcmp(f.id, "COMM") != 0 ||
+		    t_ftid3v2_frame_tags(data, &f, NULL) != 1 ||
+		    t_ftid3v2_frame_content(data, &f, &p, &len, &buf) != 0)
+			continue;
+		/* encoding and language */
+		if (len >= 4)
+			(void)memcpy(lang, p + 1, 3);
+		free(buf);
+		if (n-- == 0)
+			break;
+	}
+}
+
+
+/*
+ * find the description of the current TXXX frame for key.
+ *
+ * @return
+ *   The description with its original case (it is only different from key in
+ *   case, so it is klen bytes long) that should be passed to free(3) after use,
+ *   or NULL if there is no such frame (or on error).
+ */
+static char *
+t_ftid3v2_txxx_desc(const struct t_ftid3v2_data *data, const char *key,
+    size_t klen)
+{
+	struct t_ftid3v2_frame f;
+	const unsigned char *p, *desc;
+	unsigned char *buf;
+	char *s, *ret = NULL;
+	size_t off = 0, len, desclen;
+	int enc;
+
+	assert(data != NULL);
+	assert(key != NULL);
+
+	while (ret == NULL && t_ftid3v2_frame_next(data, &off, &f) == 1) {
+		if (strcmp(f.id, "TXXX") != 0 ||
+		    t_ftid3v2_frame_content(data, &f, &p, &len, &buf) != 0)
+			continue;
+		if (len > 0 && p[0] <= T_FTID3V2_UTF8) {
+			enc = *p++;
+			len--;
+			if (t_ftid3v2_text_next(enc, &p, &len, &desc, &desclen) == 1 &&
+			    (s = t_ftid3v2_utf8(enc, desc, desclen, &desclen)) != NULL) {
+				if (desclen == klen && strncasecmp(s, key, klen) == 0)
+					ret = strndup(s, klen);
+				if (s != (const char *)desc)
+					free(s);
+			}
+		}
+		free(buf);
+	}
+
+	return (ret);
+}
+
+
+/*
+ * write the tag header and the frames over the current tag, the rest of the
+ * tag become padding.
+ *
+ * @return
+ *   0 on success, -1 on error.
+ */
+static int
+t_ftid3v2_inplace(struct t_ftid3v2_data *data, int version, const char *frames,
+    size_t len)
+{
+	unsigned char *buf;
+	size_t wlen;
+	ssize_t n = -1;
+	int fd;
+
+	assert(data != NULL);
+	assert(data->version == version);
+	assert(frames != NULL);
+	assert(T_FTID3V2_HEADLEN + len <= data->tagsize);
+
+	/*
+	 * The padding following the old frames is already zero, unless the
+	 * tag was unsynchronised (its on-disk size is then unknown) or had a
+	 * footer.
+	 */
+	wlen = T_FTID3V2_HEADLEN + MAX(len, data->used);
+	if (data->buf != NULL || data->unsync || data->map[5] & T_FTID3V2_FOOTER ||
+	    data->map[5] & T_FTID3V2_EXTENDED)
+		wlen = data->tagsize;
+	if ((buf = calloc(1, wlen)) == NULL)
+		return (-1);
+	t_ftid3v2_header(buf, version, data->tagsize - T_FTID3V2_HEADLEN);
+	(void)memcpy(buf + T_FTID3V2_HEADLEN, frames, len);
+
+	if ((fd = open(data->path, O_WRONLY)) != -1) {
+		n = pwrite(fd, buf, wlen, 0);
+		if (close(fd) == -1)
+			n = -1;
+	}
+	free(buf);
+	if (n != (ssize_t)wlen)
+		return (-1);
+
+	/* the mapping is shared, so it reflect the new tag */
+	return (t_ftid3v2_map(data, -1));
+}
+
+
+/*
+ * rewrite the whole file with a new tag made of the frames and padlen bytes of
+ * padding, followed by the audio data.
+ *
+ * @return
+ *   0 on success, -1 on error.
+ */
+static int
+t_ftid3v2_rewrite(struct t_ftid3v2_data *data, int version, const char *frames,
+    size_t len, size_t padlen)
+{
+	struct stat st;
+	unsigned char *tag = NULL;
+	char *tempfile = NULL;
+	size_t taglen;
+	int fd = -1, tmpfd = -1, success = 0;
+
+	assert(data != NULL);
+	assert(frames != NULL || len == 0);
+	assert(len + padlen <= T_FTID3V2_MAXSIZE - T_FTID3V2_HEADLEN);
+
+	taglen = T_FTID3V2_HEADLEN + len + padlen;
+	if ((tag = calloc(1, taglen)) == NULL)
+		goto cleanup_label;
+	t_ftid3v2_header(tag, version, len + padlen);
+	if (len > 0)
+		(void)memcpy(tag + T_FTID3V2_HEADLEN, frames, len);
+
+	if ((fd = open(data->path, O_RDONLY)) == -1)
+		goto cleanup_label;
+	if (fstat(fd, &st) == -1)
+		goto cleanup_label;
+	if (asprintf(&tempfile, "%s/.__%s_XXXXXX", t_dirname(data->path), getprogname()) < 0) {
+		tempfile = NULL;
+		goto cleanup_label;
+	}
+	if ((tmpfd = mkstemps(tempfile, 0)) == -1)
+		goto cleanup_label;
+	(void)fchmod(tmpfd, st.st_mode & ALLPERMS);
+
+	if (t_write_all(tmpfd, tag, taglen) == -1)
+		goto cleanup_label;
+	if (st.st_size > (off_t)data->tagsize &&
+	    t_copy_range(fd, (off_t)data->tagsize, tmpfd,
+	    st.st_size - (off_t)data->tagsize) == -1)
+		goto cleanup_label;
+
+	if (close(tmpfd) == -1) {
+		tmpfd = -1;
+		goto cleanup_label;
+	}
+	tmpfd = -1;
+	if (rename(tempfile, data->path) == -1)
+		goto cleanup_label;
+
+	success = 1;
+	/* FALLTHROUGH */
+cleanup_label:
+	if (tmpfd != -1)
+		(void)close(tmpfd);
+	if (fd != -1)
+		(void)close(fd);
+	if (!success && tempfile != NULL)
+		(void)unlink(tempfile);
+	free(tempfile);
+	free(tag);
+	/* the old mapping is the replaced file */
+	if (success && t_ftid3v2_map(data, -1) == -1) {
+		warnx("%s: could not read the file back", data->path);
+		success = 0;
+	}
+	return (success ? 0 : -1);
+}
+
+
+/*
+ * overwrite the ID3v1 tag at the end of the file (if any) with the tags of
+ * tlist, so that players only reading ID3v1 don't see stale values. Values
+ * that don't fit are truncated silently, the ID3v2 tag has them all.
+ *
+ * @return
+ *   0 on success or if the file has no ID3v1 tag, -1 on error.
+ */
+static int
+t_ftid3v2_id3v1(const struct t_ftid3v2_data *data, int version,
+    const struct t_taglist *tlist)
+{
+	unsigned char v1[T_FTID3V2_V1LEN];
+	const struct t_tag *t;
+	const char *id;
+	char idbuf[5], *end;
+	unsigned long lu;
+	size_t i, off, len;
+	ssize_t n = -1;
+	int fd, genre;
+
+	assert(data != NULL);
+	assert(tlist != NULL);
+
+	if (data->map == NULL || data->maplen < data->tagsize + sizeof(v1) ||
+	    memcmp(data->map + data->maplen - sizeof(v1), "TAG", 3) != 0)
+		return (0);
+
+	/* the ID3v1.1 layout, see t_ftid3v1.c */
+	bzero(v1, sizeof(v1));
+	(void)memcpy(v1, "TAG", 3);
+	v1[127] = 0xff; /* no genre */
+	for (i = 0; i < tlist->count; i++) {
+		t = tlist->tags[i];
+		id = t_ftid3v2_frame_id(version, t->key, idbuf);
+		off = len = 0;
+		if (strcmp(id, "TIT2") == 0) {
+			off = 3;
+			len = 30;
+		} else if (strcmp(id, "TPE1") == 0) {
+			off = 33;
+			len = 30;
+		} else if (strcmp(id, "TALB") == 0) {
+			off = 63;
+			len = 30;
+		} else if (strcmp(id, "TDRC") == 0 || strcmp(id, "TYER") == 0) {
+			off = 93;
+			len = 4;
+		} else if (strcmp(id, "COMM") == 0) {
+			off = 97;
+			len = 28;
+		} else if (strcmp(id, "TRCK") == 0 && v1[126] == 0) {
+			/* like "3" or "3/12" */
+			lu = strtoul(t->val, &end, 10);
+			if (end != t->val && lu > 0 && lu <= UCHAR_MAX)
+				v1[126] = (unsigned char)lu;
+		} else if (strcmp(id, "TCON") == 0 && v1[127] == 0xff) {
+			if ((genre = t_id3genre_index(t->val)) != -1)
+				v1[127] = (unsigned char)genre;
+		}
+		/* only the first value of each field */
+		if (len > 0 && v1[off] == '\0')
+			(void)memcpy(v1 + off, t->val, MIN(t->vlen, len));
+	}
+
+	if ((fd = open(data->path, O_WRONLY)) != -1) {
+		n = pwrite(fd, v1, sizeof(v1), (off_t)(data->maplen - sizeof(v1)));
+		if (close(fd) == -1)
+			n = -1;
+	}
+	return (n == (ssize_t)sizeof(v1) ? 0 : -1);
+}
+
+
+/* fill the tag header, without flags */
+static void
+t_ftid3v2_header(unsigned char *p, int version, size_t size)
+{
+
+	assert(p != NULL);
+	assert(version == 3 || version == 4);
+	assert(size <= T_FTID3V2_MAXSIZE);
+
+	(void)memcpy(p, "ID3", 3);
+	p[3] = (unsigned char)version;
+	p[4] = 0; /* revision */
+	p[5] = 0; /* flags */
+	syncsafe_enc(p + 6, (uint32_t)size);
+}
+
+
+static uint32_t
+syncsafe_dec(const unsigned char *p)
+{
+
+	return ((uint32_t)(p[0] & 0x7f) << 21 | (uint32_t)(p[1] & 0x7f) << 14 |
+	    (uint32_t)(p[2] & 0x7f) << 7 | (uint32_t)(p[3] & 0x7f));
+}
+
+
+static void
+syncsafe_enc(unsigned char *p, uint32_t u)
+{
+
+	p[0] = (unsigned char)((u >> 21) & 0x7f);
+	p[1] = (unsigned char)((u >> 14) & 0x7f);
+	p[2] = (unsigned char)((u >> 7) & 0x7f);
+	p[3] = (unsigned char)(u & 0x7f);
+}
+
+
+static uint32_t
+be32dec(const unsigned char *p)
+{
+
+	return ((uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 |
+	    (uint32_t)p[2] << 8 | (uint32_t)p[3]);
+}
+
+
+static void
+be32enc(unsigned char *p, uint32_t u)
+{
+
+	p[0] = (unsigned char)((u >> 24) & 0xff);
+	p[1] = (unsigned char)((u >> 16) & 0xff);
+	p[2] = (unsigned char)((u >> 8) & 0xff);
+	p[3] = (unsigned char)(u & 0xff);
+}
@@ -1,40 +1,86 @@
 /*
  * t_ftoggvorbis.c
  *
- * Ogg/Vorbis backend, using libogg, libvorbis and libvorbisfile
+ * Ogg/Vorbis backend, using libogg and libvorbis
  */
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <unistd.h>
 
 /* Ogg headers */
 #include "ogg/ogg.h"
 /* Vorbis headers */
-#define	OV_EXCLUDE_STATIC_CALLBACKS	1
-#include "vorbis/vorbisfile.h"
-#undef	OV_EXCLUDE_STATIC_CALLBACKS
 #include "vorbis/codec.h"
 
 #include "t_config.h"
 #include "t_backend.h"
+#include "t_crc32.h"
 
 
 static const char libid[] = "libvorbis";
 
+/* how much is read(2) at once when looking for the header pages */
+#define	T_FTOGGVORBIS_READSIZ	4096
+/*
+ * size of the buffer used to remux the audio pages, should be more than the
+ * largest Ogg page (27 + 255 + 255 * 255 bytes).
+ */
+#define	T_FTOGGVORBIS_REMUXSIZ	(256 * 1024)
+/* how many time we try to pad the comment packet to fit the header pages */
+#define	T_FTOGGVORBIS_PADTRY	8
+
 
 struct t_ftoggvorbis_data {
 	const char		*libid; /* pointer to libid */
 	const char		*path; /* this is needed for t_ftoggvorbis_write() */
-	struct OggVorbis_File	 vf;
+	struct vorbis_comment	 vc;
+};
+
+/*
+ * The header pages of the first logical stream, see t_ftoggvorbis_scan().
+ *
+ * The first page hold only the identification packet. The comment and setup
+ * packets follow on their own page(s), the setup packet ending the last one,
+ * so that [start, end) can be replaced without touching the audio pages.
+ */
+struct t_ftoggvorbis_hdr {
+	int		 serialno;
+	off_t		 start;  /* offset of the comment packet first page */
+	off_t		 end;    /* offset of the first audio page */
+	long		 npage;  /* count of pages in [start, end) */
+	ogg_packet	 id;     /* copy of the identification packet */
+	ogg_packet	 setup;  /* copy of the setup packet */
 };
 
 
 struct t_backend	*t_ftoggvorbis_backend(void);
 
-static void 		*t_ftoggvorbis_init(const char *path);
+static int		 t_ftoggvorbis_probe(const struct t_backend_probe *probe);
+static void 		*t_ftoggvorbis_open(const char *path,
+			     struct t_backend_probe *probe);
 static struct t_taglist	*t_ftoggvorbis_read(void *opaque);
 static int		 t_ftoggvorbis_write(void *opaque, const struct t_taglist *tlist);
 static void		 t_ftoggvorbis_clear(void *opaque);
 
+/* helper for t_ftoggvorbis_open() and t_ftoggvorbis_write() */
+static int		 t_ftoggvorbis_scan(int fd, struct vorbis_comment *vc,
+			     struct t_ftoggvorbis_hdr *hdr);
 /* helpers for t_ftoggvorbis_write() */
-static int		 fwrite_drain_func(void *fp, const char *data, int len);
+static int		 t_ftoggvorbis_repage(const struct t_ftoggvorbis_hdr *hdr,
+			     const ogg_packet *vcpkt, long pad, struct sbuf *pages,
+			     long *npage);
+static int		 t_ftoggvorbis_rewrite(int fd, const char *path,
+			     const struct t_ftoggvorbis_hdr *hdr, struct sbuf *pages,
+			     long npage);
+static off_t		 t_ftoggvorbis_remux(int fd, off_t off, int out,
+			     int serialno, long delta);
+static void		 t_ftoggvorbis_page_setno(ogg_page *og, long pageno);
+static void		 ogg_page_crc_set(ogg_page *og);
+static size_t		 ogg_page_parse(ogg_page *og, unsigned char *p, size_t len);
+static int		 ogg_packet_copy(ogg_packet *dst, const ogg_packet *src);
 static int		 sbuf_write_ogg_page(struct sbuf *sb, ogg_page *p);
 
 
@@ -44,7 +90,8 @@ t_ftoggvorbis_backend(void)
 	static struct t_backend b = {
 		.libid		= libid,
 		.desc		= "Ogg/Vorbis files format",
-		.init		= t_ftoggvorbis_init,
+		.probe		= t_ftoggvorbis_probe,
+		.open		= t_ftoggvorbis_open,
 		.read		= t_ftoggvorbis_read,
 		.write		= t_ftoggvorbis_write,
 		.clear		= t_ftoggvorbis_clear,
@@ -53,9 +100,27 @@ t_ftoggvorbis_backend(void)
 }
 
 
+/*
+ * A Vorbis stream first page has a 27 bytes header and a single lacing value
+ * (the identification packet is 30 bytes long), then the packet itself which
+ * start with the packet type (1) and "vorbis".
+ */
+static int
+t_ftoggvorbis_probe(const struct t_backend_probe *probe)
+{
+
+	assert(probe != NULL);
+
+	return (probe->headlen >= 35 &&
+	    memcmp(probe->head, "OggS", 4) == 0 &&
+	    memcmp(probe->head + 28, "\x01vorbis", 7) == 0);
+}
+
+
 static void *
-t_ftoggvorbis_init(const char *path)
+t_ftoggvorbis_open(const char *path, struct t_backend_probe *probe)
 {
+	int fd, success;
 	size_t plen;
 	char *p;
 	struct t_ftoggvorbis_data *data;
@@ -69,15 +134,148 @@ t_ftoggvorbis_init(const char *path)
 	data->libid = libid;
 	data->path = p = (char *)(data + 1);
 	(void)memcpy(p, path, plen + 1);
-	bzero(&data->vf, sizeof(struct OggVorbis_File));
+	vorbis_comment_init(&data->vc);
 
-	if (ov_fopen(data->path, &data->vf) != 0) {
-		/* XXX: check OV_EFAULT or OV_EREAD? */
-		free(data);
-		return (NULL);
-	}
+	if ((fd = t_backend_probe_fd(probe, data->path)) == -1)
+		goto error_label;
+	success = t_ftoggvorbis_scan(fd, &data->vc, NULL);
+	(void)close(fd);
+	if (!success)
+		goto error_label;
 
 	return (data);
+error_label:
+	vorbis_comment_clear(&data->vc);
+	free(data);
+	return (NULL);
+}
+
+
+/*
+ * Read the header packets of the first logical stream.
+ *
+ * We only sync the pages needed to get the header packets and stop there, so
+ * that the cost does not depend on the file length (ov_fopen() would bisect
+ * the whole file to find the links boundaries). The comment packet may span
+ * over several pages (e.g. with embedded cover art).
+ *
+ * @param vc
+ *   The vorbis_comment filled with the comment packet.
+ *
+ * @param hdr
+ *   If NULL, stop right after the comment packet. Otherwise the setup packet
+ *   is read too and hdr is filled. On success the caller should release hdr
+ *   packets with ogg_packet_clear().
+ *
+ * @return
+ *   1 on success, 0 otherwise.
+ */
+static int
+t_ftoggvorbis_scan(int fd, struct vorbis_comment *vc,
+    struct t_ftoggvorbis_hdr *hdr)
+{
+	ogg_sync_state	 oy;
+	ogg_stream_state os;
+	ogg_page	 og;
+	ogg_packet	 op;
+	vorbis_info	 vi;
+	off_t off = 0;
+	long n, npage = 0;
+	int npacket = 0, want, stream_init = 0, success = 0;
+
+	assert(fd >= 0);
+	assert(vc != NULL);
+
+	want = (hdr == NULL ? 2 : 3);
+	if (hdr != NULL)
+		bzero(hdr, sizeof(struct t_ftoggvorbis_hdr));
+	(void)ogg_sync_init(&oy); /* always return 0 */
+	vorbis_info_init(&vi);
+
+	while (npacket < want) {
+		char *buf;
+		ssize_t nread;
+
+		n = ogg_sync_pageseek(&oy, &og);
+		if (n == 0) {
+			/* more data needed */
+			if ((buf = ogg_sync_buffer(&oy, T_FTOGGVORBIS_READSIZ)) == NULL)
+				goto cleanup_label;
+			nread = read(fd, buf, T_FTOGGVORBIS_READSIZ);
+			if (nread <= 0)
+				goto cleanup_label;
+			/* casting nread to long is fine: it is at most READSIZ */
+			if (ogg_sync_wrote(&oy, (long)nread) == -1)
+				goto cleanup_label;
+			continue;
+		} else if (n < 0) {
+			/* bytes were skipped, we're out of sync */
+			if (stream_init)
+				goto cleanup_label;
+			off += -n;
+			continue;
+		}
+
+		/* here ogg_sync_pageseek() returned a page of n bytes */
+		off += n;
+		npage++;
+		if (!stream_init) {
+			if (ogg_stream_init(&os, ogg_page_serialno(&og)) == -1)
+				goto cleanup_label;
+			stream_init = 1;
+		}
+		if (ogg_stream_pagein(&os, &og) == -1)
+			goto cleanup_label;
+		while (npacket < want) {
+			int r = ogg_stream_packetout(&os, &op);
+			if (r == 0)
+				break; /* need another page */
+			if (r == -1)
+				goto cleanup_label;
+			if (vorbis_synthesis_headerin(&vi, vc, &op) != 0)
+				goto cleanup_label;
+			if (hdr != NULL && npacket == 0) {
+				if (ogg_packet_copy(&hdr->id, &op) == -1)
+					goto cleanup_label;
+			} else if (hdr != NULL && npacket == 2) {
+				if (ogg_packet_copy(&hdr->setup, &op) == -1)
+					goto cleanup_label;
+			}
+			npacket++;
+		}
+		if (hdr != NULL && npage == 1) {
+			/* the identification packet must be alone on its page */
+			if (npacket != 1)
+				goto cleanup_label;
+			hdr->start = off;
+		}
+	}
+
+	if (hdr != NULL) {
+		/*
+		 * the setup packet must end its page, i.e. no other packet
+		 * (complete or not) should follow it.
+		 */
+		if (ogg_stream_packetpeek(&os, NULL) != 0 ||
+		    og.header[27 + og.header[26] - 1] == 255)
+			goto cleanup_label;
+		hdr->serialno = ogg_page_serialno(&og);
+		hdr->end      = off;
+		hdr->npage    = npage - 1;
+	}
+
+	success = 1;
+	/* FALLTHROUGH */
+cleanup_label:
+	if (stream_init)
+		(void)ogg_stream_clear(&os);
+	vorbis_info_clear(&vi);
+	(void)ogg_sync_clear(&oy);
+	if (!success && hdr != NULL) {
+		ogg_packet_clear(&hdr->id);
+		ogg_packet_clear(&hdr->setup);
+	}
+	return (success);
 }
 
 
@@ -93,10 +291,7 @@ t_ftoggvorbis_read(void *opaque)
 	data = opaque;
 	assert(data->libid == libid);
 
-	vc = ov_comment(&data->vf, -1);
-	if (vc == NULL)
-		return (NULL);
-
+	vc = &data->vc;
 	tlist = t_taglist_new();
 	if (tlist == NULL)
 		return (NULL);
@@ -123,283 +318,405 @@ t_ftoggvorbis_read(void *opaque)
 }
 
 
+/*
+ * We only need to replace the comment packet, which live in the header pages
+ * at the beginning of the file. The new header pages are built, padding the
+ * comment packet with zeros (the decoder ignore anything past the framing
+ * bit) in order to match the size of the old ones. If it fit, the header pages
+ * are overwritten in place. Otherwise the file is rewritten, see
+ * t_ftoggvorbis_rewrite().
+ */
 static int
 t_ftoggvorbis_write(void *opaque, const struct t_taglist *tlist)
 {
-	FILE             *fp_in  = NULL;  /* input file pointer */
-	FILE             *fp_out = NULL; /* output file pointer */
-	ogg_sync_state    oy_in;  /* sync and verify incoming physical bitstream */
-	ogg_stream_state  os_in;  /* take physical pages, weld into a logical
-	                             stream of packets */
-	ogg_stream_state  os_out; /* take physical pages, weld into a logical
-	                             stream of packets */
-	ogg_page          og_in;  /* one Ogg bitstream page. Vorbis packets are inside */
-	ogg_page          og_out; /* one Ogg bitstream page. Vorbis packets are inside */
-	ogg_packet        op_in;  /* one raw packet of data for decode */
-	ogg_packet        my_vc_packet; /* our custom packet containing vc_out */
-	vorbis_info       vi_in;  /* struct that stores all the static vorbis
-	                             bitstream settings */
-	vorbis_comment    vc_in;  /* struct that stores all the bitstream user
-	                             comment */
-	vorbis_comment    vc_out; /* struct that stores all the bitstream user
-	                             comment */
-	unsigned long     nstream_in; /* stream counter */
-	unsigned long     npage_in;   /* page counter */
-	unsigned long     npacket_in; /* packet counter */
-	long              bs;     /* blocksize of the current packet */
-	long              lastbs; /* blocksize of the last packet */
-	ogg_int64_t       granulepos; /* granulepos of the current page */
-	struct sbuf *sb = NULL;
-	char *tempfile  = NULL;
 	struct t_ftoggvorbis_data *data;
+	struct t_ftoggvorbis_hdr hdr;
+	vorbis_comment vc_in, vc_out;
+	ogg_packet vcpkt;
+	struct sbuf *pages = NULL;
 	const struct t_tag *t;
-	enum {
-		BUILDING_VC_PACKET, SETUP, B_O_S, START_READING,
-		STREAMS_INITIALIZED, READING_HEADERS, READING_DATA,
-		READING_DATA_NEED_FLUSH, READING_DATA_NEED_PAGEOUT, E_O_S,
-		WRITE_FINISH, RENAMING, DONE_SUCCESS,
-	} state;
+	off_t oldlen;
+	ssize_t newlen = -1;
+	long npage = 0, pad = 0;
+	int i, fd = -1, success = 0;
 
 	assert(opaque != NULL);
 	data = opaque;
 	assert(data->libid == libid);
 
-	/*
-	 * In order to modify the file's tag, we have to rewrite the entire
-	 * file. The Ogg container is divided into "pages" and "packets" and the
-	 * algorithm is to replace the SECOND ogg packet (which contains vorbis
-	 * comments) and copy ALL THE OTHERS. See "Metadata workflow":
-	 * https://xiph.org/vorbis/doc/libvorbis/overview.html
-	 */
-
-	state = BUILDING_VC_PACKET;
+	bzero(&hdr, sizeof(struct t_ftoggvorbis_hdr));
+	bzero(&vcpkt, sizeof(ogg_packet));
+	vorbis_comment_init(&vc_in);
 	vorbis_comment_init(&vc_out);
-	TAILQ_FOREACH(t, tlist->tags, entries)
-		vorbis_comment_add_tag(&vc_out, t->key, t->val);
+
 	/* create the packet holding our vorbis_comment */
-	if (vorbis_commentheader_out(&vc_out, &my_vc_packet) != 0)
+	T_TAGLIST_FOREACH(t, tlist)
+		vorbis_comment_add_tag(&vc_out, t->key, t->val);
+	if (vorbis_commentheader_out(&vc_out, &vcpkt) != 0) {
+		warnx("%s: could not build the Vorbis comment header",
+		    data->path);
 		goto cleanup_label;
-	vorbis_comment_clear(&vc_out);
+	}
 
-	state = SETUP;
-	/* open files & stuff */
-	(void)ogg_sync_init(&oy_in); /* always return 0 */
-	if ((fp_in = fopen(data->path, "r")) == NULL)
-		goto cleanup_label;
-	if ((sb = sbuf_new(NULL, NULL, BUFSIZ + 1, SBUF_FIXEDLEN)) == NULL)
+	if ((fd = open(data->path, O_RDWR)) == -1) {
+		warn("%s", data->path);
 		goto cleanup_label;
-	/* open the write file pointer */
-	if (asprintf(&tempfile, "%s/.__%s_XXXXXX", t_dirname(data->path), getprogname()) < 0)
-		goto cleanup_label;
-	if (mkstemps(tempfile, 0) == -1)
+	}
+	if (!t_ftoggvorbis_scan(fd, &vc_in, &hdr)) {
+		warnx("%s: could not read the Vorbis header packets",
+		    data->path);
 		goto cleanup_label;
-	if ((fp_out = fopen(tempfile, "w")) == NULL)
+	}
+	if ((pages = sbuf_new_auto()) == NULL) {
+		warn("%s", data->path);
 		goto cleanup_label;
-	sbuf_set_drain(sb, fwrite_drain_func, fp_out);
-	lastbs = granulepos = 0;
-
-	nstream_in = 0;
-bos_label: /* beginning of a stream */
-	state = B_O_S; /* never read, but that's fine */
-	nstream_in += 1;
-	npage_in = npacket_in = 0;
-	vorbis_info_init(&vi_in);
-	vorbis_comment_init(&vc_in);
+	}
 
-	state = START_READING;
-	/* main loop: read the input file into buf in order to sync pages out */
-	while (state != E_O_S) {
-		switch (ogg_sync_pageout(&oy_in, &og_in)) {
-		case 0:  /* more data needed or an internal error occurred. */
-		case -1: /* stream has not yet captured sync (bytes were skipped). */
-			if (feof(fp_in)) {
-				if (state < READING_DATA)
-					goto cleanup_label;
-				/* There is no more data to read and we could
-				   not get a page so we're done here. */
-				state = E_O_S;
-			} else {
-				/* read more data and try again to get a page. */
-				char *buf;
-				/* get a buffer */
-				if ((buf = ogg_sync_buffer(&oy_in, BUFSIZ)) == NULL)
-					goto cleanup_label;
-				/* read a part of the file */
-				/* casting fread return value to int is fine: it
-				   is at most BUFSIZ */
-				int s = (int)fread(buf, 1, BUFSIZ, fp_in);
-				/* tell ogg how much was read */
-				if (ogg_sync_wrote(&oy_in, s) == -1)
-					goto cleanup_label;
-			}
-			continue;
-		}
-		/* here ogg_sync_pageout() returned 1 and a page was sync'ed. */
-		if (++npage_in == 1) {
-			/* init both input and output streams with the serialno
-			   of the first page */
-			if (ogg_stream_init(&os_in, ogg_page_serialno(&og_in)) == -1)
-				goto cleanup_label;
-			if (ogg_stream_init(&os_out, ogg_page_serialno(&og_in)) == -1) {
-				ogg_stream_clear(&os_in);
-				goto cleanup_label;
-			}
-			state = STREAMS_INITIALIZED;
+	oldlen = hdr.end - hdr.start;
+	for (i = 0; i < T_FTOGGVORBIS_PADTRY; i++) {
+		if (t_ftoggvorbis_repage(&hdr, &vcpkt, pad, pages,
+		    &npage) == -1) {
+			warn("%s", data->path);
+			goto cleanup_label;
 		}
+		newlen = sbuf_len(pages);
+		if (newlen == oldlen || (newlen > oldlen && pad == 0))
+			break;
+		/* went past oldlen: the lacing overhead made it unreachable */
+		if (newlen < oldlen && pad > 0)
+			break;
+		pad += (long)(oldlen - newlen);
+		if (pad < 0)
+			break;
+	}
 
-		/* put the page in input stream, and then loop through each its
-		   packet(s) */
-		if (ogg_stream_pagein(&os_in, &og_in) == -1)
+	if (newlen == oldlen && npage == hdr.npage) {
+		if (pwrite(fd, sbuf_data(pages), (size_t)newlen,
+		    hdr.start) != newlen) {
+			warn("%s", data->path);
+			goto cleanup_label;
+		}
+	} else {
+		if (pad != 0 &&
+		    t_ftoggvorbis_repage(&hdr, &vcpkt, 0, pages, &npage) == -1) {
+			warn("%s", data->path);
 			goto cleanup_label;
-		while (ogg_stream_packetout(&os_in, &op_in) == 1) {
-			ogg_packet *target;
-			/*
-			 * This is where we really do what we mean to do: the
-			 * second packet is the commentheader packet, we replace
-			 * it with my_vc_packet if we're on the first stream.
-			 */
-			if (++npacket_in == 2 && nstream_in == 1)
-				target = &my_vc_packet;
-			else
-				target = &op_in;
-
-			if (npacket_in <= 3) {
-				/*
-				 * The first three packets are header packets.
-				 * We use them to get the vorbis_info which
-				 * will be used later. vc_in will not be unused.
-				 */
-				if (vorbis_synthesis_headerin(&vi_in, &vc_in, &op_in) != 0)
-					goto cleanup_label;
-				/* force a flush after the third ogg_packet */
-				state = (npacket_in == 3 ? READING_DATA_NEED_FLUSH : READING_HEADERS);
-			} else {
-				/*
-				 * granulepos computation.
-				 *
-				 * The granulepos is stored into the *pages* and
-				 * is used by the codec to seek through the
-				 * bitstream.  Its value is codec dependent (in
-				 * the Vorbis case it is the number of samples
-				 * elapsed).
-				 *
-				 * The vorbis_packet_blocksize() actually
-				 * compute the number of sample that would be
-				 * stored by the packet (without decoding it).
-				 * This is the same formula as in vcedit example
-				 * from vorbis-tools.
-				 *
-				 * We use here the vorbis_info previously filled
-				 * when reading header packets.
-				 *
-				 * XXX: check if this is not a vorbis stream ?
-				 */
-				bs = vorbis_packet_blocksize(&vi_in, &op_in);
-				if (bs < 0)
-					goto cleanup_label;
-				granulepos += (lastbs == 0 ? 0 : (bs + lastbs) / 4);
-				lastbs = bs;
-
-				/* write page(s) if needed */
-				if (state == READING_DATA_NEED_FLUSH) {
-					while (ogg_stream_flush(&os_out, &og_out))
-						(void)sbuf_write_ogg_page(sb, &og_out);
-				} else if (state == READING_DATA_NEED_PAGEOUT) {
-					while (ogg_stream_pageout(&os_out, &og_out))
-						(void)sbuf_write_ogg_page(sb, &og_out);
-				}
-
-				/*
-				 * Decide wether we need to write a page based
-				 * on our granulepos computation. The -1 case is
-				 * very common because only the last packet of a
-				 * page has its granulepos set by the ogg layer
-				 * (which only store a granulepos per page), so
-				 * all the other have a value of -1 (we need to
-				 * set the granulepos for each packet though).
-				 *
-				 * The other cases logic are borrowed from
-				 * vcedit and I fail to see how granulepos could
-				 * mismatch because we don't alter the data
-				 * packet.
-				 */
-				state = READING_DATA;
-				if (op_in.granulepos == -1) {
-					op_in.granulepos = granulepos;
-				} else if (granulepos <= op_in.granulepos) {
-					state = READING_DATA_NEED_PAGEOUT;
-				} else /* if granulepos > op_in.granulepos */ {
-					state = READING_DATA_NEED_FLUSH;
-					granulepos = op_in.granulepos;
-				}
-			}
-			/* insert the target packet into the output stream */
-			if (ogg_stream_packetin(&os_out, target) == -1)
-				goto cleanup_label;
 		}
-		if (ogg_page_eos(&og_in)) {
-			/* og_in was the last page of the stream */
-			state = E_O_S;
+		if (t_ftoggvorbis_rewrite(fd, data->path, &hdr, pages,
+		    npage) == -1) {
+			warn("%s", data->path);
+			goto cleanup_label;
 		}
 	}
 
-	/* forces remaining packets into a last page */
-	os_out.e_o_s = 1;
-	while (ogg_stream_flush(&os_out, &og_out))
-		(void)sbuf_write_ogg_page(sb, &og_out);
-	/* ogg_page and ogg_packet structs always point to storage in libvorbis.
-	   They're never freed or manipulated directly */
-
-	/* check if we need to read another stream */
-	if (!feof(fp_in)) {
-		ogg_stream_clear(&os_in);
-		ogg_stream_clear(&os_out);
-		vorbis_comment_clear(&vc_in);
-		vorbis_info_clear(&vi_in);
-		goto bos_label;
-	} else {
-		(void)fclose(fp_in);
-		fp_in = NULL;
+	success = 1;
+	/* FALLTHROUGH */
+cleanup_label:
+	if (fd != -1 && close(fd) == -1 && success) {
+		warn("%s", data->path);
+		success = 0;
 	}
+	if (pages != NULL)
+		sbuf_delete(pages);
+	ogg_packet_clear(&hdr.id);
+	ogg_packet_clear(&hdr.setup);
+	ogg_packet_clear(&vcpkt);
+	vorbis_comment_clear(&vc_out);
+	vorbis_comment_clear(&vc_in);
+	return (success ? 0 : -1);
+}
 
-	state = WRITE_FINISH;
-	if (sbuf_finish(sb) == -1)
-		goto cleanup_label;
-	if (fclose(fp_out) != 0)
+
+/*
+ * Build the header pages holding vcpkt (padded by pad zeros) and the setup
+ * packet from hdr into pages.
+ *
+ * @param npage
+ *   Set to the count of pages built.
+ *
+ * @return
+ *   0 on success, -1 on error.
+ */
+static int
+t_ftoggvorbis_repage(const struct t_ftoggvorbis_hdr *hdr,
+    const ogg_packet *vcpkt, long pad, struct sbuf *pages, long *npage)
+{
+	ogg_stream_state os;
+	ogg_packet op;
+	ogg_page og;
+	unsigned char *padded = NULL;
+	int success = 0;
+
+	assert(hdr != NULL);
+	assert(vcpkt != NULL);
+	assert(pad >= 0);
+	assert(pages != NULL);
+	assert(npage != NULL);
+
+	sbuf_clear(pages);
+	*npage = 0;
+	if (ogg_stream_init(&os, hdr->serialno) == -1)
+		return (-1);
+
+	/*
+	 * the identification page is kept as-is in the file, we only need it
+	 * to get the right page sequence numbers.
+	 */
+	op = hdr->id;
+	if (ogg_stream_packetin(&os, &op) == -1)
 		goto cleanup_label;
-	fp_out = NULL;
+	while (ogg_stream_flush(&os, &og) != 0)
+		continue;
 
-	state = RENAMING;
-	if (rename(tempfile, data->path) == -1)
+	op = *vcpkt;
+	if (pad > 0) {
+		if ((padded = calloc(1, (size_t)(op.bytes + pad))) == NULL)
+			goto cleanup_label;
+		(void)memcpy(padded, op.packet, (size_t)op.bytes);
+		op.packet = padded;
+		op.bytes += pad;
+	}
+	if (ogg_stream_packetin(&os, &op) == -1)
+		goto cleanup_label;
+	op = hdr->setup;
+	if (ogg_stream_packetin(&os, &op) == -1)
+		goto cleanup_label;
+	/* the setup packet must end the last header page, so flush */
+	while (ogg_stream_flush(&os, &og) != 0) {
+		if (sbuf_write_ogg_page(pages, &og) == -1)
+			goto cleanup_label;
+		*npage += 1;
+	}
+	if (sbuf_finish(pages) == -1)
 		goto cleanup_label;
 
-	state = DONE_SUCCESS;
+	success = 1;
+	/* FALLTHROUGH */
 cleanup_label:
-	if (state >= STREAMS_INITIALIZED) {
-		ogg_stream_clear(&os_in);
-		ogg_stream_clear(&os_out);
+	free(padded);
+	(void)ogg_stream_clear(&os);
+	return (success ? 0 : -1);
+}
+
+
+/*
+ * Rewrite the file into a temporary file and rename(2) it over path.
+ *
+ * This is a page level remux: the identification page is copied, the header
+ * pages are replaced by pages and the audio pages are streamed verbatim, see
+ * t_ftoggvorbis_remux().
+ *
+ * @return
+ *   0 on success, -1 on error.
+ */
+static int
+t_ftoggvorbis_rewrite(int fd, const char *path,
+    const struct t_ftoggvorbis_hdr *hdr, struct sbuf *pages, long npage)
+{
+	struct stat st;
+	char *tempfile = NULL;
+	off_t off;
+	int tmpfd = -1, success = 0;
+
+	assert(fd >= 0);
+	assert(path != NULL);
+	assert(hdr != NULL);
+	assert(pages != NULL);
+
+	if (fstat(fd, &st) == -1)
+		goto cleanup_label;
+	if (asprintf(&tempfile, "%s/.__%s_XXXXXX", t_dirname(path), getprogname()) < 0) {
+		tempfile = NULL;
+		goto cleanup_label;
+	}
+	if ((tmpfd = mkstemps(tempfile, 0)) == -1)
+		goto cleanup_label;
+	(void)fchmod(tmpfd, st.st_mode & ALLPERMS);
+
+	/* the identification page */
+	if (t_copy_range(fd, 0, tmpfd, hdr->start) == -1)
+		goto cleanup_label;
+	/* the new header pages */
+	if (t_write_all(tmpfd, sbuf_data(pages), (size_t)sbuf_len(pages)) == -1)
+		goto cleanup_label;
+	/* the audio pages */
+	off = hdr->end;
+	if (npage != hdr->npage) {
+		off = t_ftoggvorbis_remux(fd, off, tmpfd, hdr->serialno,
+		    npage - hdr->npage);
+		if (off == -1)
+			goto cleanup_label;
 	}
-	if (state >= START_READING) {
-		vorbis_comment_clear(&vc_in);
-		vorbis_info_clear(&vi_in);
+	if (st.st_size > off &&
+	    t_copy_range(fd, off, tmpfd, st.st_size - off) == -1)
+		goto cleanup_label;
+
+	if (close(tmpfd) == -1) {
+		tmpfd = -1;
+		goto cleanup_label;
 	}
-	ogg_sync_clear(&oy_in);
-	if (fp_out != NULL)
-		(void)fclose(fp_out);
-	if (tempfile != NULL && eaccess(tempfile, R_OK) != -1)
+	tmpfd = -1;
+	if (rename(tempfile, path) == -1)
+		goto cleanup_label;
+
+	success = 1;
+	/* FALLTHROUGH */
+cleanup_label:
+	if (tmpfd != -1)
+		(void)close(tmpfd);
+	if (!success && tempfile != NULL)
 		(void)unlink(tempfile);
 	free(tempfile);
-	if (sb != NULL)
-		sbuf_delete(sb);
-	if (fp_in != NULL)
-		(void)fclose(fp_in);
-	ogg_packet_clear(&my_vc_packet);
-	vorbis_comment_clear(&vc_out);
+	return (success ? 0 : -1);
+}
 
-	/*
-	 * FIXME: at the moment, we don't warn about the problem.
-	 */
-	return (state == DONE_SUCCESS ? 0 : -1);
+
+/*
+ * Copy the pages starting at off from fd to out, shifting the page sequence
+ * number of the logical stream serialno by delta (and updating their CRC).
+ *
+ * The pages are patched in a buffer and never decoded. We stop right after
+ * the last page of the stream, everything following (i.e. chained streams)
+ * can be copied as-is by the caller.
+ *
+ * @return
+ *   The offset of the first byte not copied, -1 on error.
+ */
+static off_t
+t_ftoggvorbis_remux(int fd, off_t off, int out, int serialno, long delta)
+{
+	ogg_page og;
+	unsigned char *buf;
+	size_t len = 0, pos, plen;
+	ssize_t nread;
+	int eos = 0;
+
+	assert(fd >= 0);
+	assert(off >= 0);
+	assert(out >= 0);
+
+	if ((buf = malloc(T_FTOGGVORBIS_REMUXSIZ)) == NULL)
+		return (-1);
+
+	/* buf hold the bytes in [off, off + len) */
+	while (!eos) {
+		nread = pread(fd, buf + len, T_FTOGGVORBIS_REMUXSIZ - len,
+		    off + (off_t)len);
+		if (nread == -1) {
+			if (errno == EINTR)
+				continue;
+			goto error_label;
+		}
+		len += (size_t)nread;
+
+		for (pos = 0; !eos && pos < len; pos += plen) {
+			plen = ogg_page_parse(&og, buf + pos, len - pos);
+			if (plen == 0) {
+				break; /* incomplete page */
+			} else if (plen == (size_t)-1) {
+				warnx("invalid Ogg page at offset %jd",
+				    (intmax_t)(off + (off_t)pos));
+				errno = EINVAL;
+				goto error_label;
+			}
+			if (ogg_page_serialno(&og) == serialno) {
+				t_ftoggvorbis_page_setno(&og,
+				    ogg_page_pageno(&og) + delta);
+				eos = ogg_page_eos(&og);
+			}
+		}
+
+		if (t_write_all(out, buf, pos) == -1)
+			goto error_label;
+		off += (off_t)pos;
+		len -= pos;
+		(void)memmove(buf, buf + pos, len);
+		/* EOF, a truncated page (if any) will be copied as-is */
+		if (nread == 0 && pos == 0)
+			break;
+	}
+
+	free(buf);
+	return (off);
+error_label:
+	free(buf);
+	return (-1);
+}
+
+
+/*
+ * Set og to the Ogg page starting at p.
+ *
+ * @return
+ *   The page length, 0 if len is too short to hold the complete page or
+ *   (size_t)-1 if p is not an Ogg page.
+ */
+static size_t
+ogg_page_parse(ogg_page *og, unsigned char *p, size_t len)
+{
+	size_t i, nseg, bodylen = 0;
+
+	assert(og != NULL);
+	assert(p != NULL);
+
+	if (len < 27)
+		return (0);
+	if (memcmp(p, "OggS", 4) != 0 || p[4] != 0 /* version */)
+		return ((size_t)-1);
+	nseg = p[26];
+	if (len < 27 + nseg)
+		return (0);
+	for (i = 0; i < nseg; i++)
+		bodylen += p[27 + i];
+	if (len < 27 + nseg + bodylen)
+		return (0);
+
+	og->header     = p;
+	og->header_len = (long)(27 + nseg);
+	og->body       = p + 27 + nseg;
+	og->body_len   = (long)bodylen;
+	return (27 + nseg + bodylen);
+}
+
+
+/*
+ * Set the page sequence number of og and update its CRC.
+ */
+static void
+t_ftoggvorbis_page_setno(ogg_page *og, long pageno)
+{
+	unsigned long no = (unsigned long)pageno;
+
+	assert(og != NULL);
+	assert(og->header_len >= 27);
+
+	og->header[18] = (unsigned char)(no & 0xff);
+	og->header[19] = (unsigned char)((no >> 8) & 0xff);
+	og->header[20] = (unsigned char)((no >> 16) & 0xff);
+	og->header[21] = (unsigned char)((no >> 24) & 0xff);
+	ogg_page_crc_set(og);
+}
+
+
+/*
+ * Same as ogg_page_checksum_set(), using t_crc32_ogg().
+ */
+static void
+ogg_page_crc_set(ogg_page *og)
+{
+	uint32_t crc;
+
+	assert(og != NULL);
+	assert(og->header_len >= 27);
+	assert(og->body_len >= 0);
+
+	(void)memset(og->header + 22, 0, 4);
+	crc = t_crc32_ogg(0, og->header, (size_t)og->header_len);
+	crc = t_crc32_ogg(crc, og->body, (size_t)og->body_len);
+	og->header[22] = (unsigned char)(crc & 0xff);
+	og->header[23] = (unsigned char)((crc >> 8) & 0xff);
+	og->header[24] = (unsigned char)((crc >> 16) & 0xff);
+	og->header[25] = (unsigned char)((crc >> 24) & 0xff);
 }
 
 
@@ -412,19 +729,27 @@ t_ftoggvorbis_clear(void *opaque)
 	data = opaque;
 	assert(data->libid == libid);
 
-	ov_clear(&data->vf);
+	vorbis_comment_clear(&data->vc);
 	free(data);
 }
 
 
+/*
+ * Copy src into dst, dst->packet is a malloc(3)'d copy of src->packet that can
+ * be released by ogg_packet_clear().
+ */
 static int
-fwrite_drain_func(void *fp, const char *data, int len)
+ogg_packet_copy(ogg_packet *dst, const ogg_packet *src)
 {
-	if (fp == NULL || len < 0)
+	assert(dst != NULL);
+	assert(src != NULL);
+	assert(src->bytes >= 0);
+
+	*dst = *src;
+	if ((dst->packet = malloc((size_t)src->bytes)) == NULL)
 		return (-1);
-	/* casting fwrite return value to int is fine: it is at most len */
-	int s = (int)fwrite(data, 1, (size_t)len, fp);
-	return (s == 0 ? -1 : s);
+	(void)memcpy(dst->packet, src->packet, (size_t)src->bytes);
+	return (0);
 }
 
 
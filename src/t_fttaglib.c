@@ -3,31 +3,74 @@
  *
  * a taglib tagutil backend, using TagLib.
  */
-#include <limits.h>
-
-/* TagLib headers */
-#include "tag_c.h"
+#include <strings.h>
 
 #include "t_config.h"
 #include "t_backend.h"
+#include "t_fttaglib_file.h"
 
 
 static const char libid[] = "TagLib";
 
+/* the most common formats handled by TagLib */
+static const struct t_backend_magic magics[] = {
+	/* MP3 with ID3v2 tags */
+	{ .offset = 0, .len = 3, .bytes = "ID3" },
+	/* MPEG audio frame sync */
+	{ .offset = 0, .len = 2, .bytes = "\xFF\xE0", .mask = "\xFF\xE0" },
+	/* MP4, M4A */
+	{ .offset = 4, .len = 4, .bytes = "ftyp" },
+	/* ASF, WMA */
+	{ .offset = 0, .len = 4, .bytes = "\x30\x26\xB2\x75" },
+	/* WAV, AIFF */
+	{ .offset = 0, .len = 4, .bytes = "RIFF" },
+	{ .offset = 0, .len = 4, .bytes = "FORM" },
+	/* Monkey's Audio, WavPack, Musepack, True Audio */
+	{ .offset = 0, .len = 4, .bytes = "MAC " },
+	{ .offset = 0, .len = 4, .bytes = "wvpk" },
+	{ .offset = 0, .len = 4, .bytes = "MPCK" },
+	{ .offset = 0, .len = 3, .bytes = "MP+" },
+	{ .offset = 0, .len = 4, .bytes = "TTA1" },
+	/* Ogg (FLAC, Speex, Opus) and FLAC */
+	{ .offset = 0, .len = 4, .bytes = "OggS" },
+	{ .offset = 0, .len = 4, .bytes = "fLaC" },
+	/* ID3v1 and APE tags at the end of the file */
+	{ .offset = -128, .len = 3, .bytes = "TAG" },
+	{ .offset =  -32, .len = 8, .bytes = "APETAGEX" },
+	{ .len = 0 },
+};
+
 
 struct t_fttaglib_data {
-	const char	*libid;
-	TagLib_File	*file;
-	TagLib_Tag	*tag;
+	const char		*libid;
+	struct t_fttaglib_file	*file;
+};
+
+/*
+ * tagutil's historical TagLib backend keys and the corresponding TagLib
+ * property names, translated both on read and write so that the keys are the
+ * same as the other backends ones.
+ */
+static const struct {
+	const char	*key;
+	const char	*property;
+} aliases[] = {
+	{ .key = t_key_year,  .property = "DATE" },
+	{ .key = t_key_track, .property = "TRACKNUMBER" },
 };
 
 struct t_backend	*t_fttaglib_backend(void);
 
-static void 		*t_fttaglib_init(const char *path);
+static void 		*t_fttaglib_open(const char *path,
+			     struct t_backend_probe *probe);
 static struct t_taglist	*t_fttaglib_read(void *opaque);
 static int		 t_fttaglib_write(void *opaque, const struct t_taglist *tlist);
 static void		 t_fttaglib_clear(void *opaque);
 
+static int	t_fttaglib_insert(void *ctx, const char *key, const char *val);
+static int	t_fttaglib_unsupported(void *ctx, const char *key,
+		    const char *val);
+
 
 struct t_backend *
 t_fttaglib_backend(void)
@@ -35,37 +78,21 @@ t_fttaglib_backend(void)
 
 	static struct t_backend b = {
 		.libid		= libid,
-		.desc		= "various file format but limited set of tags",
-		.init		= t_fttaglib_init,
+		.desc		= "various file format using TagLib's property interface",
+		.magics		= magics,
+		.open		= t_fttaglib_open,
 		.read		= t_fttaglib_read,
 		.write		= t_fttaglib_write,
 		.clear		= t_fttaglib_clear,
 	};
 
-	/* TagLib specific init */
-
-	/*
-	 * FIXME: UTF-8 is a default in TagLib's C API, so this is useless.
-	 * However it is unclear when we should switch to Latin1, in particular
-	 * when we can't get a locale. This OK for now since most backend assume
-	 * an UTF-8 (which should be fixed).
-	 */
-	char *lc_all, *dot;
-	lc_all = getenv("LC_ALL");
-	if (lc_all != NULL) {
-		dot = strchr(lc_all, '.');
-		if (dot != NULL && strcmp(dot + 1, "UTF-8") == 0)
-			taglib_set_strings_unicode(1);
-	}
-	taglib_set_string_management_enabled(0);
-
 	return (&b);
 }
 
 static void *
-t_fttaglib_init(const char *path)
+t_fttaglib_open(const char *path, struct t_backend_probe *probe)
 {
-	TagLib_File *f;
+	struct t_fttaglib_file *f;
 	struct t_fttaglib_data *data;
 
 	assert(path != NULL);
@@ -75,14 +102,17 @@ t_fttaglib_init(const char *path)
 		return (NULL);
 	data->libid = libid;
 
-	f = taglib_file_new(path);
-	if (f == NULL || !taglib_file_is_valid(f)) {
+	/* we never use the audio properties, so don't let TagLib read them */
+	/* TagLib open path by itself */
+	if (probe != NULL)
+		probe->nopen++;
+	f = t_fttaglib_file_new(path);
+	if (f == NULL) {
 		free(data);
 		return (NULL);
 	}
 
 	data->file = f;
-	data->tag  = taglib_file_tag(f);
 
 	return (data);
 }
@@ -90,8 +120,6 @@ t_fttaglib_init(const char *path)
 static struct t_taglist *
 t_fttaglib_read(void *opaque)
 {
-	unsigned int uintval;
-	char buf[5], *val = NULL;
 	struct t_fttaglib_data *data;
 	struct t_taglist *tlist = NULL;
 
@@ -102,70 +130,13 @@ t_fttaglib_read(void *opaque)
 	if ((tlist = t_taglist_new()) == NULL)
 		return (NULL);
 
-	/*
-	 * There is a lot of duplication around here but it's ok because it's
-	 * very dumb code.
-	 */
-
-	if ((val = taglib_tag_title(data->tag)) == NULL)
-		goto error_label;
-	if (strlen(val) > 0 && t_taglist_insert(tlist, "title", val) == -1)
-		goto error_label;
-	taglib_free(val);
-	val = NULL;
-
-	if ((val = taglib_tag_artist(data->tag)) == NULL)
-		goto error_label;
-	if (strlen(val) > 0 && t_taglist_insert(tlist, "artist", val) == -1)
-		goto error_label;
-	taglib_free(val);
-	val = NULL;
-
-	uintval = taglib_tag_year(data->tag);
-	if (uintval > 0 && uintval < 10000) {
-		if (sprintf(buf, "%04u", uintval) < 0)
-			goto error_label;
-		if (t_taglist_insert(tlist, "year", buf) == -1)
-			goto error_label;
-	}
-
-	if ((val = taglib_tag_album(data->tag)) == NULL)
-		goto error_label;
-	if (strlen(val) > 0 && t_taglist_insert(tlist, "album", val) == -1)
-		goto error_label;
-	taglib_free(val);
-	val = NULL;
-
-	uintval = taglib_tag_track(data->tag);
-	if (uintval > 0 && uintval < 10000) {
-		if (sprintf(buf, "%02u", uintval) < 0)
-			goto error_label;
-		if (t_taglist_insert(tlist, "track", buf) == -1)
-			goto error_label;
+	/* the whole PropertyMap in one pass, keys are lowercased by t_tag */
+	if (t_fttaglib_file_properties(data->file, t_fttaglib_insert, tlist) == -1) {
+		t_taglist_delete(tlist);
+		return (NULL);
 	}
 
-	if ((val = taglib_tag_genre(data->tag)) == NULL)
-		goto error_label;
-	if (strlen(val) > 0 && t_taglist_insert(tlist, "genre", val) == -1)
-		goto error_label;
-	taglib_free(val);
-	val = NULL;
-
-	if ((val = taglib_tag_comment(data->tag)) == NULL)
-		goto error_label;
-	if (strlen(val) > 0 && t_taglist_insert(tlist, "comment", val) == -1)
-		goto error_label;
-	taglib_free(val);
-	val = NULL;
-
 	return (tlist);
-error_label:
-	/* NOTE: the documentation does not state if NULL is a valid argument
-	   for tablib_free() */
-	if (val != NULL)
-		taglib_free(val);
-	t_taglist_delete(tlist);
-	return (NULL);
 }
 
 static int
@@ -173,61 +144,26 @@ t_fttaglib_write(void *opaque, const struct t_taglist *tlist)
 {
 	struct t_fttaglib_data *data;
 	struct t_tag *t;
-	char *endptr;
-	unsigned long ulongval;
+	const char *key;
+	size_t i;
 
 	assert(opaque != NULL);
 	data = opaque;
 	assert(data->libid == libid);
 
-	/* clear all the tags */
-	taglib_tag_set_title(data->tag, "");
-	taglib_tag_set_artist(data->tag, "");
-	taglib_tag_set_year(data->tag, 0);
-	taglib_tag_set_album(data->tag, "");
-	taglib_tag_set_track(data->tag, 0);
-	taglib_tag_set_genre(data->tag, "");
-	taglib_tag_set_comment(data->tag, "");
-
-	/* load the tlist */
-	TAILQ_FOREACH(t, tlist->tags, entries) {
-		if (t_tag_keycmp(t->key, "title") == 0)
-			taglib_tag_set_title(data->tag, t->val);
-		else if (t_tag_keycmp(t->key, "artist") == 0)
-			taglib_tag_set_artist(data->tag, t->val);
-		else if (t_tag_keycmp(t->key, "year") == 0) {
-			ulongval = strtoul(t->val, &endptr, 10);
-			if (endptr == t->val || *endptr != '\0') {
-				warnx("invalid unsigned int argument for %s: %s",
-				    t->key, t->val);
-			} else if (ulongval > UINT_MAX) {
-				warnx("invalid unsigned int argument for %s: %s (too large)",
-				    t->key, t->val);
-			} else
-				taglib_tag_set_year(data->tag, (unsigned int)ulongval);
-		} else if (t_tag_keycmp(t->key, "album") == 0)
-			taglib_tag_set_album(data->tag, t->val);
-		else if (t_tag_keycmp(t->key, "track") == 0) {
-			ulongval = strtoul(t->val, &endptr, 10);
-			if (endptr == t->val || *endptr != '\0') {
-				warnx("invalid unsigned int argument for %s: %s",
-				    t->key, t->val);
-			} else if (ulongval > UINT_MAX) {
-				warnx("invalid unsigned int argument for %s: %s (too large)",
-				    t->key, t->val);
-			} else
-				taglib_tag_set_track(data->tag, (unsigned int)ulongval);
-		} else if (t_tag_keycmp(t->key, "genre") == 0)
-			taglib_tag_set_genre(data->tag, t->val);
-		else if (t_tag_keycmp(t->key, "comment") == 0)
-			taglib_tag_set_comment(data->tag, t->val);
-		else
-			warnx("unsupported tag for TagLib backend: %s", t->key);
+	T_TAGLIST_FOREACH(t, tlist) {
+		key = t->key;
+		for (i = 0; i < NELEM(aliases); i++) {
+			if (key == aliases[i].key) {
+				key = aliases[i].property;
+				break;
+			}
+		}
+		if (t_fttaglib_file_property_add(data->file, key, t->val) == -1)
+			return (-1);
 	}
 
-	if (!taglib_file_save(data->file))
-		return (-1);
-	return (0);
+	return (t_fttaglib_file_save(data->file, t_fttaglib_unsupported, NULL));
 }
 
 static void
@@ -239,6 +175,41 @@ t_fttaglib_clear(void *opaque)
 	data = opaque;
 	assert(data->libid == libid);
 
-	taglib_file_free(data->file);
+	t_fttaglib_file_delete(data->file);
 	free(data);
 }
+
+/*
+ * t_fttaglib_file_cb inserting a tag in the t_taglist ctx.
+ */
+static int
+t_fttaglib_insert(void *ctx, const char *key, const char *val)
+{
+	size_t i;
+
+	assert(ctx != NULL);
+	assert(key != NULL);
+
+	for (i = 0; i < NELEM(aliases); i++) {
+		if (strcasecmp(key, aliases[i].property) == 0) {
+			key = aliases[i].key;
+			break;
+		}
+	}
+
+	return (t_taglist_insert(ctx, key, val));
+}
+
+/*
+ * t_fttaglib_file_cb warning about a tag the file format could not store.
+ */
+static int
+t_fttaglib_unsupported(void *ctx, const char *key, const char *val)
+{
+
+	(void)ctx;
+	(void)val;
+
+	warnx("unsupported tag for TagLib backend: %s", key);
+	return (0);
+}
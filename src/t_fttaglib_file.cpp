@@ -0,0 +1,138 @@
+/*
+ * t_fttaglib_file.cpp
+ *
+ * a thin C++ shim over TagLib::FileRef for the TagLib backend.
+ */
+#include <cassert>
+#include <cstddef>
+#include <new>
+#include <string>
+
+/* TagLib headers */
+#include "fileref.h"
+#include "tpropertymap.h"
+
+#include "t_fttaglib_file.h"
+
+
+struct t_fttaglib_file {
+	TagLib::FileRef		ref;
+	/* the properties to be written by t_fttaglib_file_save() */
+	TagLib::PropertyMap	pending;
+
+	explicit t_fttaglib_file(const char *path)
+	    : ref(path, /* readAudioProperties */false) {}
+};
+
+
+static int	t_fttaglib_file_foreach(const TagLib::PropertyMap &map,
+		    t_fttaglib_file_cb cb, void *ctx);
+
+
+struct t_fttaglib_file *
+t_fttaglib_file_new(const char *path)
+{
+	struct t_fttaglib_file *f;
+
+	assert(path != NULL);
+
+	f = new (std::nothrow) t_fttaglib_file(path);
+	if (f == NULL)
+		return (NULL);
+	if (f->ref.isNull()) {
+		delete f;
+		return (NULL);
+	}
+
+	return (f);
+}
+
+int
+t_fttaglib_file_properties(struct t_fttaglib_file *f, t_fttaglib_file_cb cb,
+    void *ctx)
+{
+
+	assert(f != NULL);
+	assert(cb != NULL);
+
+	try {
+		return (t_fttaglib_file_foreach(f->ref.file()->properties(),
+		    cb, ctx));
+	} catch (const std::bad_alloc &) {
+		return (-1);
+	}
+}
+
+int
+t_fttaglib_file_property_add(struct t_fttaglib_file *f, const char *key,
+    const char *val)
+{
+
+	assert(f != NULL);
+	assert(key != NULL);
+	assert(val != NULL);
+
+	try {
+		/* insert() append to the values of an existing key */
+		f->pending.insert(TagLib::String(key, TagLib::String::UTF8),
+		    TagLib::StringList(TagLib::String(val, TagLib::String::UTF8)));
+	} catch (const std::bad_alloc &) {
+		return (-1);
+	}
+
+	return (0);
+}
+
+int
+t_fttaglib_file_save(struct t_fttaglib_file *f, t_fttaglib_file_cb cb,
+    void *ctx)
+{
+	TagLib::PropertyMap unsupported;
+	int ret;
+
+	assert(f != NULL);
+
+	try {
+		unsupported = f->ref.file()->setProperties(f->pending);
+		f->pending.clear();
+		if (cb != NULL)
+			(void)t_fttaglib_file_foreach(unsupported, cb, ctx);
+		ret = (f->ref.save() ? 0 : -1);
+	} catch (const std::bad_alloc &) {
+		ret = -1;
+	}
+
+	return (ret);
+}
+
+void
+t_fttaglib_file_delete(struct t_fttaglib_file *f)
+{
+
+	delete f;
+}
+
+/*
+ * call cb for each value in map, in one pass.
+ *
+ * @return
+ *   0 on success, -1 if cb failed.
+ */
+static int
+t_fttaglib_file_foreach(const TagLib::PropertyMap &map, t_fttaglib_file_cb cb,
+    void *ctx)
+{
+	TagLib::PropertyMap::ConstIterator it;
+	TagLib::StringList::ConstIterator v;
+	std::string key;
+
+	for (it = map.begin(); it != map.end(); ++it) {
+		key = it->first.to8Bit(/* unicode */true);
+		for (v = it->second.begin(); v != it->second.end(); ++v) {
+			if (cb(ctx, key.c_str(), v->toCString(true)) == -1)
+				return (-1);
+		}
+	}
+
+	return (0);
+}
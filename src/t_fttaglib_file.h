@@ -0,0 +1,83 @@
+#ifndef T_FTTAGLIB_FILE_H
+#define T_FTTAGLIB_FILE_H
+/*
+ * t_fttaglib_file.h
+ *
+ * a thin C++ shim over TagLib::FileRef for the TagLib backend.
+ *
+ * TagLib's C API always open files with their audio properties, which for
+ * some formats (MP3 in particular) means scanning the audio frames, and only
+ * gives access to a fixed set of tags. tagutil only need the tags, but all of
+ * them, so the files are opened and their PropertyMap used through this shim.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* an opened file, a TagLib::FileRef */
+struct t_fttaglib_file;
+
+/*
+ * called with each key and value pair, both UTF-8 encoded.
+ *
+ * @return
+ *   0 on success, -1 to stop the iteration.
+ */
+typedef int	(*t_fttaglib_file_cb)(void *ctx, const char *key,
+		    const char *val);
+
+/*
+ * open a file without reading its audio properties.
+ *
+ * @param path
+ *   The file path, cannot be NULL.
+ *
+ * @return
+ *   a t_fttaglib_file that should be passed to t_fttaglib_file_delete() after
+ *   use, or NULL if the file could not be opened or is not supported.
+ */
+struct t_fttaglib_file	*t_fttaglib_file_new(const char *path);
+
+/*
+ * call cb for each value of each property of the file, in one pass.
+ *
+ * @return
+ *   0 on success, -1 if cb failed.
+ */
+int	t_fttaglib_file_properties(struct t_fttaglib_file *f,
+	    t_fttaglib_file_cb cb, void *ctx);
+
+/*
+ * add a value to the properties to be written by t_fttaglib_file_save().
+ *
+ * @return
+ *   0 on success, -1 on error (memory allocation failed).
+ */
+int	t_fttaglib_file_property_add(struct t_fttaglib_file *f, const char *key,
+	    const char *val);
+
+/*
+ * replace all the file's properties by the ones added with
+ * t_fttaglib_file_property_add() since the last call, and save the file.
+ *
+ * @param cb
+ *   If not NULL, called for each value that the file format could not store.
+ *   Its return value is ignored.
+ *
+ * @return
+ *   0 on success, -1 on error.
+ */
+int	t_fttaglib_file_save(struct t_fttaglib_file *f, t_fttaglib_file_cb cb,
+	    void *ctx);
+
+/*
+ * close the file.
+ */
+void	t_fttaglib_file_delete(struct t_fttaglib_file *f);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ndef T_FTTAGLIB_FILE_H */
@@ -0,0 +1,25 @@
+#ifndef T_ID3GENRE_H
+#define T_ID3GENRE_H
+/*
+ * t_id3genre.h
+ *
+ * ID3v1 genres, also referenced by number in ID3v2 TCON frames.
+ */
+#include "t_config.h"
+
+
+/*
+ * @return
+ *   the name of the genre number n, or NULL if n is not a known genre.
+ */
+const char	*t_id3genre_name(unsigned int n);
+
+/*
+ * find a genre by name (case insensitive).
+ *
+ * @return
+ *   the genre number, or -1 if name is not a known genre.
+ */
+int	t_id3genre_index(const char *name);
+
+#endif /* ndef T_ID3GENRE_H */
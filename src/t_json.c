@@ -20,6 +20,7 @@
 #include "t_config.h"
 #include "t_toolkit.h"
 #include "t_taglist.h"
+#include "t_sink.h"
 #include "t_format.h"
 
 
@@ -30,6 +31,14 @@ static const char fileext[] = "json";
 struct t_format		*t_json_format(void);
 
 static char		*t_tags2json(const struct t_taglist *tlist, const char *path);
+static int		 t_json_tags2sink(struct t_sink *sink,
+			    const struct t_taglist *tlist, const char *path);
+/*
+ * write a quoted and escaped JSON string into sink, the same way json_dumps()
+ * would.
+ */
+static int		 t_json_string(struct t_sink *sink, const char *s,
+			    size_t len);
 static struct t_taglist	*t_json2tags(FILE *fp, char **errmsg_p);
 
 
@@ -42,6 +51,7 @@ t_json_format(void)
 		.desc		=
 		    "JSON - JavaScript Object Notation",
 		.tags2fmt	= t_tags2json,
+		.tags2sink	= t_json_tags2sink,
 		.fmt2tags	= t_json2tags,
 	};
 
@@ -50,39 +60,88 @@ t_json_format(void)
 
 
 static char *
-t_tags2json(const struct t_taglist *tlist, t__unused const char *path)
+t_tags2json(const struct t_taglist *tlist, const char *path)
 {
-	json_t *root = NULL, *obj = NULL;
-	const struct t_tag *t;
+	struct t_sink sink;
 	char *ret = NULL;
 
 	assert(tlist != NULL);
 
-	if ((root = json_array()) == NULL)
-		goto error_label;
+	t_sink_init(&sink, -1);
+	if (t_json_tags2sink(&sink, tlist, path) == 0)
+		ret = t_sink_detach(&sink);
+	t_sink_release(&sink);
+	return (ret);
+}
 
-	TAILQ_FOREACH(t, tlist->tags, entries) {
-		if ((obj = json_object()) == NULL)
-			goto error_label;
-		if (json_object_set_new_nocheck(obj, t->key,
-		    json_string_nocheck(t->val)) == -1) {
-			goto error_label;
-		}
-		if (json_array_append(root, obj) == -1)
-			goto error_label;
-		json_decref(obj);
-		obj = NULL;
+
+/*
+ * The output is the JSON_COMPACT json_dumps() one, but written directly
+ * instead of building a jansson tree first.
+ */
+static int
+t_json_tags2sink(struct t_sink *sink, const struct t_taglist *tlist,
+    t__unused const char *path)
+{
+	const struct t_tag *t;
+	const char *sep = "{";
+
+	assert(sink != NULL);
+	assert(tlist != NULL);
+
+	if (t_sink_write(sink, "[", 1) == -1)
+		return (-1);
+	T_TAGLIST_FOREACH(t, tlist) {
+		if (t_sink_write(sink, sep, strlen(sep)) == -1 ||
+		    t_json_string(sink, t->key, t->klen) == -1 ||
+		    t_sink_write(sink, ":", 1) == -1 ||
+		    t_json_string(sink, t->val, t->vlen) == -1 ||
+		    t_sink_write(sink, "}", 1) == -1)
+			return (-1);
+		sep = ",{";
 	}
+	return (t_sink_write(sink, "]", 1));
+}
 
-	ret = json_dumps(root, JSON_COMPACT);
-	/* FALLTHROUGH */
-error_label:
-	if (root != NULL)
-		json_decref(root);
-	if (obj != NULL)
-		json_decref(obj);
 
-	return (ret);
+static int
+t_json_string(struct t_sink *sink, const char *s, size_t len)
+{
+	const char *p, *end, *esc;
+	char buf[7]; /* "\u001F"NUL */
+
+	assert(sink != NULL);
+	assert(s != NULL);
+
+	if (t_sink_write(sink, "\"", 1) == -1)
+		return (-1);
+	end = s + len;
+	for (p = s; p < end; p++) {
+		switch (*p) {
+		case '"':  esc = "\\\""; break;
+		case '\\': esc = "\\\\"; break;
+		case '\b': esc = "\\b";  break;
+		case '\f': esc = "\\f";  break;
+		case '\n': esc = "\\n";  break;
+		case '\r': esc = "\\r";  break;
+		case '\t': esc = "\\t";  break;
+		default:
+			if ((unsigned char)*p >= 0x20)
+				continue;
+			(void)snprintf(buf, sizeof(buf), "\\u%04X",
+			    (unsigned char)*p);
+			esc = buf;
+		}
+		/* write the unescaped run before p, then its escape */
+		if (t_sink_write(sink, s, p - s) == -1 ||
+		    t_sink_write(sink, esc, strlen(esc)) == -1)
+			return (-1);
+		s = p + 1;
+	}
+	if (t_sink_write(sink, s, end - s) == -1 ||
+	    t_sink_write(sink, "\"", 1) == -1)
+		return (-1);
+	return (0);
 }
 
 
@@ -0,0 +1,267 @@
+/*
+ * t_key.c
+ *
+ * interned tag keys.
+ *
+ * The keys are stored in an open addressing hash table (linear probing) kept
+ * at most half full. The table is seeded with the common keys at the first
+ * use, their interned copy being the static t_key_* arrays.
+ *
+ * Lookups don't take any lock: a slot is published by storing its key last
+ * (with release semantic) and is never modified afterward, and when the table
+ * grow the new one is published the same way while the old one is never
+ * freed (all the tables sum up to less than the last one). Only the insertion
+ * of a new key takes t_key_mtx, which is rare: a music collection use a
+ * handful of distinct keys.
+ */
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "t_config.h"
+#include "t_toolkit.h"
+#include "t_casefold.h"
+#include "t_key.h"
+
+
+/* initial count of slots, should be more than twice NELEM(t_key_common) */
+#define	T_KEY_MINSIZE	64
+
+const char	t_key_album[]       = "album";
+const char	t_key_albumartist[] = "albumartist";
+const char	t_key_artist[]      = "artist";
+const char	t_key_comment[]     = "comment";
+const char	t_key_composer[]    = "composer";
+const char	t_key_date[]        = "date";
+const char	t_key_discnumber[]  = "discnumber";
+const char	t_key_disctotal[]   = "disctotal";
+const char	t_key_genre[]       = "genre";
+const char	t_key_performer[]   = "performer";
+const char	t_key_title[]       = "title";
+const char	t_key_track[]       = "track";
+const char	t_key_tracknumber[] = "tracknumber";
+const char	t_key_tracktotal[]  = "tracktotal";
+const char	t_key_year[]        = "year";
+
+static const char * const t_key_common[] = {
+	t_key_album,
+	t_key_albumartist,
+	t_key_artist,
+	t_key_comment,
+	t_key_composer,
+	t_key_date,
+	t_key_discnumber,
+	t_key_disctotal,
+	t_key_genre,
+	t_key_performer,
+	t_key_title,
+	t_key_track,
+	t_key_tracknumber,
+	t_key_tracktotal,
+	t_key_year,
+};
+
+struct t_key_slot {
+	_Atomic(const char *)	 key; /* NULL for an empty slot */
+	size_t			 klen;
+	uint32_t		 hash;
+};
+
+struct t_key_table {
+	size_t			 size; /* a power of two */
+	struct t_key_slot	*slots;
+};
+
+static struct t_key_slot	t_key_initial_slots[T_KEY_MINSIZE];
+static struct t_key_table	t_key_initial = {
+	.size  = T_KEY_MINSIZE,
+	.slots = t_key_initial_slots,
+};
+static _Atomic(struct t_key_table *)	t_key_table = &t_key_initial;
+/* count of keys in t_key_table, protected by t_key_mtx */
+static size_t	t_key_count = 0;
+
+static pthread_once_t	t_key_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t	t_key_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+
+/* pthread_once(3) routine seeding the table with t_key_common */
+static void	t_key_init(void);
+
+/*
+ * find the slot of key in table, or the empty slot where it should be
+ * inserted.
+ */
+static struct t_key_slot	*t_key_find(struct t_key_table *table,
+		    const char *key, size_t klen, uint32_t hash);
+
+/*
+ * publish key in slot, t_key_mtx must be held.
+ */
+static void	t_key_insert(struct t_key_slot *slot, const char *key,
+		    size_t klen, uint32_t hash);
+
+/*
+ * publish a table twice as big as the current one.
+ *
+ * t_key_mtx must be held.
+ *
+ * @return
+ *   0 on success, -1 and set errno on error (malloc(3) failed).
+ */
+static int	t_key_grow(void);
+
+
+const char *
+t_key_intern(const char *key, size_t klen)
+{
+	struct t_key_table *table;
+	struct t_key_slot *slot;
+	const char *ret;
+	uint32_t hash;
+	char *s;
+
+	assert(key != NULL);
+
+	if ((ret = t_key_lookup(key, klen)) != NULL)
+		return (ret);
+
+	hash = t_casefold_hash(key, klen);
+	(void)pthread_mutex_lock(&t_key_mtx);
+	table = atomic_load_explicit(&t_key_table, memory_order_relaxed);
+	/* another thread may have inserted it since t_key_lookup() */
+	slot = t_key_find(table, key, klen, hash);
+	ret  = atomic_load_explicit(&slot->key, memory_order_relaxed);
+	if (ret != NULL)
+		goto out;
+	if (2 * (t_key_count + 1) > table->size) {
+		if (t_key_grow() == -1)
+			goto out;
+		table = atomic_load_explicit(&t_key_table,
+		    memory_order_relaxed);
+		slot = t_key_find(table, key, klen, hash);
+	}
+	if ((s = malloc(klen + 1)) == NULL)
+		goto out;
+	t_casefold_lower(s, key, klen);
+	s[klen] = '\0';
+
+	t_key_insert(slot, s, klen, hash);
+	ret = s;
+out:
+	(void)pthread_mutex_unlock(&t_key_mtx);
+	return (ret);
+}
+
+
+const char *
+t_key_lookup(const char *key, size_t klen)
+{
+	struct t_key_table *table;
+	struct t_key_slot *slot;
+
+	assert(key != NULL);
+
+	(void)pthread_once(&t_key_once, t_key_init);
+
+	table = atomic_load_explicit(&t_key_table, memory_order_acquire);
+	slot  = t_key_find(table, key, klen, t_casefold_hash(key, klen));
+
+	return (atomic_load_explicit(&slot->key, memory_order_relaxed));
+}
+
+
+static void
+t_key_init(void)
+{
+	struct t_key_slot *slot;
+	const char *key;
+	size_t i, klen;
+	uint32_t hash;
+
+	(void)pthread_mutex_lock(&t_key_mtx);
+	for (i = 0; i < NELEM(t_key_common); i++) {
+		key  = t_key_common[i];
+		klen = strlen(key);
+		hash = t_casefold_hash(key, klen);
+		slot = t_key_find(&t_key_initial, key, klen, hash);
+		assert(atomic_load(&slot->key) == NULL);
+		t_key_insert(slot, key, klen, hash);
+	}
+	assert(2 * t_key_count <= t_key_initial.size);
+	(void)pthread_mutex_unlock(&t_key_mtx);
+}
+
+
+static struct t_key_slot *
+t_key_find(struct t_key_table *table, const char *key, size_t klen,
+    uint32_t hash)
+{
+	struct t_key_slot *slot;
+	const char *k;
+	size_t i, mask;
+
+	mask = table->size - 1;
+	for (i = hash & mask; ; i = (i + 1) & mask) {
+		slot = &table->slots[i];
+		/* pairs with the release store of t_key_insert() */
+		k = atomic_load_explicit(&slot->key, memory_order_acquire);
+		if (k == NULL)
+			return (slot);
+		if (slot->hash == hash && slot->klen == klen &&
+		    t_casefold_eq(k, key, klen))
+			return (slot);
+	}
+	/* NOTREACHED */
+}
+
+
+static void
+t_key_insert(struct t_key_slot *slot, const char *key, size_t klen,
+    uint32_t hash)
+{
+
+	slot->klen = klen;
+	slot->hash = hash;
+	atomic_store_explicit(&slot->key, key, memory_order_release);
+	t_key_count++;
+}
+
+
+static int
+t_key_grow(void)
+{
+	struct t_key_table *old, *neo;
+	struct t_key_slot *slot;
+	const char *k;
+	size_t i;
+
+	old = atomic_load_explicit(&t_key_table, memory_order_relaxed);
+	if (old->size > SIZE_MAX / 2 / sizeof(struct t_key_slot) - 1) {
+		errno = ENOMEM;
+		return (-1);
+	}
+	neo = calloc(1, sizeof(struct t_key_table) +
+	    2 * old->size * sizeof(struct t_key_slot));
+	if (neo == NULL)
+		return (-1);
+	neo->size  = 2 * old->size;
+	neo->slots = (struct t_key_slot *)(neo + 1);
+
+	/* neo is not published yet, no need for the t_key_insert() dance */
+	for (i = 0; i < old->size; i++) {
+		k = atomic_load_explicit(&old->slots[i].key,
+		    memory_order_relaxed);
+		if (k == NULL)
+			continue;
+		slot = t_key_find(neo, k, old->slots[i].klen,
+		    old->slots[i].hash);
+		slot->klen = old->slots[i].klen;
+		slot->hash = old->slots[i].hash;
+		atomic_store_explicit(&slot->key, k, memory_order_relaxed);
+	}
+
+	/* readers may still use old, it is never freed */
+	atomic_store_explicit(&t_key_table, neo, memory_order_release);
+	return (0);
+}
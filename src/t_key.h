@@ -0,0 +1,69 @@
+#ifndef T_KEY_H
+#define T_KEY_H
+/*
+ * t_key.h
+ *
+ * interned tag keys.
+ *
+ * Every tag key is interned (see t_key_intern()): there is only one copy of
+ * each distinct lowercase key for the whole process, so that two interned keys
+ * are equal if and only if they are the same pointer.
+ */
+#include <stddef.h>
+
+#include "t_config.h"
+
+
+/*
+ * the common keys, always interned.
+ *
+ * t_key_intern("TITLE", 5) == t_key_title, so an interned key can be compared
+ * to these without calling t_key_intern().
+ */
+extern const char	t_key_album[];
+extern const char	t_key_albumartist[];
+extern const char	t_key_artist[];
+extern const char	t_key_comment[];
+extern const char	t_key_composer[];
+extern const char	t_key_date[];
+extern const char	t_key_discnumber[];
+extern const char	t_key_disctotal[];
+extern const char	t_key_genre[];
+extern const char	t_key_performer[];
+extern const char	t_key_title[];
+extern const char	t_key_track[];
+extern const char	t_key_tracknumber[];
+extern const char	t_key_tracktotal[];
+extern const char	t_key_year[];
+
+
+/*
+ * intern a key.
+ *
+ * This routine is thread-safe. Interned keys are never released.
+ *
+ * @param key
+ *   The key, it doesn't need to be NUL-terminated and is case insensitive.
+ *
+ * @param klen
+ *   The length of key.
+ *
+ * @return
+ *   the lowercase, NUL-terminated and interned copy of key on success, NULL
+ *   and set errno on error (malloc(3) failed).
+ */
+const char	*t_key_intern(const char *key, size_t klen);
+
+/*
+ * find an already interned key.
+ *
+ * Unlike t_key_intern(), this routine never allocate: when it returns NULL no
+ * tag can have the given key.
+ *
+ * @return
+ *   the interned copy of key (see t_key_intern()) or NULL if key has never
+ *   been interned.
+ */
+const char	*t_key_lookup(const char *key, size_t klen);
+
+#endif /* ndef T_KEY_H */
@@ -13,12 +13,27 @@ int
 t_load(struct t_tune *tune, const char *fmtfile)
 {
 	int ret;
+	struct t_taglist *tlist;
+
+	assert(tune != NULL);
+	assert(fmtfile != NULL);
+
+	if ((tlist = t_load_tags(fmtfile)) == NULL)
+		return (-1);
+	ret = t_tune_set_tags(tune, tlist);
+	t_taglist_delete(tlist);
+	return (ret);
+}
+
+
+struct t_taglist *
+t_load_tags(const char *fmtfile)
+{
 	char *errmsg;
 	struct t_taglist *tlist;
 	extern const struct t_format *Fflag;
 	FILE *fp;
 
-	assert(tune != NULL);
 	assert(fmtfile != NULL);
 
 	if (strlen(fmtfile) == 0 || strcmp(fmtfile, "-") == 0)
@@ -27,7 +42,7 @@ t_load(struct t_tune *tune, const char *fmtfile)
 		fp = fopen(fmtfile, "r");
 		if (fp == NULL) {
 			warn("%s: fopen", fmtfile);
-			return (-1);
+			return (NULL);
 		}
 	}
 
@@ -37,9 +52,6 @@ t_load(struct t_tune *tune, const char *fmtfile)
 	if (tlist == NULL) {
 		warnx("%s", errmsg);
 		free(errmsg);
-		return (-1);
-	 }
-	ret = t_tune_set_tags(tune, tlist);
-	t_taglist_delete(tlist);
-	return (ret);
+	}
+	return (tlist);
 }
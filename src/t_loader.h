@@ -22,4 +22,16 @@
  */
 int	t_load(struct t_tune *tune, const char *fmtfile);
 
+/*
+ * parse a given fmtfile.
+ *
+ * @param fmtfile
+ *   see t_load().
+ *
+ * @return
+ *   the parsed tags on success, NULL on error (a warning is emitted). The
+ *   caller should pass the returned value to t_taglist_delete().
+ */
+struct t_taglist	*t_load_tags(const char *fmtfile);
+
 #endif /* ndef T_LOADER_H */
@@ -0,0 +1,179 @@
+/*
+ * t_pool.c
+ *
+ * worker pool used to process many files at once.
+ *
+ * Workers pick the next path to process in order and write their output into
+ * a private memory sink. The calling thread acts as the "printer": it waits
+ * for each job in the paths order and write its output to stdout, so that the
+ * jobs can complete in any order while the output stay ordered (i.e. a reorder
+ * buffer). Workers never get more than T_POOL_WINDOW(nworkers) jobs ahead of
+ * the printer, bounding the memory used by buffered outputs. It also mean
+ * that the job i can use the sink i % window, since the job i - window has
+ * been printed before the job i start. Thus the sinks buffers are reused and
+ * no memory is allocated per job once they are big enough. The printer write
+ * every consecutive finished jobs at once with writev(2).
+ */
+#include <pthread.h>
+
+#include "t_config.h"
+#include "t_toolkit.h"
+#include "t_sink.h"
+#include "t_pool.h"
+
+
+/* how many jobs can be in flight (running or waiting to be printed) */
+#define	T_POOL_WINDOW(nworkers)	(4 * (nworkers))
+
+
+struct t_pool_job {
+	const char	*path;
+	struct t_sink	*sink;    /* buffered output */
+	int		 success;
+	int		 done;    /* 1 once the job is finished */
+};
+
+struct t_pool {
+	pthread_mutex_t	 mtx;
+	pthread_cond_t	 cond;    /* signaled when next or printed change */
+	struct t_pool_job	*jobs;
+	int		 njob;
+	int		 next;    /* index of the next job to start */
+	int		 printed; /* count of jobs printed so far */
+	int		 window;
+	struct t_sink	*sinks;   /* window sinks, reused by the jobs */
+	t_pool_job_func	*func;
+	void		*arg;
+};
+
+
+/* worker thread main loop */
+static void	*t_pool_worker(void *vpool);
+
+
+int
+t_pool_run(int nworkers, int npath, char **paths, t_pool_job_func *func,
+    void *arg)
+{
+	int i, j, k, grand_success = 1;
+	pthread_t *tids;
+	struct t_pool pool;
+	struct t_sink **batch;
+
+	assert(nworkers > 0);
+	assert(npath >= 0);
+	assert(paths != NULL);
+	assert(func != NULL);
+
+	bzero(&pool, sizeof(pool));
+	pool.njob   = npath;
+	pool.window = T_POOL_WINDOW(nworkers);
+	pool.func   = func;
+	pool.arg    = arg;
+	pool.jobs   = calloc((size_t)npath + 1, sizeof(struct t_pool_job));
+	pool.sinks  = calloc((size_t)pool.window, sizeof(struct t_sink));
+	batch       = calloc((size_t)pool.window, sizeof(struct t_sink *));
+	tids        = calloc((size_t)nworkers, sizeof(pthread_t));
+	if (pool.jobs == NULL || pool.sinks == NULL || batch == NULL ||
+	    tids == NULL)
+		err(EXIT_FAILURE, "calloc");
+	for (i = 0; i < npath; i++)
+		pool.jobs[i].path = paths[i];
+	for (i = 0; i < pool.window; i++)
+		t_sink_init(&pool.sinks[i], -1);
+	if ((errno = pthread_mutex_init(&pool.mtx, NULL)) != 0)
+		err(EXIT_FAILURE, "pthread_mutex_init");
+	if ((errno = pthread_cond_init(&pool.cond, NULL)) != 0)
+		err(EXIT_FAILURE, "pthread_cond_init");
+
+	for (i = 0; i < nworkers; i++) {
+		errno = pthread_create(&tids[i], NULL, t_pool_worker, &pool);
+		if (errno != 0)
+			err(EXIT_FAILURE, "pthread_create");
+	}
+
+	/* anything already output by the calling thread come first */
+	if (t_sink_flush(t_sink_get()) != 0) {
+		warn("write");
+		grand_success = 0;
+	}
+
+	/* the printer loop, output the jobs results in order */
+	for (i = 0; i < npath; i = j) {
+		(void)pthread_mutex_lock(&pool.mtx);
+		while (!pool.jobs[i].done)
+			(void)pthread_cond_wait(&pool.cond, &pool.mtx);
+		/* every consecutive finished job, at most window of them */
+		for (j = i + 1; j < npath && pool.jobs[j].done; j++)
+			continue;
+		(void)pthread_mutex_unlock(&pool.mtx);
+
+		for (k = i; k < j; k++) {
+			batch[k - i] = pool.jobs[k].sink;
+			grand_success &= pool.jobs[k].success;
+		}
+		if (t_sink_flushv(STDOUT_FILENO, batch, j - i) != 0) {
+			warn("write");
+			grand_success = 0;
+		}
+
+		(void)pthread_mutex_lock(&pool.mtx);
+		pool.printed = j;
+		(void)pthread_cond_broadcast(&pool.cond);
+		(void)pthread_mutex_unlock(&pool.mtx);
+	}
+
+	for (i = 0; i < nworkers; i++)
+		(void)pthread_join(tids[i], NULL);
+
+	(void)pthread_cond_destroy(&pool.cond);
+	(void)pthread_mutex_destroy(&pool.mtx);
+	for (i = 0; i < pool.window; i++)
+		t_sink_release(&pool.sinks[i]);
+	free(tids);
+	free(batch);
+	free(pool.sinks);
+	free(pool.jobs);
+	return (grand_success);
+}
+
+
+static void *
+t_pool_worker(void *vpool)
+{
+	struct t_pool *pool;
+	struct t_pool_job *job;
+	int idx;
+
+	assert(vpool != NULL);
+	pool = vpool;
+
+	for (;;) {
+		(void)pthread_mutex_lock(&pool->mtx);
+		while (pool->next < pool->njob &&
+		    pool->next >= pool->printed + pool->window) {
+			(void)pthread_cond_wait(&pool->cond, &pool->mtx);
+		}
+		if (pool->next >= pool->njob) {
+			(void)pthread_mutex_unlock(&pool->mtx);
+			break;
+		}
+		idx = pool->next++;
+		(void)pthread_mutex_unlock(&pool->mtx);
+
+		job = &pool->jobs[idx];
+		/* the previous user of this sink has been printed */
+		job->sink = &pool->sinks[idx % pool->window];
+		assert(job->sink->len == 0);
+		t_sink_set(job->sink);
+		job->success = pool->func(job->path, pool->arg);
+		t_sink_set(NULL);
+
+		(void)pthread_mutex_lock(&pool->mtx);
+		job->done = 1;
+		(void)pthread_cond_broadcast(&pool->cond);
+		(void)pthread_mutex_unlock(&pool->mtx);
+	}
+
+	return (NULL);
+}
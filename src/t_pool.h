@@ -0,0 +1,41 @@
+#ifndef T_POOL_H
+#define T_POOL_H
+/*
+ * t_pool.h
+ *
+ * worker pool used to process many files at once.
+ */
+#include "t_config.h"
+
+
+/* upper bound for the count of workers */
+#define	T_POOL_MAX_WORKERS	256
+
+/*
+ * routine called once for each file by a worker.
+ *
+ * @param path
+ *   The file to process.
+ *
+ * @param arg
+ *   The arg pointer given to t_pool_run().
+ *
+ * @return
+ *   1 on success, 0 otherwise.
+ */
+typedef int	t_pool_job_func(const char *path, void *arg);
+
+/*
+ * Apply job to each of the npath paths using nworkers threads.
+ *
+ * Each job output (see t_sink_get()) is buffered and printed on stdout in the
+ * same order as paths, so that the result look exactly like a serial run.
+ * Errors (like malloc(3) failure) are fatal.
+ *
+ * @return
+ *   1 if every job succeeded, 0 otherwise.
+ */
+int	t_pool_run(int nworkers, int npath, char **paths, t_pool_job_func *job,
+	    void *arg);
+
+#endif /* ndef T_POOL_H */
@@ -12,6 +12,7 @@
 
 #include <ctype.h>
 #include <errno.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -19,6 +20,7 @@
 #include "t_config.h"
 #include "t_toolkit.h"
 #include "t_renamer.h"
+#include "t_sink.h"
 
 
 /*
@@ -53,6 +55,8 @@ static char	*t_rename_eval(struct t_tune *tune,
  *   return -1 on error and set and errno, 0 on success.
  */
 static int	t_rename_safe(const char *oldpath, const char *newpath);
+/* t_rename_safe() implementation, called with its mutex held */
+static int	t_rename_safe_locked(const char *oldpath, const char *newpath);
 
 /*
  * print the given question, and read user's input. input should match
@@ -262,14 +266,15 @@ char *
 t_rename_eval(struct t_tune *tune, const struct t_rename_pattern *pattern)
 {
 	struct t_rename_token *token;
-	struct sbuf *sb = NULL;
+	struct sbuf sbs, *sb = NULL;
 	struct t_taglist *tlist = NULL, *l = NULL;
 	char *s = NULL, *ret;
 
 	assert(tune != NULL);
 	assert(pattern != NULL);
 
-	sb = sbuf_new_auto();
+	/* a result fitting in MAXPATHLEN never need malloc(3) */
+	sb = t_arena_sbuf(t_tune_arena(tune), &sbs, MAXPATHLEN + 1);
 	if (sb == NULL)
 		goto error;
 
@@ -366,15 +371,16 @@ t_yesno(const char *question)
 		(void)memset(buffer, '\0', sizeof(buffer));
 
 		if (question != NULL) {
-			(void)printf("%s? [y/n] ", question);
-			(void)fflush(stdout);
+			(void)t_sink_printf(t_sink_get(), "%s? [y/n] ",
+			    question);
+			(void)t_sink_flush(t_sink_get());
 		}
 
 		if (Yflag) {
-			(void)printf("yes\n");
+			(void)t_sink_printf(t_sink_get(), "yes\n");
 			return (1);
 		} else if (Nflag) {
-			(void)printf("no\n");
+			(void)t_sink_printf(t_sink_get(), "no\n");
 			return (0);
 		}
 
@@ -404,6 +410,23 @@ t_yesno(const char *question)
 
 static int
 t_rename_safe(const char *opath, const char *npath)
+{
+	/*
+	 * build() change the process umask(2) and the destination checks are
+	 * racy, so renames are serialized when running with many workers.
+	 */
+	static pthread_mutex_t mtx = PTHREAD_MUTEX_INITIALIZER;
+	int ret;
+
+	(void)pthread_mutex_lock(&mtx);
+	ret = t_rename_safe_locked(opath, npath);
+	(void)pthread_mutex_unlock(&mtx);
+	return (ret);
+}
+
+
+static int
+t_rename_safe_locked(const char *opath, const char *npath)
 {
 	extern int pflag;
 	int failed = 0;
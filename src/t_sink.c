@@ -0,0 +1,294 @@
+/*
+ * t_sink.c
+ *
+ * output buffers for tagutil.
+ *
+ * A sink is a growing buffer that the formats write into directly (instead of
+ * building and copying a string per file). A sink bound to a file descriptor
+ * is written out once it reach T_SINK_BUFSIZ, so that printing many files
+ * cost a handful of write(2) calls. Memory sinks (like the worker pool jobs
+ * ones) are reused from a file to the next, so their buffer is only allocated
+ * once.
+ */
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include <limits.h>
+#include <stdint.h>
+
+#include "t_config.h"
+#include "t_toolkit.h"
+#include "t_sink.h"
+
+
+/* initial size of a memory sink buffer */
+#define	T_SINK_MINSIZE	4096
+
+/* the count of struct iovec given to a single writev(2) call */
+#if defined(IOV_MAX) && IOV_MAX < 64
+#define	T_SINK_IOVMAX	IOV_MAX
+#else
+#define	T_SINK_IOVMAX	64
+#endif
+
+/* the stdout sink, only used by the main thread */
+static struct t_sink	t_sink_stdout;
+static int		t_sink_stdout_initialized = 0;
+
+/* the calling thread output sink, NULL means the stdout sink */
+static t__thread struct t_sink	*t_sink_current = NULL;
+
+
+/*
+ * ensure that sink can receive len more bytes (and a NUL).
+ *
+ * @return
+ *   0 on success, -1 and set errno on error.
+ */
+static int	t_sink_reserve(struct t_sink *sink, size_t len);
+
+/* atexit(3) handler flushing the stdout sink */
+static void	t_sink_stdout_atexit(void);
+
+
+void
+t_sink_init(struct t_sink *sink, int fd)
+{
+
+	assert(sink != NULL);
+
+	bzero(sink, sizeof(struct t_sink));
+	sink->fd  = fd;
+	sink->tty = (fd != -1 && isatty(fd));
+}
+
+
+int
+t_sink_write(struct t_sink *sink, const void *data, size_t len)
+{
+
+	assert(sink != NULL);
+	assert(data != NULL || len == 0);
+
+	if (len == 0)
+		return (0);
+
+	if (sink->fd != -1 && sink->len + len > T_SINK_BUFSIZ) {
+		if (t_sink_flush(sink) == -1)
+			return (-1);
+		/* too big to be worth a copy */
+		if (len >= T_SINK_BUFSIZ)
+			return (t_write_all(sink->fd, data, len));
+	}
+
+	if (t_sink_reserve(sink, len) == -1)
+		return (-1);
+	(void)memcpy(sink->buf + sink->len, data, len);
+	sink->len += len;
+
+	return (sink->tty ? t_sink_flush(sink) : 0);
+}
+
+
+int
+t_sink_printf(struct t_sink *sink, const char *fmt, ...)
+{
+	va_list ap;
+	char buf[BUFSIZ], *s = buf;
+	int n, ret;
+
+	assert(sink != NULL);
+	assert(fmt != NULL);
+
+	va_start(ap, fmt);
+	n = vsnprintf(buf, sizeof(buf), fmt, ap);
+	va_end(ap);
+	if (n < 0)
+		return (-1);
+	if ((size_t)n >= sizeof(buf)) {
+		/* rare enough to not bother writing into the sink directly */
+		va_start(ap, fmt);
+		n = vasprintf(&s, fmt, ap);
+		va_end(ap);
+		if (n < 0)
+			return (-1);
+	}
+
+	ret = t_sink_write(sink, s, (size_t)n);
+	if (s != buf)
+		free(s);
+	return (ret);
+}
+
+
+int
+t_sink_flush(struct t_sink *sink)
+{
+	int ret;
+
+	assert(sink != NULL);
+
+	if (sink->fd == -1 || sink->len == 0)
+		return (0);
+
+	ret = t_write_all(sink->fd, sink->buf, sink->len);
+	sink->len = 0;
+	return (ret);
+}
+
+
+int
+t_sink_flushv(int fd, struct t_sink **sinks, int count)
+{
+	struct iovec iov[T_SINK_IOVMAX], *v;
+	ssize_t n;
+	int i, iovcnt, ret = 0;
+
+	assert(fd >= 0);
+	assert(sinks != NULL || count == 0);
+
+	for (i = 0; i < count && ret == 0; ) {
+		iovcnt = 0;
+		for (; i < count && iovcnt < T_SINK_IOVMAX; i++) {
+			assert(sinks[i]->fd == -1);
+			if (sinks[i]->len == 0)
+				continue;
+			iov[iovcnt].iov_base = sinks[i]->buf;
+			iov[iovcnt].iov_len  = sinks[i]->len;
+			iovcnt++;
+		}
+		v = iov;
+		while (iovcnt > 0) {
+			n = writev(fd, v, iovcnt);
+			if (n == -1) {
+				if (errno == EINTR)
+					continue;
+				ret = -1;
+				break;
+			}
+			/* skip what was written, retry the rest */
+			while (iovcnt > 0 && (size_t)n >= v->iov_len) {
+				n -= v->iov_len;
+				v++;
+				iovcnt--;
+			}
+			if (iovcnt > 0) {
+				v->iov_base = (char *)v->iov_base + n;
+				v->iov_len -= n;
+			}
+		}
+	}
+
+	/* on error the content is lost, like with a failed fwrite(3) */
+	for (i = 0; i < count; i++)
+		t_sink_reset(sinks[i]);
+	return (ret);
+}
+
+
+char *
+t_sink_detach(struct t_sink *sink)
+{
+	char *ret;
+
+	assert(sink != NULL);
+	assert(sink->fd == -1);
+
+	if (t_sink_reserve(sink, 0) == -1)
+		return (NULL);
+	sink->buf[sink->len] = '\0';
+	ret = sink->buf;
+
+	sink->buf  = NULL;
+	sink->len  = 0;
+	sink->size = 0;
+	return (ret);
+}
+
+
+void
+t_sink_reset(struct t_sink *sink)
+{
+
+	assert(sink != NULL);
+
+	sink->len = 0;
+}
+
+
+void
+t_sink_release(struct t_sink *sink)
+{
+
+	if (sink == NULL)
+		return;
+
+	free(sink->buf);
+	sink->buf  = NULL;
+	sink->len  = 0;
+	sink->size = 0;
+}
+
+
+struct t_sink *
+t_sink_get(void)
+{
+
+	if (t_sink_current != NULL)
+		return (t_sink_current);
+
+	if (!t_sink_stdout_initialized) {
+		t_sink_init(&t_sink_stdout, STDOUT_FILENO);
+		if (atexit(t_sink_stdout_atexit) != 0)
+			err(EXIT_FAILURE, "atexit");
+		t_sink_stdout_initialized = 1;
+	}
+	return (&t_sink_stdout);
+}
+
+
+void
+t_sink_set(struct t_sink *sink)
+{
+
+	t_sink_current = sink;
+}
+
+
+static int
+t_sink_reserve(struct t_sink *sink, size_t len)
+{
+	size_t size;
+	char *buf;
+
+	assert(sink != NULL);
+
+	if (len >= SIZE_MAX - sink->len) {
+		errno = ENOMEM;
+		return (-1);
+	}
+	if (sink->len + len < sink->size)
+		return (0);
+
+	size = (sink->size > 0 ? sink->size : T_SINK_MINSIZE);
+	while (size <= sink->len + len) {
+		if (size > SIZE_MAX / 2) {
+			size = sink->len + len + 1;
+			break;
+		}
+		size *= 2;
+	}
+	if ((buf = realloc(sink->buf, size)) == NULL)
+		return (-1);
+	sink->buf  = buf;
+	sink->size = size;
+	return (0);
+}
+
+
+static void
+t_sink_stdout_atexit(void)
+{
+
+	(void)t_sink_flush(&t_sink_stdout);
+}
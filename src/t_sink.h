@@ -0,0 +1,113 @@
+#ifndef T_SINK_H
+#define T_SINK_H
+/*
+ * t_sink.h
+ *
+ * output buffers for tagutil.
+ *
+ * Everything that is part of tagutil's output (as opposed to diagnostics) is
+ * written into the calling thread sink (see t_sink_get()), so that the worker
+ * pool can buffer and reorder each file output.
+ */
+#include <stddef.h>
+
+#include "t_config.h"
+
+
+/* a sink bound to a file descriptor is flushed when it reach this size */
+#define	T_SINK_BUFSIZ	(64 * 1024)
+
+struct t_sink {
+	char	*buf;
+	size_t	 len; /* bytes in buf not flushed yet */
+	size_t	 size; /* allocated bytes in buf */
+	/* the file descriptor written by t_sink_flush(), -1 for memory only */
+	int	 fd;
+	int	 tty; /* 1 if fd is a terminal, the sink is then unbuffered */
+};
+
+
+/*
+ * initialize a sink.
+ *
+ * @param fd
+ *   The file descriptor where the sink will be flushed. If -1, the sink is
+ *   only a growing memory buffer and never flushed.
+ */
+void	t_sink_init(struct t_sink *sink, int fd);
+
+/*
+ * append len bytes to a sink.
+ *
+ * A sink bound to a file descriptor may be flushed as a side effect.
+ *
+ * @return
+ *   0 on success, -1 and set errno on error.
+ */
+int	t_sink_write(struct t_sink *sink, const void *data, size_t len);
+
+/*
+ * append a formated string to a sink, see printf(3) and t_sink_write().
+ *
+ * @return
+ *   0 on success, -1 and set errno on error.
+ */
+int	t_sink_printf(struct t_sink *sink, const char *fmt, ...)
+	    t__printflike(2, 3);
+
+/*
+ * write the content of a sink to its file descriptor and empty it.
+ *
+ * @return
+ *   0 on success, -1 and set errno on error.
+ */
+int	t_sink_flush(struct t_sink *sink);
+
+/*
+ * write the content of count memory sinks to fd, in order and with a single
+ * writev(2) when possible, and empty them.
+ *
+ * @return
+ *   0 on success, -1 and set errno on error.
+ */
+int	t_sink_flushv(int fd, struct t_sink **sinks, int count);
+
+/*
+ * get the content of a memory sink as a NUL-terminated string and reset the
+ * sink.
+ *
+ * @return
+ *   the content, which should be passed to free(3) after use, or NULL and
+ *   set errno on error.
+ */
+char	*t_sink_detach(struct t_sink *sink);
+
+/*
+ * empty a sink, keeping its buffer so that it can be reused.
+ */
+void	t_sink_reset(struct t_sink *sink);
+
+/*
+ * free the buffer of a sink. The sink should be initialized again to be
+ * reused.
+ */
+void	t_sink_release(struct t_sink *sink);
+
+/*
+ * get the calling thread output sink.
+ *
+ * @return
+ *   the sink set by t_sink_set() or the stdout sink, which is flushed at
+ *   exit(3).
+ */
+struct t_sink	*t_sink_get(void);
+
+/*
+ * set the calling thread output sink.
+ *
+ * @param sink
+ *   The new output sink, NULL means the stdout sink.
+ */
+void	t_sink_set(struct t_sink *sink);
+
+#endif /* ndef T_SINK_H */
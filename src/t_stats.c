@@ -0,0 +1,389 @@
+/*
+ * t_stats.c
+ *
+ * tag values statistics for tagutil.
+ *
+ * Each thread calling t_stats_add() get its own table (found through a
+ * pthread key), so that the workers never contend. The tables are
+ * registered in their t_stats at creation and are only merged by
+ * t_stats_report(), once all the files are processed. A table is an open
+ * addressing hash table (linear probing) of the distinct values, so the
+ * memory used is bounded by the count of distinct values and not by the
+ * count of files.
+ */
+#include <pthread.h>
+#include <stdint.h>
+
+#include "t_config.h"
+#include "t_toolkit.h"
+#include "t_casefold.h"
+#include "t_key.h"
+#include "t_stats.h"
+
+
+/* initial count of slots of a table */
+#define	T_STATS_MINSIZE	64
+
+struct t_stats_entry {
+	char		*val; /* NULL for an empty slot */
+	size_t		 vlen;
+	uint32_t	 hash;
+	unsigned long	 count;
+};
+
+struct t_stats_table {
+	unsigned long		 nfile;
+	unsigned long		 nmissing;
+	size_t			 count; /* used slots */
+	size_t			 size; /* a power of two */
+	struct t_stats_entry	*slots;
+	struct t_stats_table	*next;
+};
+
+struct t_stats {
+	const char		*key; /* interned, see t_key_intern() */
+	pthread_key_t		 tkey; /* the calling thread's table */
+	pthread_mutex_t		 mtx; /* protect tables */
+	struct t_stats_table	*tables;
+};
+
+
+/*
+ * get the calling thread's table, creating it if needed.
+ *
+ * @return
+ *   the table on success, NULL and set errno on error.
+ */
+static struct t_stats_table	*t_stats_table(struct t_stats *stats);
+
+/*
+ * find the slot of val in table, or the empty slot where it should be
+ * inserted.
+ */
+static struct t_stats_entry	*t_stats_find(struct t_stats_table *table,
+		    const char *val, size_t vlen, uint32_t hash);
+
+/*
+ * add count to the entry of val in table, creating it if needed (val is then
+ * copied unless own is set, in which case the table take ownership of val).
+ *
+ * @return
+ *   0 on success, -1 and set errno on error.
+ */
+static int	t_stats_count(struct t_stats_table *table, char *val,
+		    size_t vlen, uint32_t hash, unsigned long count, int own);
+
+/* free a table and its values */
+static void	t_stats_table_delete(struct t_stats_table *table);
+
+/* qsort(3) routine sorting entries by decreasing count and then by value */
+static int	t_stats_entry_cmp(const void *va, const void *vb);
+
+
+struct t_stats *
+t_stats_new(const char *key)
+{
+	struct t_stats *stats;
+
+	assert(key != NULL);
+
+	if ((stats = calloc(1, sizeof(struct t_stats))) == NULL)
+		return (NULL);
+
+	if ((stats->key = t_key_intern(key, strlen(key))) == NULL)
+		goto error;
+	if ((errno = pthread_key_create(&stats->tkey, NULL)) != 0)
+		goto error;
+	if ((errno = pthread_mutex_init(&stats->mtx, NULL)) != 0) {
+		(void)pthread_key_delete(stats->tkey);
+		goto error;
+	}
+
+	return (stats);
+error:
+	free(stats);
+	return (NULL);
+}
+
+
+int
+t_stats_add(struct t_stats *stats, const struct t_taglist *tlist)
+{
+	struct t_stats_table *table;
+	const struct t_tag *t;
+	int missing = 1;
+
+	assert(stats != NULL);
+	assert(tlist != NULL);
+
+	if ((table = t_stats_table(stats)) == NULL)
+		return (-1);
+
+	T_TAGLIST_FOREACH(t, tlist) {
+		if (t->key != stats->key)
+			continue;
+		missing = 0;
+		/* the const is dropped, but val is copied since own is 0 */
+		if (t_stats_count(table, (char *)t->val, t->vlen,
+		    t_casefold_hash(t->val, t->vlen), 1, 0) != 0)
+			return (-1);
+	}
+
+	table->nfile++;
+	table->nmissing += missing;
+	return (0);
+}
+
+
+const char *
+t_stats_key(const struct t_stats *stats)
+{
+
+	assert(stats != NULL);
+
+	return (stats->key);
+}
+
+
+struct t_taglist *
+t_stats_report(struct t_stats *stats)
+{
+	int success = 0;
+	struct t_stats_table *all, *table;
+	struct t_stats_entry *e, *entries = NULL;
+	struct t_taglist *tlist = NULL;
+	size_t i, n;
+	char num[32];
+
+	assert(stats != NULL);
+
+	/* merge all the tables into the first one */
+	(void)pthread_mutex_lock(&stats->mtx);
+	if (stats->tables == NULL) {
+		/* no file were processed */
+		stats->tables = calloc(1, sizeof(struct t_stats_table));
+		if (stats->tables == NULL)
+			goto cleanup;
+	}
+	all = stats->tables;
+	while ((table = all->next) != NULL) {
+		all->nfile    += table->nfile;
+		all->nmissing += table->nmissing;
+		for (i = 0; i < table->size; i++) {
+			e = &table->slots[i];
+			if (e->val == NULL)
+				continue;
+			if (t_stats_count(all, e->val, e->vlen, e->hash,
+			    e->count, 1) != 0)
+				goto cleanup;
+			/* now owned by all */
+			e->val = NULL;
+		}
+		all->next = table->next;
+		t_stats_table_delete(table);
+	}
+
+	/* sort the distinct values */
+	if ((entries = calloc(all->count + 1, sizeof(*entries))) == NULL)
+		goto cleanup;
+	for (i = n = 0; i < all->size; i++) {
+		if (all->slots[i].val != NULL)
+			entries[n++] = all->slots[i];
+	}
+	assert(n == all->count);
+	qsort(entries, n, sizeof(*entries), t_stats_entry_cmp);
+
+	if ((tlist = t_taglist_new()) == NULL)
+		goto cleanup;
+	(void)snprintf(num, sizeof(num), "%lu", all->nfile);
+	if (t_taglist_insert(tlist, "files", num) != 0)
+		goto cleanup;
+	(void)snprintf(num, sizeof(num), "%lu", all->nmissing);
+	if (t_taglist_insert(tlist, "missing", num) != 0)
+		goto cleanup;
+	(void)snprintf(num, sizeof(num), "%zu", n);
+	if (t_taglist_insert(tlist, "distinct", num) != 0)
+		goto cleanup;
+	for (i = 0; i < n; i++) {
+		e = &entries[i];
+		(void)snprintf(num, sizeof(num), "%lu", e->count);
+		if (t_taglist_insert(tlist, "count", num) != 0)
+			goto cleanup;
+		if (t_taglist_insert_len(tlist, "value", 5, e->val,
+		    e->vlen) != 0)
+			goto cleanup;
+	}
+
+	/* All went well. */
+	success = 1;
+
+	/* FALLTHROUGH */
+cleanup:
+	(void)pthread_mutex_unlock(&stats->mtx);
+	free(entries);
+	if (!success) {
+		t_taglist_delete(tlist);
+		tlist = NULL;
+	}
+	return (tlist);
+}
+
+
+void
+t_stats_delete(struct t_stats *stats)
+{
+	struct t_stats_table *table, *next;
+
+	if (stats == NULL)
+		return;
+
+	for (table = stats->tables; table != NULL; table = next) {
+		next = table->next;
+		t_stats_table_delete(table);
+	}
+	(void)pthread_mutex_destroy(&stats->mtx);
+	(void)pthread_key_delete(stats->tkey);
+	free(stats);
+}
+
+
+static struct t_stats_table *
+t_stats_table(struct t_stats *stats)
+{
+	struct t_stats_table *table;
+
+	assert(stats != NULL);
+
+	table = pthread_getspecific(stats->tkey);
+	if (table != NULL)
+		return (table);
+
+	if ((table = calloc(1, sizeof(struct t_stats_table))) == NULL)
+		return (NULL);
+	if ((errno = pthread_setspecific(stats->tkey, table)) != 0) {
+		free(table);
+		return (NULL);
+	}
+
+	/* the table outlive the thread, it is owned by stats */
+	(void)pthread_mutex_lock(&stats->mtx);
+	table->next   = stats->tables;
+	stats->tables = table;
+	(void)pthread_mutex_unlock(&stats->mtx);
+
+	return (table);
+}
+
+
+static struct t_stats_entry *
+t_stats_find(struct t_stats_table *table, const char *val, size_t vlen,
+    uint32_t hash)
+{
+	struct t_stats_entry *e;
+	size_t i, mask;
+
+	assert(table != NULL);
+	assert(table->size > 0);
+
+	mask = table->size - 1;
+	for (i = hash & mask; ; i = (i + 1) & mask) {
+		e = &table->slots[i];
+		if (e->val == NULL)
+			return (e);
+		if (e->hash == hash && e->vlen == vlen &&
+		    memcmp(e->val, val, vlen) == 0)
+			return (e);
+	}
+	/* NOTREACHED */
+}
+
+
+static int
+t_stats_count(struct t_stats_table *table, char *val, size_t vlen,
+    uint32_t hash, unsigned long count, int own)
+{
+	struct t_stats_entry *e, *slots, *old;
+	size_t i, size, oldsize;
+
+	assert(table != NULL);
+	assert(val != NULL);
+
+	if (table->size > 0) {
+		e = t_stats_find(table, val, vlen, hash);
+		if (e->val != NULL) {
+			e->count += count;
+			if (own)
+				free(val);
+			return (0);
+		}
+	}
+
+	/* a new value, keep the table at most half full */
+	if (2 * (table->count + 1) > table->size) {
+		size = (table->size > 0 ? 2 * table->size : T_STATS_MINSIZE);
+		if ((slots = calloc(size, sizeof(*slots))) == NULL)
+			return (-1);
+		old     = table->slots;
+		oldsize = table->size;
+		table->slots = slots;
+		table->size  = size;
+		for (i = 0; i < oldsize; i++) {
+			if (old[i].val != NULL) {
+				*t_stats_find(table, old[i].val, old[i].vlen,
+				    old[i].hash) = old[i];
+			}
+		}
+		free(old);
+	}
+
+	e = t_stats_find(table, val, vlen, hash);
+	if (!own) {
+		/* the tag (and its value) doesn't outlive its tune */
+		if ((e->val = malloc(vlen + 1)) == NULL)
+			return (-1);
+		(void)memcpy(e->val, val, vlen);
+		e->val[vlen] = '\0';
+	} else
+		e->val = val;
+	e->vlen  = vlen;
+	e->hash  = hash;
+	e->count = count;
+	table->count++;
+	return (0);
+}
+
+
+static void
+t_stats_table_delete(struct t_stats_table *table)
+{
+	size_t i;
+
+	if (table == NULL)
+		return;
+
+	for (i = 0; i < table->size; i++)
+		free(table->slots[i].val);
+	free(table->slots);
+	free(table);
+}
+
+
+static int
+t_stats_entry_cmp(const void *va, const void *vb)
+{
+	const struct t_stats_entry *a, *b;
+	size_t len;
+	int cmp;
+
+	assert(va != NULL);
+	assert(vb != NULL);
+
+	a = va;
+	b = vb;
+	if (a->count != b->count)
+		return (a->count > b->count ? -1 : 1);
+	len = (a->vlen < b->vlen ? a->vlen : b->vlen);
+	if ((cmp = memcmp(a->val, b->val, len)) != 0)
+		return (cmp);
+	return (a->vlen < b->vlen ? -1 : (a->vlen > b->vlen));
+}
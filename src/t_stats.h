@@ -0,0 +1,63 @@
+#ifndef T_STATS_H
+#define T_STATS_H
+/*
+ * t_stats.h
+ *
+ * tag values statistics for tagutil.
+ */
+#include "t_config.h"
+#include "t_taglist.h"
+
+
+/* declaration of a statistics accumulator type */
+struct t_stats;
+
+
+/*
+ * create a new statistics accumulator for the given tag key.
+ *
+ * @return
+ *   a new t_stats on success, NULL and set errno on error. The returned value
+ *   should be passed to t_stats_delete() after use.
+ */
+struct t_stats	*t_stats_new(const char *key);
+
+/*
+ * account the tags of a file.
+ *
+ * This routine is thread-safe: each thread accumulate into its own table, so
+ * that concurrent calls don't contend.
+ *
+ * @return
+ *   0 on success, -1 and set errno on error (malloc(3) failed).
+ */
+int	t_stats_add(struct t_stats *stats, const struct t_taglist *tlist);
+
+/*
+ * @return
+ *   the (interned) tag key given to t_stats_new().
+ */
+const char	*t_stats_key(const struct t_stats *stats);
+
+/*
+ * merge the statistics of all the threads.
+ *
+ * This routine should be called once all the files have been accounted:
+ * the only valid call on stats afterward is t_stats_delete().
+ *
+ * @return
+ *   a t_taglist containing the count of files (`files'), the count of files
+ *   without any tag matching the key (`missing') and the count of distinct
+ *   values (`distinct'), followed by a `count' and a `value' tag for each
+ *   distinct value, from the most to the least frequent. On error NULL is
+ *   returned and errno is set (malloc(3) failed). The returned value should
+ *   be passed to t_taglist_delete() after use.
+ */
+struct t_taglist	*t_stats_report(struct t_stats *stats);
+
+/*
+ * free all memory associated with a statistics accumulator.
+ */
+void	t_stats_delete(struct t_stats *stats);
+
+#endif /* ndef T_STATS_H */
@@ -0,0 +1,303 @@
+/*
+ * t_subst.c
+ *
+ * regex substitution of tag values for tagutil.
+ */
+#include <regex.h>
+
+#include "t_config.h"
+#include "t_toolkit.h"
+#include "t_key.h"
+#include "t_subst.h"
+
+
+/* initial size of the buffer receiving a substituted value */
+#define	T_SUBST_BUFSIZ	256
+
+/* & and \1 to \9 */
+#define	T_SUBST_NMATCH	10
+
+struct t_subst {
+	const char	*key; /* interned, see t_key_intern() */
+	regex_t		 re;
+	char		*repl; /* the REPLACEMENT, with \/ unescaped */
+	int		 global; /* the `g' flag */
+};
+
+
+/*
+ * copy the spec field starting at *p_p up to the next unescaped `/' (or the
+ * end of the spec), unescaping \/.
+ *
+ * @return
+ *   the field (which should be passed to free(3) after use) and set *p_p
+ *   after the `/' or at the end of the spec, NULL and set errno on error.
+ */
+static char	*t_subst_field(const char **p_p);
+
+/*
+ * substitute the value of a tag into sb.
+ *
+ * @return
+ *   1 if the substituted value (in sb) differ from the tag's value, 0 if it
+ *   doesn't, -1 and set errno on error.
+ */
+static int	t_subst_eval(const struct t_subst *subst, const struct t_tag *t,
+		    struct sbuf *sb);
+
+
+struct t_subst *
+t_subst_parse(const char *spec)
+{
+	int success = 0, error, cflags = REG_EXTENDED;
+	struct t_subst *subst;
+	const char *p, *r;
+	char *key = NULL, *regex = NULL, *repl = NULL, errbuf[BUFSIZ];
+
+	assert(spec != NULL);
+
+	if ((subst = calloc(1, sizeof(struct t_subst))) == NULL)
+		goto cleanup;
+
+	p = spec;
+	if ((key = t_subst_field(&p)) == NULL)
+		goto cleanup;
+	if (strlen(key) == 0 || *p == '\0') {
+		warnx("sub: %s: expected TAG/REGEX/REPLACEMENT", spec);
+		errno = EINVAL;
+		goto cleanup;
+	}
+	if ((regex = t_subst_field(&p)) == NULL)
+		goto cleanup;
+	if ((repl = t_subst_field(&p)) == NULL)
+		goto cleanup;
+	for (; *p != '\0'; p++) {
+		switch (*p) {
+		case 'g':
+			subst->global = 1;
+			break;
+		case 'i':
+			cflags |= REG_ICASE;
+			break;
+		default:
+			warnx("sub: %s: unknown flag `%c'", spec, *p);
+			errno = EINVAL;
+			goto cleanup;
+		}
+	}
+
+	if ((subst->key = t_key_intern(key, strlen(key))) == NULL)
+		goto cleanup;
+
+	error = regcomp(&subst->re, regex, cflags);
+	if (error != 0) {
+		(void)regerror(error, &subst->re, errbuf, sizeof(errbuf));
+		warnx("sub: %s: %s", regex, errbuf);
+		errno = EINVAL;
+		goto cleanup;
+	}
+	/* from now on, t_subst_delete() will regfree() */
+	subst->repl = repl;
+	repl = NULL;
+	/* check the back-references of the replacement */
+	for (r = subst->repl; *r != '\0'; r++) {
+		if (r[0] != '\\' || r[1] == '\0')
+			continue;
+		r++;
+		if (isdigit((unsigned char)*r) && (size_t)(*r - '0') >
+		    subst->re.re_nsub) {
+			warnx("sub: %s: invalid reference \\%c", subst->repl,
+			    *r);
+			errno = EINVAL;
+			goto cleanup;
+		}
+	}
+
+	/* All went well. */
+	success = 1;
+
+	/* FALLTHROUGH */
+cleanup:
+	free(repl);
+	free(regex);
+	free(key);
+	if (!success) {
+		assert(errno == EINVAL || errno == ENOMEM);
+		t_subst_delete(subst);
+		subst = NULL;
+	}
+	return (subst);
+}
+
+
+int
+t_subst(const struct t_subst *subst, struct t_taglist **tlist_p,
+    struct t_arena *arena)
+{
+	struct sbuf sbs, *sb;
+	struct t_taglist *tlist, *neo;
+	const struct t_tag *t;
+	size_t i;
+	int changed = 0, success = 0;
+
+	assert(subst != NULL);
+	assert(tlist_p != NULL);
+	assert(*tlist_p != NULL);
+
+	sb = t_arena_sbuf(arena, &sbs, T_SUBST_BUFSIZ);
+	if (sb == NULL)
+		return (-1);
+
+	tlist = *tlist_p;
+	for (i = 0; i < tlist->count; i++) {
+		t = tlist->tags[i];
+		if (t->key != subst->key)
+			continue;
+		switch (t_subst_eval(subst, t, sb)) {
+		case -1:
+			goto cleanup;
+		case 0:
+			continue;
+		}
+		/* copy-on-write, the list is shared with the tune */
+		if (!changed) {
+			if ((neo = t_taglist_unshare(tlist)) == NULL)
+				goto cleanup;
+			*tlist_p = tlist = neo;
+			changed = 1;
+		}
+		if (t_taglist_set_at(tlist, i, sbuf_data(sb),
+		    sbuf_len(sb)) != 0)
+			goto cleanup;
+	}
+
+	/* All went well. */
+	success = 1;
+
+	/* FALLTHROUGH */
+cleanup:
+	sbuf_delete(sb);
+	return (success ? changed : -1);
+}
+
+
+void
+t_subst_delete(struct t_subst *subst)
+{
+
+	if (subst == NULL)
+		return;
+
+	/* repl is set iff re was successfully compiled */
+	if (subst->repl != NULL) {
+		regfree(&subst->re);
+		free(subst->repl);
+	}
+	free(subst);
+}
+
+
+static char *
+t_subst_field(const char **p_p)
+{
+	const char *p;
+	char *field, *f;
+
+	assert(p_p != NULL);
+	assert(*p_p != NULL);
+
+	p = *p_p;
+	/* the unescaped field is never longer than the rest of the spec */
+	if ((field = f = malloc(strlen(p) + 1)) == NULL)
+		return (NULL);
+
+	for (; *p != '\0' && *p != '/'; p++) {
+		if (p[0] == '\\' && p[1] == '/')
+			p++;
+		else if (p[0] == '\\' && p[1] != '\0')
+			*f++ = *p++;
+		*f++ = *p;
+	}
+	*f = '\0';
+
+	*p_p = (*p == '/' ? p + 1 : p);
+	return (field);
+}
+
+
+static int
+t_subst_eval(const struct t_subst *subst, const struct t_tag *t,
+    struct sbuf *sb)
+{
+	regmatch_t m[T_SUBST_NMATCH];
+	size_t nmatch, n;
+	const char *s, *r;
+	int eflags = 0, matched = 0;
+	int after = 0; /* 1 if s is right after a non-empty match */
+
+	assert(subst != NULL);
+	assert(t != NULL);
+	assert(sb != NULL);
+
+	nmatch = subst->re.re_nsub + 1;
+	if (nmatch > NELEM(m))
+		nmatch = NELEM(m);
+
+	sbuf_clear(sb);
+	s = t->val;
+	while (regexec(&subst->re, s, nmatch, m, eflags) == 0) {
+		if (after && m[0].rm_so == 0 && m[0].rm_eo == 0) {
+			/* an empty match right after the previous match is
+			   not replaced, like sed(1) */
+			if (*s == '\0')
+				break;
+			(void)sbuf_putc(sb, *s++);
+			after = 0;
+			continue;
+		}
+		matched = 1;
+		(void)sbuf_bcat(sb, s, m[0].rm_so);
+		for (r = subst->repl; *r != '\0'; r++) {
+			if (r[0] == '&')
+				n = 0;
+			else if (r[0] == '\\' && isdigit((unsigned char)r[1]))
+				n = *++r - '0';
+			else {
+				if (r[0] == '\\' && r[1] != '\0')
+					r++;
+				(void)sbuf_putc(sb, *r);
+				continue;
+			}
+			if (n < nmatch && m[n].rm_so != -1) {
+				(void)sbuf_bcat(sb, s + m[n].rm_so,
+				    m[n].rm_eo - m[n].rm_so);
+			}
+		}
+		if (m[0].rm_eo == m[0].rm_so) {
+			/* empty match, move forward by one character */
+			if (s[m[0].rm_eo] == '\0') {
+				s += m[0].rm_eo;
+				break;
+			}
+			(void)sbuf_putc(sb, s[m[0].rm_eo]);
+			s += m[0].rm_eo + 1;
+			after = 0;
+		} else {
+			s += m[0].rm_eo;
+			after = 1;
+		}
+		if (!subst->global)
+			break;
+		eflags = REG_NOTBOL;
+	}
+	if (!matched)
+		return (0);
+
+	/* the rest of the value, including anything after an embedded NUL */
+	(void)sbuf_bcat(sb, s, t->val + t->vlen - s);
+	if (sbuf_finish(sb) == -1)
+		return (-1);
+
+	return ((size_t)sbuf_len(sb) != t->vlen ||
+	    memcmp(sbuf_data(sb), t->val, t->vlen) != 0);
+}
@@ -0,0 +1,63 @@
+#ifndef T_SUBST_H
+#define T_SUBST_H
+/*
+ * t_subst.h
+ *
+ * regex substitution of tag values for tagutil.
+ */
+#include "t_config.h"
+#include "t_arena.h"
+#include "t_taglist.h"
+
+
+/* declaration of a compiled substitution type */
+struct t_subst;
+
+
+/*
+ * compile a substitution.
+ *
+ * spec looks like TAG/REGEX/REPLACEMENT/FLAGS, where a `/' can be escaped by a
+ * backslash and the trailing `/FLAGS' is optional. REGEX is a POSIX extended
+ * regex. In REPLACEMENT, & is replaced by the matched string and \1 to \9 by
+ * the corresponding sub-expression, other backslashes escape the following
+ * character. FLAGS can contain `g' (replace every match instead of only the
+ * first one) and `i' (ignore case).
+ *
+ * On error a warning is emitted.
+ *
+ * @return
+ *   the compiled substitution on success, NULL and set errno to either EINVAL
+ *   (malformed spec) or ENOMEM on error. The returned value should be passed
+ *   to t_subst_delete() after use.
+ */
+struct t_subst	*t_subst_parse(const char *spec);
+
+/*
+ * apply a substitution to each tag of a tag list having the substitution's
+ * key.
+ *
+ * A compiled substitution is never modified by this routine, so it can be
+ * used by several threads concurrently.
+ *
+ * @param tlist_p
+ *   A pointer to the tag list. The list is only unshared (see
+ *   t_taglist_unshare()) when a value is actually changed, in which case
+ *   *tlist_p is updated.
+ *
+ * @param arena
+ *   Used for temporary memory, may be NULL.
+ *
+ * @return
+ *   1 if at least one value was changed, 0 if none was, -1 and set errno on
+ *   error (malloc(3) failed).
+ */
+int	t_subst(const struct t_subst *subst, struct t_taglist **tlist_p,
+	    struct t_arena *arena);
+
+/*
+ * free all memory associated with a substitution.
+ */
+void	t_subst_delete(struct t_subst *subst);
+
+#endif /* ndef T_SUBST_H */
@@ -3,36 +3,61 @@
  *
  * a tag (or "comment").
  */
-#include <strings.h>
-
 #include "t_config.h"
 #include "t_toolkit.h"
+#include "t_casefold.h"
 #include "t_tag.h"
 
 
 struct t_tag *
 t_tag_new(const char *key, const char *val)
+{
+
+	assert(key != NULL);
+	assert(val != NULL);
+
+	return (t_tag_new_len(key, strlen(key), val, strlen(val)));
+}
+
+
+struct t_tag *
+t_tag_new_len(const char *key, size_t klen, const char *val, size_t vlen)
+{
+
+	return (t_tag_new_arena(NULL, key, klen, val, vlen));
+}
+
+
+struct t_tag *
+t_tag_new_arena(struct t_arena *arena, const char *key, size_t klen,
+    const char *val, size_t vlen)
 {
 	struct t_tag *t;
+	size_t size;
 	char *s;
-	size_t klen, vlen;
 
 	assert(key != NULL);
 	assert(val != NULL);
-	klen = strlen(key);
-	vlen = strlen(val);
 
-	t = malloc(sizeof(struct t_tag) + klen + 1 + vlen + 1);
+	/* the value is stored right after the t_tag */
+	size = sizeof(struct t_tag) + vlen + 1;
+	if (arena != NULL)
+		t = t_arena_alloc(arena, size);
+	else
+		t = malloc(size);
 	if (t == NULL)
 		return (NULL);
+	if ((t->key = t_key_intern(key, klen)) == NULL) {
+		if (arena == NULL)
+			free(t);
+		return (NULL);
+	}
 
 	t->klen = klen;
 	t->vlen = vlen;
-	t->key = s = (char *)(t + 1);
-	(void)memcpy(s, key, t->klen + 1);
-	t_strtolower(s);
-	t->val = s = (char *)(s + t->klen + 1);
-	(void)memcpy(s, val, t->vlen + 1);
+	t->val = s = (char *)(t + 1);
+	(void)memcpy(s, val, t->vlen);
+	s[t->vlen] = '\0';
 
 	return (t);
 }
@@ -42,7 +67,9 @@ int
 t_tag_keycmp(const char *x, const char *y)
 {
 
-	return (strcasecmp(x, y));
+	if (x == y)
+		return (0);
+	return (t_casefold_cmp(x, strlen(x), y, strlen(y)));
 }
 
 
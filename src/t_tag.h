@@ -6,18 +6,21 @@
  * a tag (or "comment").
  */
 #include "t_config.h"
+#include "t_arena.h"
+#include "t_key.h"
 
 /*
- * key / value pair, element of a list (implemented as TAILQ).
+ * key / value pair, element of a t_taglist.
+ *
+ * A tag is never modified once created, so it can be shared by several
+ * t_taglist allocated from the same arena (see t_taglist_clone_arena()).
  */
 struct t_tag {
 	size_t		klen;
 	size_t		vlen;
-	const char	*key;
+	const char	*key; /* interned, see t_key_intern() */
 	const char	*val;
-	TAILQ_ENTRY(t_tag)	entries;
 };
-TAILQ_HEAD(t_tagQ, t_tag);
 
 
 /*
@@ -30,10 +33,40 @@ TAILQ_HEAD(t_tagQ, t_tag);
  */
 struct t_tag *	t_tag_new(const char *key, const char *val);
 
+/*
+ * create a new tag from key and val with explicit lengths.
+ *
+ * key and val don't need to be NUL-terminated, allowing to create a tag from
+ * a view into a larger buffer (e.g. a mmap(2)'d file).
+ *
+ * The returned t_tag should be passed to free(3) after use.
+ *
+ * @return
+ *   a new t_tag or NULL or error (malloc(3) failed).
+ */
+struct t_tag *	t_tag_new_len(const char *key, size_t klen, const char *val,
+		    size_t vlen);
+
+/*
+ * create a new tag allocated from an arena, see t_tag_new_len().
+ *
+ * @param arena
+ *   The arena to allocate from, the tag is valid until the arena is reset. If
+ *   NULL the tag is allocated by malloc(3) and should be passed to free(3)
+ *   after use.
+ *
+ * @return
+ *   a new t_tag or NULL or error (memory allocation failed).
+ */
+struct t_tag *	t_tag_new_arena(struct t_arena *arena, const char *key,
+		    size_t klen, const char *val, size_t vlen);
+
 /*
  * compare two tag keys.
  *
- * This routine should be used when key comparison is needed.
+ * This routine should be used when key comparison is needed. When both k1 and
+ * k2 are interned (e.g. two t_tag keys) comparing the pointers is enough to
+ * test for equality.
  *
  * @param k1
  *   The first key to compare, cannot be NULL.
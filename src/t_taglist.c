@@ -3,6 +3,7 @@
  *
  * tagutil's tag routines.
  */
+#include <stdint.h>
 #include <string.h>
 
 #include "t_config.h"
@@ -11,78 +12,421 @@
 #include "t_taglist.h"
 
 
+/* initial count of tag slots */
+#define	T_TAGLIST_MINSIZE	8
+/* lists with at least this many tag slots can be indexed */
+#define	T_TAGLIST_INDEX_MIN	32
+/* end of a positions chain */
+#define	T_TAGLIST_NONE		SIZE_MAX
+
+/* a key of the index, and the positions of its tags */
+struct t_taglist_ikey {
+	const char	*key; /* interned, NULL for an empty slot */
+	size_t		 count;
+	size_t		 first;
+	size_t		 last;
+};
+
+/*
+ * the index of a t_taglist.
+ *
+ * It is an open addressing hash table (linear probing) keyed by the interned
+ * key pointers, each key having the chain of the positions of its tags in
+ * next. It is sized for the tag slots of the list and so is at most half full.
+ *
+ * The index is built by the first lookup (see t_taglist_index()), kept up to
+ * date when tags are appended and invalidated when tags are removed. Its
+ * memory is kept until the list grow.
+ */
+struct t_taglist_index {
+	size_t			 size;  /* the tlist->size it was allocated for */
+	int			 valid;
+	size_t			 nkey;  /* a power of two */
+	struct t_taglist_ikey	*keys;
+	size_t			*next;  /* the next position with the same key */
+};
+
+
+/*
+ * make room for at least size tags in tlist.
+ *
+ * @return
+ *   0 on success, -1 and set errno on error (memory allocation failed).
+ */
+static int	t_taglist_reserve(struct t_taglist *tlist, size_t size);
+
+/*
+ * append a tag to tlist, which must have room for it.
+ */
+static void	t_taglist_append(struct t_taglist *tlist, struct t_tag *t);
+
+/*
+ * get the index of tlist.
+ *
+ * @param build
+ *   if true, build the index when it is not valid.
+ *
+ * @return
+ *   the valid index of tlist, or NULL when tlist is too small to be indexed,
+ *   has no valid index and build is false, or memory allocation failed.
+ */
+static struct t_taglist_index	*t_taglist_index(const struct t_taglist *tlist,
+		    int build);
+
+/*
+ * allocate an invalid index for tlist, unless it already has one of the
+ * right size.
+ *
+ * @return
+ *   0 on success, -1 and set errno on error (memory allocation failed).
+ */
+static int	t_taglist_index_alloc(struct t_taglist *tlist);
+
+/*
+ * release the index of tlist, if any.
+ */
+static void	t_taglist_index_delete(struct t_taglist *tlist);
+
+/*
+ * add the tag at pos to the index of tlist.
+ */
+static void	t_taglist_index_add(struct t_taglist *tlist, size_t pos);
+
+/*
+ * @return
+ *   the index slot of key (an interned key), or the empty slot where it should
+ *   be inserted.
+ */
+static struct t_taglist_ikey	*t_taglist_index_key(
+		    const struct t_taglist_index *index, const char *key);
+
+
 struct t_taglist *
 t_taglist_new(void)
+{
+
+	return (t_taglist_new_arena(NULL));
+}
+
+
+struct t_taglist *
+t_taglist_new_arena(struct t_arena *arena)
 {
 	struct t_taglist *ret;
 
-	ret = malloc(sizeof(struct t_taglist));
+	if (arena != NULL)
+		ret = t_arena_alloc(arena, sizeof(struct t_taglist));
+	else
+		ret = malloc(sizeof(struct t_taglist));
 	if (ret == NULL)
 		return (NULL);
 
-	ret->count = 0;
-	TAILQ_INIT(ret->tags);
+	ret->count    = 0;
+	ret->tags     = NULL;
+	ret->size     = 0;
+	ret->arena    = arena;
+	ret->refcount = 1;
+	ret->index    = NULL;
 
 	return (ret);
 }
 
+
 struct t_taglist *
 t_taglist_clone(const struct t_taglist *tlist)
+{
+
+	if (tlist == NULL)
+		return (NULL);
+
+	return (t_taglist_clone_arena(tlist, tlist->arena));
+}
+
+
+struct t_taglist *
+t_taglist_clone_arena(const struct t_taglist *tlist, struct t_arena *arena)
 {
 	struct t_taglist *clone;
+	struct t_taglist_index *index;
 	struct t_tag *t;
 
 	if (tlist == NULL)
 		return (NULL);
 
-	clone = t_taglist_new();
+	clone = t_taglist_new_arena(arena);
 	if (clone == NULL)
 		return (NULL);
-	TAILQ_FOREACH(t, tlist->tags, entries) {
-		if (t_taglist_insert(clone, t->key, t->val) != 0) {
-			t_taglist_delete(clone);
-			return (NULL);
+	if (t_taglist_reserve(clone, tlist->count) == -1)
+		goto error_label;
+
+	if (arena != NULL && arena == tlist->arena) {
+		/* the tags live as long as the arena, share them */
+		if (tlist->count > 0) {
+			(void)memcpy(clone->tags, tlist->tags,
+			    tlist->count * sizeof(*tlist->tags));
+		}
+		clone->count = tlist->count;
+		/* same tags at the same positions, copy the index too */
+		index = t_taglist_index(tlist, 0);
+		if (index != NULL && clone->size == tlist->size &&
+		    t_taglist_index_alloc(clone) == 0) {
+			(void)memcpy(clone->index->keys, index->keys,
+			    index->nkey * sizeof(*index->keys));
+			(void)memcpy(clone->index->next, index->next,
+			    tlist->count * sizeof(*index->next));
+			clone->index->valid = 1;
 		}
+		return (clone);
+	}
+
+	T_TAGLIST_FOREACH(t, tlist) {
+		if (t_taglist_insert_len(clone, t->key, t->klen, t->val,
+		    t->vlen) != 0)
+			goto error_label;
 	}
 
 	return (clone);
+error_label:
+	t_taglist_delete(clone);
+	return (NULL);
 }
 
+
+struct t_taglist *
+t_taglist_ref(struct t_taglist *tlist)
+{
+
+	assert(tlist != NULL);
+	assert(tlist->refcount > 0);
+
+	tlist->refcount++;
+	return (tlist);
+}
+
+
+struct t_taglist *
+t_taglist_unshare(struct t_taglist *tlist)
+{
+	struct t_taglist *copy;
+
+	assert(tlist != NULL);
+	assert(tlist->refcount > 0);
+
+	if (tlist->refcount == 1)
+		return (tlist);
+
+	if ((copy = t_taglist_clone(tlist)) == NULL)
+		return (NULL);
+	t_taglist_delete(tlist);
+	return (copy);
+}
+
+
 int
 t_taglist_insert(struct t_taglist *tlist, const char *key, const char *val)
+{
+
+	assert(key != NULL);
+	assert(val != NULL);
+
+	return (t_taglist_insert_len(tlist, key, strlen(key), val, strlen(val)));
+}
+
+
+int
+t_taglist_insert_len(struct t_taglist *tlist, const char *key, size_t klen,
+    const char *val, size_t vlen)
 {
 	struct t_tag *t;
 
 	assert(tlist != NULL);
+	assert(tlist->refcount == 1);
 	assert(key != NULL);
 	assert(val != NULL);
 
-	t = t_tag_new(key, val);
+	if (t_taglist_reserve(tlist, tlist->count + 1) == -1)
+		return (-1);
+	t = t_tag_new_arena(tlist->arena, key, klen, val, vlen);
 	if (t == NULL)
 		return (-1);
 
-	TAILQ_INSERT_TAIL(tlist->tags, t, entries);
-	tlist->count++;
+	t_taglist_append(tlist, t);
+	return (0);
+}
+
+
+int
+t_taglist_replace(struct t_taglist *tlist, const char *key, const char *val)
+{
+	struct t_tag *t, *neo;
+	struct t_taglist_index *index;
+	struct t_taglist_ikey *ik;
+	size_t i, j;
+	int n = 0;
+
+	assert(tlist != NULL);
+	assert(tlist->refcount == 1);
+	assert(key != NULL);
+	assert(val != NULL);
+
+	if (t_taglist_reserve(tlist, tlist->count + 1) == -1)
+		return (-1);
+	neo = t_tag_new_arena(tlist->arena, key, strlen(key), val, strlen(val));
+	if (neo == NULL)
+		return (-1);
+
+	if ((index = t_taglist_index(tlist, 0)) != NULL) {
+		ik = t_taglist_index_key(index, neo->key);
+		if (ik->key == NULL) {
+			t_taglist_append(tlist, neo);
+			return (0);
+		} else if (ik->count == 1) {
+			t = tlist->tags[ik->first];
+			if (tlist->arena == NULL)
+				t_tag_delete(t);
+			tlist->tags[ik->first] = neo;
+			return (0);
+		}
+	}
+
+	/* neo replace the first occurence found, the others are removed */
+	for (i = j = 0; i < tlist->count; i++) {
+		t = tlist->tags[i];
+		if (t->key == neo->key) {
+			if (++n == 1)
+				tlist->tags[j++] = neo;
+			if (tlist->arena == NULL)
+				t_tag_delete(t);
+		} else
+			tlist->tags[j++] = t;
+	}
+	tlist->count = j;
+	if (tlist->index != NULL)
+		tlist->index->valid = 0;
+	if (n == 0) {
+		/* there wasn't any tag matching the key, so we just add neo at
+		   the end. */
+		t_taglist_append(tlist, neo);
+	}
+
+	return (0);
+}
+
+
+int
+t_taglist_set_at(struct t_taglist *tlist, size_t index, const char *val,
+    size_t vlen)
+{
+	struct t_tag *t, *neo;
+
+	assert(tlist != NULL);
+	assert(tlist->refcount == 1);
+	assert(index < tlist->count);
+	assert(val != NULL);
+
+	t   = tlist->tags[index];
+	neo = t_tag_new_arena(tlist->arena, t->key, t->klen, val, vlen);
+	if (neo == NULL)
+		return (-1);
+	if (tlist->arena == NULL)
+		t_tag_delete(t);
+	/* same key at the same position, the index is still valid */
+	tlist->tags[index] = neo;
 	return (0);
 }
 
 
+void
+t_taglist_clear(struct t_taglist *tlist, const char *key)
+{
+	struct t_taglist_index *index;
+	struct t_tag *t;
+	const char *atom = NULL;
+	size_t i, j;
+
+	assert(tlist != NULL);
+	assert(tlist->refcount == 1);
+
+	if (key != NULL && (atom = t_key_lookup(key, strlen(key))) == NULL)
+		return; /* never interned, no tag can match */
+	if (atom != NULL && (index = t_taglist_index(tlist, 0)) != NULL &&
+	    t_taglist_index_key(index, atom)->key == NULL)
+		return;
+
+	for (i = j = 0; i < tlist->count; i++) {
+		t = tlist->tags[i];
+		if (atom == NULL || t->key == atom) {
+			if (tlist->arena == NULL)
+				t_tag_delete(t);
+		} else
+			tlist->tags[j++] = t;
+	}
+	tlist->count = j;
+	if (tlist->index != NULL)
+		tlist->index->valid = 0;
+}
+
+
+struct t_tag *
+t_taglist_find(const struct t_taglist *tlist, const char *key)
+{
+	struct t_taglist_index *index;
+	struct t_taglist_ikey *ik;
+	struct t_tag *t;
+	const char *atom;
+
+	assert(tlist != NULL);
+	assert(key != NULL);
+
+	if ((atom = t_key_lookup(key, strlen(key))) == NULL)
+		return (NULL);
+
+	if ((index = t_taglist_index(tlist, 1)) != NULL) {
+		ik = t_taglist_index_key(index, atom);
+		return (ik->key == NULL ? NULL : tlist->tags[ik->first]);
+	}
+	T_TAGLIST_FOREACH(t, tlist) {
+		if (t->key == atom)
+			return (t);
+	}
+	return (NULL);
+}
+
+
 struct t_taglist *
 t_taglist_find_all(const struct t_taglist *tlist, const char *key)
 {
 	struct t_taglist *r;
-	const struct t_tag *t;
+	struct t_taglist_index *index;
+	struct t_taglist_ikey *ik;
+	struct t_tag *t;
+	const char *atom;
+	size_t i;
 
 	assert(tlist != NULL);
 	assert(key != NULL);
-	if ((r = t_taglist_new()) == NULL)
+	if ((r = t_taglist_new_arena(tlist->arena)) == NULL)
 		goto error;
+	if ((atom = t_key_lookup(key, strlen(key))) == NULL)
+		return (r); /* never interned, no tag can match */
 
-	TAILQ_FOREACH(t, tlist->tags, entries) {
-		if (t_tag_keycmp(t->key, key) == 0) {
-			if (t_taglist_insert(r, t->key, t->val) != 0)
+	i = 0;
+	if ((index = t_taglist_index(tlist, 1)) != NULL) {
+		ik = t_taglist_index_key(index, atom);
+		i  = (ik->key == NULL ? tlist->count : ik->first);
+	}
+	for (; i < tlist->count; i = (index != NULL ? index->next[i] : i + 1)) {
+		t = tlist->tags[i];
+		if (t->key != atom)
+			continue;
+		if (r->arena != NULL) {
+			/* share the tag, see t_taglist_clone_arena() */
+			if (t_taglist_reserve(r, r->count + 1) == -1)
 				goto error;
-		}
+			t_taglist_append(r, t);
+		} else if (t_taglist_insert_len(r, t->key, t->klen, t->val,
+		    t->vlen) != 0)
+			goto error;
 	}
 
 	return (r);
@@ -96,45 +440,70 @@ error:
 struct t_tag *
 t_taglist_tag_at(const struct t_taglist *tlist, unsigned int index)
 {
-	struct t_tag *t;
 
 	assert(tlist != NULL);
 
-	t = TAILQ_FIRST(tlist->tags);
-	while (t != NULL && index-- > 0)
-		t = TAILQ_NEXT(t, entries);
+	return (index < tlist->count ? tlist->tags[index] : NULL);
+}
+
+
+int
+t_taglist_equal(const struct t_taglist *a, const struct t_taglist *b)
+{
+	const struct t_tag *x, *y;
+	size_t i;
+
+	assert(a != NULL);
+	assert(b != NULL);
+
+	if (a == b)
+		return (1);
+	if (a->count != b->count)
+		return (0);
+
+	for (i = 0; i < a->count; i++) {
+		x = a->tags[i];
+		y = b->tags[i];
+		/* shared tags are common, see t_taglist_clone_arena() */
+		if (x == y)
+			continue;
+		if (x->key != y->key || x->vlen != y->vlen ||
+		    memcmp(x->val, y->val, x->vlen) != 0)
+			return (0);
+	}
 
-	return (t);
+	return (1);
 }
 
 
 char *
 t_taglist_join(const struct t_taglist *tlist, const char *glue)
 {
-	struct sbuf *sb;
-	struct t_tag *t, *last;
-	char *ret;
+	struct t_tag *t;
+	size_t i, len, glen;
+	char *ret, *p;
 
 	assert(tlist != NULL);
 	assert(glue != NULL);
 
-	sb = sbuf_new_auto();
-	if (sb == NULL)
+	/* compute the exact length first, so that we allocate only once */
+	glen = strlen(glue);
+	len  = 1;
+	T_TAGLIST_FOREACH(t, tlist)
+		len += t->vlen + glen;
+	if ((ret = p = malloc(len)) == NULL)
 		return (NULL);
 
-	last = TAILQ_LAST(tlist->tags, t_tagQ);
-	TAILQ_FOREACH(t, tlist->tags, entries) {
-		(void)sbuf_cat(sb, t->val);
-		if (t != last)
-			(void)sbuf_cat(sb, glue);
-	}
-
-	if (sbuf_finish(sb) == -1) {
-		sbuf_delete(sb);
-		return (NULL);
+	for (i = 0; i < tlist->count; i++) {
+		t = tlist->tags[i];
+		if (i > 0) {
+			(void)memcpy(p, glue, glen);
+			p += glen;
+		}
+		(void)memcpy(p, t->val, t->vlen);
+		p += t->vlen;
 	}
-	ret = strdup(sbuf_data(sb));
-	sbuf_delete(sb);
+	*p = '\0';
 
 	return (ret);
 }
@@ -143,16 +512,196 @@ t_taglist_join(const struct t_taglist *tlist, const char *glue)
 void
 t_taglist_delete(struct t_taglist *tlist)
 {
-	struct t_tag *t1, *t2;
+	size_t i;
 
 	if (tlist == NULL)
 		return;
 
-	t1 = TAILQ_FIRST(tlist->tags);
-	while (t1 != NULL) {
-		t2 = TAILQ_NEXT(t1, entries);
-		t_tag_delete(t1);
-		t1 = t2;
-	}
+	assert(tlist->refcount > 0);
+	if (--tlist->refcount > 0)
+		return;
+	/* memory from an arena is released when the arena is reset */
+	if (tlist->arena != NULL)
+		return;
+
+	for (i = 0; i < tlist->count; i++)
+		t_tag_delete(tlist->tags[i]);
+	free(tlist->tags);
+	t_taglist_index_delete(tlist);
 	free(tlist);
 }
+
+
+static int
+t_taglist_reserve(struct t_taglist *tlist, size_t size)
+{
+	struct t_tag **tags;
+	size_t neosize;
+
+	assert(tlist != NULL);
+
+	if (size <= tlist->size)
+		return (0);
+
+	neosize = (tlist->size > 0 ? tlist->size : T_TAGLIST_MINSIZE);
+	while (neosize < size)
+		neosize *= 2;
+	if (neosize > SIZE_MAX / sizeof(*tags)) {
+		errno = ENOMEM;
+		return (-1);
+	}
+
+	if (tlist->arena != NULL) {
+		tags = t_arena_alloc(tlist->arena, neosize * sizeof(*tags));
+		if (tags != NULL && tlist->count > 0) {
+			(void)memcpy(tags, tlist->tags,
+			    tlist->count * sizeof(*tags));
+		}
+	} else
+		tags = realloc(tlist->tags, neosize * sizeof(*tags));
+	if (tags == NULL)
+		return (-1);
+
+	tlist->tags = tags;
+	tlist->size = neosize;
+	/* the index is sized for the old tag slots */
+	t_taglist_index_delete(tlist);
+	return (0);
+}
+
+
+static void
+t_taglist_append(struct t_taglist *tlist, struct t_tag *t)
+{
+
+	assert(tlist != NULL);
+	assert(tlist->count < tlist->size);
+	assert(t != NULL);
+
+	tlist->tags[tlist->count] = t;
+	if (tlist->index != NULL && tlist->index->valid)
+		t_taglist_index_add(tlist, tlist->count);
+	tlist->count++;
+}
+
+
+
+static struct t_taglist_index *
+t_taglist_index(const struct t_taglist *tlist, int build)
+{
+	/* the index is a cache: building it doesn't modify the list */
+	struct t_taglist *cache = (struct t_taglist *)(uintptr_t)tlist;
+	size_t i;
+
+	assert(tlist != NULL);
+
+	if (tlist->index != NULL && tlist->index->valid)
+		return (tlist->index);
+	if (!build || tlist->size < T_TAGLIST_INDEX_MIN ||
+	    t_taglist_index_alloc(cache) == -1)
+		return (NULL);
+
+	for (i = 0; i < cache->index->nkey; i++)
+		cache->index->keys[i].key = NULL;
+	cache->index->valid = 1;
+	for (i = 0; i < cache->count; i++)
+		t_taglist_index_add(cache, i);
+
+	return (cache->index);
+}
+
+
+static int
+t_taglist_index_alloc(struct t_taglist *tlist)
+{
+	struct t_taglist_index *index;
+	size_t nkey, size;
+
+	assert(tlist != NULL);
+
+	if (tlist->index != NULL && tlist->index->size == tlist->size)
+		return (0);
+	t_taglist_index_delete(tlist);
+
+	if (tlist->size > SIZE_MAX / 4 / (sizeof(struct t_taglist_ikey) +
+	    sizeof(size_t))) {
+		errno = ENOMEM;
+		return (-1);
+	}
+	nkey = 2 * tlist->size;
+	size = sizeof(struct t_taglist_index) +
+	    nkey * sizeof(struct t_taglist_ikey) + tlist->size * sizeof(size_t);
+
+	if (tlist->arena != NULL)
+		index = t_arena_alloc(tlist->arena, size);
+	else
+		index = malloc(size);
+	if (index == NULL)
+		return (-1);
+	index->size  = tlist->size;
+	index->valid = 0;
+	index->nkey  = nkey;
+	index->keys  = (struct t_taglist_ikey *)(index + 1);
+	index->next  = (size_t *)(index->keys + nkey);
+
+	tlist->index = index;
+	return (0);
+}
+
+
+static void
+t_taglist_index_delete(struct t_taglist *tlist)
+{
+
+	assert(tlist != NULL);
+
+	/* memory from an arena is released when the arena is reset */
+	if (tlist->arena == NULL)
+		free(tlist->index);
+	tlist->index = NULL;
+}
+
+
+static void
+t_taglist_index_add(struct t_taglist *tlist, size_t pos)
+{
+	struct t_taglist_ikey *ik;
+
+	assert(tlist != NULL);
+	assert(tlist->index != NULL);
+	assert(tlist->index->valid);
+	assert(pos < tlist->index->size);
+
+	ik = t_taglist_index_key(tlist->index, tlist->tags[pos]->key);
+	if (ik->key == NULL) {
+		ik->key   = tlist->tags[pos]->key;
+		ik->count = 0;
+		ik->first = pos;
+	} else
+		tlist->index->next[ik->last] = pos;
+	ik->last = pos;
+	ik->count++;
+	tlist->index->next[pos] = T_TAGLIST_NONE;
+}
+
+
+static struct t_taglist_ikey *
+t_taglist_index_key(const struct t_taglist_index *index, const char *key)
+{
+	struct t_taglist_ikey *ik;
+	uint64_t h;
+	size_t i, mask;
+
+	assert(index != NULL);
+	assert(key != NULL);
+
+	/* Fibonacci hashing of the pointer */
+	h    = (uint64_t)(uintptr_t)key * UINT64_C(0x9e3779b97f4a7c15);
+	mask = index->nkey - 1;
+	for (i = (size_t)(h >> 32) & mask; ; i = (i + 1) & mask) {
+		ik = &index->keys[i];
+		if (ik->key == NULL || ik->key == key)
+			return (ik);
+	}
+	/* NOTREACHED */
+}
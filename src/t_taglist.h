@@ -7,20 +7,43 @@
  */
 #include "t_config.h"
 #include "t_tag.h"
+#include "t_arena.h"
 
 
 /*
  * a list of tags.
  *
  * abstract structure for a music file's tags.
+ *
+ * A t_taglist is reference counted, see t_taglist_ref(). A list shared by more
+ * than one reference must not be modified, t_taglist_unshare() should be used
+ * to get a private copy first (copy-on-write). Reference counts are not
+ * atomic: a list should not be shared between threads.
+ *
+ * Big lists maintain an index from the keys to the positions of their tags,
+ * so that looking up a key doesn't need to scan the whole list.
  */
 struct t_taglist {
-	size_t		count;
-	/* we want to access the tags member as it was a pointer for queue(3)
-	   macros */
-	struct t_tagQ	tags[1];
+	size_t		  count;
+	/* the tags in order, use T_TAGLIST_FOREACH() or t_taglist_tag_at() */
+	struct t_tag	**tags;
+	size_t		  size; /* allocated slots in tags */
+	/* where the list and its tags are allocated, NULL for malloc(3) */
+	struct t_arena	 *arena;
+	unsigned int	  refcount;
+	/* key -> positions index, built by the lookups (see t_taglist_find()) */
+	struct t_taglist_index	*index;
 };
 
+/*
+ * loop over each tag of a t_taglist, in order.
+ *
+ * The list must not be modified by the loop body.
+ */
+#define	T_TAGLIST_FOREACH(var, tlist)					\
+	for (size_t t__i = 0; t__i < (tlist)->count &&			\
+	    ((var) = (tlist)->tags[t__i], 1); t__i++)
+
 
 /*
  * create a new t_taglist.
@@ -35,7 +58,20 @@ struct t_taglist {
 struct t_taglist	*t_taglist_new(void);
 
 /*
- * create a deep copy of a taglist.
+ * create a new t_taglist allocated from an arena.
+ *
+ * The list and all the tags inserted into it are allocated from arena (or by
+ * malloc(3) if arena is NULL, see t_taglist_new()). t_taglist_delete() is
+ * cheap for such a list, its memory is released when the arena is reset.
+ *
+ * @return
+ *   a t_taglist pointer on success, NULL and set errno on error (memory
+ *   allocation failed).
+ */
+struct t_taglist	*t_taglist_new_arena(struct t_arena *arena);
+
+/*
+ * create a copy of a taglist, allocated from the same arena.
  *
  * The returned should be passed to t_taglist_delete() after use.
  *
@@ -45,6 +81,44 @@ struct t_taglist	*t_taglist_new(void);
  */
 struct t_taglist	*t_taglist_clone(const struct t_taglist *tags);
 
+/*
+ * create a copy of a taglist allocated from the given arena, see
+ * t_taglist_new_arena().
+ *
+ * When both tlist and the copy are allocated from the same arena, the tags
+ * are shared and only the list itself is copied. Otherwise every tag is
+ * copied.
+ *
+ * @return
+ *   a t_taglist pointer on success, NULL and set errno on error (memory
+ *   allocation failed).
+ */
+struct t_taglist	*t_taglist_clone_arena(const struct t_taglist *tags,
+			    struct t_arena *arena);
+
+/*
+ * get a new reference to a taglist.
+ *
+ * Each reference should be passed to t_taglist_delete() after use.
+ *
+ * @return
+ *   tlist.
+ */
+struct t_taglist	*t_taglist_ref(struct t_taglist *tlist);
+
+/*
+ * get a taglist that can be modified (copy-on-write).
+ *
+ * If tlist is the only reference to the list, it is returned. Otherwise a
+ * copy is returned (see t_taglist_clone()) and the tlist reference is
+ * released.
+ *
+ * @return
+ *   a t_taglist that can be modified on success, NULL and set errno on error
+ *   (memory allocation failed) in which case tlist is left untouched.
+ */
+struct t_taglist	*t_taglist_unshare(struct t_taglist *tlist);
+
 /*
  * insert a tag in a tag list.
  *
@@ -60,6 +134,59 @@ struct t_taglist	*t_taglist_clone(const struct t_taglist *tags);
 int	t_taglist_insert(struct t_taglist *tlist, const char *key,
 	    const char *val);
 
+/*
+ * insert a tag in a tag list, key and val are given with explicit lengths.
+ *
+ * See t_tag_new_len().
+ *
+ * @return
+ *   0 on success, -1 and set errno on error (malloc(3) failed).
+ */
+int	t_taglist_insert_len(struct t_taglist *tlist, const char *key,
+	    size_t klen, const char *val, size_t vlen);
+
+/*
+ * replace the tags matching key in a tag list.
+ *
+ * The first tag matching key is replaced by a new tag with the given key and
+ * value, the others matching tags are removed. If there is no tag matching
+ * key, the new tag is inserted at the end of the list.
+ *
+ * @return
+ *   0 on success, -1 and set errno on error (malloc(3) failed).
+ */
+int	t_taglist_replace(struct t_taglist *tlist, const char *key,
+	    const char *val);
+
+/*
+ * change the value of the tag at the given index, keeping its key and its
+ * position in the list.
+ *
+ * @param index
+ *   The index of the tag to change, must be less than tlist->count.
+ *
+ * @return
+ *   0 on success, -1 and set errno on error (malloc(3) failed).
+ */
+int	t_taglist_set_at(struct t_taglist *tlist, size_t index,
+	    const char *val, size_t vlen);
+
+/*
+ * remove all the tags matching key from a tag list.
+ *
+ * @param key
+ *   The key to match. If NULL, all the tags are removed.
+ */
+void	t_taglist_clear(struct t_taglist *tlist, const char *key);
+
+/*
+ * find the first tag matching key in tlist.
+ *
+ * @return
+ *   the first tag matching key, or NULL if there is none.
+ */
+struct t_tag	*t_taglist_find(const struct t_taglist *tlist, const char *key);
+
 /*
  * Find all tags matching key in tlist.
  *
@@ -70,9 +197,9 @@ int	t_taglist_insert(struct t_taglist *tlist, const char *key,
  *   The key to match, cannot be NULL.
  *
  * @return
- *   a t_taglist with all tags matching key found in the given tlist. On error
- *   NULL is returned (malloc(3) failed). The returned value should be passed to
- *   t_taglist_delete() after use.
+ *   a t_taglist with all tags matching key found in the given tlist, allocated
+ *   from the same arena. On error NULL is returned (malloc(3) failed). The
+ *   returned value should be passed to t_taglist_delete() after use.
  */
 struct t_taglist	*t_taglist_find_all(const struct t_taglist *tlist,
 			    const char *key);
@@ -82,6 +209,17 @@ struct t_taglist	*t_taglist_find_all(const struct t_taglist *tlist,
  */
 struct t_tag	*t_taglist_tag_at(const struct t_taglist *tlist, unsigned int index);
 
+/*
+ * compare two taglists.
+ *
+ * The lists are equal when they have the same tags (same keys and values) in
+ * the same order.
+ *
+ * @return
+ *   1 if a and b are equal, 0 otherwise.
+ */
+int	t_taglist_equal(const struct t_taglist *a, const struct t_taglist *b);
+
 /*
  * join all the tag values in tlist with the given glue.
  *
@@ -97,9 +235,10 @@ struct t_tag	*t_taglist_tag_at(const struct t_taglist *tlist, unsigned int index
 char	*t_taglist_join(const struct t_taglist *tlist, const char *glue);
 
 /*
- * free the t_taglist and all its tags.
+ * release a reference to a t_taglist, free it and all its tags when it was
+ * the last one.
  *
- * A t_taglist should not be used after a call to t_taglist_delete().
+ * The reference should not be used after a call to t_taglist_delete().
  *
  * @param tlist
  *   The taglist to free
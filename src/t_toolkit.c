@@ -12,25 +12,30 @@
 
 #include <locale.h>
 #include <iconv.h>
+#include <pthread.h>
 
 #include "t_config.h"
 #include "t_toolkit.h"
+#include "t_casefold.h"
 #include "t_action.h"
 
 
 /* accept NULL as src */
 static char *	t_iconv_convert(int tou8, const char *src);
+/* called once before the first t_iconv_convert() */
+static void	t_iconv_setlocale(void);
+
+/* buffer size used by t_copy_range() when copy_file_range(2) can't be used */
+#define	T_COPY_BUFSIZ	(64 * 1024)
 
 
 char *
 t_strtoupper(char *str)
 {
-	char *s;
 
 	assert(str != NULL);
 
-	for (s = str; *s != '\0'; s++)
-		*s = (char)toupper(*s);
+	t_casefold_upper(str, str, strlen(str));
 	return (str);
 }
 
@@ -38,12 +43,10 @@ t_strtoupper(char *str)
 char *
 t_strtolower(char *str)
 {
-	char *s;
 
 	assert(str != NULL);
 
-	for (s = str; *s != '\0'; s++)
-		*s = (char)tolower(*s);
+	t_casefold_lower(str, str, strlen(str));
 	return (str);
 }
 
@@ -91,7 +94,7 @@ t_iconv_loc_to_utf8(const char *src)
 char *
 t_dirname(const char *path)
 {
-	static char dname[MAXPATHLEN];
+	static t__thread char dname[MAXPATHLEN];
 	size_t len;
 	const char *endp;
 
@@ -159,7 +162,7 @@ t_dirname(const char *path)
 char *
 t_basename(const char *path)
 {
-	static char bname[MAXPATHLEN];
+	static t__thread char bname[MAXPATHLEN];
 	size_t len;
 	const char *endp, *startp;
 
@@ -198,10 +201,18 @@ t_basename(const char *path)
 }
 
 
+static void
+t_iconv_setlocale(void)
+{
+
+	setlocale(LC_ALL, "");
+}
+
+
 static char *
 t_iconv_convert(int tou8, const char *const_src)
 {
-	static int setlocale_called = 0;
+	static pthread_once_t setlocale_once = PTHREAD_ONCE_INIT;
 	int success = 0;
 	size_t srclen, destlen;
 	char *dest, *ret = NULL, *srcdup = NULL;
@@ -210,10 +221,7 @@ t_iconv_convert(int tou8, const char *const_src)
 	if (const_src == NULL)
 		goto cleanup;
 
-	if (!setlocale_called) {
-		setlocale(LC_ALL, "");
-		setlocale_called = 1;
-	}
+	(void)pthread_once(&setlocale_once, t_iconv_setlocale);
 
 	if (tou8)
 		cd = iconv_open("utf-8", "");
@@ -254,6 +262,82 @@ cleanup:
 }
 
 
+int
+t_write_all(int fd, const void *buf, size_t len)
+{
+	const char *p = buf;
+	ssize_t n;
+
+	assert(fd >= 0);
+	assert(buf != NULL || len == 0);
+
+	while (len > 0) {
+		n = write(fd, p, len);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			return (-1);
+		}
+		p   += n;
+		len -= (size_t)n;
+	}
+	return (0);
+}
+
+
+int
+t_copy_range(int in, off_t off, int out, off_t len)
+{
+	char *buf;
+	ssize_t n;
+
+	assert(in >= 0);
+	assert(off >= 0);
+	assert(out >= 0);
+	assert(len >= 0);
+
+#if defined(HAS_COPY_FILE_RANGE)
+	while (len > 0) {
+		n = copy_file_range(in, &off, out, NULL, (size_t)len, 0);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			/* not supported for this fd pair, do it by hand */
+			if (errno == ENOSYS || errno == EXDEV ||
+			    errno == EINVAL || errno == EOPNOTSUPP)
+				break;
+			return (-1);
+		}
+		if (n == 0) /* EOF */
+			return (0);
+		len -= n;
+	}
+	if (len == 0)
+		return (0);
+#endif /* HAS_COPY_FILE_RANGE */
+
+	if ((buf = malloc(T_COPY_BUFSIZ)) == NULL)
+		return (-1);
+	while (len > 0) {
+		size_t want = (len < T_COPY_BUFSIZ ? (size_t)len : T_COPY_BUFSIZ);
+		n = pread(in, buf, want, off);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		if (n == 0) /* EOF */
+			len = 0;
+		else if (t_write_all(out, buf, (size_t)n) == -1)
+			break;
+		off += n;
+		len -= n;
+	}
+	free(buf);
+	return (len == 0 ? 0 : -1);
+}
+
+
 void
 xasprintf(char **strp, const char *fmt, ...)
 {
@@ -72,13 +72,38 @@ char	*t_iconv_loc_to_utf8(const char *src);
 
 /*
  * dirname() routine that does not modify its argument.
+ *
+ * The returned buffer is private to the calling thread.
  */
 char	*t_dirname(const char *);
 /*
  * basename() routine that does not modify its argument.
+ *
+ * The returned buffer is private to the calling thread.
  */
 char	*t_basename(const char *);
 
+/*
+ * write(2) all of buf to fd, retrying on short writes.
+ *
+ * @return
+ *   0 on success, -1 on error and errno is set.
+ */
+int	 t_write_all(int fd, const void *buf, size_t len);
+
+/*
+ * copy len bytes at offset off from the file descriptor in to the current
+ * offset of out.
+ *
+ * copy_file_range(2) is used when available so that the data does not need to
+ * go through userland (and may even be shared on a CoW filesystem), otherwise
+ * we fall back to pread(2) / write(2).
+ *
+ * @return
+ *   0 on success, -1 on error and errno is set.
+ */
+int	 t_copy_range(int in, off_t off, int out, off_t len);
+
 /* XXX: to avoid -Werror=return-type */
 void	 xasprintf(char **strp, const char *fmt, ...);
 #endif /* ndef T_TOOLKIT_H */
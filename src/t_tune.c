@@ -3,6 +3,8 @@
  *
  * A tune represent a music file with tags (or comments) attributes.
  */
+#include <stdatomic.h>
+
 #include "t_config.h"
 #include "t_backend.h"
 #include "t_tag.h"
@@ -13,12 +15,27 @@
 struct t_tune {
 	char	*path;    /* the file's path */
 	int	 dirty;   /* 0 if clean (tags have not changed), >0 otherwise. */
-	void	*opaque;  /* pointer used by the backend's read and write routines */
+	int	 set;     /* >0 if t_tune_set_tags() was called */
+	void	*opaque;  /* pointer used by the backend's read and write routines,
+			     NULL until t_tune_open() */
 	const struct t_backend	*backend; /* backend used to handle this file. */
 	struct t_taglist	*tlist; /* used internal by t_tune routines. use t_tune_tags() instead */
+	struct t_taglist	*saved; /* the tags as they are in the file */
+	struct t_arena		*arena; /* see t_tune_arena() */
+	/* the file head and tail, given to the backend's open routine */
+	struct t_backend_probe	 probe;
+	int			 probed; /* 1 if probe was read, 0 otherwise */
 };
 
 
+/* backend selection counters, see t_tune_stats() */
+static atomic_ulong	t_tune_nprobe;	/* files probed */
+static atomic_ulong	t_tune_nmatch;	/* backend found by signature */
+static atomic_ulong	t_tune_nopen;	/* open(2) calls made by backends */
+static atomic_ulong	t_tune_ntrial;	/* open calls without probes */
+static atomic_ulong	t_tune_nclean;	/* writes skipped, tags unchanged */
+
+
 /*
  * initialize internal data, find a backend able to handle the tune.
  *
@@ -30,7 +47,25 @@ struct t_tune {
 static int	t_tune_init(struct t_tune *tune, const char *path);
 
 /*
- * free all the memory used internally by the t_tune.
+ * open the file with its backend if it was not done yet. If the backend
+ * fail to open the file, all the other backends are tried.
+ *
+ * @return
+ *   0 on success, -1 on error.
+ */
+static int	t_tune_open(struct t_tune *tune);
+
+/*
+ * try to open the tune with the given backend.
+ *
+ * @return
+ *   1 on success, 0 otherwise.
+ */
+static int	t_tune_try(struct t_tune *tune, const struct t_backend *b);
+
+/*
+ * free all the memory used internally by the t_tune and close the probe file
+ * descriptor.
  */
 static void	t_tune_clear(struct t_tune *tune);
 
@@ -57,6 +92,7 @@ t_tune_new(const char *path)
 static int
 t_tune_init(struct t_tune *tune, const char *path)
 {
+	int rank, claimed;
 	const struct t_backend  *b;
 	const struct t_backendQ *bQ;
 
@@ -67,37 +103,178 @@ t_tune_init(struct t_tune *tune, const char *path)
 	tune->path = strdup(path);
 	if (tune->path == NULL)
 		return (-1);
+	/* reuse the memory of the last tune processed by this thread */
+	tune->arena = t_arena_get();
+	if (tune->arena == NULL) {
+		free(tune->path);
+		tune->path = NULL;
+		return (-1);
+	}
 
-	/* find the first backend able to handle path */
 	bQ = t_all_backends();
-	TAILQ_FOREACH(b, bQ, entries) {
-		if (b->init != NULL) {
-			void *o = b->init(tune->path);
-			if (o != NULL) {
+	atomic_fetch_add(&t_tune_nprobe, 1);
+
+	/*
+	 * Find the first backend claiming the file from its head and tail.
+	 * The backend only get the probe (and its file descriptor) when the
+	 * tags are needed, see t_tune_open().
+	 */
+	if (t_backend_probe_read(&tune->probe, tune->path) == 0) {
+		tune->probed = 1;
+		rank = 0;
+		TAILQ_FOREACH(b, bQ, entries) {
+			rank++;
+			if (b->probe != NULL)
+				claimed = b->probe(&tune->probe);
+			else
+				claimed = t_backend_match(b, &tune->probe);
+			if (claimed) {
 				tune->backend = b;
-				tune->opaque  = o;
+				atomic_fetch_add(&t_tune_nmatch, 1);
+				/* the trial loop would have opened the file
+				   with every backend up to b */
+				atomic_fetch_add(&t_tune_ntrial, (unsigned long)rank);
 				return (0);
 			}
 		}
 	}
+
+	/* fallback to the first backend able to open path */
+	rank = 0;
+	TAILQ_FOREACH(b, bQ, entries) {
+		rank++;
+		if (t_tune_try(tune, b))
+			break;
+	}
+	atomic_fetch_add(&t_tune_ntrial, (unsigned long)rank);
+	if (tune->backend != NULL)
+		return (0);
 	/* no backend found */
 
+	if (tune->probed)
+		t_backend_probe_close(&tune->probe);
+	t_arena_put(tune->arena);
+	tune->arena = NULL;
 	free(tune->path);
 	tune->path = NULL;
 	return (-1);
 }
 
 
+static int
+t_tune_open(struct t_tune *tune)
+{
+	const struct t_backend *b, *probed;
+
+	assert(tune != NULL);
+	assert(tune->backend != NULL);
+
+	if (tune->opaque != NULL)
+		return (0);
+
+	probed = tune->backend;
+	if (t_tune_try(tune, probed))
+		return (0);
+	/* the probe was wrong (or the file is damaged), try the others */
+	TAILQ_FOREACH(b, t_all_backends(), entries) {
+		if (b != probed && t_tune_try(tune, b))
+			return (0);
+	}
+
+	tune->backend = probed;
+	if (tune->probed)
+		t_backend_probe_close(&tune->probe);
+	warnx("%s: unsupported file format", tune->path);
+	return (-1);
+}
+
+
+static int
+t_tune_try(struct t_tune *tune, const struct t_backend *b)
+{
+	struct t_backend_probe *probe;
+	unsigned int nopen;
+	void *o;
+
+	assert(tune != NULL);
+	assert(b != NULL);
+
+	if (b->open == NULL)
+		return (0);
+
+	if (tune->probed) {
+		probe = &tune->probe;
+		nopen = probe->nopen;
+		o = b->open(tune->path, probe);
+		/* a backend taking the probe fd doesn't open the file */
+		atomic_fetch_add(&t_tune_nopen,
+		    (unsigned long)(probe->nopen - nopen));
+	} else {
+		atomic_fetch_add(&t_tune_nopen, 1);
+		o = b->open(tune->path, NULL);
+	}
+	if (o == NULL)
+		return (0);
+
+	tune->backend = b;
+	tune->opaque  = o;
+	if (tune->probed)
+		t_backend_probe_close(&tune->probe);
+	return (1);
+}
+
+
+void
+t_tune_stats(FILE *fp)
+{
+	const struct t_backend *b;
+	unsigned long nprobe, nmatch, nopen, ntrial;
+
+	assert(fp != NULL);
+
+	nprobe = atomic_load(&t_tune_nprobe);
+	nmatch = atomic_load(&t_tune_nmatch);
+	nopen  = atomic_load(&t_tune_nopen);
+	ntrial = atomic_load(&t_tune_ntrial);
+
+	/* each probe open the file once to read its head and tail */
+	(void)fprintf(fp, "%s: backend probes: %lu file(s), %lu claimed by "
+	    "probe, %lu open(s) (%lu probe + %lu backend open) instead of "
+	    "%lu backend open\n", getprogname(), nprobe, nmatch,
+	    nprobe + nopen, nprobe, nopen, ntrial);
+	(void)fprintf(fp, "%s: %lu file(s) not written, tags unchanged\n",
+	    getprogname(), atomic_load(&t_tune_nclean));
+
+	TAILQ_FOREACH(b, t_all_backends(), entries) {
+		if (b->stats != NULL)
+			b->stats(fp);
+	}
+}
+
+
 struct t_taglist *
 t_tune_tags(struct t_tune *tune)
 {
 
+	struct t_taglist *read;
+
 	assert(tune != NULL);
 
-	if (tune->tlist == NULL)
-		tune->tlist = tune->backend->read(tune->opaque);
+	if (tune->tlist == NULL) {
+		if (t_tune_open(tune) == -1)
+			return (NULL);
+		if ((read = tune->backend->read(tune->opaque)) == NULL)
+			return (NULL);
+		/* move the tags into the arena so that copies can share them */
+		tune->tlist = t_taglist_clone_arena(read, tune->arena);
+		t_taglist_delete(read);
+		if (tune->tlist == NULL)
+			return (NULL);
+		tune->saved = t_taglist_ref(tune->tlist);
+	}
 
-	return (t_taglist_clone(tune->tlist));
+	/* borrowed, see t_taglist_unshare() for writers */
+	return (t_taglist_ref(tune->tlist));
 }
 
 
@@ -119,22 +296,43 @@ t_tune_backend(struct t_tune *tune)
 }
 
 
+struct t_arena *
+t_tune_arena(struct t_tune *tune)
+{
+	assert(tune != NULL);
+
+	return (tune->arena);
+}
+
+
 int
-t_tune_set_tags(struct t_tune *tune, const struct t_taglist *neo)
+t_tune_set_tags(struct t_tune *tune, struct t_taglist *neo)
 {
 	struct t_taglist *copy;
 
 	assert(tune  != NULL);
 	assert(neo   != NULL);
 
+	if (t_tune_open(tune) == -1)
+		return (-1);
+	/* we need the file's tags to know if neo change anything */
+	if (tune->saved == NULL)
+		t_taglist_delete(t_tune_tags(tune));
+
+	tune->set++;
 	if (tune->tlist != neo) {
-		copy = t_taglist_clone(neo);
+		if (neo->arena == tune->arena)
+			copy = t_taglist_ref(neo);
+		else
+			copy = t_taglist_clone_arena(neo, tune->arena);
 		if (copy == NULL)
 			return (-1);
 		t_taglist_delete(tune->tlist);
 		tune->tlist = copy;
-		tune->dirty++;
 	}
+	/* when the tags could not be read, assume they changed */
+	tune->dirty = (tune->saved == NULL ||
+	    !t_taglist_equal(tune->saved, tune->tlist));
 
 	return (0);
 }
@@ -147,15 +345,40 @@ t_tune_save(struct t_tune *tune)
 	assert(tune != NULL);
 
 	if (tune->dirty) {
+		/* t_tune_set_tags() did open the file */
+		assert(tune->opaque != NULL);
 		int ret = tune->backend->write(tune->opaque, tune->tlist);
-		if (ret == 0) /* success */
+		if (ret == 0) { /* success */
 			tune->dirty = 0;
+			t_taglist_delete(tune->saved);
+			tune->saved = t_taglist_ref(tune->tlist);
+		}
+	} else if (tune->set) {
+		/* the file already has these tags, don't write it */
+		atomic_fetch_add(&t_tune_nclean, 1);
 	}
+	tune->set = 0;
 
 	return (tune->dirty ? -1 : 0);
 }
 
 
+int
+t_tune_repad(struct t_tune *tune, const struct t_padding *pad)
+{
+
+	assert(tune != NULL);
+	assert(pad  != NULL);
+
+	if (t_tune_open(tune) == -1)
+		return (-1);
+	if (tune->backend->repad == NULL)
+		return (0);
+
+	return (tune->backend->repad(tune->opaque, pad));
+}
+
+
 static void
 t_tune_clear(struct t_tune *tune)
 {
@@ -163,10 +386,15 @@ t_tune_clear(struct t_tune *tune)
 	assert(tune != NULL);
 
 	/* tune is either initialized with both path and backend set, or it's
-	 uninitialized */
-	if (tune->backend != NULL)
+	 uninitialized. The backend data are only set once the file is open. */
+	if (tune->opaque != NULL)
 		tune->backend->clear(tune->opaque);
+	if (tune->probed)
+		t_backend_probe_close(&tune->probe);
+	t_taglist_delete(tune->saved);
 	t_taglist_delete(tune->tlist);
+	/* release all the tune's tags at once */
+	t_arena_put(tune->arena);
 	free(tune->path);
 	bzero(tune, sizeof(struct t_tune));
 }
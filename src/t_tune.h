@@ -11,10 +11,13 @@
 #include "t_toolkit.h"
 #include "t_backend.h"
 #include "t_taglist.h"
+#include "t_arena.h"
 
 
 /* abstract music file */
 struct t_tune;
+/* see t_backend.h */
+struct t_padding;
 
 /*
  * allocate memory for a new t_tune.
@@ -29,7 +32,10 @@ struct t_tune	*t_tune_new(const char *path);
  *
  * @return
  *   A complete and ordered t_taglist on success, NULL on error. The caller
- *   should pass the returned t_taglist to t_taglist_delete() after use.
+ *   should pass the returned t_taglist to t_taglist_delete() after use. The
+ *   t_taglist is shared with the tune: it must be passed to
+ *   t_taglist_unshare() before any modification. It is allocated from the
+ *   tune's arena and cannot be used after t_tune_delete().
  */
 struct t_taglist	*t_tune_tags(struct t_tune *tune);
 
@@ -49,22 +55,55 @@ const char	*t_tune_path(struct t_tune *tune);
  */
 const struct t_backend	*t_tune_backend(struct t_tune *tune);
 
+/*
+ * get the tune's arena.
+ *
+ * @return
+ *   an arena for allocations that can be released along with the tune, see
+ *   t_arena.h.
+ */
+struct t_arena	*t_tune_arena(struct t_tune *tune);
+
 /*
  * set the tags for a tune.
  *
+ * When tlist is allocated from the tune's arena, the tune keep a reference to
+ * it instead of a copy, see t_taglist_ref(). The tune is only marked as
+ * changed if tlist differ from the tags in the file (see t_taglist_equal()).
+ *
  * @return
  *   0 on success, -1 on error.
  */
-int	t_tune_set_tags(struct t_tune *tune, const struct t_taglist *tlist);
+int	t_tune_set_tags(struct t_tune *tune, struct t_taglist *tlist);
 
 /*
  * Save (write) the file to the storage with its new tags.
  *
+ * Nothing is written when the tags did not change since they were read or
+ * last saved.
+ *
  * @return
  *   0 on success, -1 on error.
  */
 int	t_tune_save(struct t_tune *tune);
 
+/*
+ * change the padding reserved in the file for its tags, see the repad action.
+ * The file is changed right away, the tags set by t_tune_set_tags() are still
+ * only written by t_tune_save().
+ *
+ * @return
+ *   0 on success (or if the tune's backend has no notion of padding), -1 on
+ *   error.
+ */
+int	t_tune_repad(struct t_tune *tune, const struct t_padding *pad);
+
+/*
+ * print statistics about backend selection and the backends own statistics,
+ * see -v.
+ */
+void	t_tune_stats(FILE *fp);
+
 /*
  * clear the t_tune and pass it to free(3). The pointer should not be used
  * afterward.
@@ -18,10 +18,10 @@
 #include "t_config.h"
 #include "t_toolkit.h"
 #include "t_taglist.h"
+#include "t_sink.h"
 #include "t_format.h"
 
 
-
 /* t_error handling macros */
 /* used for any struct that need to behave like a t_error */
 #define	T_ERROR_MSG_MEMBER	char *t__errmsg /* t__deprecated XXX: whine too much */
@@ -47,6 +47,8 @@ static const char fileext[] = "yml";
 struct t_format		*t_yaml_format(void);
 
 static char		*t_tags2yaml(const struct t_taglist *tlist, const char *path);
+static int		 t_yaml_tags2sink(struct t_sink *sink,
+			    const struct t_taglist *tlist, const char *path);
 static struct t_taglist	*t_yaml2tags(FILE *fp, char **errmsg_p);
 /*
  * libyaml emitter helper.
@@ -62,6 +64,7 @@ t_yaml_format(void)
 		.desc		=
 		    "YAML - YAML Ain't Markup Language",
 		.tags2fmt	= t_tags2yaml,
+		.tags2sink	= t_yaml_tags2sink,
 		.fmt2tags	= t_yaml2tags,
 	};
 
@@ -70,46 +73,61 @@ t_yaml_format(void)
 
 
 int
-t_yaml_whdl(void *sb, unsigned char *buffer, size_t size)
+t_yaml_whdl(void *sink, unsigned char *buffer, size_t size)
 {
 
-	assert(sb != NULL);
+	assert(sink != NULL);
 	assert(buffer != NULL);
 
-	if (sb == NULL || buffer == NULL)
+	if (sink == NULL || buffer == NULL)
 		return (0); /* error */
-	else
-		(void)sbuf_bcat(sb, buffer, size);
-	
+	else if (t_sink_write(sink, buffer, size) == -1)
+		return (0); /* error, errno is set */
+
 	return (1); /* success */
 }
 
 
 static char *
 t_tags2yaml(const struct t_taglist *tlist, const char *path)
+{
+	struct t_sink sink;
+	char *ret = NULL;
+
+	assert(tlist != NULL);
+
+	t_sink_init(&sink, -1);
+	if (t_yaml_tags2sink(&sink, tlist, path) == 0)
+		ret = t_sink_detach(&sink);
+	t_sink_release(&sink);
+	return (ret);
+}
+
+
+static int
+t_yaml_tags2sink(struct t_sink *sink, const struct t_taglist *tlist,
+    const char *path)
 {
 	yaml_emitter_t emitter;
 	yaml_event_t event;
-	struct sbuf *sb;
 	const struct t_tag *t;
-	char *ret;
 
+	assert(sink != NULL);
 	assert(tlist != NULL);
 
-	sb = sbuf_new_auto();
-	if (sb == NULL)
-		return (NULL);
-
 	if (path != NULL) {
 		/* create a comment header with the filename */
-		(void)sbuf_printf(sb, "# %s\n", path);
+		if (t_sink_printf(sink, "# %s\n", path) == -1)
+			return (-1);
 	}
 
 	/* Create the Emitter object. */
-	if (!yaml_emitter_initialize(&emitter))
-		goto emitter_error_label;
+	if (!yaml_emitter_initialize(&emitter)) {
+		errno = ENOMEM;
+		return (-1);
+	}
 
-	yaml_emitter_set_output(&emitter, t_yaml_whdl, sb);
+	yaml_emitter_set_output(&emitter, t_yaml_whdl, sink);
 	yaml_emitter_set_unicode(&emitter, 1);
 
 	/* Create and emit the STREAM-START event. */
@@ -136,7 +154,7 @@ t_tags2yaml(const struct t_taglist *tlist, const char *path)
 	if (!yaml_emitter_emit(&emitter, &event))
 		goto emitter_error_label;
 
-	TAILQ_FOREACH(t, tlist->tags, entries) {
+	T_TAGLIST_FOREACH(t, tlist) {
 		/* Create and emit the MAPPING-START event. */
 		if (!yaml_mapping_start_event_initialize(&event, /* anchor */NULL,
 		    (yaml_char_t *)YAML_MAP_TAG, /* implicit */1,
@@ -193,23 +211,19 @@ t_tags2yaml(const struct t_taglist *tlist, const char *path)
 	/* Destroy the Emitter object. */
 	yaml_emitter_delete(&emitter);
 	yaml_event_delete(&event);
-
-	if (sbuf_finish(sb) == -1) {
-		warn("sbuf_finish");
-		sbuf_delete(sb);
-		return (NULL);
-	}
-
-	ret = strdup(sbuf_data(sb));
-	sbuf_delete(sb);
-	return (ret);
+	return (0);
 	/* NOTREACHED */
 event_error_label:
-	sbuf_delete(sb);
+	yaml_emitter_delete(&emitter);
 	errno = ENOMEM;
-	return (NULL);
+	return (-1);
 	/* NOTREACHED */
 emitter_error_label:
+	if (emitter.error == YAML_WRITER_ERROR) {
+		/* a sink error, errno was set by t_sink_write() */
+		yaml_emitter_delete(&emitter);
+		return (-1);
+	}
 	warnx("t_tags2yaml: emit error");
 	ABANDON_SHIP();
 }
@@ -17,6 +17,15 @@
 #include "t_backend.h"
 #include "t_format.h"
 #include "t_action.h"
+#include "t_pool.h"
+#include "t_sink.h"
+
+
+/* what every file go through, shared by all the workers */
+struct t_job_spec {
+	struct t_actionQ	*aQ;
+	int			 write; /* 1 if any action need write access */
+};
 
 
 /*
@@ -24,11 +33,26 @@
  */
 static void	usage(int status) t__dead2;
 
+/*
+ * apply all the actions to the file at path.
+ *
+ * @return
+ *   1 on success, 0 otherwise.
+ */
+static int	process(const char *path, void *vspec);
 
-/* options */
+
+/*
+ * options. They are set once while parsing the command line, before any worker
+ * is started, and are read-only afterward.
+ */
 int			 pflag; /* create directory with rename */
 const struct t_format	*Fflag; /* output format */
+int			 jflag = 1; /* count of workers */
 int			 Nflag; /* answer no to all questions */
+const struct t_padding	*Pflag; /* padding reserve when a file is rewritten,
+				   NULL for the backend default */
+int			 vflag; /* print statistics on exit */
 int			 Yflag; /* answer yes to all questions */
 
 
@@ -39,21 +63,35 @@ int			 Yflag; /* answer yes to all questions */
 int
 main(int argc, char *argv[])
 {
-	int	i;
-	struct t_tune		*tune;
+	int	i, interactive;
+	long	l;
+	char	*endptr;
 	struct t_action		*a;
 	struct t_format		*fmt;
 	struct t_actionQ	*aQ;
+	struct t_job_spec	 spec;
+	static struct t_padding	 padding;
 
 	errno = 0; /* this is a bug in malloc(3) */
 
 	Fflag = TAILQ_FIRST(t_all_formats());
 
-	while ((i = getopt(argc, argv, "hpF:NY")) != -1) {
+	while ((i = getopt(argc, argv, "hpF:j:NP:vY")) != -1) {
 		switch ((char)i) {
 		case 'p':
 			pflag = 1;
 			break;
+		case 'j':
+			errno = 0;
+			l = strtol(optarg, &endptr, 10);
+			if (errno != 0 || endptr == optarg || *endptr != '\0' ||
+			    l < 1 || l > T_POOL_MAX_WORKERS) {
+				errx(errno = EINVAL, "%s: invalid -j option, "
+				    "expected a number between 1 and %d.",
+				    optarg, T_POOL_MAX_WORKERS);
+			}
+			jflag = (int)l;
+			break;
 		case 'F':
 			Fflag = NULL;
 			TAILQ_FOREACH(fmt, t_all_formats(), entries) {
@@ -75,6 +113,17 @@ main(int argc, char *argv[])
 			}
 			Nflag = 1;
 			break;
+		case 'P':
+			if (t_backend_padding_parse(&padding, optarg) == -1) {
+				errx(errno = EINVAL, "%s: invalid -P option, "
+				    "expected a size like 8192, 8k, 1M or 5%%.",
+				    optarg);
+			}
+			Pflag = &padding;
+			break;
+		case 'v':
+			vflag = 1;
+			break;
 		case 'Y':
 			if (Nflag) {
 				errno = EINVAL;
@@ -111,58 +160,93 @@ main(int argc, char *argv[])
 		    getprogname());
 	}
 
-	/* find if any action need write access */
-	int write = 0;
-	TAILQ_FOREACH(a, aQ, entries)
-		write += a->write;
+	/* find if any action need write access or the terminal */
+	spec.aQ    = aQ;
+	spec.write = interactive = 0;
+	TAILQ_FOREACH(a, aQ, entries) {
+		spec.write  += a->write;
+		interactive += a->interactive;
+	}
+	if (jflag > 1 && interactive) {
+		warnx("an action require the terminal, -j ignored.");
+		jflag = 1;
+	}
+	if (jflag > argc)
+		jflag = argc;
 
 	/*
 	 * main loop, foreach files
 	 */
 	int grand_success = 1;
-	for (i = 0; i < argc; i++) {
-		/* check file path and access */
-		const char *path = argv[i];
-		int success = 1;
-		if (access(path, (write ? (R_OK | W_OK) : R_OK)) == -1) {
-			warn("%s", path);
-			grand_success = 0;
-			continue;
-		}
+	if (jflag > 1) {
+		/* the backend list is lazily initialized, so do it before any
+		   worker need it */
+		(void)t_all_backends();
+		grand_success = t_pool_run(jflag, argc, argv, process, &spec);
+	} else {
+		for (i = 0; i < argc; i++)
+			grand_success &= process(argv[i], &spec);
+	}
+	if (t_actionQ_finish(aQ) != 0)
+		grand_success = 0;
+	t_actionQ_delete(aQ);
+	if (t_sink_flush(t_sink_get()) != 0) {
+		warn("write");
+		grand_success = 0;
+	}
+	if (vflag)
+		t_tune_stats(stderr);
+	return (grand_success ? EXIT_SUCCESS : EXIT_FAILURE);
+}
 
-		if ((tune = t_tune_new(path)) == NULL) {
-			if (errno == ENOMEM)
-				err(EXIT_FAILURE, "malloc");
-			warnx("%s: unsupported file format", path);
-			grand_success = 0;
-			continue;
-		}
 
-		/* apply every actions */
-		TAILQ_FOREACH(a, aQ, entries) {
-			if (a->apply(a, tune) != 0) {
-				/*
-				 * prevent further action on this particular
-				 * file.
-				 */
-				success = 0;
-				break;
-			}
+static int
+process(const char *path, void *vspec)
+{
+	int status = 0, success = 1;
+	struct t_tune		*tune;
+	struct t_action		*a;
+	const struct t_job_spec	*spec;
+
+	assert(path  != NULL);
+	assert(vspec != NULL);
+	spec = vspec;
+
+	/* check file path and access */
+	if (access(path, (spec->write ? (R_OK | W_OK) : R_OK)) == -1) {
+		warn("%s", path);
+		return (0);
+	}
+
+	if ((tune = t_tune_new(path)) == NULL) {
+		if (errno == ENOMEM)
+			err(EXIT_FAILURE, "malloc");
+		warnx("%s: unsupported file format", path);
+		return (0);
+	}
+
+	/* apply every actions */
+	TAILQ_FOREACH(a, spec->aQ, entries) {
+		if ((status = a->apply(a, tune)) != 0) {
+			/*
+			 * prevent further action on this particular
+			 * file.
+			 */
+			success = (status == T_ACTION_SKIP);
+			break;
 		}
-		if (write && success) {
-			/* all actions went well and at least one of them
-			   require the tags to be written back to the file */
-			if (t_tune_save(tune) == -1) {
-				warnx("%s: could not write tags to the file,",
-				    t_tune_path(tune));
-				grand_success = 0;
-			}
+	}
+	if (spec->write && status == 0) {
+		/* all actions went well and at least one of them
+		   require the tags to be written back to the file */
+		if (t_tune_save(tune) == -1) {
+			warnx("%s: could not write tags to the file,",
+			    t_tune_path(tune));
+			success = 0;
 		}
-		t_tune_delete(tune);
-		grand_success &= success;
 	}
-	t_actionQ_delete(aQ);
-	return (grand_success ? EXIT_SUCCESS : EXIT_FAILURE);
+	t_tune_delete(tune);
+	return (success);
 }
 
 
@@ -187,8 +271,11 @@ usage(int status)
 	fprintf(stderr, "  -h     show this help\n");
 	fprintf(stderr, "  -p     create destination directories if needed (used by rename)\n");
 	fprintf(stderr, "  -F fmt use the fmt format for print, edit and load actions (see Formats)\n");
+	fprintf(stderr, "  -j num process num files in parallel\n");
 	fprintf(stderr, "  -Y     answer yes to all questions\n");
 	fprintf(stderr, "  -N     answer no  to all questions\n");
+	fprintf(stderr, "  -P pad reserve pad bytes (or percent) of padding when a file is rewritten\n");
+	fprintf(stderr, "  -v     print statistics on exit\n");
 	fprintf(stderr, "\n");
 
 	fprintf(stderr, "Actions:\n");
@@ -198,9 +285,14 @@ usage(int status)
 	    "empty, all tags are cleared\n");
 	fprintf(stderr, "  add:TAG=VALUE    add a TAG=VALUE pair\n");
 	fprintf(stderr, "  set:TAG=VALUE    set TAG to VALUE\n");
+	fprintf(stderr, "  stats:TAG        count the values of TAG over all files\n");
+	fprintf(stderr, "  sub:TAG/RE/REPL/FLAGS\n"
+	    "                   replace RE by REPL in TAG values\n");
 	fprintf(stderr, "  edit             prompt for editing\n");
 	fprintf(stderr, "  load:PATH        load PATH yaml tag file\n");
 	fprintf(stderr, "  rename:PATTERN   rename to PATTERN\n");
+	fprintf(stderr, "  repad:SIZE       reserve SIZE bytes (or percent) of padding\n");
+	fprintf(stderr, "  where:EXPR       skip the next actions unless EXPR match\n");
 	fprintf(stderr, "\n");
 
 	fprintf(stderr, "Formats:\n");
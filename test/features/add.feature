@@ -39,14 +39,14 @@ Feature: Adding tags to a file
             | music-file |
             | track.flac |
             | track.ogg  |
+            | track.mp3  |
 
-    Scenario Outline: multiples tags with the same key (using TagLib)
-        Given there is a music file <music-file>
-        When  I run tagutil add:artist="Richard Wright" add:"artist=David Gilmour" <music-file>
-        And   I run tagutil print <music-file>
+    Scenario: adding a friendly key and its frame ID to a mp3 file
+        Given there is a music file track.mp3
+        When  I run tagutil add:year=2001 add:tdrc=2002 track.mp3
         Then  I expect tagutil to succeed
-        And   I should see the YAML tag list:
-            | artist | David Gilmour  |
-    Examples:
-            | music-file |
-            | track.mp3  |
+        And   I expect track.mp3 to have 1 ID3v2 TDRC frame
+        When  I run tagutil track.mp3
+        Then  I should see the YAML tag list:
+            | year | 2001 |
+            | year | 2002 |
@@ -12,8 +12,8 @@ Feature: Printing the backend used for a file
         Then  I expect tagutil to succeed
         And   I should see "libvorbis"
 
-    Scenario: using the taglib backend
+    Scenario: using the ID3v2 backend
         Given there is a music file track.mp3
         When  I run tagutil backend track.mp3
         Then  I expect tagutil to succeed
-        And   I should see "TagLib"
+        And   I should see "ID3v2"
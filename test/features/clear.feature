@@ -49,3 +49,20 @@ Feature: Clearing tags from a file
             | music-file |
             | track.flac |
             | track.ogg  |
+
+    Scenario Outline: clearing all tags before setting new ones
+        Given there is a music file <music-file> tagged with:
+            | title  | Echoes         |
+            | artist | Pink Floyd     |
+        When  I run tagutil clear: set:title=Time "set:artist=Pink Floyd" add:comment=DSOTM <music-file>
+        And   I run tagutil print <music-file>
+        Then  I expect tagutil to succeed
+        And   I should see the YAML tag list:
+            | title   | Time       |
+            | artist  | Pink Floyd |
+            | comment | DSOTM      |
+    Examples:
+            | music-file |
+            | track.flac |
+            | track.ogg  |
+            | track.mp3  |
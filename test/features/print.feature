@@ -56,3 +56,46 @@ Feature: Reading a file
             | track.flac |
             | track.ogg  |
             | track.mp3  |
+
+    Scenario: reading tags of many files in parallel
+        Given there is a music file first.flac tagged with:
+            | title       | Echoes            |
+        And   there is a music file second.ogg tagged with:
+            | title       | Fearless          |
+        When  I run tagutil -j 2 first.flac second.ogg
+        Then  I expect tagutil to succeed
+        And   I should see "# first.flac"
+        And   I should see "- title: Echoes"
+        And   I should see "# second.ogg"
+        And   I should see "- title: Fearless"
+
+    Scenario: reading tags of many files in parallel keeps the argument order
+        Given there is a music file a.flac with a 64 KiB comment tag
+        And   there is a music file b.mp3
+        And   there is a music file c.ogg tagged with:
+            | title       | Fearless          |
+            | artist      | Pink Floyd        |
+        And   there is a music file d.mp3 with a 16 KiB title tag
+        And   there is a music file e.flac
+        And   there is a music file f.ogg with a 64 KiB title tag
+        And   there is a music file g.mp3 tagged with:
+            | title       | Echoes            |
+        When  I run tagutil -j 3 f.ogg a.flac b.mp3 e.flac c.ogg g.mp3 d.mp3
+        Then  I expect tagutil to succeed
+        And   I should see the files in this order:
+            | f.ogg  |
+            | a.flac |
+            | b.mp3  |
+            | e.flac |
+            | c.ogg  |
+            | g.mp3  |
+            | d.mp3  |
+        And   I should see the same output as tagutil -j 1 f.ogg a.flac b.mp3 e.flac c.ogg g.mp3 d.mp3
+
+    Scenario: reading tags needing escapes in JSON
+        Given there is a music file track.flac tagged with:
+            | title       | "Echoes" \\ Live  |
+        When  I run tagutil -F json track.flac
+        Then  I expect tagutil to succeed
+        And   I should see the JSON tag list:
+            | title       | "Echoes" \\ Live  |
@@ -0,0 +1,45 @@
+Feature: Reserving padding in a file
+
+    Scenario: repadding a FLAC file
+        Given there is a music file track.flac
+        When  I run tagutil -v repad:64k track.flac
+        Then  I expect tagutil to succeed
+        And   I should see "track.flac: padding set to 65536 bytes, file rewritten"
+        And   I should see "FLAC writes: 0 in place, 0 rewritten, 1 repadded"
+
+    Scenario: repadding an already padded FLAC file
+        Given there is a music file track.flac
+        When  I run tagutil repad:64k track.flac
+        And   I run tagutil -v repad:64k set:title=Echoes track.flac
+        Then  I expect tagutil to succeed
+        And   I should see "track.flac: comments written in place"
+        And   I should see "FLAC writes: 1 in place, 0 rewritten, 0 repadded"
+
+    Scenario: reserving padding on rewrite
+        Given there is a music file track.flac
+        When  I run tagutil repad:0 track.flac
+        And   I run tagutil -v -P 8k add:comment=grown track.flac
+        Then  I expect tagutil to succeed
+        And   I should see "track.flac: not enough padding, file rewritten"
+        When  I run tagutil -v set:title=Echoes track.flac
+        Then  I expect tagutil to succeed
+        And   I should see "track.flac: comments written in place"
+
+    Scenario: invalid padding
+        Given there is a music file track.flac
+        When  I run tagutil repad:lots track.flac
+        Then  I expect tagutil to fail
+
+    Scenario: repadding a mp3 file
+        Given there is a music file track.mp3
+        When  I run tagutil -v repad:4k track.mp3
+        And   I run tagutil -v set:title=Echoes track.mp3
+        Then  I expect tagutil to succeed
+        And   I should see "track.mp3: tag written in place"
+        And   I should see "ID3v2 writes: 1 in place, 0 rewritten, 0 repadded"
+
+    Scenario: repadding a mp3 file with an unsynchronised ID3v2.4 tag
+        Given there is a music file track.mp3 with an unsynchronised ID3v2.4 tag
+        When  I run tagutil repad:4k track.mp3
+        Then  I expect tagutil to succeed
+        And   I expect the ID3v2 PRIV frame of track.mp3 to be unchanged
@@ -60,3 +60,69 @@ Feature: Setting tags to a file
             | music-file |
             | track.flac |
             | track.ogg  |
+
+    Scenario: setting FLAC tags in place
+        Given there is a music file track.flac
+        When  I run tagutil -v set:title=Echoes track.flac
+        Then  I expect tagutil to succeed
+        And   I should see "track.flac: comments written in place"
+        And   I should see "FLAC writes: 1 in place, 0 rewritten"
+
+    Scenario: setting tags to their current value
+        Given there is a music file track.flac
+        When  I run tagutil set:title=Echoes track.flac
+        And   I run tagutil -v set:title=Echoes track.flac
+        Then  I expect tagutil to succeed
+        And   I should see "1 file(s) not written, tags unchanged"
+        And   I should see "FLAC writes: 0 in place, 0 rewritten, 0 repadded"
+
+    Scenario: changing the count of Ogg/Vorbis header pages
+        Given there is a music file track.ogg with a 64 KiB comment tag
+        Then  I expect the Ogg pages of track.ogg to be valid
+        When  I run tagutil track.ogg
+        Then  I should see "- comment: xxxxxxxx"
+        When  I run tagutil set:comment=Echoes track.ogg
+        Then  I expect tagutil to succeed
+        And   I expect the Ogg pages of track.ogg to be valid
+        And   I expect track.ogg to have 3 Ogg pages
+        When  I run tagutil track.ogg
+        Then  I should see the YAML tag list:
+            | comment | Echoes |
+
+    Scenario: setting a tag of a mp3 file with an unsynchronised ID3v2.4 tag
+        Given there is a music file track.mp3 with an unsynchronised ID3v2.4 tag
+        When  I run tagutil set:title=Atom track.mp3
+        Then  I expect tagutil to succeed
+        And   I expect the ID3v2 PRIV frame of track.mp3 to be unchanged
+        When  I run tagutil track.mp3
+        Then  I should see the YAML tag list:
+            | title | Atom |
+
+    Scenario: setting the comment of a mp3 file keeps its language
+        Given there is a music file track.mp3 with an ID3v2.4 "eng" comment "Echoes"
+        When  I run tagutil set:comment=Fearless track.mp3
+        Then  I expect tagutil to succeed
+        And   I expect the ID3v2 comment language of track.mp3 to be "eng"
+        When  I run tagutil track.mp3
+        Then  I should see the YAML tag list:
+            | comment | Fearless |
+
+    Scenario: setting the title of a mp3 file with both ID3v2 and ID3v1 tags
+        Given there is a music file track.mp3 with an ID3v2.4 title "Echoes" and an ID3v1 title "Echoes"
+        When  I run tagutil set:title=Fearless track.mp3
+        Then  I expect tagutil to succeed
+        And   I expect the ID3v1 title of track.mp3 to be "Fearless"
+        When  I run tagutil track.mp3
+        Then  I should see the YAML tag list:
+            | title | Fearless |
+
+    Scenario: setting the frame ID of a friendly key of a mp3 file
+        Given there is a music file track.mp3 tagged with:
+            | conductor | Atom |
+        When  I run tagutil set:tpe3=Heart track.mp3
+        Then  I expect tagutil to succeed
+        And   I expect track.mp3 to have 1 ID3v2 TPE3 frame
+        When  I run tagutil track.mp3
+        Then  I should see the YAML tag list:
+            | conductor | Atom  |
+            | conductor | Heart |
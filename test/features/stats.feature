@@ -0,0 +1,32 @@
+Feature: Counting tag values over many files
+
+    Scenario Outline: counting the values of a tag
+        Given there is a music file meddle.<ext> tagged with:
+            | genre | Rock |
+        And   there is a music file animals.<ext> tagged with:
+            | genre | Rock |
+        And   there is a music file kind.<ext> tagged with:
+            | genre | Jazz |
+        And   there is a music file untitled.<ext>
+        When  I run tagutil -j 2 stats:genre meddle.<ext> animals.<ext> kind.<ext> untitled.<ext>
+        Then  I expect tagutil to succeed
+        And   I should see the YAML tag list:
+            | files    | 4      |
+            | missing  | 1      |
+            | distinct | 2      |
+            | count    | 2      |
+            | value    | Rock   |
+            | count    | 1      |
+            | value    | Jazz   |
+    Examples:
+            | ext  |
+            | flac |
+            | ogg  |
+            | mp3  |
+
+    Scenario: missing tag key
+        Given there is a music file track.flac
+        When  I run tagutil stats: track.flac
+        Then  I expect tagutil to fail
+        And   I should see "stats: missing tag key"
+        And   I should not see "Invalid argument"
@@ -16,6 +16,22 @@ Given(/^there is a music file (\w+)\.(mp3|ogg|flac) tagged with:$/) do |filename
   Tagutil.create_tune(filename, ext, tags_from_cuke_table(tbl))
 end
 
+Given(/^there is a music file (\w+)\.(mp3|ogg|flac) with a (\d+) KiB (\w+) tag$/) do |filename, ext, size, key|
+  Tagutil.create_tune(filename, ext, [{ key => 'x' * (size.to_i * 1024) }])
+end
+
+Given(/^there is a music file (\w+)\.mp3 with an unsynchronised ID3v2\.4 tag$/) do |filename|
+  Tagutil.create_unsync_tune(filename)
+end
+
+Given(/^there is a music file (\w+)\.mp3 with an ID3v2\.4 "(\w{3})" comment "(.*?)"$/) do |filename, lang, text|
+  Tagutil.create_id3v2_tune(filename, { 'COMM' => "\x03#{lang}\x00#{text}".b })
+end
+
+Given(/^there is a music file (\w+)\.mp3 with an ID3v2\.4 title "(.*?)" and an ID3v1 title "(.*?)"$/) do |filename, v2, v1|
+  Tagutil.create_id3v2_tune(filename, { 'TIT2' => "\x03#{v2}".b }, id3v1: v1)
+end
+
 Given(/^there is a text file named (\w+\.\w+) containing:$/) do |filename, content|
   File.write filename, content
 end
@@ -49,6 +65,23 @@ Then(/^I should see "(.*?)"$/) do |text|
 end
 
 
+Then(/^I should not see "(.*?)"$/) do |text|
+  expect(@output).not_to include(text)
+end
+
+
+Then(/^I should see the same output as tagutil(.*)$/) do |params|
+  output, status = Tagutil.run(env: @env || Hash.new, argv: params)
+  expect(status.exitstatus).to eq(0)
+  expect(@output).to eq(output)
+end
+
+
+Then(/^I should see the files in this order:$/) do |tbl|
+  expect(@output.scan(/^# (.+)$/).flatten).to eq(tbl.raw.flatten)
+end
+
+
 Then(/^I should see the help about (.+)$/) do |section|
   expect(@output).to match(/^#{section}/m)
 end
@@ -78,6 +111,30 @@ Then(/^I should see the JSON tag list:$/) do |tbl|
   expect(JSON.load(@output)).to eql(tags)
 end
 
+Then(/^I expect the ID3v2 PRIV frame of (\S+) to be unchanged$/) do |file|
+  expect(Tagutil.id3v2_frame(file, 'PRIV')).to eq(Tagutil::UnsyncPriv)
+end
+
+Then(/^I expect the ID3v2 comment language of (\S+) to be "(\w{3})"$/) do |file, lang|
+  expect(Tagutil.id3v2_frame(file, 'COMM')[1, 3]).to eq(lang)
+end
+
+Then(/^I expect the Ogg pages of (\S+) to be valid$/) do |file|
+  expect { Tagutil.ogg_pages(file) }.not_to raise_error
+end
+
+Then(/^I expect (\S+) to have (\d+) Ogg pages$/) do |file, count|
+  expect(Tagutil.ogg_pages(file)).to eq(count.to_i)
+end
+
+Then(/^I expect the ID3v1 title of (\S+) to be "(.*?)"$/) do |file, title|
+  expect(Tagutil.id3v1_title(file)).to eq(title)
+end
+
+Then(/^I expect (\S+) to have (\d+) ID3v2 (\w{4}) frames?$/) do |file, count, id|
+  expect(Tagutil.id3v2_frames(file, id).size).to eq(count.to_i)
+end
+
 Then("I expect the file {string} not to exist") do |file|
   expect(File).not_to exist(file)
 end
@@ -0,0 +1,50 @@
+Feature: Substituting tag values
+
+    Scenario Outline: replacing a string in all the values of a tag
+        Given there is a music file <music-file> tagged with:
+            | artist | Pink Floyd feat. David Gilmour  |
+            | title  | Echoes                          |
+            | artist | Roger Waters feat. Eric Clapton |
+        When  I run tagutil 'sub:artist/ feat\. / ft. /' <music-file>
+        And   I run tagutil print <music-file>
+        Then  I expect tagutil to succeed
+        And   I should see the YAML tag list:
+            | artist | Pink Floyd ft. David Gilmour  |
+            | title  | Echoes                        |
+            | artist | Roger Waters ft. Eric Clapton |
+    Examples:
+            | music-file |
+            | track.flac |
+            | track.ogg  |
+
+    Scenario: using sub-expressions and flags
+        Given there is a music file track.flac tagged with:
+            | artist | Floyd, Pink |
+            | title  | echoes      |
+        When  I run tagutil 'sub:artist/^([^,]+), (.*)$/\2 \1/' 'sub:title/E/[&]/gi' track.flac
+        And   I run tagutil print track.flac
+        Then  I expect tagutil to succeed
+        And   I should see the YAML tag list:
+            | artist | Pink Floyd |
+            | title  | [e]cho[e]s |
+
+    Scenario: substituting nothing
+        Given there is a music file track.flac tagged with:
+            | title | Echoes |
+        When  I run tagutil -v sub:title/Time/Money/ track.flac
+        Then  I expect tagutil to succeed
+        And   I should see "FLAC writes: 0 in place, 0 rewritten, 0 repadded"
+
+    Scenario: invalid back-reference
+        Given there is a music file track.flac
+        When  I run tagutil 'sub:title/(a)/\2/' track.flac
+        Then  I expect tagutil to fail
+        And   I should see "sub: \2: invalid reference \2"
+
+    Scenario: substituting empty matches globally
+        Given there is a music file track.flac tagged with:
+            | title | xab |
+        When  I run tagutil 'sub:title/x*/X/g' track.flac
+        And   I run tagutil track.flac
+        Then  I should see the YAML tag list:
+            | title | XaXbX |
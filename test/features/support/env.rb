@@ -56,6 +56,111 @@ module Tagutil
     end
   end
 
+  # a PRIV frame content that need to be unsynchronised
+  UnsyncPriv = "tagutil\x00\xff\xe0\xff\x00!".b
+
+  # create a mp3 file with an ID3v2.4 tag having the unsynchronisation flag
+  # (but not its frames) containing a title and an UnsyncPriv PRIV frame.
+  def self.create_unsync_tune(filename)
+    create_id3v2_tune(filename, { 'TIT2' => "\x03Echoes".b, 'PRIV' => UnsyncPriv }, unsync: true)
+  end
+
+  # create a mp3 file with an ID3v2.4 tag made of the given frames contents
+  # (by frame id), and an ID3v1 tag with the given title if id3v1 is set.
+  def self.create_id3v2_tune(filename, frames, unsync: false, id3v1: nil)
+    path   = File.join(@tmpdir, "#{filename}.mp3")
+    blank  = @blankfiles.select { |f| f =~ /\.mp3$/ }.first
+    frames = frames.map do |id, data|
+      data = unsync(data) if unsync
+      id.b + syncsafe_enc(data.bytesize) + "\x00\x00".b + data
+    end.join
+    header = "ID3\x04\x00".b + (unsync ? "\x80" : "\x00").b + syncsafe_enc(frames.bytesize)
+    tail   = id3v1 ? ["TAG", id3v1, 255].pack('a3a124C') : ''.b
+    File.binwrite(path, header + frames + File.binread(blank) + tail)
+  end
+
+  # the title of the ID3v1 tag at the end of a file, nil if there is none.
+  def self.id3v1_title(path)
+    tag = File.binread(path)[-128..-1]
+    tag[3, 30].sub(/\x00.*/m, '') if tag and tag[0, 3] == 'TAG'
+  end
+
+  # the content of the first frame id of an ID3v2.4 tag, without its
+  # unsynchronisation and data length indicator.
+  def self.id3v2_frame(path, id)
+    id3v2_frames(path, id).first
+  end
+
+  # the contents of all the frames id of an ID3v2.4 tag, in file order.
+  def self.id3v2_frames(path, id)
+    tag = File.binread(path)
+    raise ArgumentError.new "#{path}: no ID3v2.4 tag" unless tag[0, 4] == "ID3\x04".b
+    tflags = tag.getbyte(5)
+    off    = 10
+    last   = off + syncsafe_dec(tag[6, 4])
+    frames = []
+    while off + 10 <= last and tag.getbyte(off) != 0
+      len    = syncsafe_dec(tag[off + 4, 4])
+      fflags = tag.getbyte(off + 9)
+      if tag[off, 4] == id
+        data = tag[off + 10, len]
+        data = data.gsub("\xff\x00".b, "\xff".b) if (tflags & 0x80) != 0 or (fflags & 0x02) != 0
+        data = data[4..-1] if (fflags & 0x01) != 0
+        frames << data
+      end
+      off += 10 + len
+    end
+    frames
+  end
+
+  # the Ogg CRC-32: polynomial 0x04c11db7, no reflection and no final xor.
+  OggCRCTable = (0..255).map do |i|
+    8.times.inject(i << 24) { |r, _| (r & 0x80000000) != 0 ? ((r << 1) ^ 0x04c11db7) & 0xffffffff : (r << 1) & 0xffffffff }
+  end
+
+  # check that path is made of Ogg pages with a valid CRC and a page sequence
+  # number following the previous page of their logical stream.
+  #
+  # return the count of pages, raise RuntimeError on error.
+  def self.ogg_pages(path)
+    data  = File.binread(path)
+    off   = 0
+    seqno = Hash.new
+    count = 0
+    while off < data.bytesize
+      raise RuntimeError.new("#{path}: no Ogg page at #{off}") unless data[off, 4] == 'OggS'.b
+      nseg   = data.getbyte(off + 26)
+      len    = 27 + nseg + data[off + 27, nseg].bytes.sum
+      page   = data[off, len].b
+      serial, pageno, crc = page[14, 12].unpack('VVV')
+      page[22, 4] = "\x00\x00\x00\x00".b
+      sum = page.each_byte.inject(0) { |c, b| ((c << 8) & 0xffffffff) ^ OggCRCTable[(c >> 24) ^ b] }
+      raise RuntimeError.new("#{path}: bad CRC for the page at #{off}") unless sum == crc
+      expected = seqno.key?(serial) ? seqno[serial] + 1 : 0
+      raise RuntimeError.new("#{path}: page #{pageno} at #{off}, expected #{expected}") unless pageno == expected
+      seqno[serial] = pageno
+      off   += len
+      count += 1
+    end
+    count
+  end
+
+  def self.unsync(data)
+    bytes = data.bytes
+    bytes.each_with_index.flat_map do |b, i|
+      nxt = bytes[i + 1]
+      if b == 0xff and (nxt.nil? or nxt == 0 or nxt >= 0xe0) then [b, 0] else [b] end
+    end.pack('C*')
+  end
+
+  def self.syncsafe_enc(n)
+    [21, 14, 7, 0].map { |shift| (n >> shift) & 0x7f }.pack('C*')
+  end
+
+  def self.syncsafe_dec(s)
+    s.bytes.inject(0) { |n, b| (n << 7) | b }
+  end
+
   def self.run(env: {}, argv: "")
     cmd = "#{Executable} #{argv}"
     Open3.capture2e(env, cmd)
@@ -0,0 +1,40 @@
+Feature: Filtering files by their tags
+
+    Scenario Outline: setting tags to the matching files only
+        Given there is a music file meddle.<ext> tagged with:
+            | albumartist | Pink Floyd |
+            | date        | 1971       |
+        And   there is a music file division.<ext> tagged with:
+            | albumartist | Pink Floyd |
+            | date        | 1994       |
+        When  I run tagutil 'where:albumartist == "Pink Floyd" and date < 1980' set:genre=Rock meddle.<ext> division.<ext>
+        Then  I expect tagutil to succeed
+        When  I run tagutil print meddle.<ext>
+        Then  I should see the YAML tag list:
+            | albumartist | Pink Floyd |
+            | date        | 1971       |
+            | genre       | Rock       |
+        When  I run tagutil print division.<ext>
+        Then  I should see the YAML tag list:
+            | albumartist | Pink Floyd |
+            | date        | 1994       |
+    Examples:
+            | ext  |
+            | flac |
+            | ogg  |
+            | mp3  |
+
+    Scenario: printing the non-matching files
+        Given there is a music file meddle.flac tagged with:
+            | title | Echoes |
+        And   there is a music file untitled.flac
+        When  I run tagutil 'where:not exists title or title =~ ^[a-z]' print meddle.flac untitled.flac
+        Then  I expect tagutil to succeed
+        And   I should see "# untitled.flac"
+        And   I should not see "# meddle.flac"
+
+    Scenario: invalid expression
+        Given there is a music file track.flac
+        When  I run tagutil 'where:(title == Echoes' track.flac
+        Then  I expect tagutil to fail
+        And   I should see "where: expected ) at column 17"